@@ -0,0 +1,186 @@
+//Checks and times the LZNT1 kernel of helpers.c against the one rawccopy had before (lznt1-ref.c),
+//on the compression units in the corpus folder: corp00.lz, corp00.raw, corp01.lz...
+//Every unit has to decompress to its .raw file with both kernels. After that, truncated and
+//bit-flipped copies of it are fed to the new kernel, which must reject or survive them: build
+//with AddressSanitizer to see that it stays inside its buffers. See README.md.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "helpers.h"
+
+#define UNIT_SZ 0x10000
+
+//The reference kernel reads up to 8 bytes at a time, so its copy of the input gets some slack
+#define REF_SLACK 8
+
+#define DEFAULT_ROUNDS 300
+
+#define FLIP_CNT 200
+
+bool RefLZNT1Decompress(const bytes compressed, rsize_t offset1, bytes decompressed, rsize_t offset2);
+
+uint8_t* LoadFile(const char* name, rsize_t slack, rsize_t* len);
+
+double Seconds();
+
+unsigned int NextRandom(unsigned int* state);
+
+bool Survives(const uint8_t* src, rsize_t len, uint8_t* dst);
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: lznt1-bench <corpus folder> [rounds]\n");
+		return 2;
+	}
+	int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+	if (rounds <= 0)
+		rounds = DEFAULT_ROUNDS;
+
+	uint8_t* out = malloc(UNIT_SZ);
+	uint8_t* ref_out = malloc(UNIT_SZ);
+	if (!out || !ref_out)
+		return 2;
+
+	int fails = 0, units = 0;
+	double new_time = 0.0, ref_time = 0.0;
+	uint64_t total = 0;
+	unsigned int seed = 7;
+	char name[1024];
+
+	printf("%-10s %8s %8s %12s %12s\n", "unit", "packed", "raw", "old MB/s", "new MB/s");
+	for (;; ++units)
+	{
+		rsize_t packed_len, raw_len;
+		snprintf(name, sizeof(name), "%s/corp%02d.lz", argv[1], units);
+		uint8_t* packed = LoadFile(name, 0, &packed_len);
+		if (!packed)
+			break;
+		uint8_t* ref_packed = LoadFile(name, REF_SLACK, &packed_len);
+		snprintf(name, sizeof(name), "%s/corp%02d.raw", argv[1], units);
+		uint8_t* raw = LoadFile(name, 0, &raw_len);
+		if (!raw || !ref_packed || raw_len > UNIT_SZ)
+		{
+			printf("corp%02d: no matching .raw file\n", units);
+			return 2;
+		}
+
+		struct _bytes ref_src = { ref_packed, packed_len };
+		struct _bytes ref_dst = { ref_out, UNIT_SZ };
+		bool ref_ok = RefLZNT1Decompress(&ref_src, 0, &ref_dst, 0);
+		long new_len = LZNT1DecompressBuffer(packed, packed_len, out, UNIT_SZ);
+		if (!ref_ok || ref_dst.buffer_len != raw_len || memcmp(ref_out, raw, raw_len))
+		{
+			printf("corp%02d: the old kernel doesn't give the .raw file\n", units);
+			fails++;
+		}
+		if (new_len != (long)raw_len || memcmp(out, raw, raw_len))
+		{
+			printf("corp%02d: the new kernel doesn't give the .raw file\n", units);
+			fails++;
+		}
+
+		double start = Seconds();
+		for (int i = 0; i < rounds; ++i)
+		{
+			ref_dst.buffer_len = UNIT_SZ;
+			RefLZNT1Decompress(&ref_src, 0, &ref_dst, 0);
+		}
+		double ref_unit = Seconds() - start;
+
+		start = Seconds();
+		for (int i = 0; i < rounds; ++i)
+			LZNT1DecompressBuffer(packed, packed_len, out, UNIT_SZ);
+		double new_unit = Seconds() - start;
+
+		printf("corp%02d     %8zu %8zu %12.1f %12.1f\n", units, (size_t)packed_len, (size_t)raw_len,
+			raw_len * (double)rounds / ref_unit / 1e6, raw_len * (double)rounds / new_unit / 1e6);
+		ref_time += ref_unit;
+		new_time += new_unit;
+		total += raw_len * (uint64_t)rounds;
+
+		//Cut off anywhere, and with single bits flipped:
+		for (rsize_t cut = 0; cut < packed_len; cut += packed_len / 37 + 1)
+			if (!Survives(packed, cut, out))
+				fails++;
+
+		for (int i = 0; i < FLIP_CNT; ++i)
+		{
+			memcpy(ref_packed, packed, packed_len);
+			ref_packed[NextRandom(&seed) % packed_len] ^= 1 << (NextRandom(&seed) % 8);
+			if (!Survives(ref_packed, packed_len, out))
+				fails++;
+		}
+
+		free(packed);
+		free(ref_packed);
+		free(raw);
+	}
+
+	if (!units)
+	{
+		printf("No corp00.lz in %s\n", argv[1]);
+		return 2;
+	}
+	printf("%d units, %d failures, old %.1f MB/s, new %.1f MB/s (%.2fx)\n", units, fails,
+		total / ref_time / 1e6, total / new_time / 1e6, ref_time / new_time);
+
+	free(out);
+	free(ref_out);
+	return fails ? 1 : 0;
+}
+
+uint8_t* LoadFile(const char* name, rsize_t slack, rsize_t* len)
+{
+	FILE* file = fopen(name, "rb");
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	*len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t* result = calloc(*len + slack + 1, 1);
+	if (result && fread(result, 1, *len, file) != *len)
+	{
+		free(result);
+		result = NULL;
+	}
+	fclose(file);
+	return result;
+}
+
+double Seconds()
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+unsigned int NextRandom(unsigned int* state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+//Damaged input only has to be rejected or decompressed, without writing outside the unit. The
+//copy has exactly 'len' bytes, so AddressSanitizer also catches reads past its end.
+bool Survives(const uint8_t* src, rsize_t len, uint8_t* dst)
+{
+	uint8_t* copy = malloc(len ? len : 1);
+	if (!copy)
+		return false;
+
+	memcpy(copy, src, len);
+	long out_len = LZNT1DecompressBuffer(copy, len, dst, UNIT_SZ);
+	free(copy);
+	if (out_len > UNIT_SZ)
+	{
+		printf("%ld bytes out of a unit of %d\n", out_len, UNIT_SZ);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,119 @@
+//The LZNT1 kernel rawccopy had before it was rewritten, as the reference for lznt1-bench.c.
+//Only run it on valid input: it reads headers and tuples through size_t casts.
+#include <string.h>
+#include "byte-buffer.h"
+
+
+#define LZNT1_BLOCK_LEN( header ) ( ( (header) & 0x0fff ) + 1 )
+
+#define LZNT1_BLOCK_COMPRESSED( header ) ( (header) & 0x8000 )
+
+#define LZNT1_VALUE_LEN( tuple, split ) \
+	( ( ((uint64_t) tuple) & ( ( 1ULL << (split) ) - 1ULL ) ) + 3 )
+
+#define LZNT1_VALUE_OFFSET( tuple, split ) ( ( ((uint64_t)tuple) >> split ) + 1 )
+
+
+long ref_lznt1_block(bytes compressed, size_t limit, size_t offset1, bytes destination, size_t offset2);
+
+bool RefLZNT1Decompress(const bytes compressed, rsize_t offset1, bytes decompressed, rsize_t offset2)
+{
+	const uint16_t* header;
+	const uint8_t* end;
+	size_t out_len = 0;
+	size_t block_len;
+	size_t limit;
+	long block_out_len;
+
+	while (offset1 != compressed->buffer_len)
+	{
+		if ((offset1 + sizeof(*end)) == compressed->buffer_len)
+		{
+			end = (compressed->buffer + offset1);
+			if (*end == 0)
+				break;
+		}
+
+		if ((offset1 + sizeof(*header)) > compressed->buffer_len)
+			return false;
+
+		header = (uint16_t *)(compressed->buffer + offset1);
+
+		if (*header == 0)
+			break;
+
+		offset1 += sizeof(*header);
+
+		block_len = LZNT1_BLOCK_LEN(*(size_t*)header);
+		if (LZNT1_BLOCK_COMPRESSED(*header))
+		{
+			limit = (offset1 + block_len);
+			block_out_len = ref_lznt1_block(compressed, limit, offset1, decompressed, out_len);
+			if (block_out_len < 0)
+				return false;
+			offset1 += block_len;
+			out_len += block_out_len;
+		}
+		else if ((offset1 + block_len) > compressed->buffer_len)
+			return false;
+		else
+		{
+			memcpy(decompressed->buffer + out_len, compressed->buffer + offset1, block_len);
+
+			offset1 += block_len;
+			out_len += block_len;
+		}
+	}
+	RightTrim(decompressed, decompressed->buffer_len - out_len);
+	return true;
+}
+
+long ref_lznt1_block(bytes compressed, size_t limit, size_t offset1, bytes destination, size_t offset2)
+{
+	uint16_t* tuple;
+	size_t copy_len;
+	size_t block_out_len = 0;
+	unsigned int split = 12;
+	unsigned int next_threshold = 16;
+	unsigned int tag_bit = 0;
+	unsigned int tag = 0;
+
+	while (offset1 != limit)
+	{
+		if (tag_bit == 0)
+		{
+			tag = *((uint8_t*)(compressed->buffer + offset1));
+			offset1++;
+			if (offset1 == limit)
+				break;
+		}
+
+		if (tag & 1)
+		{
+			if (offset1 + sizeof(*tuple) > limit)
+				return -1;
+
+			tuple = (uint16_t*)(compressed->buffer + offset1);
+			offset1 += sizeof(*tuple);
+			copy_len = LZNT1_VALUE_LEN(*(size_t*)tuple, split);
+
+			uint8_t* dst = destination->buffer + offset2 + block_out_len;
+			uint8_t* src = dst - LZNT1_VALUE_OFFSET(*tuple, split);
+			block_out_len += copy_len;
+			while (copy_len--)
+				*(dst++) = *(src++);
+		}
+		else
+			*(destination->buffer + offset2 + block_out_len++) = *(compressed->buffer + offset1++);
+
+		while (block_out_len > next_threshold)
+		{
+			split--;
+			next_threshold <<= 1;
+		}
+		tag >>= 1;
+		tag_bit = ((tag_bit + 1) % 8);
+	}
+
+	return (long)block_out_len;
+}
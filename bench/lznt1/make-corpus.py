@@ -0,0 +1,61 @@
+# Writes the corpus of lznt1-bench.c: compression units of 64K (and one partial one) in
+# corpNN.raw, with the LZNT1 compressed form in corpNN.lz. The output is the same on every run.
+#   python3 make-corpus.py [folder]
+import os, random, struct, sys
+random.seed(7)
+def compress_chunk(data):
+    # greedy LZNT1 compressor for one chunk (<=4096 bytes)
+    out=bytearray(); i=0; n=len(data)
+    while i<n:
+        tagpos=len(out); out.append(0); tag=0
+        for bit in range(8):
+            if i>=n: break
+            # split
+            pos=i; split=12; thr=16
+            while pos>thr: split-=1; thr<<=1
+            maxoff=1<<(16-split); maxlen=(1<<split)+2
+            best=(0,0)
+            lo=max(0,i-maxoff)
+            for j in range(i-1, lo-1, -1):
+                l=0
+                while i+l<n and l<maxlen and data[j+l]==data[i+l]: l+=1
+                if l>best[0]: best=(l,i-j)
+                if l==maxlen: break
+            if best[0]>=3:
+                l,off=best
+                out+=struct.pack('<H', ((off-1)<<split) | (l-3))
+                tag|=1<<bit; i+=l
+            else:
+                out.append(data[i]); i+=1
+        out[tagpos]=tag
+    return bytes(out)
+def compress_unit(data):
+    out=bytearray()
+    for k in range(0,len(data),4096):
+        ch=data[k:k+4096]
+        c=compress_chunk(ch)
+        if len(c)>=4096:
+            out+=struct.pack('<H', 0x3000 | (len(ch)-1)); out+=ch
+        else:
+            out+=struct.pack('<H', 0xB000 | (len(c)-1)); out+=c
+    return bytes(out)
+def samples():
+    words=[b'the',b'NTFS',b'compression',b'unit',b'cluster',b'\x00\x00',b'rawccopy',b'  ',b'\r\n']
+    yield b'\x00'*65536
+    yield bytes(random.getrandbits(8) for _ in range(65536))
+    yield b''.join(random.choice(words) for _ in range(20000))[:65536]
+    for p in range(1,12):
+        pat=bytes(random.getrandbits(8) for _ in range(p)); yield (pat*(65536//p+1))[:65536]
+    d=bytearray()
+    while len(d)<65536:
+        if random.random()<0.5 and len(d)>20:
+            o=random.randint(1,min(len(d),300)); l=random.randint(3,60)
+            for _ in range(l): d.append(d[-o])
+        else: d+=bytes(random.getrandbits(3) for _ in range(random.randint(1,10)))
+    yield bytes(d[:65536])
+    yield bytes(d[:12345])
+folder=sys.argv[1] if len(sys.argv)>1 else 'corpus'
+os.makedirs(folder, exist_ok=True)
+for k,s in enumerate(samples()):
+    open(os.path.join(folder,f'corp{k:02d}.raw'),'wb').write(s)
+    open(os.path.join(folder,f'corp{k:02d}.lz'),'wb').write(compress_unit(s))
@@ -0,0 +1,346 @@
+//Times the binary search of a directory index with the name comparisons of names.c: the old
+//per-character compare that upper cases both sides (CompareNames), and CompareFoldedName on a
+//query that is upper cased once, without and with the SSE2 blocks (context->ascii_upcase).
+//The names are sorted the way NTFS sorts them, and every lookup searches for one of them with
+//its case changed. Before timing, the three compares are checked to agree on random pairs.
+//See README.md.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "names.h"
+
+#define MAX_NAME_LEN 255
+
+//About the files of a big folder like System32. The names are packed together, as they are in
+//the index records, so the search isn't held up more by the memory than it would be there.
+#define SYNTHETIC_CNT 20000
+
+#define LOOKUP_CNT 1000000
+
+//Each mode is timed this many times, taking turns, and the fastest counts
+#define ROUND_CNT 7
+
+#define FUZZ_CNT 1000000
+
+typedef struct {
+	rsize_t len;
+	const wchar_t* name;
+} bench_name;
+
+typedef struct {
+	bench_name* names;
+	wchar_t* chars;
+	rsize_t cnt;
+	rsize_t capacity;
+	rsize_t chars_len;
+	rsize_t chars_capacity;
+} bench_set;
+
+typedef enum { COMPARE_TABLE, COMPARE_FOLDED, COMPARE_SSE2 } compare_mode;
+
+static const char* mode_names[] = { "table", "folded", "folded+sse2" };
+
+static struct _execution_context context;
+
+static const char* words[] = { "Microsoft", "Windows", "System", "Runtime", "Security", "Management", "Diagnostics",
+								"Resources", "Interop", "Native", "amd64", "wow64", "x86", "msil", "neutral", "en-us",
+								"policy", "culture", "31bf3856ad364e35", "10.0.19041.1", "dll", "mui", "exe", "manifest", "cat" };
+
+unsigned int NextRandom();
+
+void SetUpperCase();
+
+rsize_t MakeName(wchar_t* dest, int kind);
+
+bool AddName(bench_set* set, const wchar_t* name, rsize_t len);
+
+bool MakeNames(int kind, bench_set* set);
+
+bool LoadNames(const char* file_name, bench_set* set);
+
+void FinishNames(bench_set* set);
+
+int CompareEntries(const void* first, const void* second);
+
+int Sign(int val);
+
+bool CheckCompares();
+
+double TimeLookups(const bench_name* names, rsize_t cnt, compare_mode mode);
+
+int main(int argc, char** argv)
+{
+	SetUpperCase();
+	if (!CheckCompares())
+		return 1;
+
+	printf("%-28s %10s %10s %14s   (ns per lookup)\n", "names", mode_names[0], mode_names[1], mode_names[2]);
+	static const char* kinds[] = { "WinSxS style", "System32 style", "non-ASCII documents" };
+	for (int kind = 0; kind < 3 + argc - 1; ++kind)
+	{
+		bench_set set = { 0 };
+		if (!(kind < 3 ? MakeNames(kind, &set) : LoadNames(argv[kind - 2], &set)) || !set.cnt)
+		{
+			printf("Can't make or read the names of %s\n", kind < 3 ? kinds[kind] : argv[kind - 2]);
+			return 2;
+		}
+		FinishNames(&set);
+		qsort(set.names, set.cnt, sizeof(bench_name), CompareEntries);
+
+		double best[COMPARE_SSE2 + 1] = { 0 };
+		for (int round = 0; round < ROUND_CNT; ++round)
+		{
+			for (compare_mode mode = COMPARE_TABLE; mode <= COMPARE_SSE2; ++mode)
+			{
+				double time = TimeLookups(set.names, set.cnt, mode);
+				if (!round || time < best[mode])
+					best[mode] = time;
+			}
+		}
+
+		printf("%-28.28s %10.1f %10.1f %14.1f\n", kind < 3 ? kinds[kind] : argv[kind - 2],
+			best[COMPARE_TABLE], best[COMPARE_FOLDED], best[COMPARE_SSE2]);
+		free(set.names);
+		free(set.chars);
+	}
+	return 0;
+}
+
+unsigned int NextRandom()
+{
+	static unsigned int state = 88172645;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+//ASCII, Latin-1 and Greek letters get upper cased, like $UpCase does with them
+void SetUpperCase()
+{
+	context.upper_case = malloc(0x10000 * sizeof(wchar_t));
+	for (unsigned int c = 0; c < 0x10000; ++c)
+		context.upper_case[c] = (wchar_t)((c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7) ||
+											(c >= 0x3B1 && c <= 0x3C9 && c != 0x3C2) ? c - 0x20 : c);
+	context.ascii_upcase = true;
+}
+
+rsize_t MakeName(wchar_t* dest, int kind)
+{
+	rsize_t len = 0;
+	if (kind == 0)
+	{
+		//amd64_microsoft-windows-security_31bf3856ad364e35_10.0.19041.1_none_0123456789abcdef
+		int parts = 3 + NextRandom() % 6;
+		for (int p = 0; p < parts; ++p)
+		{
+			for (const char* w = words[NextRandom() % (sizeof(words) / sizeof(*words))]; *w && len < 200; ++w)
+				dest[len++] = NextRandom() % 4 ? *w : (wchar_t)tolower(*w);
+			if (p + 1 < parts)
+				dest[len++] = p == parts - 2 ? L'.' : L'_';
+		}
+		for (int i = 0; i < 16; ++i)
+			dest[len++] = "0123456789abcdef"[NextRandom() % 16];
+	}
+	else if (kind == 1)
+	{
+		//ntdll.dll, KernelBase.dll...
+		for (int i = 4 + NextRandom() % 16; i > 0; --i)
+			dest[len++] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-"[NextRandom() % 64];
+		for (const char* ext = NextRandom() % 2 ? ".dll" : ".exe"; *ext; ++ext)
+			dest[len++] = *ext;
+	}
+	else
+	{
+		//Document names with accents, Greek and CJK in them
+		for (int i = 5 + NextRandom() % 30; i > 0; --i)
+		{
+			unsigned int r = NextRandom() % 20;
+			dest[len++] = r == 0 ? 0xE9 : r == 1 ? 0x3B1 : r == 2 ? 0x4E2D : "abcdefghij klmnopqrst"[NextRandom() % 21];
+		}
+	}
+	return len;
+}
+
+//Until FinishNames, 'name' holds where the name starts in 'chars', which can still move
+bool AddName(bench_set* set, const wchar_t* name, rsize_t len)
+{
+	if (set->cnt == set->capacity)
+	{
+		set->capacity = set->capacity ? set->capacity * 2 : 0x1000;
+		bench_name* bigger = realloc(set->names, set->capacity * sizeof(bench_name));
+		if (!bigger)
+			return false;
+		set->names = bigger;
+	}
+	if (set->chars_len + len > set->chars_capacity)
+	{
+		set->chars_capacity = set->chars_capacity * 2 + MAX_NAME_LEN;
+		wchar_t* bigger = realloc(set->chars, set->chars_capacity * sizeof(wchar_t));
+		if (!bigger)
+			return false;
+		set->chars = bigger;
+	}
+
+	memcpy(set->chars + set->chars_len, name, len * sizeof(wchar_t));
+	set->names[set->cnt].len = len;
+	set->names[set->cnt++].name = (const wchar_t*)set->chars_len;
+	set->chars_len += len;
+	return true;
+}
+
+bool MakeNames(int kind, bench_set* set)
+{
+	wchar_t name[MAX_NAME_LEN];
+	for (int i = 0; i < SYNTHETIC_CNT; ++i)
+	{
+		if (!AddName(set, name, MakeName(name, kind)))
+			return false;
+	}
+	return true;
+}
+
+void FinishNames(bench_set* set)
+{
+	for (rsize_t i = 0; i < set->cnt; ++i)
+		set->names[i].name = set->chars + (rsize_t)set->names[i].name;
+}
+
+//One name or path per line in UTF-8 (like the output of 'dir /s /b > names.txt'), of which the
+//last component is taken. Duplicates are left in, they just get found more often.
+bool LoadNames(const char* file_name, bench_set* set)
+{
+	FILE* file = fopen(file_name, "rb");
+	if (!file)
+		return false;
+
+	bool ok = true;
+	char line[0x1000];
+	wchar_t name[MAX_NAME_LEN];
+	while (ok && fgets(line, sizeof(line), file))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		char* start = line;
+		for (char* pt = line; *pt; ++pt)
+			if (*pt == '\\' || *pt == '/')
+				start = pt + 1;
+
+		rsize_t len = 0;
+		for (const unsigned char* pt = (const unsigned char*)start; *pt && len < MAX_NAME_LEN;)
+		{
+			unsigned int cp = *pt++;
+			int extra = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+			cp &= extra ? 0x3F >> extra : 0x7F;
+			for (; extra && (*pt & 0xC0) == 0x80; --extra)
+				cp = (cp << 6) | (*pt++ & 0x3F);
+
+			//Outside the BMP, a name holds a surrogate pair
+			if (cp > 0xFFFF && len + 1 < MAX_NAME_LEN)
+			{
+				name[len++] = (wchar_t)(0xD800 + ((cp - 0x10000) >> 10));
+				cp = 0xDC00 + (cp & 0x3FF);
+			}
+			name[len++] = (wchar_t)cp;
+		}
+		if (len)
+			ok = AddName(set, name, len);
+	}
+	fclose(file);
+	return ok;
+}
+
+int CompareEntries(const void* first, const void* second)
+{
+	const bench_name* one = first;
+	const bench_name* other = second;
+	return CompareNames(&context, one->name, one->len, other->name, other->len);
+}
+
+int Sign(int val)
+{
+	return (val > 0) - (val < 0);
+}
+
+//Pairs of names that are alike (case flips, other characters, cut off) or not, of all kinds
+bool CheckCompares()
+{
+	wchar_t first[MAX_NAME_LEN + 8], second[MAX_NAME_LEN + 8], folded[MAX_NAME_LEN + 8];
+	for (int i = 0; i < FUZZ_CNT; ++i)
+	{
+		rsize_t first_len = MakeName(first, i % 3), second_len;
+		if (NextRandom() % 2)
+		{
+			memcpy(second, first, sizeof(first));
+			second_len = first_len;
+			for (int changes = NextRandom() % 4; changes > 0; --changes)
+			{
+				rsize_t pos = NextRandom() % (second_len + 1);
+				if (NextRandom() % 3 == 0)
+					second_len = pos;
+				else if (pos < second_len)
+					second[pos] = NextRandom() % 3 ? second[pos] ^ 0x20 : (wchar_t)(NextRandom() % 0x200);
+			}
+		}
+		else
+			second_len = MakeName(second, NextRandom() % 3);
+
+		FoldName(&context, first, first_len, folded);
+		int expected = Sign(CompareNames(&context, first, first_len, second, second_len));
+		context.ascii_upcase = false;
+		int folded_result = Sign(CompareFoldedName(&context, folded, first_len, second, second_len));
+		context.ascii_upcase = true;
+		int sse2_result = Sign(CompareFoldedName(&context, folded, first_len, second, second_len));
+		if (folded_result != expected || sse2_result != expected)
+		{
+			printf("The compares don't agree: %d, %d and %d on '%.*ls' and '%.*ls'\n", expected, folded_result, sse2_result,
+				(int)first_len, first, (int)second_len, second);
+			return false;
+		}
+	}
+	printf("%d pairs of names compare the same in all modes\n", FUZZ_CNT);
+	return true;
+}
+
+double TimeLookups(const bench_name* names, rsize_t cnt, compare_mode mode)
+{
+	context.ascii_upcase = mode == COMPARE_SSE2;
+	struct timespec start, end;
+	timespec_get(&start, TIME_UTC);
+
+	rsize_t found = 0;
+	for (rsize_t q = 0; q < LOOKUP_CNT; ++q)
+	{
+		//Every other ASCII letter is made lower case, like in a path typed by hand
+		const bench_name* key = names + (q * 7919) % cnt;
+		wchar_t query[MAX_NAME_LEN], folded[MAX_NAME_LEN];
+		for (rsize_t i = 0; i < key->len; ++i)
+			query[i] = (i & 1) && key->name[i] >= L'A' && key->name[i] <= L'Z' ? key->name[i] + 0x20 : key->name[i];
+		if (mode != COMPARE_TABLE)
+			FoldName(&context, query, key->len, folded);
+
+		ptrdiff_t l = 0, r = (ptrdiff_t)cnt - 1;
+		while (l <= r)
+		{
+			ptrdiff_t m = (l + r) / 2;
+			int cmp = mode == COMPARE_TABLE ? CompareNames(&context, query, key->len, names[m].name, names[m].len)
+											: CompareFoldedName(&context, folded, key->len, names[m].name, names[m].len);
+			if (cmp < 0)
+				r = m - 1;
+			else if (cmp > 0)
+				l = m + 1;
+			else
+			{
+				found++;
+				break;
+			}
+		}
+	}
+
+	timespec_get(&end, TIME_UTC);
+	context.ascii_upcase = true;
+	if (found != LOOKUP_CNT)
+		printf("(only %zu of %d found) ", (size_t)found, LOOKUP_CNT);
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / LOOKUP_CNT;
+}
@@ -141,6 +141,27 @@ typedef struct _file_name_attribute {
 
 
 
+#pragma pack (push, 1)
+typedef struct _standard_information {
+	/*  0*/	uint64_t creation_time;				/* Time file was created. */
+	/*  8*/	uint64_t last_data_change_time;		/* Time the data attribute was last modified. */
+	/* 10*/	uint64_t last_mft_change_time;		/* Time this mft record was last modified. */
+	/* 18*/	uint64_t last_access_time;			/* Time the file was last accessed. */
+	/* 20*/	uint32_t file_attributes;			/* Flags describing the file. */
+	/* 24*/	uint32_t max_versions;				/* Maximum allowed versions for file, zero if versioning is disabled. */
+	/* 28*/	uint32_t version_number;			/* This file's version (if any). */
+	/* 2c*/	uint32_t class_id;					/* Class id from bidirectional class id index (?). */
+	//The rest is only there from NTFS 3.0 on:
+	/* 30*/	uint32_t owner_id;					/* Owner_id of the user owning the file, an index into $Quota. */
+	/* 34*/	uint32_t security_id;				/* Security_id for the file, an index into $Secure. */
+	/* 38*/	uint64_t quota_charged;				/* Byte size of the charge to the quota for all streams of the file. */
+	/* 40*/	uint64_t usn;						/* Last update sequence number of the file, an offset into $UsnJrnl. */
+} *standard_information;
+#pragma pack(pop)
+
+//Size of a $STANDARD_INFORMATION from before NTFS 3.0
+#define STANDARD_INFORMATION_V1_SZ 0x30
+
 #pragma pack (push, 1)
 typedef struct _at_list_entry {
 	/*Ofs*/
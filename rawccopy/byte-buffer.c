@@ -96,10 +96,47 @@ bool Reserve(bytes buf, rsize_t count)
 	return true;
 }
 
+bool ReserveGrowing(bytes buf, rsize_t count, rsize_t* capacity)
+{
+	if (count > *capacity)
+	{
+		rsize_t new_capacity = *capacity + *capacity / 2;
+		if (new_capacity < count)
+			new_capacity = count;
+		uint8_t* new_buf = realloc(buf->buffer, new_capacity);
+		if (new_buf == NULL)
+		{
+			ErrorExit("Memory Allocation Problem", -1);
+			return false;
+		}
+		buf->buffer = new_buf;
+		*capacity = new_capacity;
+	}
+	if (buf->buffer_len < count)
+		buf->buffer_len = count;
+	return true;
+}
+
+void AppendGrowing(bytes first, rsize_t* capacity, const bytes second, rsize_t offset, rsize_t count)
+{
+	IntervalCheck(second, offset, count);
+
+	rsize_t start = first->buffer_len;
+	if (count && ReserveGrowing(first, start + count, capacity))
+		memcpy(first->buffer + start, second->buffer + offset, count);
+}
+
 void AppendAt(bytes first, rsize_t offset1, const bytes second, rsize_t offset2, rsize_t count)
 {
 	IntervalCheck(first, offset1, 0);
 	IntervalCheck(second, offset2, count);
+
+	//Nothing to copy, and a realloc to 0 bytes would free the buffer:
+	if (!count)
+	{
+		first->buffer_len = offset1;
+		return;
+	}
 	unsigned char* newBuffer = realloc(first->buffer, offset1 + count);
 	if (newBuffer)
 	{
@@ -40,6 +40,13 @@ bytes TakeBufferSlice(const bytes buf, rsize_t offset, rsize_t count);
 
 bool Reserve(bytes buf, rsize_t count);
 
+//Reserve and Append for a buffer that's filled a little at a time: when it has to grow, it grows
+//by half its size at least, so it isn't copied over and over. '*capacity' is what's allocated,
+//which starts out as buffer_len. While these are used, the buffer can't grow any other way.
+bool ReserveGrowing(bytes buf, rsize_t count, rsize_t* capacity);
+
+void AppendGrowing(bytes first, rsize_t* capacity, const bytes second, rsize_t offset, rsize_t count);
+
 void DeleteBytes(bytes buf);
 
 //Creates an ut_array that contains byte buffers
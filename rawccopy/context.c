@@ -1,6 +1,9 @@
 
 #include "context.h"
 #include "mft.h"
+#include "index.h"
+#include "path.h"
+#include "mft-snapshot.h"
 #include "helpers.h"
 
 bool SetUppercaseList(execution_context context);
@@ -13,6 +16,9 @@ execution_context SetupContext(int argc, char* argv[])
 	if (!((result->parameters = Parse(argc, argv))))
 		return ErrorCleanUp(free, result, "");
 
+	if (!(result->workers = CreateThreadPool(result->parameters->thread_cnt)))
+		return ErrorCleanUp(CleanUp, result, "");
+
 	if (!(result->boot = ReadFromDisk(result->parameters->source_drive, result->parameters->image_offs)))
 		return ErrorCleanUp(CleanUp, result, "");
 
@@ -40,9 +46,22 @@ execution_context SetupContext(int argc, char* argv[])
 	if (!(result->mft_table = LoadMFTFile(result, MASTER_FILE_TABLE_NUMBER)))
 		return ErrorCleanUp(CleanUp, result, "");
 
+	//Extension records of a fragmented $MFT are loaded on first use. Do it for all of them now,
+	//so the record doesn't change anymore once it's shared by several threads:
+	for (attribute at = FirstAttribute(result, result->mft_table, 0xFFFF); at; at = NextAttribute(result, result->mft_table, at, 0xFFFF));
+
 	if (!SetUppercaseList(result))
 		return ErrorCleanUp(CleanUp, result, "");
 
+	if (!(result->index_nodes = CreateIndexCache()))
+		return ErrorCleanUp(CleanUp, result, "");
+
+	if (!(result->paths = CreatePathCache()))
+		return ErrorCleanUp(CleanUp, result, "");
+
+	if (result->parameters->snapshot_file && !(result->snapshot = LoadSnapshot(result)))
+		return ErrorCleanUp(CleanUp, result, "");
+
 	return result;
 }
 
@@ -60,6 +79,10 @@ bool SetUppercaseList(execution_context context)
 		bytes table = GetBytesFromAttrib(context, file, lst, 0, 0x20000);
 		context->upper_case = (wchar_t*)table->buffer;
 		free(table);
+
+		context->ascii_upcase = true;
+		for (wchar_t c = 0; c < 0x80; ++c)
+			context->ascii_upcase &= context->upper_case[c] == ((c >= L'a' && c <= L'z') ? c - 0x20 : c);
 	}
 	else
 		printf("Error: UpCase file incomplete.\n");
@@ -77,6 +100,15 @@ void CleanUp(execution_context context)
 	if (context->parameters)
 		DeleteSettings(context->parameters);
 
+	if (context->paths)
+		DeletePathCache(context->paths);
+
+	if (context->snapshot)
+		CloseSnapshot(context->snapshot);
+
+	if (context->index_nodes)
+		DeleteIndexCache(context->index_nodes);
+
 	if (context->mft_table)
 		DeleteMFTFile(context->mft_table);
 
@@ -89,5 +121,8 @@ void CleanUp(execution_context context)
 	if (context->upper_case)
 		free(context->upper_case);
 
+	if (context->workers)
+		CloseThreadPool(context->workers);
+
 	free(context);
 }
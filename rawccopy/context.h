@@ -6,9 +6,16 @@
 #include "fileio.h"
 #include "data-writer.h"
 #include "ut-wrapper.h"
+#include "thread-pool.h"
 
 typedef struct _mft_file* mft_file;
 
+typedef struct _index_cache* index_cache;
+
+typedef struct _path_cache* path_cache;
+
+typedef struct _mft_snapshot* mft_snapshot;
+
 typedef struct _execution_context
 {
 	settings parameters;
@@ -19,6 +26,11 @@ typedef struct _execution_context
 	disk_reader dr;
 	data_writer writer;
 	wchar_t *upper_case;
+	bool ascii_upcase;			// $UpCase maps ASCII like toupper does
+	thread_pool workers;
+	index_cache index_nodes;
+	path_cache paths;
+	mft_snapshot snapshot;		// Only with /Snapshot:
 }*execution_context;
 
 
@@ -1,20 +1,43 @@
 #include <winsock2.h>
+#include <winioctl.h>
 #include <stdio.h>
 
 #include "network.h"
 #include "data-writer.h"
 #include "helpers.h"
 
+#define ZERO_GRANULE 0x1000
+
 struct _data_writer
 {
 	HANDLE fh;
 	SOCKET socket;
+	bool sparse;				// when set, holes are skipped in the output file or sent as a hole
+								// descriptor over TCP, instead of being written out as zeros
+	uint64_t pending_hole;		// zero bytes that haven't been committed to the output yet
 };
 
-data_writer TCPWriter(uint32_t ip, uint16_t port)
+#pragma pack (push, 1)
+//In sparse mode, everything sent over TCP is framed by this header:
+typedef struct _frame_header {
+	/*0x00*/ uint8_t tag[4];		// "RCCD": a data frame, followed by 'length' bytes of data
+									// "RCCH": a hole, stands for 'length' zero bytes, nothing follows
+	/*0x04*/ uint64_t length;
+} frame_header;
+#pragma pack(pop)
+
+static const uint8_t zero_block[0x10000];
+
+bool WriteBuffer(const data_writer wr, const uint8_t* buf, rsize_t len);
+
+bool FlushHole(const data_writer wr);
+
+data_writer TCPWriter(uint32_t ip, uint16_t port, bool sparse)
 {
 	SafeCreate(result, data_writer);
 	result->fh = INVALID_HANDLE_VALUE;
+	result->sparse = sparse;
+	result->pending_hole = 0;
 
 	if ((result->socket = GetConnectedSocket(ip, port)) == INVALID_SOCKET)
 		return ErrorCleanUp(free, result, "");
@@ -22,7 +45,7 @@ data_writer TCPWriter(uint32_t ip, uint16_t port)
 	return result;
 }
 
-data_writer FileWriter(const string file_name)
+data_writer FileWriter(const string file_name, bool sparse)
 {
 
 	HANDLE fh = CreateFileW(BaseString(file_name), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -36,6 +59,12 @@ data_writer FileWriter(const string file_name)
 
 	SafeCreate(result, data_writer);
 	result->fh = fh;
+	result->pending_hole = 0;
+
+	//Not every target file system supports sparse files, in that case we
+	//silently fall back to writing the zeros:
+	DWORD ret_len = 0;
+	result->sparse = sparse && DeviceIoControl(fh, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret_len, NULL);
 
 	return result;
 }
@@ -43,6 +72,7 @@ data_writer FileWriter(const string file_name)
 
 void CloseDataWriter(data_writer writer)
 {
+	FlushHole(writer);
 	if (writer->fh == INVALID_HANDLE_VALUE)
 		CleanUpSocket(writer->socket);
 	else
@@ -55,17 +85,95 @@ void CloseDataWriter(data_writer writer)
 
 bool WriteData(const data_writer wr, const bytes data)
 {
+	return WriteBuffer(wr, data->buffer, data->buffer_len);
+}
+
+bool WriteHole(const data_writer wr, uint64_t count)
+{
+	if (wr->sparse)
+	{
+		//Consecutive holes are merged, so just keep count for now:
+		wr->pending_hole += count;
+		return true;
+	}
+
+	for (rsize_t delta = (rsize_t)min(count, sizeof(zero_block)); count > 0; count -= delta, delta = (rsize_t)min(count, sizeof(zero_block)))
+		if (!WriteBuffer(wr, zero_block, delta))
+			return false;
+
+	return true;
+}
+
+bool WriteSparseData(const data_writer wr, const bytes data)
+{
+	//Split the data in data runs and zero runs, the latter become holes:
+	rsize_t data_st = 0;
+	for (rsize_t pos = 0; pos < data->buffer_len; )
+	{
+		rsize_t len = min(ZERO_GRANULE, data->buffer_len - pos);
+		if (!IsZeroBlock(data->buffer + pos, len))
+		{
+			pos += len;
+			continue;
+		}
+
+		if (pos > data_st && !WriteBuffer(wr, data->buffer + data_st, pos - data_st))
+			return false;
+
+		rsize_t zero_st = pos;
+		for (pos += len; pos < data->buffer_len && IsZeroBlock(data->buffer + pos, min(ZERO_GRANULE, data->buffer_len - pos));
+					pos += min(ZERO_GRANULE, data->buffer_len - pos));
+
+		if (!WriteHole(wr, pos - zero_st))
+			return false;
+		data_st = pos;
+	}
+
+	return data_st == data->buffer_len || WriteBuffer(wr, data->buffer + data_st, data->buffer_len - data_st);
+}
+
+bool WriteBuffer(const data_writer wr, const uint8_t* buf, rsize_t len)
+{
+	if (len == 0)
+		return true;
+
+	if (!FlushHole(wr))
+		return false;
+
 	if (wr->fh == INVALID_HANDLE_VALUE)
 	{
-		int result = SendData(wr->socket, data);
-		if (result == SOCKET_ERROR)
+		frame_header hdr = { {'R', 'C', 'C', 'D'}, len };
+		if ((wr->sparse && !SendBuffer(wr->socket, &hdr, sizeof(hdr))) || !SendBuffer(wr->socket, buf, len))
 			return CleanUpAndFail(NULL, NULL, "Error TCPSend: %d\n", WSAGetLastError());
 		return true;
 	}
 	else
 	{
 		DWORD bytes_written = 0;
-		return WriteFile(wr->fh, data->buffer, (DWORD)data->buffer_len, &bytes_written, NULL) &&
-					bytes_written == data->buffer_len;
+		return WriteFile(wr->fh, buf, (DWORD)len, &bytes_written, NULL) &&
+					bytes_written == len;
+	}
+}
+
+bool FlushHole(const data_writer wr)
+{
+	if (wr->pending_hole == 0)
+		return true;
+
+	uint64_t hole = wr->pending_hole;
+	wr->pending_hole = 0;
+
+	if (wr->fh == INVALID_HANDLE_VALUE)
+	{
+		frame_header hdr = { {'R', 'C', 'C', 'H'}, hole };
+		if (!SendBuffer(wr->socket, &hdr, sizeof(hdr)))
+			return CleanUpAndFail(NULL, NULL, "Error TCPSend: %d\n", WSAGetLastError());
+		return true;
 	}
+
+	//Seeking past the end of a sparse file and setting the new end, leaves the
+	//skipped range unallocated:
+	LARGE_INTEGER delta;
+	delta.QuadPart = (LONGLONG)hole;
+	return SetFilePointerEx(wr->fh, delta, NULL, FILE_CURRENT) && SetEndOfFile(wr->fh);
 }
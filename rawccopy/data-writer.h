@@ -6,12 +6,21 @@
 
 typedef struct _data_writer* data_writer;
 
-data_writer TCPWriter(uint32_t ip, uint16_t port);
+//When 'sparse' is set, zero ranges passed to WriteHole don't get written out:
+//they become holes in the output file, or hole descriptors in the TCP stream
+//(in which case all data is framed, see data-writer.c)
+data_writer TCPWriter(uint32_t ip, uint16_t port, bool sparse);
 
-data_writer FileWriter(const string file_name);
+data_writer FileWriter(const string file_name, bool sparse);
 
 void CloseDataWriter(data_writer writer);
 
 bool WriteData(const data_writer wr, const bytes data);
 
+//Same as WriteData, but blocks of zeros in data are treated as holes
+bool WriteSparseData(const data_writer wr, const bytes data);
+
+//Writes 'count' zero bytes
+bool WriteHole(const data_writer wr, uint64_t count);
+
 #endif DATA_WRITER_H
@@ -0,0 +1,292 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deleted.h"
+#include "mft.h"
+#include "attribs.h"
+#include "index.h"
+#include "file-table.h"
+#include "listing.h"
+#include "helpers.h"
+
+//MFT record of $Bitmap, which has a bit for every cluster of the volume
+#define BITMAP_RECORD 6
+
+//A run of the unnamed $DATA of a deleted file
+typedef struct {
+	uint64_t row;
+	uint64_t lcn;						// 0 for a sparse run
+	uint64_t length;					// In clusters
+} deleted_run;
+
+static const UT_icd deleted_run_icd = { sizeof(deleted_run), NULL, NULL, NULL };
+
+static const wchar_t* const recovery_labels[] = { L"none", L"resident", L"free", L"partial", L"allocated" };
+
+//Number of bits set in every value of a nibble
+static const uint8_t nibble_bits[] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+bool CollectRuns(execution_context context, const file_table table, const record_batch* batch, void* state);
+
+void CollectRecordRuns(uint64_t row, const bytes rec, UT_array* runs);
+
+bool RunFits(const uint8_t* pair, const uint8_t* end);
+
+bytes VolumeBitmap(execution_context context);
+
+int Recovery(const file_table table, uint64_t row, const bytes bitmap, const deleted_run* runs, rsize_t cnt);
+
+uint64_t ClustersInUse(const bytes bitmap, uint64_t lcn, uint64_t cnt);
+
+void ListDeletedCSV(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+					const string flags, int recovery, const deleted_run* runs, rsize_t cnt);
+
+void ListDeletedJSON(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+					const string flags, int recovery, const deleted_run* runs, rsize_t cnt);
+
+
+bool ListDeletedFiles(execution_context context)
+{
+	//The run lists aren't in the file table, they're taken from the records while the MFT is read:
+	UT_array* runs;
+	utarray_new(runs, &deleted_run_icd);
+	file_table table = BuildFileTable(context, SCAN_DELETED, CollectRuns, runs);
+	bytes bitmap = table ? VolumeBitmap(context) : NULL;
+
+	const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+	bool csv = context->parameters->deleted_mode == LIST_CSV;
+	folder_paths paths = bitmap ? CreateFolderPaths(table, source[0] && source[1] == L':' ? source : L"x:", 2) : NULL;
+	string flags = paths ? NewString() : NULL;
+	listing lst = flags ? OpenListingFile(context, context->parameters->tcp_send ? NULL : csv ? L"Deleted.csv" : L"Deleted.jsonl") : NULL;
+	bool result = lst != NULL;
+	if (result && csv)
+		PutText(lst, L"Directory,FileName,MftRef,MftSeqNo,ParentMftRef,ParentMftSeqNo,Flags,Created,Modified,"
+						L"MftModified,Accessed,AllocatedSize,RealSize,Recovery,Runs\n");
+
+	deleted_run* run = result ? (deleted_run*)utarray_front(runs) : NULL;
+	for (uint64_t row = 0; result && row < table->row_cnt; ++row)
+	{
+		//Extension records have nothing to list by themselves, and records without a name
+		//are mostly ones that were never used:
+		if (!(table->flags[row] & FILE_ROW_DELETED) || (table->flags[row] & FILE_ROW_EXTENSION) || !table->name_len[row])
+			continue;
+
+		//The runs are in record order:
+		for (; run && run->row < row; run = (deleted_run*)utarray_next(runs, run));
+		deleted_run* first = run;
+		rsize_t cnt = 0;
+		for (; run && run->row == row; run = (deleted_run*)utarray_next(runs, run), ++cnt);
+
+		rsize_t path_len = 0;
+		const wchar_t* path = FolderPath(paths, table->parent[row], &path_len);
+		FileFlagsToString(table->attributes[row] | (table->flags[row] & FILE_ROW_DIRECTORY ? FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT : 0), flags);
+		int recovery = Recovery(table, row, bitmap, first, cnt);
+		if (csv)
+			ListDeletedCSV(lst, table, row, path, path_len, flags, recovery, first, cnt);
+		else
+			ListDeletedJSON(lst, table, row, path, path_len, flags, recovery, first, cnt);
+	}
+
+	if (lst)
+		result = CloseListing(lst) && result;
+	if (flags)
+		DeleteString(flags);
+	if (paths)
+		DeleteFolderPaths(paths);
+	if (bitmap)
+		DeleteBytes(bitmap);
+	if (table)
+		DeleteFileTable(table);
+	utarray_free(runs);
+	return result;
+}
+
+bool CollectRuns(execution_context context, const file_table table, const record_batch* batch, void* state)
+{
+	for (rsize_t i = 0; i < batch->cnt; ++i)
+	{
+		raw_mft_record hdr = (raw_mft_record)batch->records[i].buffer;
+		if (hdr && !(hdr->flags & MFT_RECORD_IN_USE) && !hdr->base_mft_rec)
+			CollectRecordRuns(batch->first + i, batch->records + i, (UT_array*)state);
+	}
+	return true;
+}
+
+//Only what's in the base record is left of a deleted file, which is all of it for most files.
+//Nothing in a record that isn't in use is trusted, so every part is checked to be inside it.
+void CollectRecordRuns(uint64_t row, const bytes rec, UT_array* runs)
+{
+	for (attribute at = FirstCheckedAttr(rec); at; at = NextCheckedAttr(rec, at))
+	{
+		if (at->type != ATTR_DATA || at->name_len || !at->non_resident || at->run_list_offs >= at->length)
+			continue;
+
+		uint8_t* at_end = (uint8_t*)at + at->length;
+		if (!RunFits((uint8_t*)at + at->run_list_offs, at_end))
+			continue;
+
+		run_list_iterator iter = StartRunListIterator(at);
+		while (!iter->end_of_runs && iter->next_vcn > iter->cur_vcn)
+		{
+			deleted_run run = { row, iter->cur_lcn, iter->next_vcn - iter->cur_vcn };
+			utarray_push_back(runs, &run);
+			if (!RunFits(iter->next_index, at_end))
+				break;
+			NextRun(iter);
+		}
+		CloseRunListIterator(iter);
+	}
+}
+
+//The header of a pair of the run list tells how long it is, the end of the list is a zero
+bool RunFits(const uint8_t* pair, const uint8_t* end)
+{
+	return pair < end && (!*pair || pair + 1 + (*pair & 0x0F) + (*pair >> 4) <= end);
+}
+
+bytes VolumeBitmap(execution_context context)
+{
+	mft_file file = LoadMFTFile(context, BITMAP_RECORD);
+	attribute data = file ? FirstAttribute(context, file, AttrTypeFlag(ATTR_DATA)) : NULL;
+	bytes result = data ? GetBytesFromAttrib(context, file, data, 0, AttributeSize(data)) : NULL;
+	if (file)
+		DeleteMFTFile(file);
+	if (!result)
+		return ErrorCleanUp(NULL, NULL, "Error: Unable to read the volume bitmap.\n");
+	return result;
+}
+
+int Recovery(const file_table table, uint64_t row, const bytes bitmap, const deleted_run* runs, rsize_t cnt)
+{
+	if (table->flags[row] & FILE_ROW_RESIDENT)
+		return RECOVERY_RESIDENT;
+
+	uint64_t clusters = 0, in_use = 0;
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		if (!runs[i].lcn)
+			continue;
+		clusters += runs[i].length;
+		in_use += ClustersInUse(bitmap, runs[i].lcn, runs[i].length);
+	}
+
+	if (!clusters)
+		return RECOVERY_NONE;
+	return !in_use ? RECOVERY_FREE : (in_use < clusters ? RECOVERY_PARTIAL : RECOVERY_ALLOCATED);
+}
+
+uint64_t ClustersInUse(const bytes bitmap, uint64_t lcn, uint64_t cnt)
+{
+	//Clusters beyond the end of the volume can't be the file's, they count as taken:
+	uint64_t bits = (uint64_t)bitmap->buffer_len * 8;
+	uint64_t inside = lcn < bits ? min(cnt, bits - lcn) : 0;
+	uint64_t result = cnt - inside;
+
+	//A byte at a time in between the first and last one:
+	for (uint64_t cl = lcn, end = lcn + inside; cl < end; )
+	{
+		uint8_t bits_of = bitmap->buffer[cl / 8];
+		if (!(cl % 8) && cl + 8 <= end)
+		{
+			result += nibble_bits[bits_of & 0x0F] + nibble_bits[bits_of >> 4];
+			cl += 8;
+		}
+		else
+			result += (bits_of >> (cl++ % 8)) & 1;
+	}
+	return result;
+}
+
+//The dates are those of $STANDARD_INFORMATION. The runs are "lcn:clusters", "sparse:clusters"
+//for sparse runs, separated by spaces.
+void ListDeletedCSV(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+					const string flags, int recovery, const deleted_run* runs, rsize_t cnt)
+{
+	PutCSVField(lst, path ? path : L"", path_len);
+	PutText(lst, L",");
+	PutCSVField(lst, FileRowName(table, row), table->name_len[row]);
+	PutText(lst, L",");
+	PutNumber(lst, row, 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->seq[row], 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->parent[row] & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->parent[row] >> 48, 0, 0);
+	PutText(lst, L",");
+	PutCSVField(lst, BaseString(flags), StringLen(flags));
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		PutText(lst, L",");
+		PutISODate(lst, table->si_times[row * FILE_TIMES + i]);
+	}
+	PutText(lst, L",");
+	PutNumber(lst, table->alloc_sz[row], 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->data_sz[row], 0, 0);
+	PutText(lst, L",");
+	PutText(lst, recovery_labels[recovery]);
+	PutText(lst, L",");
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		if (i > 0)
+			PutText(lst, L" ");
+		if (runs[i].lcn)
+			PutNumber(lst, runs[i].lcn, 0, 0);
+		else
+			PutText(lst, L"sparse");
+		PutText(lst, L":");
+		PutNumber(lst, runs[i].length, 0, 0);
+	}
+	PutText(lst, L"\n");
+}
+
+//The runs are pairs of the first cluster (null for a sparse run) and the number of clusters
+void ListDeletedJSON(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+					const string flags, int recovery, const deleted_run* runs, rsize_t cnt)
+{
+	PutText(lst, L"{\"directory\":");
+	if (path)
+		PutJSONString(lst, path, path_len);
+	else
+		PutText(lst, L"null");
+	PutText(lst, L",\"name\":");
+	PutJSONString(lst, FileRowName(table, row), table->name_len[row]);
+	PutText(lst, L",\"mft_ref\":");
+	PutNumber(lst, row, 0, 0);
+	PutText(lst, L",\"mft_seq_no\":");
+	PutNumber(lst, table->seq[row], 0, 0);
+	PutText(lst, L",\"parent_mft_ref\":");
+	PutNumber(lst, table->parent[row] & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",\"parent_mft_seq_no\":");
+	PutNumber(lst, table->parent[row] >> 48, 0, 0);
+	PutText(lst, L",\"flags\":");
+	PutJSONString(lst, BaseString(flags), StringLen(flags));
+
+	static const wchar_t* const time_keys[] = { L",\"created\":\"", L"\",\"modified\":\"", L"\",\"mft_modified\":\"", L"\",\"accessed\":\"" };
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		PutText(lst, time_keys[i]);
+		PutISODate(lst, table->si_times[row * FILE_TIMES + i]);
+	}
+	PutText(lst, L"\",\"allocated_size\":");
+	PutNumber(lst, table->alloc_sz[row], 0, 0);
+	PutText(lst, L",\"real_size\":");
+	PutNumber(lst, table->data_sz[row], 0, 0);
+	PutText(lst, L",\"recovery\":\"");
+	PutText(lst, recovery_labels[recovery]);
+	PutText(lst, L"\",\"runs\":[");
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		PutText(lst, i > 0 ? L",[" : L"[");
+		if (runs[i].lcn)
+			PutNumber(lst, runs[i].lcn, 0, 0);
+		else
+			PutText(lst, L"null");
+		PutText(lst, L",");
+		PutNumber(lst, runs[i].length, 0, 0);
+		PutText(lst, L"]");
+	}
+	PutText(lst, L"]}\n");
+}
@@ -0,0 +1,20 @@
+#ifndef DELETED_H
+#define DELETED_H
+
+#include "context.h"
+
+//How much of the data of a deleted file can still be on the volume
+#define RECOVERY_NONE 0					// It has no data, or no run list is left
+#define RECOVERY_RESIDENT 1				// The data is in the MFT record itself
+#define RECOVERY_FREE 2					// None of its clusters are in use
+#define RECOVERY_PARTIAL 3				// Some of its clusters are in use by other files now
+#define RECOVERY_ALLOCATED 4			// All of them are
+
+//Lists what's left of the deleted files in the MFT (/Deleted:): the records that aren't in use
+//anymore, but still have a name. They're found in one sequential read of the whole MFT, along
+//with the files that are still there, for the paths. Whether their data can be recovered is
+//told by the volume $Bitmap, which is read at once. The list is written as CSV or JSON lines
+//to Deleted.csv or Deleted.jsonl in the output folder.
+bool ListDeletedFiles(execution_context context);
+
+#endif //DELETED_H
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir-snapshot.h"
+#include "index.h"
+#include "names.h"
+#include "helpers.h"
+
+struct _dir_snapshot {
+	bytes entries;				// Copies of all index entries, back to back
+	rsize_t entries_len;		// Part of 'entries' in use
+	uint32_t entry_cnt;
+	uint32_t* slots;			// Open addressing table of offsets in 'entries' plus one, 0 if empty
+	uint32_t* hashes;			// Name hash of the entry in the corresponding slot
+	uint32_t slot_mask;
+};
+
+bool AddSnapshotEntry(dir_snapshot snap, const index_entry entry);
+
+dir_snapshot TakeDirSnapshot(execution_context context, uint64_t folder)
+{
+	SafeCreate(result, dir_snapshot);
+	memset(result, 0, sizeof(struct _dir_snapshot));
+	result->entries = CreateEmpty();
+
+	//Only the MFT reference of the folder is needed to iterate it:
+	struct _index_entry root;
+	root.mft_reference = folder;
+	index_iter iter = StartIndexIterator(context, &root);
+	if (!iter)
+		return ErrorCleanUp(DeleteDirSnapshot, result, "");
+
+	bool ok = true;
+	for (index_entry rec = CurrentIterEntry(iter); ok && rec; rec = NextIterEntry(context, iter))
+		ok = AddSnapshotEntry(result, rec);
+	CloseIndexIterator(iter);
+
+	if (!ok)
+		return ErrorCleanUp(DeleteDirSnapshot, result, "Unable to take a snapshot of directory %lld.\n", folder);
+
+	//Table at most half full:
+	uint32_t slot_cnt = 16;
+	while (slot_cnt < 2 * result->entry_cnt)
+		slot_cnt <<= 1;
+	result->slot_mask = slot_cnt - 1;
+	if (!(result->slots = calloc(slot_cnt, sizeof(uint32_t))) || !(result->hashes = malloc(slot_cnt * sizeof(uint32_t))))
+		return ErrorCleanUp(DeleteDirSnapshot, result, "Memory allocation problem.\n");
+
+	for (rsize_t offs = 0; offs < result->entries_len; offs += ((index_entry)(result->entries->buffer + offs))->entry_size)
+	{
+		index_entry ent = (index_entry)(result->entries->buffer + offs);
+		uint32_t hash = NameHash(context, (wchar_t*)ent->filename, ent->filename_len);
+		uint32_t slot = hash & result->slot_mask;
+		while (result->slots[slot])
+			slot = (slot + 1) & result->slot_mask;
+		result->slots[slot] = (uint32_t)offs + 1;
+		result->hashes[slot] = hash;
+	}
+	return result;
+}
+
+void DeleteDirSnapshot(dir_snapshot snap)
+{
+	DeleteBytes(snap->entries);
+	if (snap->slots)
+		free(snap->slots);
+	if (snap->hashes)
+		free(snap->hashes);
+	free(snap);
+}
+
+bytes FindSnapshotEntry(execution_context context, const dir_snapshot snap, const wchar_t* name)
+{
+	rsize_t len = wcslen(name);
+	uint32_t hash = NameHash(context, name, len);
+	for (uint32_t slot = hash & snap->slot_mask; snap->slots[slot]; slot = (slot + 1) & snap->slot_mask)
+	{
+		index_entry ent = (index_entry)(snap->entries->buffer + snap->slots[slot] - 1);
+		if (snap->hashes[slot] == hash && NamesEqual(context, (wchar_t*)ent->filename, (rsize_t)ent->filename_len, name, len))
+			return FromBuffer(ent, ent->entry_size);
+	}
+	return NULL;
+}
+
+bool AddSnapshotEntry(dir_snapshot snap, const index_entry entry)
+{
+	//Entries need a complete name, and offsets are kept in 32 bits:
+	if (entry->entry_size < 0x52 || entry->entry_size < 0x52 + 2 * (rsize_t)entry->filename_len ||
+			snap->entries_len + entry->entry_size >= UINT32_MAX)
+		return false;
+
+	//The buffer grows by doubling, 'entries_len' keeps track of what's in use:
+	if (snap->entries_len + entry->entry_size > snap->entries->buffer_len &&
+			!Reserve(snap->entries, max(snap->entries_len + entry->entry_size, 2 * snap->entries->buffer_len)))
+		return false;
+
+	memcpy(snap->entries->buffer + snap->entries_len, entry, entry->entry_size);
+	snap->entries_len += entry->entry_size;
+	snap->entry_cnt++;
+	return true;
+}
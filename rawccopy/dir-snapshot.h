@@ -0,0 +1,18 @@
+#ifndef DIR_SNAPSHOT_H
+#define DIR_SNAPSHOT_H
+
+#include "context.h"
+#include "byte-buffer.h"
+
+//In-memory copy of all entries in the index of a directory, hashed by name, for directories
+//in which a lot of names get looked up
+typedef struct _dir_snapshot* dir_snapshot;
+
+dir_snapshot TakeDirSnapshot(execution_context context, uint64_t folder);
+
+void DeleteDirSnapshot(dir_snapshot snap);
+
+//Returns a copy of the index entry with the given name, NULL if it isn't in the directory
+bytes FindSnapshotEntry(execution_context context, const dir_snapshot snap, const wchar_t* name);
+
+#endif //DIR_SNAPSHOT_H
@@ -0,0 +1,658 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "file-table.h"
+#include "mft.h"
+#include "attribs.h"
+#include "helpers.h"
+#include "thread-pool.h"
+
+//MFT record of the root folder
+#define ROOT_RECORD 5
+
+//A chain of parents longer than this has a loop in it
+#define MAX_FOLDER_DEPTH 0x4000
+
+//Path length of a folder that has no path
+#define NO_PATH 0xFFFF
+
+typedef struct {
+	batch_slice slice;
+	bytes names;				// Names of the slice, the name_offs of its rows are relative to it until merged
+	rsize_t names_cap;			// Allocated size of 'names', which grows with AppendGrowing
+	UT_array* extra_names;		// Of the slice, their name_offs are relative to 'names' as well
+} slice_job;
+
+typedef struct {
+	file_table table;
+	rsize_t names_cap;			// Of the names of the table
+	UT_array* extensions;		// References of the extension records of the files with an attribute list
+} row_updater;
+
+typedef struct {
+	file_table table;
+	rsize_t names_cap;			// Of the names of the table
+	UT_array* slices;			// slice_job, kept from one read to the next to reuse their 'names'
+	table_callback inspect;
+	void* state;
+} table_builder;
+
+struct _folder_paths {
+	file_table table;
+	uint32_t* path_offs;		// Offset of the path of a row in 'paths', in characters
+	uint16_t* path_len;			// 0 when it's not worked out yet, NO_PATH when there's none
+	bytes paths;
+	rsize_t paths_cap;			// Allocated size of 'paths', which grows with ReserveGrowing
+	UT_array* chain;			// Rows from a folder up to the first one whose path is known
+};
+
+struct _row_names {
+	extra_name* names;			// Copies of the extra names of the table, by row and in the order of their names
+	rsize_t cnt;
+};
+
+void InitSliceJob(void* job);
+
+void DeleteSliceJob(void* job);
+
+static const UT_icd slice_job_icd = { sizeof(slice_job), InitSliceJob, NULL, DeleteSliceJob };
+
+static const UT_icd ref_icd = { sizeof(uint64_t), NULL, NULL, NULL };
+
+static const UT_icd extra_name_icd = { sizeof(extra_name), NULL, NULL, NULL };
+
+file_table AllocateFileTable(uint64_t row_cnt);
+
+bool ParseBatch(execution_context context, const record_batch* batch, void* state);
+
+void ParseSlice(void* item, void* shared);
+
+void ParseRecord(file_table table, uint64_t row, const bytes rec, bytes names, rsize_t* names_cap, UT_array* extra_names);
+
+void ParseAttribute(file_table table, uint64_t row, const attribute attr, bytes names, rsize_t* names_cap, UT_array* extra_names);
+
+void AddExtraName(uint64_t row, const file_name_attribute fn, bytes names, rsize_t* names_cap, UT_array* extra_names);
+
+void DropExtraNames(file_table table, const uint64_t* rows, rsize_t cnt);
+
+bool ParseSpreadFile(execution_context context, file_table table, uint64_t row);
+
+void ParseSpreadData(execution_context context, file_table table, uint64_t row, mft_file file);
+
+void UpdateRow(execution_context context, uint64_t ref, mft_file file, void* state);
+
+void ClearRow(file_table table, uint64_t row);
+
+rsize_t SortRows(uint64_t* rows, rsize_t cnt);
+
+int CompareRows(const void* first, const void* second);
+
+bool IsFolderRef(const file_table table, uint64_t ref);
+
+void AddFolderPath(folder_paths paths, uint64_t row);
+
+int CompareExtraNames(const void* first, const void* second);
+
+
+file_table BuildFileTable(execution_context context, uint32_t scan_flags, table_callback inspect, void* state)
+{
+	attribute mft_data = FirstAttribute(context, context->mft_table, AttrTypeFlag(ATTR_DATA));
+	if (!mft_data)
+		return ErrorCleanUp(NULL, NULL, "Error: Unable to find the data of the MFT.\n");
+
+	file_table result = AllocateFileTable(AttributeSize(mft_data) / context->mft_record_sz);
+	if (!result)
+		return NULL;
+
+	table_builder builder = { result, 0, NULL, inspect, state };
+	utarray_new(builder.slices, &slice_job_icd);
+	bool ok = ScanMFT(context, scan_flags, ParseBatch, &builder);
+	utarray_free(builder.slices);
+	if (!ok)
+		return ErrorCleanUp(DeleteFileTable, result, "Error: Unable to read the MFT.\n");
+
+	//The data attributes of files with an attribute list can be in other records, so they're
+	//read once more through the list. There aren't many of them, so they're done one by one.
+	//Deleted files have only what's in their base record:
+	for (uint64_t row = 0; row < result->row_cnt; ++row)
+	{
+		if ((result->flags[row] & (FILE_ROW_ATTRIBUTE_LIST | FILE_ROW_IN_USE)) == (FILE_ROW_ATTRIBUTE_LIST | FILE_ROW_IN_USE) &&
+				!ParseSpreadFile(context, result, row))
+			return ErrorCleanUp(DeleteFileTable, result, "Error: Unable to read MFT record %llu.\n", row);
+	}
+	return result;
+}
+
+file_table CopyFileTable(const file_table table, uint64_t row_cnt)
+{
+	file_table result = AllocateFileTable(row_cnt);
+	if (!result)
+		return NULL;
+
+	rsize_t rows = (rsize_t)min(row_cnt, table->row_cnt);
+	memcpy(result->seq, table->seq, rows * sizeof(uint16_t));
+	memcpy(result->flags, table->flags, rows * sizeof(uint16_t));
+	memcpy(result->parent, table->parent, rows * sizeof(uint64_t));
+	memcpy(result->name_offs, table->name_offs, rows * sizeof(uint32_t));
+	memcpy(result->name_len, table->name_len, rows * sizeof(uint8_t));
+	memcpy(result->name_space, table->name_space, rows * sizeof(uint8_t));
+	memcpy(result->attributes, table->attributes, rows * sizeof(uint32_t));
+	memcpy(result->si_times, table->si_times, rows * FILE_TIMES * sizeof(uint64_t));
+	memcpy(result->fn_times, table->fn_times, rows * FILE_TIMES * sizeof(uint64_t));
+	memcpy(result->data_sz, table->data_sz, rows * sizeof(uint64_t));
+	memcpy(result->alloc_sz, table->alloc_sz, rows * sizeof(uint64_t));
+	memcpy(result->streams, table->streams, rows * sizeof(uint16_t));
+	Append(result->names, table->names, 0, table->names->buffer_len);
+	for (extra_name* name = table->extra_names ? utarray_front(table->extra_names) : NULL; name;
+		name = utarray_next(table->extra_names, name))
+	{
+		if (name->row < rows)
+			utarray_push_back(result->extra_names, name);
+	}
+	return result;
+}
+
+bool UpdateFileRows(execution_context context, file_table table, uint64_t* rows, rsize_t cnt)
+{
+	//The extension records a file had before go along, they may not belong to it anymore:
+	cnt = SortRows(rows, cnt);
+	UT_array* refs;
+	utarray_new(refs, &ref_icd);
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		if (rows[i] < table->row_cnt)
+			utarray_push_back(refs, rows + i);
+	}
+	for (uint64_t row = 0; cnt && row < table->row_cnt; ++row)
+	{
+		uint64_t base = table->parent[row] & 0x0000FFFFFFFFFFFF;
+		if ((table->flags[row] & FILE_ROW_EXTENSION) && bsearch(&base, rows, cnt, sizeof(uint64_t), CompareRows))
+			utarray_push_back(refs, &row);
+	}
+	rsize_t ref_cnt = SortRows(utarray_front(refs), utarray_len(refs));
+	utarray_resize(refs, ref_cnt);
+
+	//Rows of records that aren't in use anymore stay cleared, FetchMFTRecords skips them.
+	//The references don't have a sequence number, so whatever is in a record now is taken:
+	for (uint64_t* row = utarray_front(refs); row; row = utarray_next(refs, row))
+		ClearRow(table, *row);
+	DropExtraNames(table, utarray_front(refs), ref_cnt);
+
+	row_updater updater = { table, table->names->buffer_len, NULL };
+	utarray_new(updater.extensions, &ref_icd);
+	bool result = !ref_cnt || FetchMFTRecords(context, utarray_front(refs), ref_cnt, UpdateRow, &updater);
+
+	//Extension records that are new to their file, the ones that were read already are left out.
+	//They're read with their sequence number, so they're only taken when they're still in use:
+	UT_array* extensions = updater.extensions;
+	rsize_t ext_cnt = 0;
+	for (uint64_t* ref = utarray_front(extensions); ref; ref = utarray_next(extensions, ref))
+	{
+		uint64_t row = *ref & 0x0000FFFFFFFFFFFF;
+		if (row < table->row_cnt && !bsearch(&row, utarray_front(refs), ref_cnt, sizeof(uint64_t), CompareRows))
+			*(uint64_t*)utarray_eltptr(extensions, ext_cnt++) = *ref;
+	}
+	ext_cnt = SortRows(utarray_front(extensions), ext_cnt);
+	for (rsize_t i = 0; i < ext_cnt; ++i)
+		ClearRow(table, *(uint64_t*)utarray_eltptr(extensions, i) & 0x0000FFFFFFFFFFFF);
+
+	//What these add isn't followed any further:
+	utarray_new(updater.extensions, &ref_icd);
+	if (result && ext_cnt)
+		result = FetchMFTRecords(context, utarray_front(extensions), ext_cnt, UpdateRow, &updater);
+
+	utarray_free(updater.extensions);
+	utarray_free(extensions);
+	utarray_free(refs);
+	return result;
+}
+
+void DeleteFileTable(file_table table)
+{
+	free(table->seq);
+	free(table->flags);
+	free(table->parent);
+	free(table->name_offs);
+	free(table->name_len);
+	free(table->name_space);
+	free(table->attributes);
+	free(table->si_times);
+	free(table->fn_times);
+	free(table->data_sz);
+	free(table->alloc_sz);
+	free(table->streams);
+	if (table->names)
+		DeleteBytes(table->names);
+	if (table->extra_names)
+		utarray_free(table->extra_names);
+	free(table);
+}
+
+folder_paths CreateFolderPaths(const file_table table, const wchar_t* root, rsize_t root_len)
+{
+	SafeCreate(result, folder_paths);
+	memset(result, 0, sizeof(struct _folder_paths));
+	result->table = table;
+	if (!(result->path_offs = calloc((rsize_t)table->row_cnt, sizeof(uint32_t))) ||
+		!(result->path_len = calloc((rsize_t)table->row_cnt, sizeof(uint16_t))) || !(result->paths = CreateEmpty()))
+		return ErrorCleanUp(DeleteFolderPaths, result, "Memory allocation problem.\n");
+	utarray_new(result->chain, &ref_icd);
+
+	if (table->row_cnt > ROOT_RECORD)
+	{
+		struct _bytes root_path = { (uint8_t*)root, root_len * sizeof(wchar_t) };
+		Append(result->paths, &root_path, 0, root_path.buffer_len);
+		result->paths_cap = result->paths->buffer_len;
+		result->path_len[ROOT_RECORD] = root_len ? (uint16_t)root_len : NO_PATH;
+	}
+	return result;
+}
+
+const wchar_t* FolderPath(folder_paths paths, uint64_t ref, rsize_t* len)
+{
+	file_table table = paths->table;
+	if (!IsFolderRef(table, ref))
+		return NULL;
+
+	//A path that's known is only looked up:
+	uint64_t row = ref & 0x0000FFFFFFFFFFFF;
+	if (!paths->path_len[row])
+		AddFolderPath(paths, row);
+
+	if (paths->path_len[row] == NO_PATH)
+		return NULL;
+	*len = paths->path_len[row];
+	return (wchar_t*)paths->paths->buffer + paths->path_offs[row];
+}
+
+void ResolveFolderPaths(folder_paths paths)
+{
+	rsize_t len;
+	for (uint64_t row = 0; row < paths->table->row_cnt; ++row)
+		FolderPath(paths, row | ((uint64_t)paths->table->seq[row] << 48), &len);
+}
+
+void AddFolderPath(folder_paths paths, uint64_t row)
+{
+	//Up to the first folder with a known path (the root at least)...
+	file_table table = paths->table;
+	bool broken = false;
+	utarray_clear(paths->chain);
+	for (uint64_t cur = row; !paths->path_len[cur]; cur = table->parent[cur] & 0x0000FFFFFFFFFFFF)
+	{
+		utarray_push_back(paths->chain, &cur);
+		if ((broken = utarray_len(paths->chain) > MAX_FOLDER_DEPTH || !IsFolderRef(table, table->parent[cur])))
+			break;
+	}
+
+	//...and back down, adding a name every step:
+	for (uint64_t* cur = utarray_back(paths->chain); cur; cur = utarray_prev(paths->chain, cur))
+	{
+		uint64_t parent = table->parent[*cur] & 0x0000FFFFFFFFFFFF;
+		rsize_t parent_len = broken ? NO_PATH : paths->path_len[parent];
+		rsize_t path_len = parent_len + 1 + table->name_len[*cur];
+		if (path_len >= NO_PATH)
+		{
+			paths->path_len[*cur] = NO_PATH;
+			continue;
+		}
+
+		rsize_t start = paths->paths->buffer_len;
+		ReserveGrowing(paths->paths, start + path_len * sizeof(wchar_t), &paths->paths_cap);
+		wchar_t* dest = (wchar_t*)(paths->paths->buffer + start);
+		memcpy(dest, (wchar_t*)paths->paths->buffer + paths->path_offs[parent], parent_len * sizeof(wchar_t));
+		dest[parent_len] = L'\\';
+		memcpy(dest + parent_len + 1, FileRowName(table, *cur), table->name_len[*cur] * sizeof(wchar_t));
+		paths->path_offs[*cur] = (uint32_t)(start / sizeof(wchar_t));
+		paths->path_len[*cur] = (uint16_t)path_len;
+	}
+}
+
+void DeleteFolderPaths(folder_paths paths)
+{
+	free(paths->path_offs);
+	free(paths->path_len);
+	if (paths->paths)
+		DeleteBytes(paths->paths);
+	if (paths->chain)
+		utarray_free(paths->chain);
+	free(paths);
+}
+
+row_names CreateRowNames(const file_table table, rsize_t first)
+{
+	SafeCreate(result, row_names);
+	rsize_t total = utarray_len(table->extra_names);
+	result->cnt = total > first ? total - first : 0;
+	if (!(result->names = malloc(result->cnt * sizeof(extra_name) + 1)))
+		return ErrorCleanUp(free, result, "Memory allocation problem.\n");
+	if (result->cnt)
+	{
+		memcpy(result->names, utarray_eltptr(table->extra_names, first), result->cnt * sizeof(extra_name));
+		qsort(result->names, result->cnt, sizeof(extra_name), CompareExtraNames);
+	}
+	return result;
+}
+
+rsize_t ExtraRowNames(const row_names names, uint64_t row, const extra_name** first)
+{
+	rsize_t low = 0, high = names->cnt;
+	while (low < high)
+	{
+		rsize_t mid = low + (high - low) / 2;
+		if (names->names[mid].row < row)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	rsize_t end = low;
+	while (end < names->cnt && names->names[end].row == row)
+		++end;
+	*first = names->names + low;
+	return end - low;
+}
+
+void DeleteRowNames(row_names names)
+{
+	free(names->names);
+	free(names);
+}
+
+file_table AllocateFileTable(uint64_t row_cnt)
+{
+	SafeCreate(result, file_table);
+	memset(result, 0, sizeof(struct _file_table));
+	result->row_cnt = row_cnt;
+	rsize_t rows = (rsize_t)row_cnt;
+	result->names = CreateEmpty();
+
+	//All columns start out zeroed, which is what a row of a record that isn't in use looks like:
+	if (!(result->seq = calloc(rows, sizeof(uint16_t))) || !(result->flags = calloc(rows, sizeof(uint16_t))) ||
+		!(result->parent = calloc(rows, sizeof(uint64_t))) || !(result->name_offs = calloc(rows, sizeof(uint32_t))) ||
+		!(result->name_len = calloc(rows, sizeof(uint8_t))) || !(result->name_space = calloc(rows, sizeof(uint8_t))) ||
+		!(result->attributes = calloc(rows, sizeof(uint32_t))) ||
+		!(result->si_times = calloc(rows * FILE_TIMES, sizeof(uint64_t))) ||
+		!(result->fn_times = calloc(rows * FILE_TIMES, sizeof(uint64_t))) ||
+		!(result->data_sz = calloc(rows, sizeof(uint64_t))) || !(result->alloc_sz = calloc(rows, sizeof(uint64_t))) ||
+		!(result->streams = calloc(rows, sizeof(uint16_t))))
+		return ErrorCleanUp(DeleteFileTable, result, "Memory allocation problem.\n");
+	utarray_new(result->extra_names, &extra_name_icd);
+	return result;
+}
+
+void InitSliceJob(void* job)
+{
+	slice_job* sj = (slice_job*)job;
+	memset(sj, 0, sizeof(slice_job));
+	sj->names = CreateEmpty();
+	utarray_new(sj->extra_names, &extra_name_icd);
+}
+
+void DeleteSliceJob(void* job)
+{
+	DeleteBytes(((slice_job*)job)->names);
+	utarray_free(((slice_job*)job)->extra_names);
+}
+
+bool ParseBatch(execution_context context, const record_batch* batch, void* state)
+{
+	table_builder* builder = (table_builder*)state;
+	//Every slice has its own rows and its own names, so the threads don't need any locking:
+	rsize_t slice_cnt = RunSlices(context, batch, builder->slices, ParseSlice, builder->table);
+
+	//The names of the slices go to the table in record order, and the offsets of a slice
+	//just move up by what was there before it:
+	file_table table = builder->table;
+	for (rsize_t i = 0; i < slice_cnt; ++i)
+	{
+		slice_job* job = (slice_job*)utarray_eltptr(builder->slices, i);
+		uint32_t base = (uint32_t)(table->names->buffer_len / sizeof(wchar_t));
+		for (uint64_t row = batch->first + job->slice.first; row < batch->first + job->slice.first + job->slice.cnt; ++row)
+		{
+			if (table->name_len[row])
+				table->name_offs[row] += base;
+		}
+		for (extra_name* name = utarray_front(job->extra_names); name; name = utarray_next(job->extra_names, name))
+		{
+			name->name_offs += base;
+			utarray_push_back(table->extra_names, name);
+		}
+		AppendGrowing(table->names, &builder->names_cap, job->names, 0, job->names->buffer_len);
+	}
+	return !builder->inspect || builder->inspect(context, table, batch, builder->state);
+}
+
+void ParseSlice(void* item, void* shared)
+{
+	slice_job* job = (slice_job*)item;
+	const record_batch* batch = job->slice.batch;
+	RightTrim(job->names, job->names->buffer_len);
+	utarray_clear(job->extra_names);
+	for (rsize_t i = job->slice.first; i < job->slice.first + job->slice.cnt; ++i)
+	{
+		if (batch->records[i].buffer)
+			ParseRecord((file_table)shared, batch->first + i, batch->records + i, job->names, &job->names_cap, job->extra_names);
+	}
+}
+
+void ParseRecord(file_table table, uint64_t row, const bytes rec, bytes names, rsize_t* names_cap, UT_array* extra_names)
+{
+	raw_mft_record hdr = (raw_mft_record)rec->buffer;
+	table->seq[row] = hdr->seq_nmbr;
+	table->flags[row] = (hdr->flags & MFT_RECORD_IN_USE ? FILE_ROW_IN_USE : FILE_ROW_DELETED) |
+						(hdr->flags & MFT_RECORD_IS_DIRECTORY ? FILE_ROW_DIRECTORY : 0);
+	if (hdr->base_mft_rec)
+	{
+		table->flags[row] |= FILE_ROW_EXTENSION;
+		table->parent[row] = hdr->base_mft_rec;
+
+		//The names in here are more names of the file of the base record, as long as it's its file:
+		for (attribute at = hdr->flags & MFT_RECORD_IN_USE ? FirstCheckedAttr(rec) : NULL; at; at = NextCheckedAttr(rec, at))
+		{
+			file_name_attribute fn = at->type == ATTR_FILE_NAME ? ResidentValue(at, sizeof(struct _file_name_attribute)) : NULL;
+			if (fn && sizeof(struct _file_name_attribute) + fn->file_name_length * sizeof(wchar_t) <= at->value_len)
+				AddExtraName(hdr->base_mft_rec & 0x0000FFFFFFFFFFFF, fn, names, names_cap, extra_names);
+		}
+		return;
+	}
+
+	for (attribute at = FirstCheckedAttr(rec); at; at = NextCheckedAttr(rec, at))
+		ParseAttribute(table, row, at, names, names_cap, extra_names);
+}
+
+void ParseAttribute(file_table table, uint64_t row, const attribute attr, bytes names, rsize_t* names_cap, UT_array* extra_names)
+{
+	standard_information si;
+	file_name_attribute fn;
+	switch (attr->type)
+	{
+	case ATTR_ATTRIBUTE_LIST:
+		table->flags[row] |= FILE_ROW_ATTRIBUTE_LIST;
+		break;
+
+	case ATTR_STANDARD_INFORMATION:
+		si = ResidentValue(attr, STANDARD_INFORMATION_V1_SZ);
+		if (si)
+		{
+			memcpy(table->si_times + row * FILE_TIMES, &si->creation_time, FILE_TIMES * sizeof(uint64_t));
+			table->attributes[row] = si->file_attributes;
+		}
+		break;
+
+	case ATTR_FILE_NAME:
+		fn = ResidentValue(attr, sizeof(struct _file_name_attribute));
+		if (fn)
+		{
+			if (sizeof(struct _file_name_attribute) + fn->file_name_length * sizeof(wchar_t) > attr->value_len)
+				break;
+
+			//A DOS name only when there's nothing better, the names that aren't taken are extra names:
+			if (table->name_len[row] && (fn->name_space == FILE_NAME_DOS || table->name_space[row] != FILE_NAME_DOS))
+			{
+				AddExtraName(row, fn, names, names_cap, extra_names);
+				break;
+			}
+			if (table->name_len[row])
+			{
+				extra_name replaced = { row, table->parent[row], table->name_offs[row], table->name_len[row], table->name_space[row] };
+				utarray_push_back(extra_names, &replaced);
+			}
+
+			struct _bytes name = { fn->file_name, fn->file_name_length * sizeof(wchar_t) };
+			table->name_offs[row] = (uint32_t)(names->buffer_len / sizeof(wchar_t));
+			table->name_len[row] = fn->file_name_length;
+			AppendGrowing(names, names_cap, &name, 0, name.buffer_len);
+			table->name_space[row] = fn->name_space;
+			table->parent[row] = fn->parent_directory;
+			memcpy(table->fn_times + row * FILE_TIMES, &fn->creation_time, FILE_TIMES * sizeof(uint64_t));
+		}
+		break;
+
+	case ATTR_DATA:
+		//Only the first extent of an attribute has its sizes:
+		if (attr->non_resident && attr->start_vcn)
+			break;
+
+		if (attr->name_len)
+			++table->streams[row];
+		else if (attr->non_resident)
+		{
+			table->data_sz[row] = attr->real_sz;
+			table->alloc_sz[row] = attr->alloc_sz;
+		}
+		else
+		{
+			//Like in $FILE_NAME, resident data is counted in multiples of 8 bytes:
+			table->data_sz[row] = attr->value_len;
+			table->alloc_sz[row] = (attr->value_len + 7) & ~7ULL;
+			table->flags[row] |= FILE_ROW_RESIDENT;
+		}
+		break;
+	}
+}
+
+void AddExtraName(uint64_t row, const file_name_attribute fn, bytes names, rsize_t* names_cap, UT_array* extra_names)
+{
+	if (!fn->file_name_length)
+		return;
+
+	struct _bytes name = { fn->file_name, fn->file_name_length * sizeof(wchar_t) };
+	extra_name extra = { row, fn->parent_directory, (uint32_t)(names->buffer_len / sizeof(wchar_t)), fn->file_name_length, fn->name_space };
+	AppendGrowing(names, names_cap, &name, 0, name.buffer_len);
+	utarray_push_back(extra_names, &extra);
+}
+
+//Parses the data attributes of a file with an attribute list again, this time through the list.
+//The names and times are taken from the base record: $STANDARD_INFORMATION is always there,
+//and a $FILE_NAME only moves out when the record is full of hard links.
+bool ParseSpreadFile(execution_context context, file_table table, uint64_t row)
+{
+	mft_file file = LoadMFTFile(context, row);
+	if (!file)
+		return false;
+
+	ParseSpreadData(context, table, row, file);
+	DeleteMFTFile(file);
+	return true;
+}
+
+void ParseSpreadData(execution_context context, file_table table, uint64_t row, mft_file file)
+{
+	table->streams[row] = 0;
+	table->data_sz[row] = table->alloc_sz[row] = 0;
+	table->flags[row] &= ~FILE_ROW_RESIDENT;
+
+	//Only $DATA, so there are no names to add:
+	for (attribute at = FirstAttribute(context, file, AttrTypeFlag(ATTR_DATA)); at;
+		at = NextAttribute(context, file, at, AttrTypeFlag(ATTR_DATA)))
+		ParseAttribute(table, row, at, NULL, NULL, NULL);
+}
+
+void UpdateRow(execution_context context, uint64_t ref, mft_file file, void* state)
+{
+	row_updater* updater = (row_updater*)state;
+	uint64_t row = ref & 0x0000FFFFFFFFFFFF;
+	bytes rec = FileRecord(file, row);
+	if (!rec)
+		return;
+
+	ParseRecord(updater->table, row, rec, updater->table->names, &updater->names_cap, updater->table->extra_names);
+	if (updater->table->flags[row] & FILE_ROW_ATTRIBUTE_LIST)
+	{
+		AppendExtensionRefs(file, row, updater->extensions);
+		ParseSpreadData(context, updater->table, row, file);
+	}
+}
+
+void ClearRow(file_table table, uint64_t row)
+{
+	table->seq[row] = table->flags[row] = table->streams[row] = 0;
+	table->parent[row] = table->data_sz[row] = table->alloc_sz[row] = 0;
+	table->name_offs[row] = table->attributes[row] = 0;
+	table->name_len[row] = table->name_space[row] = 0;
+	memset(table->si_times + row * FILE_TIMES, 0, FILE_TIMES * sizeof(uint64_t));
+	memset(table->fn_times + row * FILE_TIMES, 0, FILE_TIMES * sizeof(uint64_t));
+}
+
+//The extra names of the files of 'rows', which are sorted
+void DropExtraNames(file_table table, const uint64_t* rows, rsize_t cnt)
+{
+	if (!cnt)
+		return;
+
+	rsize_t kept = 0;
+	for (extra_name* name = utarray_front(table->extra_names); name; name = utarray_next(table->extra_names, name))
+	{
+		if (bsearch(&name->row, rows, cnt, sizeof(uint64_t), CompareRows))
+			continue;
+
+		*(extra_name*)utarray_eltptr(table->extra_names, kept) = *name;
+		kept++;
+	}
+	utarray_resize(table->extra_names, kept);
+}
+
+//Sorts rows or MFT references by record number and drops the doubles, returns how many are left
+rsize_t SortRows(uint64_t* rows, rsize_t cnt)
+{
+	if (!cnt)
+		return 0;
+
+	qsort(rows, cnt, sizeof(uint64_t), CompareRows);
+	rsize_t result = 1;
+	for (rsize_t i = 1; i < cnt; ++i)
+	{
+		if (CompareRows(rows + i, rows + result - 1))
+			rows[result++] = rows[i];
+	}
+	return result;
+}
+
+int CompareRows(const void* first, const void* second)
+{
+	uint64_t first_row = *(uint64_t*)first & 0x0000FFFFFFFFFFFF;
+	uint64_t second_row = *(uint64_t*)second & 0x0000FFFFFFFFFFFF;
+	return first_row > second_row ? 1 : (first_row < second_row ? -1 : 0);
+}
+
+int CompareExtraNames(const void* first, const void* second)
+{
+	const extra_name* first_name = (const extra_name*)first;
+	const extra_name* second_name = (const extra_name*)second;
+	if (first_name->row != second_name->row)
+		return first_name->row > second_name->row ? 1 : -1;
+	return first_name->name_offs > second_name->name_offs ? 1 : (first_name->name_offs < second_name->name_offs ? -1 : 0);
+}
+
+//A reference to a folder of the table, with the right sequence number. That of a record goes
+//up by one when it's freed, so a deleted folder can be one ahead of the references to it.
+bool IsFolderRef(const file_table table, uint64_t ref)
+{
+	uint64_t row = ref & 0x0000FFFFFFFFFFFF;
+	if (row >= table->row_cnt || !(table->flags[row] & FILE_ROW_DIRECTORY))
+		return false;
+	if (table->flags[row] & FILE_ROW_IN_USE)
+		return table->seq[row] == (uint16_t)(ref >> 48);
+	return (table->flags[row] & FILE_ROW_DELETED) &&
+			(table->seq[row] == (uint16_t)(ref >> 48) || table->seq[row] == (uint16_t)((ref >> 48) + 1));
+}
@@ -0,0 +1,106 @@
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include "context.h"
+#include "byte-buffer.h"
+#include "mft.h"
+
+//Flags of a row of the file table
+#define FILE_ROW_IN_USE 0x0001			// The record is in use
+#define FILE_ROW_DIRECTORY 0x0002		// It's a directory
+#define FILE_ROW_EXTENSION 0x0004		// Extension record of the file in 'parent'
+#define FILE_ROW_RESIDENT 0x0008		// The unnamed $DATA is stored in the record itself
+#define FILE_ROW_ATTRIBUTE_LIST 0x0010	// The attributes are spread over more than one record
+#define FILE_ROW_DELETED 0x0020			// The record isn't in use, but still has what was in it
+
+//Number of timestamps per row in si_times and fn_times: created, modified, MFT record modified
+//and accessed, in that order
+#define FILE_TIMES 4
+
+//A name of a file besides the one in its row: its DOS name, its other hard links, and the names
+//in its extension records
+typedef struct {
+	uint64_t row;				// Row of the file, that of its base record
+	uint64_t parent;			// MFT reference of the folder the name is in
+	uint32_t name_offs;			// Offset of the name in 'names' of the table, in characters
+	uint8_t name_len;
+	uint8_t name_space;			// FILE_NAME_xxx
+} extra_name;
+
+//Everything the MFT says about the files of a volume, one row per MFT record: the row of a
+//record is its record number. Every property has its own column (array), so going through
+//all rows for one or two properties stays cheap.
+typedef struct _file_table {
+	uint64_t row_cnt;
+	uint16_t* seq;				// Sequence number of the record
+	uint16_t* flags;			// FILE_ROW_xxx
+	uint64_t* parent;			// MFT reference of the parent folder (of the base record for an extension)
+	uint32_t* name_offs;		// Offset of the name in 'names', in characters
+	uint8_t* name_len;
+	uint8_t* name_space;		// FILE_NAME_xxx
+	uint32_t* attributes;		// File attributes from $STANDARD_INFORMATION
+	uint64_t* si_times;			// FILE_TIMES per row, from $STANDARD_INFORMATION
+	uint64_t* fn_times;			// FILE_TIMES per row, from the $FILE_NAME of the name
+	uint64_t* data_sz;			// Size of the unnamed $DATA
+	uint64_t* alloc_sz;			// Allocated size of the unnamed $DATA
+	uint16_t* streams;			// Number of alternate data streams
+	bytes names;				// The names of all files, back to back (without terminating zeros)
+	UT_array* extra_names;		// extra_name, in no particular order
+} *file_table;
+
+//Gets every read of the MFT while a file table is built, when the rows of its records are filled in
+typedef bool (*table_callback)(execution_context context, const file_table table, const record_batch* batch, void* state);
+
+//Reads the whole MFT, and parses the records on all threads of the pool. Every file gets
+//the first of its names that isn't a DOS name, its other names go in 'extra_names'. With SCAN_DELETED, the records of deleted files
+//are parsed too, and their rows get FILE_ROW_DELETED. When there's an 'inspect' callback, it
+//gets every read of the MFT as well, after its records are in the table. Only the rows with
+//FILE_ROW_ATTRIBUTE_LIST are done later: their data sizes and streams are read after the scan.
+file_table BuildFileTable(execution_context context, uint32_t scan_flags, table_callback inspect, void* state);
+
+//A copy of 'table' with 'row_cnt' rows, the rows that it has more are those of records that aren't in use
+file_table CopyFileTable(const file_table table, uint64_t row_cnt);
+
+//Parses the records of 'rows' again, along with the extension records of their files, and
+//replaces the extra names of their files. The rows can be in any order and in there more than
+//once, they're sorted in place.
+bool UpdateFileRows(execution_context context, file_table table, uint64_t* rows, rsize_t cnt);
+
+void DeleteFileTable(file_table table);
+
+//The full paths of the folders of a file table, each worked out when it's first asked for,
+//from the one of its parent
+typedef struct _folder_paths* folder_paths;
+
+//'root' is what the paths start with, like "c:"
+folder_paths CreateFolderPaths(const file_table table, const wchar_t* root, rsize_t root_len);
+
+//Path of the folder that 'ref' refers to, NULL when that isn't a folder of the table (anymore),
+//or isn't connected to the root. Deleted folders, as far as their records are left, are part of
+//the paths. It stays valid until the next call.
+const wchar_t* FolderPath(folder_paths paths, uint64_t ref, rsize_t* len);
+
+//Works out the paths of all folders at once. FolderPath only looks them up after that, so it can
+//be called from any thread, and the paths it gives stay valid.
+void ResolveFolderPaths(folder_paths paths);
+
+//Where files are shown whose folder has no path, after the root, like with The Sleuth Kit
+#define ORPHAN_FOLDER L"\\$OrphanFiles"
+
+void DeleteFolderPaths(folder_paths paths);
+
+//The extra names of a file table sorted by row, to find all names of a file
+typedef struct _row_names* row_names;
+
+//Takes the extra names from 'first' on, so during BuildFileTable an inspect callback can take
+//just those that the last read added. NULL after a message when memory runs out.
+row_names CreateRowNames(const file_table table, rsize_t first);
+
+//Sets 'names' to the first of the extra names of 'row', and returns how many it has
+rsize_t ExtraRowNames(const row_names names, uint64_t row, const extra_name** first);
+
+void DeleteRowNames(row_names names);
+
+#define FileRowName(table, row) ((wchar_t*)((table)->names->buffer) + (table)->name_offs[row])
+
+#endif //FILE_TABLE_H
@@ -4,6 +4,9 @@
 #include "fileio.h"
 
 
+//The reader is shared by all threads: every read passes its own offset to ReadFile, so
+//there's no file pointer to fight over. 'offset' is only there for reads that continue
+//where the previous one stopped.
 struct _disk_reader {
 	HANDLE fh;
 	uint64_t offset;
@@ -71,18 +74,14 @@ bool AppendBytesFromDiskRdr(disk_reader dr, int64_t offset, uint64_t cnt, bytes
 	}
 
 
-	if (offset != dr->offset)
-	{
-		uint32_t low = offset & 0x0000000000FFFFFFFF;
-		uint32_t high = offset >> 32;
-		SetFilePointer(dr->fh, low, &high, FILE_BEGIN);
-	}
-
 	if (!Reserve(dest, (rsize_t)pos + (rsize_t)al_cnt))
 		return false;
 
+	OVERLAPPED at = { 0 };
+	at.Offset = offset & 0x00000000FFFFFFFF;
+	at.OffsetHigh = offset >> 32;
 	DWORD bytes_read = 0;
-	if (ReadFile(dr->fh, dest->buffer + pos, (DWORD)al_cnt, &bytes_read, NULL) && bytes_read == al_cnt)
+	if (ReadFile(dr->fh, dest->buffer + pos, (DWORD)al_cnt, &bytes_read, &at) && bytes_read == al_cnt)
 	{
 		RightTrim(dest, dest->buffer_len - (rsize_t)(pos + cnt));
 		dr->offset = offset + cnt;
@@ -0,0 +1,849 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "filter.h"
+#include "index.h"
+#include "names.h"
+#include "listing.h"
+#include "processor.h"
+#include "helpers.h"
+#include "thread-pool.h"
+
+//Kinds of nodes
+#define NODE_AND 0
+#define NODE_OR 1
+#define NODE_NOT 2
+#define NODE_COMPARE 3
+#define NODE_FLAG 4
+#define NODE_NAME 5
+
+#define OP_EQ 0
+#define OP_NE 1
+#define OP_LT 2
+#define OP_LE 3
+#define OP_GT 4
+#define OP_GE 5
+
+//What's compared: a constant, or a column of the file table
+#define FIELD_CONSTANT 0
+#define FIELD_SIZE 1
+#define FIELD_ALLOCATED 2
+#define FIELD_STREAMS 3
+#define FIELD_SI_TIME 4				// Up to FIELD_SI_TIME + FILE_TIMES
+#define FIELD_FN_TIME 8				// Same
+#define FIELD_NAME 12
+
+#define VALUE_NUMBER 1
+#define VALUE_TIME 2
+#define VALUE_NAME 3
+
+//What testing a node costs, roughly: a flag is one AND, a name is compared character by character
+#define COST_FLAG 1
+#define COST_COMPARE 2
+#define COST_NAME 16
+
+#define TOKEN_END 0
+#define TOKEN_OPEN 1
+#define TOKEN_CLOSE 2
+#define TOKEN_OPERATOR 3
+#define TOKEN_WORD 4
+#define TOKEN_QUOTED 5
+
+#define NO_NODE ((rsize_t)-1)
+
+//Ticks (of 100 ns) in a second, and days from 1601-01-01 (FILETIME) to 1970-01-01
+#define TICKS_PER_SECOND 10000000ULL
+#define EPOCH_DAYS 134774ULL
+
+typedef struct {
+	int field;
+	uint64_t value;				// Of FIELD_CONSTANT
+} operand;
+
+typedef struct {
+	int kind;
+	int op;						// OP_xxx of NODE_COMPARE and NODE_NAME
+	rsize_t first, second;		// Nodes of NODE_AND and NODE_OR, NODE_NOT only has 'first'
+	operand left, right;		// Of NODE_COMPARE
+	uint32_t mask;				// Of NODE_FLAG: FILE_ATTR_xxx, or FILE_ROW_xxx with 'row_flag'
+	bool row_flag;
+	name_pattern pattern;		// Of NODE_NAME
+	uint32_t cost;
+} filter_node;
+
+void DeleteFilterNode(void* node);
+
+static const UT_icd filter_node_icd = { sizeof(filter_node), NULL, NULL, DeleteFilterNode };
+
+struct _filter {
+	execution_context context;
+	UT_array* nodes;			// filter_node, children before their parents, so the root is the last one
+};
+
+static const struct {
+	const wchar_t* name;
+	int field;
+	int type;
+} field_names[] = {
+	{ L"size", FIELD_SIZE, VALUE_NUMBER },
+	{ L"allocated", FIELD_ALLOCATED, VALUE_NUMBER },
+	{ L"streams", FIELD_STREAMS, VALUE_NUMBER },
+	{ L"created", FIELD_SI_TIME, VALUE_TIME },
+	{ L"modified", FIELD_SI_TIME + 1, VALUE_TIME },
+	{ L"changed", FIELD_SI_TIME + 2, VALUE_TIME },
+	{ L"accessed", FIELD_SI_TIME + 3, VALUE_TIME },
+	{ L"fn_created", FIELD_FN_TIME, VALUE_TIME },
+	{ L"fn_modified", FIELD_FN_TIME + 1, VALUE_TIME },
+	{ L"fn_changed", FIELD_FN_TIME + 2, VALUE_TIME },
+	{ L"fn_accessed", FIELD_FN_TIME + 3, VALUE_TIME },
+	{ L"name", FIELD_NAME, VALUE_NAME }
+};
+
+static const struct {
+	const wchar_t* name;
+	uint32_t mask;
+	bool row_flag;
+} flag_names[] = {
+	{ L"dir", FILE_ROW_DIRECTORY, true },
+	{ L"resident", FILE_ROW_RESIDENT, true },
+	{ L"readonly", FILE_ATTR_READONLY, false },
+	{ L"hidden", FILE_ATTR_HIDDEN, false },
+	{ L"system", FILE_ATTR_SYSTEM, false },
+	{ L"archive", FILE_ATTR_ARCHIVE, false },
+	{ L"temporary", FILE_ATTR_TEMPORARY, false },
+	{ L"sparse", FILE_ATTR_SPARSE_FILE, false },
+	{ L"reparse", FILE_ATTR_REPARSE_POINT, false },
+	{ L"compressed", FILE_ATTR_COMPRESSED, false },
+	{ L"offline", FILE_ATTR_OFFLINE, false },
+	{ L"encrypted", FILE_ATTR_ENCRYPTED, false }
+};
+
+typedef struct {
+	filter flt;
+	const wchar_t* pos;			// Where the next token starts
+	const wchar_t* token;
+	rsize_t token_len;
+	int token_kind;				// TOKEN_xxx
+	int op;						// OP_xxx of TOKEN_OPERATOR
+	uint64_t now;
+	bool failed;
+} filter_parser;
+
+typedef struct {
+	batch_slice slice;
+	UT_array* rows;
+} filter_job;
+
+void InitFilterJob(void* job);
+
+void DeleteFilterJob(void* job);
+
+static const UT_icd filter_job_icd = { sizeof(filter_job), InitFilterJob, NULL, DeleteFilterJob };
+
+//A file that passes, with the folder it's in, to sort them by
+typedef struct {
+	uint64_t parent;
+	uint64_t row;
+} file_match;
+
+static const UT_icd file_match_icd = { sizeof(file_match), NULL, NULL, NULL };
+
+static const UT_icd row_icd = { sizeof(uint64_t), NULL, NULL, NULL };
+
+typedef struct {
+	filter flt;
+	UT_array* jobs;				// filter_job, kept from one read to the next
+	UT_array* matches;
+	file_table table;
+	row_names names;			// Extra names of the rows of the read
+	rsize_t extra_cnt;			// Extra names of the table before the read
+} file_selection;
+
+void NextToken(filter_parser* parser);
+
+bool IsWord(const filter_parser* parser, const wchar_t* word);
+
+void FilterError(filter_parser* parser, const wchar_t* at, const wchar_t* what);
+
+rsize_t ParseOr(filter_parser* parser);
+
+rsize_t ParseAnd(filter_parser* parser);
+
+rsize_t ParseUnary(filter_parser* parser);
+
+rsize_t ParseComparison(filter_parser* parser);
+
+int FindField(const wchar_t* word, rsize_t len, bool quoted);
+
+bool ParseValue(filter_parser* parser, const wchar_t* word, rsize_t len, operand* result, int* type);
+
+bool ParseNumber(const wchar_t* word, rsize_t len, uint64_t* result);
+
+bool ParseTime(const filter_parser* parser, const wchar_t* word, rsize_t len, uint64_t* result);
+
+uint64_t DateTicks(uint32_t year, uint32_t month, uint32_t day, uint32_t hour, uint32_t minute, uint32_t second);
+
+rsize_t AddNode(filter_parser* parser, filter_node* node);
+
+bool EvaluateNode(const filter flt, const filter_node* nodes, rsize_t index, const file_table table, const row_names names, uint64_t row);
+
+bool MatchRowName(const filter flt, const name_pattern pattern, const file_table table, const row_names names, uint64_t row);
+
+uint64_t FieldValue(const file_table table, uint64_t row, const operand* opd);
+
+bool FilterBatch(execution_context context, const file_table table, const record_batch* batch, void* state);
+
+void FilterSlice(void* item, void* shared);
+
+bool IsSelectable(const file_table table, uint64_t row);
+
+int CompareMatches(const void* first, const void* second);
+
+bool OutputMatches(execution_context context, const file_table table, UT_array* matches);
+
+
+filter CompileFilter(execution_context context, const wchar_t* text)
+{
+	SafeCreate(result, filter);
+	result->context = context;
+	utarray_new(result->nodes, &filter_node_icd);
+
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	filter_parser parser = { result, text, NULL, 0, TOKEN_END, 0, ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime, false };
+	NextToken(&parser);
+	if (parser.token_kind == TOKEN_END)
+		FilterError(&parser, parser.token, L"Nothing to compare");
+
+	rsize_t root = parser.failed ? NO_NODE : ParseOr(&parser);
+	if (root != NO_NODE && parser.token_kind != TOKEN_END)
+		FilterError(&parser, parser.token, parser.token_kind == TOKEN_CLOSE ? L"There's no '(' for this" : L"'and' or 'or' is missing");
+	if (parser.failed)
+	{
+		DeleteFilter(result);
+		return NULL;
+	}
+	return result;
+}
+
+bool MatchFilter(const filter flt, const file_table table, const row_names names, uint64_t row)
+{
+	return EvaluateNode(flt, (filter_node*)utarray_front(flt->nodes), utarray_len(flt->nodes) - 1, table, names, row);
+}
+
+void DeleteFilter(filter flt)
+{
+	utarray_free(flt->nodes);
+	free(flt);
+}
+
+void NextToken(filter_parser* parser)
+{
+	const wchar_t* pos = parser->pos;
+	while (*pos == L' ' || *pos == L'\t')
+		++pos;
+
+	parser->token = pos;
+	parser->token_len = 1;
+	switch (*pos)
+	{
+	case 0:
+		parser->token_kind = TOKEN_END;
+		parser->token_len = 0;
+		break;
+	case L'(':
+		parser->token_kind = TOKEN_OPEN;
+		break;
+	case L')':
+		parser->token_kind = TOKEN_CLOSE;
+		break;
+	case L'=':
+		parser->token_kind = TOKEN_OPERATOR;
+		parser->op = OP_EQ;
+		parser->token_len = pos[1] == L'=' ? 2 : 1;
+		break;
+	case L'!':
+		parser->token_kind = TOKEN_OPERATOR;
+		parser->op = OP_NE;
+		if (pos[1] == L'=')
+			parser->token_len = 2;
+		else
+			FilterError(parser, pos, L"'!' is only part of '!='");
+		break;
+	case L'<':
+		parser->token_kind = TOKEN_OPERATOR;
+		parser->op = pos[1] == L'=' ? OP_LE : (pos[1] == L'>' ? OP_NE : OP_LT);
+		parser->token_len = pos[1] == L'=' || pos[1] == L'>' ? 2 : 1;
+		break;
+	case L'>':
+		parser->token_kind = TOKEN_OPERATOR;
+		parser->op = pos[1] == L'=' ? OP_GE : OP_GT;
+		parser->token_len = pos[1] == L'=' ? 2 : 1;
+		break;
+	case L'"':
+	{
+		//The token is what's between the quotes:
+		const wchar_t* end = wcschr(pos + 1, L'"');
+		if (!end)
+		{
+			FilterError(parser, pos, L"The closing '\"' is missing");
+			parser->token_kind = TOKEN_END;
+			parser->pos = pos + wcslen(pos);
+			return;
+		}
+		parser->token_kind = TOKEN_QUOTED;
+		parser->token = pos + 1;
+		parser->token_len = end - pos - 1;
+		parser->pos = end + 1;
+		return;
+	}
+	default:
+	{
+		const wchar_t* end = pos;
+		while (*end && !wcschr(L" \t()=!<>\"", *end))
+			++end;
+		parser->token_kind = TOKEN_WORD;
+		parser->token_len = end - pos;
+		break;
+	}
+	}
+	parser->pos = pos + parser->token_len;
+}
+
+bool IsWord(const filter_parser* parser, const wchar_t* word)
+{
+	return parser->token_kind == TOKEN_WORD && parser->token_len == wcslen(word) && !wstrncmp_nocase(parser->token, word, parser->token_len);
+}
+
+//Only the first error is told, what comes after it follows from it mostly
+void FilterError(filter_parser* parser, const wchar_t* at, const wchar_t* what)
+{
+	if (!parser->failed)
+		wprintf(L"Error: %ls in Filter, at: %ls\n", what, *at ? at : L"the end");
+	parser->failed = true;
+}
+
+rsize_t ParseOr(filter_parser* parser)
+{
+	rsize_t result = ParseAnd(parser);
+	while (result != NO_NODE && IsWord(parser, L"or"))
+	{
+		NextToken(parser);
+		filter_node node = { NODE_OR, 0, result, ParseAnd(parser) };
+		result = node.second == NO_NODE ? NO_NODE : AddNode(parser, &node);
+	}
+	return result;
+}
+
+rsize_t ParseAnd(filter_parser* parser)
+{
+	rsize_t result = ParseUnary(parser);
+	while (result != NO_NODE && IsWord(parser, L"and"))
+	{
+		NextToken(parser);
+		filter_node node = { NODE_AND, 0, result, ParseUnary(parser) };
+		result = node.second == NO_NODE ? NO_NODE : AddNode(parser, &node);
+	}
+	return result;
+}
+
+rsize_t ParseUnary(filter_parser* parser)
+{
+	if (parser->failed)
+		return NO_NODE;
+
+	if (IsWord(parser, L"not"))
+	{
+		NextToken(parser);
+		filter_node node = { NODE_NOT, 0, ParseUnary(parser), NO_NODE };
+		return node.first == NO_NODE ? NO_NODE : AddNode(parser, &node);
+	}
+
+	if (parser->token_kind == TOKEN_OPEN)
+	{
+		NextToken(parser);
+		rsize_t result = ParseOr(parser);
+		if (result != NO_NODE && parser->token_kind != TOKEN_CLOSE)
+			FilterError(parser, parser->token, L"A ')' is missing");
+		if (parser->failed)
+			return NO_NODE;
+		NextToken(parser);
+		return result;
+	}
+
+	if (parser->token_kind == TOKEN_WORD || parser->token_kind == TOKEN_QUOTED)
+		return ParseComparison(parser);
+
+	FilterError(parser, parser->token, L"A comparison is expected");
+	return NO_NODE;
+}
+
+//A flag by itself, or two fields or values with a comparison in between
+rsize_t ParseComparison(filter_parser* parser)
+{
+	const wchar_t* first = parser->token;
+	rsize_t first_len = parser->token_len;
+	bool first_quoted = parser->token_kind == TOKEN_QUOTED;
+	NextToken(parser);
+
+	filter_node node;
+	memset(&node, 0, sizeof(filter_node));
+	node.first = node.second = NO_NODE;
+	if (parser->token_kind != TOKEN_OPERATOR)
+	{
+		for (rsize_t i = 0; !first_quoted && i < sizeof(flag_names) / sizeof(flag_names[0]); ++i)
+		{
+			if (first_len == wcslen(flag_names[i].name) && !wstrncmp_nocase(first, flag_names[i].name, first_len))
+			{
+				node.kind = NODE_FLAG;
+				node.mask = flag_names[i].mask;
+				node.row_flag = flag_names[i].row_flag;
+				node.cost = COST_FLAG;
+				return AddNode(parser, &node);
+			}
+		}
+		FilterError(parser, first, FindField(first, first_len, first_quoted) >= 0 ? L"A comparison is missing" : L"Not a flag");
+		return NO_NODE;
+	}
+
+	node.op = parser->op;
+	NextToken(parser);
+	const wchar_t* second = parser->token;
+	rsize_t second_len = parser->token_len;
+	bool second_quoted = parser->token_kind == TOKEN_QUOTED;
+	if (parser->token_kind != TOKEN_WORD && !second_quoted)
+	{
+		FilterError(parser, second, L"A value is expected");
+		return NO_NODE;
+	}
+	NextToken(parser);
+
+	//The other side of a name is a pattern, quoted or not:
+	bool first_name = FindField(first, first_len, first_quoted) == FIELD_NAME;
+	if (first_name || FindField(second, second_len, second_quoted) == FIELD_NAME)
+	{
+		if (node.op != OP_EQ && node.op != OP_NE)
+		{
+			FilterError(parser, first, L"A name can only be compared with = and !=");
+			return NO_NODE;
+		}
+		node.kind = NODE_NAME;
+		node.pattern = first_name ? CompileNamePattern(parser->flt->context, second, second_len) :
+									CompileNamePattern(parser->flt->context, first, first_len);
+		node.cost = COST_NAME;
+		return AddNode(parser, &node);
+	}
+
+	int first_type, second_type;
+	if (!ParseValue(parser, first, first_len, &node.left, &first_type) || !ParseValue(parser, second, second_len, &node.right, &second_type))
+		return NO_NODE;
+	if (first_type != second_type)
+	{
+		FilterError(parser, first, L"A time can only be compared with a time, a number with a number");
+		return NO_NODE;
+	}
+	node.kind = NODE_COMPARE;
+	node.cost = COST_COMPARE;
+	return AddNode(parser, &node);
+}
+
+//Index in field_names, -1 when it's no field. Quoted it's always a value.
+int FindField(const wchar_t* word, rsize_t len, bool quoted)
+{
+	for (rsize_t i = 0; !quoted && i < sizeof(field_names) / sizeof(field_names[0]); ++i)
+	{
+		if (len == wcslen(field_names[i].name) && !wstrncmp_nocase(word, field_names[i].name, len))
+			return field_names[i].field;
+	}
+	return -1;
+}
+
+bool ParseValue(filter_parser* parser, const wchar_t* word, rsize_t len, operand* result, int* type)
+{
+	int field = FindField(word, len, false);
+	for (rsize_t i = 0; field >= 0 && i < sizeof(field_names) / sizeof(field_names[0]); ++i)
+	{
+		if (field_names[i].field == field)
+		{
+			result->field = field;
+			*type = field_names[i].type;
+			return true;
+		}
+	}
+
+	result->field = FIELD_CONSTANT;
+	if (ParseTime(parser, word, len, &result->value))
+		*type = VALUE_TIME;
+	else if (ParseNumber(word, len, &result->value))
+		*type = VALUE_NUMBER;
+	else
+	{
+		FilterError(parser, word, L"Not a field, number or time");
+		return false;
+	}
+	return true;
+}
+
+//Digits, with an optional K, M, G or T (KB, MB...) after them
+bool ParseNumber(const wchar_t* word, rsize_t len, uint64_t* result)
+{
+	rsize_t i = 0;
+	uint64_t value = 0;
+	for (; i < len && word[i] >= L'0' && word[i] <= L'9'; ++i)
+	{
+		if (value > (UINT64_MAX - (word[i] - L'0')) / 10)
+			return false;
+		value = value * 10 + (word[i] - L'0');
+	}
+	if (!i)
+		return false;
+
+	if (i < len)
+	{
+		const wchar_t* units = L"KMGT";
+		const wchar_t* unit = wcschr(units, towupper(word[i]));
+		if (!unit || (i + 1 < len && (i + 2 < len || towupper(word[i + 1]) != L'B')))
+			return false;
+		for (const wchar_t* cur = units; cur <= unit; ++cur)
+		{
+			if (value > UINT64_MAX / 1024)
+				return false;
+			value *= 1024;
+		}
+	}
+	*result = value;
+	return true;
+}
+
+//YYYY-MM-DD, with an optional Thh:mm or Thh:mm:ss after it, or now, with an optional -N
+//and s, m, h, d or w after it
+bool ParseTime(const filter_parser* parser, const wchar_t* word, rsize_t len, uint64_t* result)
+{
+	if (len >= 3 && !wstrncmp_nocase(word, L"now", 3))
+	{
+		if (len == 3)
+		{
+			*result = parser->now;
+			return true;
+		}
+
+		static const struct { wchar_t unit; uint64_t seconds; } units[] = { { L's', 1 }, { L'm', 60 }, { L'h', 3600 }, { L'd', 86400 }, { L'w', 604800 } };
+		uint64_t cnt;
+		if (word[3] != L'-' || len < 6 || !ParseNumber(word + 4, len - 5, &cnt) || word[len - 2] < L'0' || word[len - 2] > L'9')
+			return false;
+		for (rsize_t i = 0; i < sizeof(units) / sizeof(units[0]); ++i)
+		{
+			if (towlower(word[len - 1]) == units[i].unit)
+			{
+				uint64_t ticks = units[i].seconds * TICKS_PER_SECOND;
+				*result = cnt < parser->now / ticks ? parser->now - cnt * ticks : 0;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t parts[6] = { 0 };
+	static const rsize_t widths[6] = { 4, 2, 2, 2, 2, 2 };
+	static const wchar_t separators[6] = { 0, L'-', L'-', L'T', L':', L':' };
+	rsize_t pos = 0;
+	int cnt = 0;
+	for (; cnt < 6 && pos < len; ++cnt)
+	{
+		if (cnt && towupper(word[pos++]) != separators[cnt])
+			return false;
+		for (rsize_t i = 0; i < widths[cnt]; ++i, ++pos)
+		{
+			if (pos >= len || word[pos] < L'0' || word[pos] > L'9')
+				return false;
+			parts[cnt] = parts[cnt] * 10 + (word[pos] - L'0');
+		}
+	}
+	if (pos != len || (cnt != 3 && cnt < 5) || parts[0] < 1601 || parts[1] < 1 || parts[1] > 12 || parts[2] < 1 || parts[2] > 31 ||
+			parts[3] > 23 || parts[4] > 59 || parts[5] > 59)
+		return false;
+	*result = DateTicks(parts[0], parts[1], parts[2], parts[3], parts[4], parts[5]);
+	return true;
+}
+
+//The other way around from SplitDate, in ticks since 1601 (UTC). Days are counted in eras of
+//400 years, that start in March, so the leap day is the last one of a year.
+uint64_t DateTicks(uint32_t year, uint32_t month, uint32_t day, uint32_t hour, uint32_t minute, uint32_t second)
+{
+	year -= month <= 2;
+	uint64_t era = year / 400;
+	uint64_t year_of_era = year - era * 400;
+	uint64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	uint64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	uint64_t days = era * 146097 + day_of_era - 719468 + EPOCH_DAYS;
+	return ((days * 24 + hour) * 60 + minute) * 60 * TICKS_PER_SECOND + second * TICKS_PER_SECOND;
+}
+
+//Of 'and' and 'or', the cheaper side goes first: it decides often enough on its own
+rsize_t AddNode(filter_parser* parser, filter_node* node)
+{
+	filter_node* nodes = (filter_node*)utarray_front(parser->flt->nodes);
+	if (node->kind == NODE_AND || node->kind == NODE_OR)
+	{
+		if (nodes[node->second].cost < nodes[node->first].cost)
+		{
+			rsize_t first = node->first;
+			node->first = node->second;
+			node->second = first;
+		}
+		node->cost = nodes[node->first].cost + nodes[node->second].cost;
+	}
+	else if (node->kind == NODE_NOT)
+		node->cost = nodes[node->first].cost;
+
+	utarray_push_back(parser->flt->nodes, node);
+	return utarray_len(parser->flt->nodes) - 1;
+}
+
+bool EvaluateNode(const filter flt, const filter_node* nodes, rsize_t index, const file_table table, const row_names names, uint64_t row)
+{
+	const filter_node* node = nodes + index;
+	switch (node->kind)
+	{
+	case NODE_AND:
+		return EvaluateNode(flt, nodes, node->first, table, names, row) && EvaluateNode(flt, nodes, node->second, table, names, row);
+	case NODE_OR:
+		return EvaluateNode(flt, nodes, node->first, table, names, row) || EvaluateNode(flt, nodes, node->second, table, names, row);
+	case NODE_NOT:
+		return !EvaluateNode(flt, nodes, node->first, table, names, row);
+	case NODE_FLAG:
+		return (node->row_flag ? table->flags[row] : table->attributes[row]) & node->mask;
+	case NODE_NAME:
+		return MatchRowName(flt, node->pattern, table, names, row) == (node->op == OP_EQ);
+	}
+
+	uint64_t left = FieldValue(table, row, &node->left), right = FieldValue(table, row, &node->right);
+	switch (node->op)
+	{
+	case OP_EQ:
+		return left == right;
+	case OP_NE:
+		return left != right;
+	case OP_LT:
+		return left < right;
+	case OP_LE:
+		return left <= right;
+	case OP_GT:
+		return left > right;
+	default:
+		return left >= right;
+	}
+}
+
+//Whether any of the names of the file matches, DOS names aside like with /FindName:
+bool MatchRowName(const filter flt, const name_pattern pattern, const file_table table, const row_names names, uint64_t row)
+{
+	if (MatchNamePattern(flt->context, pattern, FileRowName(table, row), table->name_len[row]))
+		return true;
+
+	const extra_name* extra = NULL;
+	rsize_t cnt = names ? ExtraRowNames(names, row, &extra) : 0;
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		if (extra[i].name_space != FILE_NAME_DOS &&
+				MatchNamePattern(flt->context, pattern, (wchar_t*)table->names->buffer + extra[i].name_offs, extra[i].name_len))
+			return true;
+	}
+	return false;
+}
+
+uint64_t FieldValue(const file_table table, uint64_t row, const operand* opd)
+{
+	switch (opd->field)
+	{
+	case FIELD_CONSTANT:
+		return opd->value;
+	case FIELD_SIZE:
+		return table->data_sz[row];
+	case FIELD_ALLOCATED:
+		return table->alloc_sz[row];
+	case FIELD_STREAMS:
+		return table->streams[row];
+	}
+	if (opd->field < FIELD_FN_TIME)
+		return table->si_times[row * FILE_TIMES + opd->field - FIELD_SI_TIME];
+	return table->fn_times[row * FILE_TIMES + opd->field - FIELD_FN_TIME];
+}
+
+void DeleteFilterNode(void* node)
+{
+	if (((filter_node*)node)->pattern)
+		DeleteNamePattern(((filter_node*)node)->pattern);
+}
+
+bool SelectFiles(execution_context context)
+{
+	file_selection selection = { CompileFilter(context, BaseString(context->parameters->filter_expr)), NULL, NULL, NULL, NULL, 0 };
+	if (!selection.flt)
+		return false;
+	utarray_new(selection.jobs, &filter_job_icd);
+	utarray_new(selection.matches, &file_match_icd);
+
+	file_table table = BuildFileTable(context, 0, FilterBatch, &selection);
+
+	//The sizes of files with an attribute list are only complete now, and so are their names:
+	row_names names = table ? CreateRowNames(table, 0) : NULL;
+	for (uint64_t row = 0; names && row < table->row_cnt; ++row)
+	{
+		if ((table->flags[row] & FILE_ROW_ATTRIBUTE_LIST) && IsSelectable(table, row) && MatchFilter(selection.flt, table, names, row))
+		{
+			file_match match = { table->parent[row], row };
+			utarray_push_back(selection.matches, &match);
+		}
+	}
+	bool result = names && OutputMatches(context, table, selection.matches);
+
+	if (names)
+		DeleteRowNames(names);
+	if (table)
+		DeleteFileTable(table);
+	utarray_free(selection.matches);
+	utarray_free(selection.jobs);
+	DeleteFilter(selection.flt);
+	return result;
+}
+
+bool FilterBatch(execution_context context, const file_table table, const record_batch* batch, void* state)
+{
+	file_selection* selection = (file_selection*)state;
+	//The other names of the files of the read are in the extra names that it added, the names in
+	//extension records are those of files with an attribute list, that wait for the end:
+	if (!(selection->names = CreateRowNames(table, selection->extra_cnt)))
+		return false;
+	selection->extra_cnt = utarray_len(table->extra_names);
+	selection->table = table;
+	rsize_t slice_cnt = RunSlices(context, batch, selection->jobs, FilterSlice, selection);
+	DeleteRowNames(selection->names);
+	selection->names = NULL;
+
+	for (rsize_t i = 0; i < slice_cnt; ++i)
+	{
+		filter_job* job = (filter_job*)utarray_eltptr(selection->jobs, i);
+		for (uint64_t* row = (uint64_t*)utarray_front(job->rows); row; row = (uint64_t*)utarray_next(job->rows, row))
+		{
+			file_match match = { table->parent[*row], *row };
+			utarray_push_back(selection->matches, &match);
+		}
+	}
+	return true;
+}
+
+//Files with an attribute list wait for the end of the scan
+void FilterSlice(void* item, void* shared)
+{
+	filter_job* job = (filter_job*)item;
+	const file_selection* selection = (const file_selection*)shared;
+	file_table table = selection->table;
+	utarray_clear(job->rows);
+	uint64_t first = job->slice.batch->first + job->slice.first;
+	for (uint64_t row = first; row < first + job->slice.cnt; ++row)
+	{
+		if (!(table->flags[row] & FILE_ROW_ATTRIBUTE_LIST) && IsSelectable(table, row) && MatchFilter(selection->flt, table, selection->names, row))
+			utarray_push_back(job->rows, &row);
+	}
+}
+
+//Base records in use of files with a name
+bool IsSelectable(const file_table table, uint64_t row)
+{
+	return (table->flags[row] & (FILE_ROW_IN_USE | FILE_ROW_EXTENSION)) == FILE_ROW_IN_USE && table->name_len[row];
+}
+
+//By folder, and within a folder in record order
+int CompareMatches(const void* first, const void* second)
+{
+	const file_match* first_match = (const file_match*)first;
+	const file_match* second_match = (const file_match*)second;
+	uint64_t first_folder = first_match->parent & 0x0000FFFFFFFFFFFF, second_folder = second_match->parent & 0x0000FFFFFFFFFFFF;
+	if (first_folder != second_folder)
+		return first_folder > second_folder ? 1 : -1;
+	if (first_match->parent != second_match->parent)
+		return first_match->parent > second_match->parent ? 1 : -1;
+	return first_match->row > second_match->row ? 1 : (first_match->row < second_match->row ? -1 : 0);
+}
+
+//Listed with /RawDirMode:, extracted otherwise; folders match only to be listed
+bool OutputMatches(execution_context context, const file_table table, UT_array* matches)
+{
+	const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+	const wchar_t* root = source[0] && source[1] == L':' ? source : L"x:";
+	folder_paths paths = CreateFolderPaths(table, root, 2);
+	string orphans = paths ? StringPrint(NULL, 0, L"%.*ls%ls", 2, root, ORPHAN_FOLDER) : NULL;
+	listing lst = NULL;
+	bool result = orphans && (context->parameters->detail_mode == 0 || (lst = OpenListing(context)));
+	if (result && !utarray_len(matches))
+		wprintf(L"Nothing matches the filter\n");
+
+	if (utarray_len(matches) > 1)
+		utarray_sort(matches, CompareMatches);
+	string out_folder = NULL;
+	uint64_t folder = UINT64_MAX;
+	for (file_match* match = result ? (file_match*)utarray_front(matches) : NULL; match; match = (file_match*)utarray_next(matches, match))
+	{
+		if (match->parent != folder)
+		{
+			folder = match->parent;
+			rsize_t path_len = 0;
+			const wchar_t* path = FolderPath(paths, match->parent, &path_len);
+			if (!path)
+			{
+				path = BaseString(orphans);
+				path_len = StringLen(orphans);
+			}
+
+			if (lst)
+				ListFolder(lst, path, path_len);
+			else
+			{
+				if (out_folder)
+					DeleteString(out_folder);
+				//The folders after the drive letter:
+				if (!(out_folder = OutputSubfolder(context, path + 2, path_len - 2)))
+				{
+					result = false;
+					break;
+				}
+			}
+		}
+
+		if (lst)
+			ListRow(lst, table, match->row);
+		else if (!(table->flags[match->row] & FILE_ROW_DIRECTORY))
+		{
+			string file_name = StringPrint(NULL, 0, L"%.*ls", (int)table->name_len[match->row], FileRowName(table, match->row));
+			result = file_name && ExtractAttributes(context, out_folder, file_name, match->row) && result;
+			if (file_name)
+				DeleteString(file_name);
+		}
+	}
+
+	if (out_folder)
+		DeleteString(out_folder);
+	if (lst)
+		result = CloseListing(lst) && result;
+	if (orphans)
+		DeleteString(orphans);
+	if (paths)
+		DeleteFolderPaths(paths);
+	return result;
+}
+
+void InitFilterJob(void* job)
+{
+	filter_job* fj = (filter_job*)job;
+	memset(fj, 0, sizeof(filter_job));
+	utarray_new(fj->rows, &row_icd);
+}
+
+void DeleteFilterJob(void* job)
+{
+	if (((filter_job*)job)->rows)
+		utarray_free(((filter_job*)job)->rows);
+}
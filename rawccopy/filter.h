@@ -0,0 +1,40 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "context.h"
+#include "file-table.h"
+
+//A filter (/Filter:) selects files by what their MFT records say about them, like
+//	size > 1GB and modified > now-7d
+//	name = *.ps1 and not (dir or hidden)
+//	created < fn_created or modified < fn_modified
+//Comparisons (=, !=, <, <=, >, >=) are combined with and, or, not and parentheses:
+//- size, allocated (both of the unnamed $DATA) and streams (alternate data streams) compare to
+//  numbers, that can have K, M, G or T (or KB, MB...) after them, in units of 1024
+//- created, modified, changed (the MFT record) and accessed from $STANDARD_INFORMATION, and
+//  fn_created, fn_modified, fn_changed and fn_accessed from $FILE_NAME compare to each other,
+//  to dates in UTC like 2024-05-01 or 2024-05-01T13:45:00, and to now, now-30m, now-7d
+//  (s, m, h, d or w)
+//- name compares with = and != to a pattern, with '*' for any number of characters and '?'
+//  for one, in any case; a pattern with spaces or parentheses goes between double quotes. A
+//  file with more names (hard links) is equal when one of them matches, DOS names aside
+//- dir, resident (the data is in the record), readonly, hidden, system, archive, temporary,
+//  sparse, reparse, compressed, offline and encrypted are true or false by themselves
+typedef struct _filter* filter;
+
+//NULL when 'text' isn't a filter, after saying where it goes wrong. Of 'and' and 'or', the
+//cheaper side is tried first, so the name is only looked at when the rest doesn't decide.
+filter CompileFilter(execution_context context, const wchar_t* text);
+
+//'names' has the extra names of the row, without them only the name in the row is tried
+bool MatchFilter(const filter flt, const file_table table, const row_names names, uint64_t row);
+
+void DeleteFilter(filter flt);
+
+//Selects the files of the volume that pass /Filter:, during one sequential read of the MFT in
+//which the filter runs on all threads, as soon as the records of a read are parsed. The files
+//are listed (/RawDirMode:, /ListFormat:) a folder at a time, or else extracted to the output
+//folder, in the same folders as they're in on the volume.
+bool SelectFiles(execution_context context);
+
+#endif //FILTER_H
@@ -7,119 +7,161 @@
 #include "safe-string.h"
 #include "regex.h"
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
 
 #define LZNT1_BLOCK_LEN( header ) ( ( (header) & 0x0fff ) + 1 )
 
 #define LZNT1_BLOCK_COMPRESSED( header ) ( (header) & 0x8000 )
 
-#define LZNT1_VALUE_LEN( tuple, split ) \
-	( ( ((uint64_t) tuple) & ( ( 1ULL << (split) ) - 1ULL ) ) + 3 )
+//Every chunk decompresses to at most 4K and back-references never leave their chunk:
+#define LZNT1_CHUNK_SZ 0x1000
 
-#define LZNT1_VALUE_OFFSET( tuple, split ) ( ( ((uint64_t)tuple) >> split ) + 1 )
+#define ReadLE16(pt) ((unsigned int)(pt)[0] | ((unsigned int)(pt)[1] << 8))
 
+long lznt1_chunk(const uint8_t* src, const uint8_t* src_end, uint8_t* chunk_st, uint8_t* chunk_end, const uint8_t* buf_end);
 
-long lznt1_block(bytes compressed, size_t limit, size_t offset1, bytes destination, size_t offset2);
+void lznt1_copy(uint8_t* dst, rsize_t offset, rsize_t len, const uint8_t* buf_end);
 
 bool LZNT1Decompress(const bytes compressed, rsize_t offset1, bytes decompressed, rsize_t offset2)
 {
-	const uint16_t* header;
-	const uint8_t* end;
-	size_t out_len = 0;
-	size_t block_len;
-	size_t limit;
-	long block_out_len;
-
-	while (offset1 != compressed->buffer_len)
-	{
-		if ((offset1 + sizeof(*end)) == compressed->buffer_len)
-		{
-			end = (compressed->buffer + offset1);
-			if (*end == 0)
-				break;
-		}
+	long out_len = LZNT1DecompressBuffer(compressed->buffer + offset1, compressed->buffer_len - offset1,
+						decompressed->buffer + offset2, decompressed->buffer_len - offset2);
+	if (out_len < 0)
+		return false;
 
-		if ((offset1 + sizeof(*header)) > compressed->buffer_len)
-			return false;
+	RightTrim(decompressed, decompressed->buffer_len - offset2 - out_len);
+	return true;
+}
 
-		header = (uint16_t *)(compressed->buffer + offset1);
+long LZNT1DecompressBuffer(const uint8_t* src, rsize_t src_len, uint8_t* dst, rsize_t dst_len)
+{
+	const uint8_t* src_end = src + src_len;
+	const uint8_t* dst_end = dst + dst_len;
+	uint8_t* out = dst;
 
-		if (*header == 0)
+	//A zero header (or running out of input) marks the end of the data:
+	while (src_end - src >= 2)
+	{
+		unsigned int header = ReadLE16(src);
+		if (header == 0)
 			break;
+		src += 2;
 
-		offset1 += sizeof(*header);
+		rsize_t chunk_len = LZNT1_BLOCK_LEN(header);
+		if (chunk_len > (rsize_t)(src_end - src))
+			return -1;
 
-		block_len = LZNT1_BLOCK_LEN(*(size_t*)header);
-		if (LZNT1_BLOCK_COMPRESSED(*header))
+		if (LZNT1_BLOCK_COMPRESSED(header))
 		{
-			limit = (offset1 + block_len);
-			block_out_len = lznt1_block(compressed, limit, offset1, decompressed, out_len);
-			if (block_out_len < 0)
-				return false;
-			offset1 += block_len;
-			out_len += block_out_len;
+			uint8_t* chunk_end = (rsize_t)(dst_end - out) > LZNT1_CHUNK_SZ ? out + LZNT1_CHUNK_SZ : (uint8_t*)dst_end;
+			long chunk_out = lznt1_chunk(src, src + chunk_len, out, chunk_end, dst_end);
+			if (chunk_out < 0)
+				return -1;
+			out += chunk_out;
 		}
-		else if ((offset1 + block_len) > compressed->buffer_len)
-			return false;
 		else
 		{
-			memcpy(decompressed->buffer + out_len, compressed->buffer + offset1, block_len);
-
-			offset1 += block_len;
-			out_len += block_len;
+			if (chunk_len > (rsize_t)(dst_end - out))
+				return -1;
+			memcpy(out, src, chunk_len);
+			out += chunk_len;
 		}
+		src += chunk_len;
 	}
-	RightTrim(decompressed, decompressed->buffer_len - out_len);
-	return true;
+	return (long)(out - dst);
 }
 
-long lznt1_block(bytes compressed, size_t limit, size_t offset1, bytes destination, size_t offset2)
+long lznt1_chunk(const uint8_t* src, const uint8_t* src_end, uint8_t* chunk_st, uint8_t* chunk_end, const uint8_t* buf_end)
 {
-	uint16_t* tuple;
-	size_t copy_len;
-	size_t block_out_len = 0;
+	uint8_t* dst = chunk_st;
+
+	//The split between offset and length bits in a back-reference depends on the position
+	//in the chunk: the further we are, the more bits go to the offset.
 	unsigned int split = 12;
-	unsigned int next_threshold = 16;
-	unsigned int tag_bit = 0;
-	unsigned int tag = 0;
+	rsize_t next_threshold = 16;
 
-	while (offset1 != limit)
+	while (src < src_end)
 	{
-		if (tag_bit == 0)
+		unsigned int tag = *src++;
+
+		//Most common case in text-like data: eight literals in a row
+		if (tag == 0 && src_end - src >= 8 && chunk_end - dst >= 8)
 		{
-			tag = *((uint8_t*)(compressed->buffer + offset1));
-			offset1++;
-			if (offset1 == limit)
-				break;
+			memcpy(dst, src, 8);
+			dst += 8;
+			src += 8;
+			continue;
 		}
 
-		if (tag & 1)
+		for (unsigned int bit = 0; bit < 8 && src < src_end; ++bit, tag >>= 1)
 		{
-			if (offset1 + sizeof(*tuple) > limit)
+			if (!(tag & 1))
+			{
+				if (dst == chunk_end)
+					return -1;
+				*dst++ = *src++;
+				continue;
+			}
+
+			if (src_end - src < 2)
 				return -1;
+			unsigned int tuple = ReadLE16(src);
+			src += 2;
 
-			tuple = (uint16_t*)(compressed->buffer + offset1);
-			offset1 += sizeof(*tuple);
-			copy_len = LZNT1_VALUE_LEN(*(size_t*)tuple, split);
+			rsize_t pos = dst - chunk_st;
+			for (; pos > next_threshold; next_threshold <<= 1)
+				split--;
 
-			uint8_t* dst = destination->buffer + offset2 + block_out_len;
-			uint8_t* src = dst - LZNT1_VALUE_OFFSET(*tuple, split);
-			block_out_len += copy_len;
-			while (copy_len--)
-				*(dst++) = *(src++);
+			rsize_t offset = (tuple >> split) + 1;
+			rsize_t len = (tuple & ((1U << split) - 1)) + 3;
+			if (offset > pos || len > (rsize_t)(chunk_end - dst))
+				return -1;
+
+			lznt1_copy(dst, offset, len, buf_end);
+			dst += len;
 		}
-		else
-			*(destination->buffer + offset2 + block_out_len++) = *(compressed->buffer + offset1++);
+	}
+
+	return (long)(dst - chunk_st);
+}
 
-		while (block_out_len > next_threshold)
+void lznt1_copy(uint8_t* dst, rsize_t offset, rsize_t len, const uint8_t* buf_end)
+{
+	const uint8_t* src = dst - offset;
+	if (offset >= 16 && (rsize_t)(buf_end - dst) >= len + 8)
+	{
+		//Every 8 byte read lags at least 16 bytes behind the write, so even overlapping
+		//matches can be copied a word at a time. With less than that, each read would take
+		//part of the word just written and stall on it. This may write up to 7 bytes beyond
+		//the match, hence the check on buf_end.
+		uint8_t* end = dst + len;
+		do
 		{
-			split--;
-			next_threshold <<= 1;
+			uint64_t word;
+			memcpy(&word, src, 8);
+			memcpy(dst, &word, 8);
+			src += 8;
+			dst += 8;
+		} while (dst < end);
+	}
+	else if (offset == 1)
+		memset(dst, *src, len);
+	else
+	{
+		//Short period (or close to the end of the buffer): the pattern is copied in
+		//non-overlapping pieces, each one twice the size of the previous one
+		for (rsize_t step = offset; len > 0; step <<= 1)
+		{
+			rsize_t n = min(step, len);
+			memcpy(dst, dst - step, n);
+			dst += n;
+			len -= n;
 		}
-		tag >>= 1;
-		tag_bit = ((tag_bit + 1) % 8);
 	}
-
-	return (long)block_out_len;
 }
 
 uint64_t ParseUnsigned(const void* buf, rsize_t length)
@@ -211,6 +253,27 @@ int wstrncmp_nocase(const wchar_t* first, const wchar_t* second, size_t max)
 	return 0;
 }
 
+bool IsZeroBlock(const void* buf, rsize_t len)
+{
+	const uint8_t* pt = buf;
+	const uint8_t* end = pt + len;
+#ifdef HAS_SSE2
+	//OR together 64 bytes at a time and bail out at the first non-zero block
+	const __m128i zero = _mm_setzero_si128();
+	for (; pt + 64 <= end; pt += 64)
+	{
+		__m128i acc = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)pt), _mm_loadu_si128((const __m128i*)(pt + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(pt + 32)), _mm_loadu_si128((const __m128i*)(pt + 48))));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+			return false;
+	}
+#endif
+	for (; pt < end; ++pt)
+		if (*pt)
+			return false;
+	return true;
+}
 
 int32_t FindInArray(const UT_array* array, const void* new_elem, void *context, int (*comp)(const void* first, const void* second, void* context))
 {
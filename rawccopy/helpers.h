@@ -16,6 +16,10 @@
 
 bool LZNT1Decompress(const bytes compressed, rsize_t offset1, bytes decompressed, rsize_t offset2);
 
+//Decompresses one compression unit from 'src' into 'dst', without allocating anything.
+//Returns the number of bytes written or -1 if the data is corrupt or doesn't fit.
+long LZNT1DecompressBuffer(const uint8_t* src, rsize_t src_len, uint8_t* dst, rsize_t dst_len);
+
 uint64_t ParseUnsigned(const void* buf, rsize_t length);
 
 int64_t ParseSigned(const void* buf, rsize_t length);
@@ -32,6 +36,9 @@ bool IsDigits(const char* input);
 
 string ExecutablePath();
 
+//True if all 'len' bytes in 'buf' are zero
+bool IsZeroBlock(const void* buf, rsize_t len);
+
 int32_t FindInArray(const UT_array * array, const void* new_elem, void* context, int (*comp)(const void* first, const void* second, void* context));
 
 #endif
@@ -0,0 +1,90 @@
+#include "huffman.h"
+
+bool BuildDecodeTable(uint32_t* table, size_t table_sz, uint32_t table_bits, const uint8_t* lens, uint32_t sym_cnt, uint32_t max_len)
+{
+	uint32_t len_cnt[HUFF_MAX_LEN + 1] = { 0 };
+	uint32_t offs[HUFF_MAX_LEN + 2];
+	uint16_t sorted[HUFF_MAX_SYMS];
+
+	if (sym_cnt > HUFF_MAX_SYMS || max_len > HUFF_MAX_LEN || table_bits > max_len || ((size_t)1 << table_bits) > table_sz)
+		return false;
+
+	for (uint32_t sym = 0; sym < sym_cnt; ++sym)
+	{
+		if (lens[sym] > max_len)
+			return false;
+		len_cnt[lens[sym]]++;
+	}
+
+	//The codes can't take up more room than there is; less is allowed, codes that are
+	//never assigned simply lead to an empty table entry:
+	int64_t left = 1;
+	for (uint32_t len = 1; len <= max_len; ++len)
+	{
+		left = (left << 1) - len_cnt[len];
+		if (left < 0)
+			return false;
+	}
+
+	//Sort the symbols on code length, and within the same length on symbol value,
+	//which is the order in which the canonical codes are handed out:
+	offs[1] = 0;
+	for (uint32_t len = 1; len <= max_len; ++len)
+		offs[len + 1] = offs[len] + len_cnt[len];
+	for (uint32_t sym = 0; sym < sym_cnt; ++sym)
+		if (lens[sym])
+			sorted[offs[lens[sym]]++] = (uint16_t)sym;
+
+	memset(table, 0, sizeof(uint32_t) << table_bits);
+
+	size_t next_sub = (size_t)1 << table_bits;
+	uint32_t cur_prefix = UINT32_MAX, sub_start = 0, sub_bits = 0;
+	uint32_t code = 0, i = 0;
+	for (uint32_t len = 1; len <= max_len; ++len, code <<= 1)
+	{
+		for (uint32_t k = 0; k < len_cnt[len]; ++k, ++code, ++i)
+		{
+			uint32_t sym = sorted[i];
+			if (len <= table_bits)
+			{
+				//Short code: fill all entries that start with it
+				uint32_t fill = 1U << (table_bits - len);
+				for (uint32_t j = 0, first = code << (table_bits - len); j < fill; ++j)
+					table[first + j] = (sym << 8) | len;
+				continue;
+			}
+
+			uint32_t prefix = code >> (len - table_bits);
+			if (prefix != cur_prefix)
+			{
+				//First code with this prefix: make a sub table big enough for all codes with the same
+				//prefix. These follow this one, so the remaining counts tell how big it has to be:
+				sub_bits = len - table_bits;
+				int64_t room = 1LL << sub_bits;
+				for (uint32_t l = len; l < max_len; ++sub_bits, room <<= 1)
+				{
+					room -= len_cnt[l] - (l == len ? k : 0);
+					if (room <= 0)
+						break;
+					++l;
+				}
+
+				if (next_sub + ((size_t)1 << sub_bits) > table_sz)
+					return false;
+				cur_prefix = prefix;
+				sub_start = (uint32_t)next_sub;
+				table[prefix] = HUFF_SUBTABLE | (sub_start << 8) | sub_bits;
+				memset(table + next_sub, 0, sizeof(uint32_t) << sub_bits);
+				next_sub += (size_t)1 << sub_bits;
+			}
+
+			uint32_t sub_len = len - table_bits;
+			uint32_t fill = 1U << (sub_bits - sub_len);
+			uint32_t first = (code & ((1U << sub_len) - 1)) << (sub_bits - sub_len);
+			for (uint32_t j = 0; j < fill; ++j)
+				table[sub_start + first + j] = (sym << 8) | sub_len;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,115 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+//Bit reader and Huffman decoding tables, shared by the XPRESS and LZX decoders.
+//Both formats store their bits in 16 bit little endian words, of which the most
+//significant bit comes first.
+
+typedef struct {
+	const uint8_t* next;		// next byte of the input to be loaded
+	const uint8_t* end;			// end of the input
+	uint32_t bitbuf;			// bits that have been loaded, the next one in the most significant position
+	uint32_t bitsleft;			// number of bits in bitbuf
+} bit_reader;
+
+#define HUFF_MAX_LEN 16
+#define HUFF_MAX_SYMS 512
+#define HUFF_SUBTABLE 0x80000000
+
+//Number of entries needed by a decoding table for 'syms' symbols, with codes of at most 'max_len' bits
+#define HUFF_TABLE_SZ(table_bits, syms, max_len) ((1 << (table_bits)) + ((syms) << ((max_len) - (table_bits))))
+
+#define ReadLE16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define ReadLE32(p) ((uint32_t)((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((uint32_t)(p)[3] << 24)))
+
+static __inline void InitBitReader(bit_reader* br, const uint8_t* src, const uint8_t* end)
+{
+	br->next = src;
+	br->end = end;
+	br->bitbuf = 0;
+	br->bitsleft = 0;
+}
+
+//Makes sure at least 'cnt' (at most 16) bits are loaded; beyond the end of the input, zeros are read
+static __inline void EnsureBits(bit_reader* br, uint32_t cnt)
+{
+	if (br->bitsleft < cnt)
+	{
+		if (br->end - br->next >= 2)
+		{
+			br->bitbuf |= (uint32_t)ReadLE16(br->next) << (16 - br->bitsleft);
+			br->next += 2;
+		}
+		br->bitsleft += 16;
+	}
+}
+
+static __inline uint32_t PeekBits(const bit_reader* br, uint32_t cnt)
+{
+	return cnt ? br->bitbuf >> (32 - cnt) : 0;
+}
+
+static __inline void RemoveBits(bit_reader* br, uint32_t cnt)
+{
+	br->bitbuf <<= cnt;
+	br->bitsleft -= cnt;
+}
+
+static __inline uint32_t ReadBits(bit_reader* br, uint32_t cnt)
+{
+	EnsureBits(br, cnt);
+	uint32_t result = PeekBits(br, cnt);
+	RemoveBits(br, cnt);
+	return result;
+}
+
+//Reads a byte straight from the input, bypassing the bits that are already loaded
+static __inline uint32_t ReadByte(bit_reader* br)
+{
+	return br->next < br->end ? *br->next++ : 0;
+}
+
+//Drops the loaded bits, so that reading continues at the next 16 bit word
+static __inline void AlignBitReader(bit_reader* br)
+{
+	br->bitbuf = 0;
+	br->bitsleft = 0;
+}
+
+//Entries of a decoding table hold the symbol in the upper bits and the code length in
+//the lowest 8 bits; codes longer than 'table_bits' continue in a sub table, to which the
+//entry points with HUFF_SUBTABLE, the start of the sub table and its number of bits.
+static __inline uint32_t DecodeSymbol(bit_reader* br, const uint32_t* table, uint32_t table_bits)
+{
+	EnsureBits(br, HUFF_MAX_LEN);
+	uint32_t entry = table[PeekBits(br, table_bits)];
+	if (entry & HUFF_SUBTABLE)
+	{
+		RemoveBits(br, table_bits);
+		entry = table[((entry & ~HUFF_SUBTABLE) >> 8) + PeekBits(br, entry & 0xFF)];
+	}
+	RemoveBits(br, entry & 0xFF);
+	return entry >> 8;
+}
+
+//Copies a match of an LZ77 stream, source and destination may overlap
+static __inline void CopyMatch(uint8_t* dst, uint32_t offset, uint32_t len)
+{
+	const uint8_t* src = dst - offset;
+	if (offset >= len)
+		memcpy(dst, src, len);
+	else
+		while (len--)
+			*dst++ = *src++;
+}
+
+//Builds the decoding table for the canonical Huffman code with the given code lengths. 'table_sz'
+//is the number of entries available. Returns false if the lengths don't make up a valid code.
+bool BuildDecodeTable(uint32_t* table, size_t table_sz, uint32_t table_bits, const uint8_t* lens, uint32_t sym_cnt, uint32_t max_len);
+
+#endif //HUFFMAN_H
@@ -1,6 +1,10 @@
+#include <windows.h>
+
 #include "index.h"
 #include "mft.h"
 #include "attribs.h"
+#include "dir-snapshot.h"
+#include "names.h"
 
 
 #define COLLATION_FILE_NAME 0x01
@@ -60,14 +64,77 @@ typedef struct _index_block {
 #pragma pack(pop)
 
 
-struct _index_iter{
-	mft_file folder;
+//Index nodes are cached per run, keyed by directory and VCN. The node in the index root
+//of a directory uses ROOT_VCN as key.
+#define ROOT_VCN UINT64_MAX
+#define NODE_CACHE_SZ 2048
+#define NODE_HASH_SZ 4096
+#define FOLDER_CACHE_SZ 16
+
+//Number of lookups in a directory with an index allocation after which it gets a snapshot
+#define SNAPSHOT_LOOKUPS 64
+
+//When an iterator enters a node, the sub nodes of it that aren't cached yet are loaded in one go,
+//reading neighbouring index blocks with a single read. This is the most of them done at once:
+#define PREFETCH_MAX 64
+
+//Size of the reads of SweepIndex
+#define SWEEP_READ_SZ 0x100000
+
+typedef struct _index_node {
+	uint64_t folder;
+	uint64_t vcn;
+	bytes data;								// Fixed up index block, or a copy of the index root node
+	UT_array* entries;						// Pointers into 'data' to all entries, the end entry included
+	volatile LONG refs;						// Nodes in use can't be evicted
+	bool loading;							// Reserved, its block is still being read
+	bool prefetched;						// Sub nodes were loaded already
+	struct _index_node* hash_next;
+	struct _index_node* lru_prev;
+	struct _index_node* lru_next;
+} *index_node;
+
+//Directories of which nodes were loaded recently, so their allocation can be read without
+//loading the MFT record again
+typedef struct {
+	uint64_t folder;
+	mft_file file;
+	attribute root;
 	attribute_reader alloc_rdr;
-	UT_array* node_queue;
-	UT_array* index_queue;
-	uint64_t vcn_mult;
 	uint64_t block_sz;
-	rsize_t index_depth;
+	uint64_t vcn_mult;
+	uint64_t last_use;
+	uint32_t lookups;
+	dir_snapshot snapshot;
+	LONG readers;							// Reads going on without the cache lock, the folder stays open
+	CRITICAL_SECTION read_lock;				// Held while 'alloc_rdr' reads, it keeps a position
+} open_folder;
+
+//The cache is shared by all threads, 'lock' guards all of it. Pinned nodes don't change, so
+//their entries can be read without holding it. Index blocks are read without it: the node
+//is added first with 'loading' set, and threads that need it wait for 'loaded'.
+struct _index_cache {
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE loaded;				// Woken when loading nodes are done or folders are released
+	index_node buckets[NODE_HASH_SZ];
+	index_node lru_head;					// Most recently used
+	index_node lru_tail;
+	rsize_t node_cnt;
+	open_folder folders[FOLDER_CACHE_SZ];
+	uint64_t tick;
+};
+
+typedef struct {
+	index_node node;
+	rsize_t pos;
+} iter_step;
+
+static const UT_icd iter_step_icd = { sizeof(iter_step), NULL, NULL, NULL };
+
+struct _index_iter{
+	uint64_t folder;
+	UT_array* steps;						// From the root node down to the node of the current entry
+	bool prefetch;							// Load the sub nodes of a node that gets entered
 };
 
 struct {
@@ -103,14 +170,43 @@ struct {
 #define NextIndexEntry(hdr, cur) (index_entry)(((uint8_t *)(cur) + (cur)->entry_size) <  \
 			(uint8_t*)(hdr) + (hdr)->index_length ? ((uint8_t *)(cur) + (cur)->entry_size) : NULL )
 
-void QueueNode(execution_context context, index_iter it, uint64_t index_vcn);
+bool QueueNode(execution_context context, index_iter it, uint64_t index_vcn);
+void PopNode(index_iter it);
 void GoLeft(execution_context context, index_iter it);
 
+index_node GetIndexNode(execution_context context, uint64_t folder, uint64_t vcn);
+void ReleaseIndexNode(index_node node);
+index_node FindCachedNode(index_cache cache, uint64_t folder, uint64_t vcn);
+void AddCachedNode(index_cache cache, index_node node);
+void RemoveCachedNode(index_cache cache, index_node node);
+void EvictIndexNodes(index_cache cache);
+index_node LoadIndexNode(execution_context context, uint64_t folder, uint64_t vcn);
+void PrefetchSubNodes(execution_context context, index_node node, rsize_t first);
+bool LoadNodeBatch(execution_context context, open_folder* dir, const uint64_t* vcns, index_node* nodes, rsize_t cnt);
+int CompareVCN(const void* first, const void* second);
+bool ParseIndexNode(index_node node, index_header hdr);
+void DeleteIndexNode(index_node node);
+open_folder* OpenFolder(execution_context context, uint64_t folder);
+void CloseFolder(open_folder* dir);
+
 bool AppendIndexBlock(execution_context context, attribute_reader rdr, uint64_t offset,
 					uint64_t block_sz, bytes dest, uint64_t pos);
 
 bool IndexSetup(execution_context context, mft_file file, attribute* root, attribute_reader* alloc_rdr, uint64_t *block_sz, uint64_t *vcn_mult);
 
+bool SweepBlocks(execution_context context, mft_file file, attribute_reader alloc_rdr, uint64_t block_sz,
+					sweep_callback callback, void* state);
+
+bool SweepNode(index_header hdr, const uint8_t* node_end, sweep_callback callback, void* state);
+
+#define BlockInUse(bitmap, block) ((bitmap)->buffer[(block) / 8] & (1 << ((block) % 8)))
+
+//Name searched for by CompareName, upper cased once for the whole search
+typedef struct {
+	const wchar_t* folded;
+	rsize_t len;
+} search_name;
+
 int CompareName(const void* name, const void* entry, void* context);
 
 #define EntryInNode(hdr, offset) ((index_entry)(((uint8_t*)(hdr) + (offset))))
@@ -118,101 +214,128 @@ int CompareName(const void* name, const void* entry, void* context);
 
 index_entry NextIterEntry(execution_context context, index_iter iter)
 {
-	if (iter->index_depth > 0)
+	iter_step* step = utarray_back(iter->steps);
+	if (step)
 	{
-		bytes* buf_ptr = utarray_eltptr(iter->node_queue, iter->index_depth - 1);
-		index_entry* ent = utarray_eltptr(iter->index_queue, iter->index_depth - 1);
-
-		if (!buf_ptr || !ent)
-			return NULL;
-
-		*ent = NextIndexEntry((index_header)(*buf_ptr)->buffer, *ent);
+		step->pos++;
 		GoLeft(context, iter);
 	}
 	return CurrentIterEntry(iter);
 };
 
-void QueueNode(execution_context context, index_iter it, uint64_t index_vcn)
+bool QueueNode(execution_context context, index_iter it, uint64_t index_vcn)
 {
-	if (++(it->index_depth) >= utarray_len(it->node_queue))
-	{
-		bytes q_buf = CreateBytes((rsize_t)it->block_sz);
-		utarray_push_back(it->node_queue, &q_buf);
-		utarray_extend_back(it->index_queue);
-	}
-	bytes* buf_ptr = utarray_eltptr(it->node_queue, it->index_depth - 1);
-	index_entry *ent = utarray_eltptr(it->index_queue, it->index_depth - 1);
-	if (!buf_ptr || !ent)
-		return;
+	iter_step step = { GetIndexNode(context, it->folder, index_vcn), 0 };
+	if (!step.node)
+		return false;
 
-	AppendIndexBlock(context, it->alloc_rdr, index_vcn * it->vcn_mult,
-		it->block_sz, *buf_ptr, 0);
+	utarray_push_back(it->steps, &step);
+	if (it->prefetch)
+		PrefetchSubNodes(context, step.node, 0);
+	return true;
+}
 
-	*ent = FirstIndexEntry(HeaderFromRawBlock(*buf_ptr));
+void PopNode(index_iter it)
+{
+	iter_step* step = utarray_back(it->steps);
+	if (!step)
+		return;
+
+	ReleaseIndexNode(step->node);
+	utarray_pop_back(it->steps);
 }
 
 index_entry CurrentIterEntry(const index_iter iter)
 {
-	if (iter->index_depth <= 0)
+	iter_step* step = utarray_back(iter->steps);
+	if (!step)
 		return NULL;
 
-	index_entry *ent_ptr = utarray_eltptr(iter->index_queue, iter->index_depth - 1);
+	index_entry* ent_ptr = utarray_eltptr(step->node->entries, step->pos);
 	return (ent_ptr ? *ent_ptr : NULL);
 }
 
 void GoLeft(execution_context context, index_iter it)
 {
-	do
+	for (index_entry head = CurrentIterEntry(it); head && (head->index_flags & INDEX_ENTRY_NODE); head = CurrentIterEntry(it))
 	{
-		index_entry head = CurrentIterEntry(it);
-		if (!head)
+		//A node that can't be loaded ends the iteration:
+		if (!QueueNode(context, it, SubNodeEntry(head)))
+		{
+			while (utarray_len(it->steps) > 0)
+				PopNode(it);
 			return;
+		}
+	}
 
-		if (head->index_flags & INDEX_ENTRY_NODE)
-			QueueNode(context, it, SubNodeEntry(head));
-		else
-			break;
-	} while (true);
+	while (utarray_len(it->steps) > 0 && (!CurrentIterEntry(it) || CurrentIterEntry(it)->index_flags & INDEX_ENTRY_END))
+	{
+		PopNode(it);
 
-	while (it->index_depth > 0 && CurrentIterEntry(it)->index_flags & INDEX_ENTRY_END)
-		it->index_depth--;
+		//A seek that runs past the end of its node is listing a longer range, so from here on
+		//the sub nodes that are still ahead get loaded together:
+		iter_step* step = utarray_back(it->steps);
+		if (!it->prefetch && step)
+		{
+			it->prefetch = true;
+			PrefetchSubNodes(context, step->node, step->pos + 1);
+		}
+	}
 }
 
 
 index_iter StartIndexIterator(execution_context context, const index_entry root)
 {
-	mft_file file = LoadMFTFile(context, root->mft_reference);
-	if (!file)
-		return NULL;
-
 	SafeCreate(result, index_iter);
-	result->folder = file;
+	result->folder = root->mft_reference;
+	result->prefetch = true;
+	utarray_new(result->steps, &iter_step_icd);
 
-	result->node_queue = ListOfBuffers();
-	utarray_new(result->index_queue, &ut_ptr_icd);
-	result->alloc_rdr = NULL;
-	attribute index_rt = NULL;
-	if (!IndexSetup(context, file, &index_rt, &result->alloc_rdr, &result->block_sz, &result->vcn_mult))
+	if (!QueueNode(context, result, ROOT_VCN))
 		return ErrorCleanUp(CloseIndexIterator, result, "");
 
-	bytes root_node = FromBuffer(IndexNodeFromRootAttrib(index_rt), IndexNodeFromRootAttrib(index_rt)->index_length + sizeof(struct _index_header));
-	utarray_push_back(result->node_queue, &root_node);
-	index_entry first = FirstIndexEntry(IndexNodeFromRootAttrib(index_rt));
-	utarray_push_back(result->index_queue, &first);
-
-	result->index_depth = 1;
-
 	GoLeft(context, result);
 	return result;
 };
 
+index_iter SeekIndexIterator(execution_context context, const index_entry root, const wchar_t* folded, rsize_t len)
+{
+	//Unless it's all of the directory, only a small part of it is expected to be listed, so
+	//there's no prefetching until the listing gets longer:
+	SafeCreate(result, index_iter);
+	result->folder = root->mft_reference;
+	result->prefetch = len == 0;
+	utarray_new(result->steps, &iter_step_icd);
+
+	//Same descent as FindIndexEntry, but every node on the way stays on the stack, positioned
+	//at its first entry that doesn't sort before the name:
+	search_name search = { folded, len };
+	for (uint64_t vcn = ROOT_VCN; ; )
+	{
+		if (!QueueNode(context, result, vcn))
+			return ErrorCleanUp(CloseIndexIterator, result, "");
+
+		iter_step* step = utarray_back(result->steps);
+		int ind = FindInArray(step->node->entries, &search, context, CompareName);
+		step->pos = (rsize_t)(ind >= 0 ? ind : ~ind);
+
+		index_entry head = CurrentIterEntry(result);
+		if (ind >= 0 || !head || !(head->index_flags & INDEX_ENTRY_NODE))
+			break;
+		vcn = SubNodeEntry(head);
+	}
+
+	//When all of the leaf sorts before the name, the next entry is higher up in the tree:
+	while (utarray_len(result->steps) > 0 && (!CurrentIterEntry(result) || CurrentIterEntry(result)->index_flags & INDEX_ENTRY_END))
+		PopNode(result);
+	return result;
+}
+
 void CloseIndexIterator(index_iter iter)
 {
-	DeleteMFTFile(iter->folder);
-	if (iter->alloc_rdr)
-		CloseAttributeReader(iter->alloc_rdr);
-	utarray_free(iter->node_queue);
-	utarray_free(iter->index_queue);
+	while (utarray_len(iter->steps) > 0)
+		PopNode(iter);
+	utarray_free(iter->steps);
 	free(iter);
 }
 
@@ -222,71 +345,563 @@ uint64_t SubNodeEntry(const index_entry rec)
 	return *(uint64_t*)((uint8_t*)rec + rec->entry_size - 8);
 }
 
+bool IsLinkEntry(const index_entry rec)
+{
+	//The index entry keeps the reparse tag in the upper half of the file flags:
+	uint32_t reparse_tag = (uint32_t)(rec->file_flags >> 32);
+	return (rec->file_flags & FILE_ATTR_REPARSE_POINT) &&
+			(!reparse_tag || reparse_tag == IO_REPARSE_TAG_MOUNT_POINT || reparse_tag == IO_REPARSE_TAG_SYMLINK);
+}
+
 bytes FindIndexEntry(execution_context context, uint64_t parent_mft, const wchar_t* name)
 {
-	mft_file rec = LoadMFTFile(context, parent_mft);
-	if (!rec)
-		return ErrorCleanUp(NULL, NULL, "Problem finding index root: %lld\n", parent_mft);
+	uint64_t folder = parent_mft & 0x0000FFFFFFFFFFFF;
+	EnterCriticalSection(&context->index_nodes->lock);
+	open_folder* dir = OpenFolder(context, folder);
+	if (!dir)
+	{
+		LeaveCriticalSection(&context->index_nodes->lock);
+		return NULL;
+	}
 
-	attribute root = NULL;
-	attribute_reader alloc_rdr;
-	uint64_t block_sz = 0;
-	uint64_t vcn_mult = 0;
+	//Directories in which a lot of names get looked up are enumerated once, and from then
+	//on searched with a hash table. The enumeration loads index nodes, so it's done without
+	//the lock, and the folder can be closed in the meantime:
+	if (dir->alloc_rdr && ++dir->lookups == SNAPSHOT_LOOKUPS)
+	{
+		LeaveCriticalSection(&context->index_nodes->lock);
+		dir_snapshot snapshot = TakeDirSnapshot(context, folder);
+		EnterCriticalSection(&context->index_nodes->lock);
+		if ((dir = OpenFolder(context, folder)) && !dir->snapshot)
+			dir->snapshot = snapshot;
+		else if (snapshot)
+			DeleteDirSnapshot(snapshot);
+	}
+	if (dir && dir->snapshot)
+	{
+		bytes result = FindSnapshotEntry(context, dir->snapshot, name);
+		LeaveCriticalSection(&context->index_nodes->lock);
+		if (!result)
+			wprintf(L"Error: Unable to find the file %ls by index scanning: \n", name);
+		return result;
+	}
+	LeaveCriticalSection(&context->index_nodes->lock);
 
-	if (!IndexSetup(context, rec, &root, &alloc_rdr, &block_sz, &vcn_mult))
-		return ErrorCleanUp(DeleteMFTFile, rec, "");
+	//No name in the index is longer than 255 characters:
+	wchar_t folded[0x100];
+	search_name search = { folded, wcslen(name) };
+	if (search.len >= 0x100)
+	{
+		wprintf(L"Error: Unable to find the file %ls by index scanning: \n", name);
+		return NULL;
+	}
+	FoldName(context, name, search.len, folded);
 
-	UT_array* entry_lst;
-	utarray_new(entry_lst, &ut_ptr_icd);
+	index_node node = GetIndexNode(context, parent_mft, ROOT_VCN);
+	if (!node)
+		return ErrorCleanUp(NULL, NULL, "Problem finding index root: %lld\n", parent_mft);
 
-	bytes index_bl = CreateEmpty();
 	bytes result = NULL;
-
-	//First node comes from root:
-	for (index_header hdr = IndexNodeFromRootAttrib(root); ; hdr = HeaderFromRawBlock(index_bl))
+	while (node)
 	{
-		//Scan through the individual entries and put them in an ut_array for binary search
-		for (index_entry entr = FirstIndexEntry(hdr); entr; entr = NextIndexEntry(hdr, entr))
-			utarray_push_back(entry_lst, &entr);
-
-		int ind = FindInArray(entry_lst, name, context, CompareName);
+		int ind = FindInArray(node->entries, &search, context, CompareName);
 		if (ind >= 0)
 		{
-			index_entry* hit = utarray_eltptr(entry_lst, (rsize_t)ind);
+			index_entry* hit = utarray_eltptr(node->entries, (rsize_t)ind);
 			if (hit)
 				result = FromBuffer((void*)*hit, (*hit)->entry_size);
 			break;
 		}
-		else
+
+		//Nothing found: if it's an end node, search failed,
+		//otherwise need to go deeper
+		index_entry* hit = utarray_eltptr(node->entries, (rsize_t)~ind);
+		if (!hit)
+			break;
+		if (!((*hit)->index_flags & INDEX_ENTRY_NODE))
 		{
-			//Nothing found: if it's an end node, search failed,
-			//otherwise need to go deeper
-			index_entry* hit = utarray_eltptr(entry_lst, (rsize_t)~ind);
-			if (!hit)
-				break;
-			if ((*hit)->index_flags & INDEX_ENTRY_NODE)
-			{
-				if (!alloc_rdr || !AppendIndexBlock(context, alloc_rdr, SubNodeEntry(*hit) * vcn_mult,
-										block_sz, index_bl, 0))
-					break;
-			}
-			else
-			{
-				wprintf(L"Error: Unable to find the file %ls by index scanning: \n", name);
-				break;
-			}
+			wprintf(L"Error: Unable to find the file %ls by index scanning: \n", name);
+			break;
 		}
-		utarray_clear(entry_lst);
+
+		index_node sub_node = GetIndexNode(context, parent_mft, SubNodeEntry(*hit));
+		ReleaseIndexNode(node);
+		node = sub_node;
 	}
+	if (node)
+		ReleaseIndexNode(node);
+
+	return result;
+}
+
+bool SweepIndex(execution_context context, uint64_t folder, sweep_callback callback, void* state)
+{
+	folder &= 0x0000FFFFFFFFFFFF;
+	mft_file file = LoadMFTFile(context, folder);
+	if (!file)
+		return CleanUpAndFail(NULL, NULL, "Problem finding index root: %lld\n", folder);
+
+	attribute root;
+	attribute_reader alloc_rdr;
+	uint64_t block_sz, vcn_mult;
+	if (!IndexSetup(context, file, &root, &alloc_rdr, &block_sz, &vcn_mult))
+		return CleanUpAndFail(DeleteMFTFile, file, "");
+
+	bool result = SweepNode(IndexNodeFromRootAttrib(root), (uint8_t*)root + root->value_offs + root->value_len, callback, state);
+	if (!result)
+		printf("Encountered corrupt index node in directory %lld.\n", folder);
+
 	if (alloc_rdr)
+	{
+		result = SweepBlocks(context, file, alloc_rdr, block_sz, callback, state) && result;
 		CloseAttributeReader(alloc_rdr);
+	}
+	DeleteMFTFile(file);
+	return result;
+}
+
+bool SweepBlocks(execution_context context, mft_file file, attribute_reader alloc_rdr, uint64_t block_sz,
+					sweep_callback callback, void* state)
+{
+	//The $I30 bitmap has a bit for every index block, telling whether it's in use. The name has
+	//to match as a whole, an unnamed bitmap or a prefix of the name is another attribute:
+	attribute bitmap_attr;
+	for (bitmap_attr = FirstAttribute(context, file, AttrTypeFlag(ATTR_BITMAP)); bitmap_attr;
+		bitmap_attr = NextAttribute(context, file, bitmap_attr, AttrTypeFlag(ATTR_BITMAP)))
+	{
+		if (bitmap_attr->name_len == 4 &&
+				!wcsncmp((wchar_t*)((uint8_t*)bitmap_attr + bitmap_attr->name_offs), L"$I30", bitmap_attr->name_len))
+			break;
+	}
+	bytes bitmap = bitmap_attr ? GetBytesFromAttrib(context, file, bitmap_attr, 0, AttributeSize(bitmap_attr)) : NULL;
+	if (!bitmap)
+		return CleanUpAndFail(NULL, NULL, "Index should contain a bitmap, but none found.\n");
+
+	bytes buffer = CreateEmpty();
+	uint64_t block_cnt = (uint64_t)bitmap->buffer_len * 8;
+	uint64_t blocks_per_read = max(SWEEP_READ_SZ / block_sz, 1);
+	bool result = buffer != NULL;
+	for (uint64_t first = 0; result && first < block_cnt; )
+	{
+		if (!BlockInUse(bitmap, first))
+		{
+			++first;
+			continue;
+		}
+
+		//Unused blocks in between are read as well, that's cheaper than an extra read:
+		uint64_t end = min(first + blocks_per_read, block_cnt);
+		while (!BlockInUse(bitmap, end - 1))
+			--end;
+		if (!(result = AppendBytesFromAttribRdr(context, alloc_rdr, first * block_sz, (end - first) * block_sz, buffer, 0)))
+			break;
+
+		//A short read means the bitmap goes beyond the end of the allocation:
+		end = first + buffer->buffer_len / block_sz;
+		for (uint64_t block = first; block < end; ++block)
+		{
+			if (!BlockInUse(bitmap, block))
+				continue;
+
+			struct _bytes raw = { buffer->buffer + (block - first) * block_sz, (rsize_t)block_sz };
+			if (strncmp(((index_block)raw.buffer)->magic, "INDX", 4) || !DoFixUp(&raw, context->boot->bytes_per_sector) ||
+					!SweepNode(HeaderFromRawBlock(&raw), raw.buffer + raw.buffer_len, callback, state))
+				result = CleanUpAndFail(NULL, NULL, "Encountered corrupt index block.\n");
+		}
+		if (end == first)
+			break;
+		first = end;
+	}
 
-	DeleteBytes(index_bl);
-	DeleteMFTFile(rec);
-	utarray_free(entry_lst);
+	if (buffer)
+		DeleteBytes(buffer);
+	DeleteBytes(bitmap);
 	return result;
 }
 
+bool SweepNode(index_header hdr, const uint8_t* node_end, sweep_callback callback, void* state)
+{
+	if ((uint8_t*)hdr + hdr->index_length > node_end || hdr->entries_offs >= hdr->index_length)
+		return false;
+
+	for (index_entry entr = FirstIndexEntry(hdr); entr; entr = NextIndexEntry(hdr, entr))
+	{
+		if (entr->entry_size < 0x10 || (uint8_t*)entr + entr->entry_size > node_end)
+			return false;
+
+		if (entr->index_flags & INDEX_ENTRY_END)
+			return true;
+		callback(entr, state);
+	}
+	return false;
+}
+
+index_cache CreateIndexCache()
+{
+	SafeCreate(result, index_cache);
+	memset(result, 0, sizeof(struct _index_cache));
+	InitializeCriticalSection(&result->lock);
+	InitializeConditionVariable(&result->loaded);
+	for (int i = 0; i < FOLDER_CACHE_SZ; ++i)
+		InitializeCriticalSection(&result->folders[i].read_lock);
+	return result;
+}
+
+void DeleteIndexCache(index_cache cache)
+{
+	for (index_node node = cache->lru_head; node; )
+	{
+		index_node next = node->lru_next;
+		DeleteIndexNode(node);
+		node = next;
+	}
+	for (int i = 0; i < FOLDER_CACHE_SZ; ++i)
+	{
+		CloseFolder(&cache->folders[i]);
+		DeleteCriticalSection(&cache->folders[i].read_lock);
+	}
+	DeleteCriticalSection(&cache->lock);
+	free(cache);
+}
+
+#define NodeHash(folder, vcn) (rsize_t)(((folder) * 0x9E3779B97F4A7C15ULL ^ (vcn) * 0xC2B2AE3D27D4EB4FULL) >> 52)
+
+//Returns the node of directory 'folder' at 'vcn', loading it when it isn't cached yet. The
+//node is pinned in the cache until it is released with ReleaseIndexNode.
+index_node GetIndexNode(execution_context context, uint64_t folder, uint64_t vcn)
+{
+	index_cache cache = context->index_nodes;
+	folder &= 0x0000FFFFFFFFFFFF;
+
+	EnterCriticalSection(&cache->lock);
+	index_node node;
+	while ((node = FindCachedNode(cache, folder, vcn)) && node->loading)
+		SleepConditionVariableCS(&cache->loaded, &cache->lock, INFINITE);
+	if (node)
+	{
+		//Move to the front of the LRU list:
+		if (node->lru_prev)
+		{
+			node->lru_prev->lru_next = node->lru_next;
+			if (node->lru_next)
+				node->lru_next->lru_prev = node->lru_prev;
+			else
+				cache->lru_tail = node->lru_prev;
+			node->lru_prev = NULL;
+			node->lru_next = cache->lru_head;
+			cache->lru_head->lru_prev = node;
+			cache->lru_head = node;
+		}
+	}
+	else
+	{
+		if (!(node = LoadIndexNode(context, folder, vcn)))
+		{
+			LeaveCriticalSection(&cache->lock);
+			return NULL;
+		}
+	}
+	InterlockedIncrement(&node->refs);
+	EvictIndexNodes(cache);
+	LeaveCriticalSection(&cache->lock);
+	return node;
+}
+
+void ReleaseIndexNode(index_node node)
+{
+	//Pins are only added with the lock held, a node can't get evicted while it's in use:
+	InterlockedDecrement(&node->refs);
+}
+
+index_node FindCachedNode(index_cache cache, uint64_t folder, uint64_t vcn)
+{
+	for (index_node node = cache->buckets[NodeHash(folder, vcn) % NODE_HASH_SZ]; node; node = node->hash_next)
+		if (node->folder == folder && node->vcn == vcn)
+			return node;
+	return NULL;
+}
+
+void AddCachedNode(index_cache cache, index_node node)
+{
+	index_node* bucket = &cache->buckets[NodeHash(node->folder, node->vcn) % NODE_HASH_SZ];
+	node->hash_next = *bucket;
+	*bucket = node;
+	node->lru_next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = node;
+	else
+		cache->lru_tail = node;
+	cache->lru_head = node;
+	cache->node_cnt++;
+}
+
+void RemoveCachedNode(index_cache cache, index_node node)
+{
+	index_node* link = &cache->buckets[NodeHash(node->folder, node->vcn) % NODE_HASH_SZ];
+	while (*link != node)
+		link = &(*link)->hash_next;
+	*link = node->hash_next;
+
+	if (node->lru_prev)
+		node->lru_prev->lru_next = node->lru_next;
+	else
+		cache->lru_head = node->lru_next;
+	if (node->lru_next)
+		node->lru_next->lru_prev = node->lru_prev;
+	else
+		cache->lru_tail = node->lru_prev;
+	cache->node_cnt--;
+}
+
+void EvictIndexNodes(index_cache cache)
+{
+	//Least recently used nodes go first, pinned and loading ones are skipped, so with many
+	//iterators open the cache can temporarily grow beyond its size:
+	for (index_node node = cache->lru_tail; node && cache->node_cnt > NODE_CACHE_SZ; )
+	{
+		index_node prev = node->lru_prev;
+		if (!node->refs && !node->loading)
+		{
+			RemoveCachedNode(cache, node);
+			DeleteIndexNode(node);
+		}
+		node = prev;
+	}
+}
+
+//Called with the cache lock held, the node is added to the cache. An index block is read with
+//the lock released in between: the node is added as loading first, so it isn't read twice.
+index_node LoadIndexNode(execution_context context, uint64_t folder, uint64_t vcn)
+{
+	index_cache cache = context->index_nodes;
+	open_folder* dir = OpenFolder(context, folder);
+	if (!dir)
+		return NULL;
+
+	SafeCreate(result, index_node);
+	memset(result, 0, sizeof(struct _index_node));
+	result->folder = folder;
+	result->vcn = vcn;
+
+	if (vcn == ROOT_VCN)
+	{
+		index_header hdr = IndexNodeFromRootAttrib(dir->root);
+		result->data = FromBuffer(hdr, hdr->index_length);
+		if (!ParseIndexNode(result, (index_header)result->data->buffer))
+			return ErrorCleanUp(DeleteIndexNode, result, "Encountered corrupt index node in directory %lld.\n", folder);
+
+		AddCachedNode(cache, result);
+		return result;
+	}
+
+	if (!dir->alloc_rdr)
+		return ErrorCleanUp(DeleteIndexNode, result, "");
+
+	result->loading = true;
+	AddCachedNode(cache, result);
+	dir->readers++;
+	LeaveCriticalSection(&cache->lock);
+
+	EnterCriticalSection(&dir->read_lock);
+	result->data = CreateEmpty();
+	bool read = AppendIndexBlock(context, dir->alloc_rdr, vcn * dir->vcn_mult, dir->block_sz, result->data, 0);
+	LeaveCriticalSection(&dir->read_lock);
+	bool ok = read && ParseIndexNode(result, HeaderFromRawBlock(result->data));
+
+	EnterCriticalSection(&cache->lock);
+	dir->readers--;
+	result->loading = false;
+	WakeAllConditionVariable(&cache->loaded);
+	if (ok)
+		return result;
+
+	RemoveCachedNode(cache, result);
+	return ErrorCleanUp(DeleteIndexNode, result, read ? "Encountered corrupt index node in directory %lld.\n" : "", folder);
+}
+
+void PrefetchSubNodes(execution_context context, index_node node, rsize_t first)
+{
+	index_cache cache = context->index_nodes;
+	EnterCriticalSection(&cache->lock);
+	if (node->prefetched)
+	{
+		LeaveCriticalSection(&cache->lock);
+		return;
+	}
+	node->prefetched = first == 0;
+
+	uint64_t vcns[PREFETCH_MAX];
+	rsize_t cnt = 0;
+	for (index_entry* ent = utarray_eltptr(node->entries, first); ent && cnt < PREFETCH_MAX; ent = utarray_next(node->entries, ent))
+		if (((*ent)->index_flags & INDEX_ENTRY_NODE) && !FindCachedNode(cache, node->folder, SubNodeEntry(*ent)))
+			vcns[cnt++] = SubNodeEntry(*ent);
+
+	//A single block is left to GetIndexNode, when it's needed:
+	open_folder* dir = cnt > 1 ? OpenFolder(context, node->folder) : NULL;
+	if (!dir || !dir->alloc_rdr)
+	{
+		LeaveCriticalSection(&cache->lock);
+		return;
+	}
+
+	//The nodes are added as loading, and read with only the lock of the folder held. A corrupt
+	//node can list the same block twice, it's added once:
+	qsort(vcns, cnt, sizeof(uint64_t), CompareVCN);
+	index_node nodes[PREFETCH_MAX];
+	rsize_t added = 0;
+	for (rsize_t i = 0; i < cnt; ++i)
+	{
+		if (FindCachedNode(cache, node->folder, vcns[i]))
+			continue;
+
+		SafeCreate(sub_node, index_node);
+		memset(sub_node, 0, sizeof(struct _index_node));
+		sub_node->folder = node->folder;
+		sub_node->vcn = vcns[i];
+		sub_node->loading = true;
+		AddCachedNode(cache, sub_node);
+		vcns[added] = vcns[i];
+		nodes[added++] = sub_node;
+	}
+	dir->readers++;
+	LeaveCriticalSection(&cache->lock);
+
+	//Blocks that follow each other in the allocation are read together:
+	EnterCriticalSection(&dir->read_lock);
+	for (rsize_t first = 0, last; first < added; first = last)
+	{
+		for (last = first + 1; last < added && (vcns[last] - vcns[last - 1]) * dir->vcn_mult == dir->block_sz; ++last);
+		if (!LoadNodeBatch(context, dir, vcns + first, nodes + first, last - first))
+			break;
+	}
+	LeaveCriticalSection(&dir->read_lock);
+
+	EnterCriticalSection(&cache->lock);
+	dir->readers--;
+	for (rsize_t i = 0; i < added; ++i)
+	{
+		nodes[i]->loading = false;
+		if (!nodes[i]->data)
+		{
+			RemoveCachedNode(cache, nodes[i]);
+			DeleteIndexNode(nodes[i]);
+		}
+	}
+	WakeAllConditionVariable(&cache->loaded);
+	EvictIndexNodes(cache);
+	LeaveCriticalSection(&cache->lock);
+}
+
+//Runs without the cache lock, 'nodes' are the loading nodes of 'vcns'. Blocks that don't check
+//out are left without data and dropped, GetIndexNode reports the problem if the block is ever
+//needed.
+bool LoadNodeBatch(execution_context context, open_folder* dir, const uint64_t* vcns, index_node* nodes, rsize_t cnt)
+{
+	bytes batch = CreateEmpty();
+	if (!batch)
+		return false;
+
+	bool read = AppendBytesFromAttribRdr(context, dir->alloc_rdr, vcns[0] * dir->vcn_mult, cnt * dir->block_sz, batch, 0) &&
+		batch->buffer_len == cnt * dir->block_sz;
+	for (rsize_t i = 0; read && i < cnt; ++i)
+	{
+		index_node node = nodes[i];
+		node->data = FromBuffer(batch->buffer + i * dir->block_sz, (rsize_t)dir->block_sz);
+		if (node->data && (strncmp(((index_block)node->data->buffer)->magic, "INDX", 4) ||
+			!DoFixUp(node->data, context->boot->bytes_per_sector) || !ParseIndexNode(node, HeaderFromRawBlock(node->data))))
+		{
+			DeleteBytes(node->data);
+			node->data = NULL;
+		}
+	}
+	DeleteBytes(batch);
+	return true;
+}
+
+int CompareVCN(const void* first, const void* second)
+{
+	return *(uint64_t*)first > *(uint64_t*)second ? 1 : (*(uint64_t*)first < *(uint64_t*)second ? -1 : 0);
+}
+
+bool ParseIndexNode(index_node node, index_header hdr)
+{
+	utarray_new(node->entries, &ut_ptr_icd);
+
+	uint8_t* node_end = node->data->buffer + node->data->buffer_len;
+	if ((uint8_t*)hdr + hdr->index_length > node_end || hdr->entries_offs >= hdr->index_length)
+		return false;
+
+	for (index_entry entr = FirstIndexEntry(hdr); entr; entr = NextIndexEntry(hdr, entr))
+	{
+		if (entr->entry_size < 0x10 || (uint8_t*)entr + entr->entry_size > node_end)
+			return false;
+
+		utarray_push_back(node->entries, &entr);
+		if (entr->index_flags & INDEX_ENTRY_END)
+			return true;
+	}
+	return false;
+}
+
+void DeleteIndexNode(index_node node)
+{
+	if (node->data)
+		DeleteBytes(node->data);
+	if (node->entries)
+		utarray_free(node->entries);
+	free(node);
+}
+
+open_folder* OpenFolder(execution_context context, uint64_t folder)
+{
+	index_cache cache = context->index_nodes;
+	open_folder* oldest = NULL;
+	while (!oldest)
+	{
+		for (int i = 0; i < FOLDER_CACHE_SZ; ++i)
+		{
+			open_folder* dir = &cache->folders[i];
+			if (dir->file && dir->folder == folder)
+			{
+				dir->last_use = ++cache->tick;
+				return dir;
+			}
+			if (!dir->readers && (!oldest || (oldest->file && (!dir->file || dir->last_use < oldest->last_use))))
+				oldest = dir;
+		}
+
+		//Folders that are read from stay open, when they all are, one of the reads is waited for:
+		if (!oldest)
+			SleepConditionVariableCS(&cache->loaded, &cache->lock, INFINITE);
+	}
+
+	CloseFolder(oldest);
+	if (!(oldest->file = LoadMFTFile(context, folder)))
+		return ErrorCleanUp(NULL, NULL, "Problem finding index root: %lld\n", folder);
+
+	if (!IndexSetup(context, oldest->file, &oldest->root, &oldest->alloc_rdr, &oldest->block_sz, &oldest->vcn_mult))
+	{
+		CloseFolder(oldest);
+		return NULL;
+	}
+	oldest->folder = folder;
+	oldest->last_use = ++cache->tick;
+	return oldest;
+}
+
+void CloseFolder(open_folder* dir)
+{
+	if (dir->snapshot)
+		DeleteDirSnapshot(dir->snapshot);
+	if (dir->alloc_rdr)
+		CloseAttributeReader(dir->alloc_rdr);
+	if (dir->file)
+		DeleteMFTFile(dir->file);
+
+	//The read lock is kept for the next folder, there are no readers:
+	memset(dir, 0, offsetof(open_folder, readers));
+}
+
 bool IndexSetup(execution_context context, mft_file file, attribute* root, attribute_reader* alloc_rdr, uint64_t* block_sz, uint64_t* vcn_mult)
 {
 	*root = NULL;
@@ -345,11 +960,16 @@ bool AppendIndexBlock(execution_context context, attribute_reader rdr, uint64_t
 
 bool FileFlagsFromIndexRec(const index_entry rec, string dest)
 {
-	uint64_t fl_cpy = rec->file_flags;
+	return FileFlagsToString(rec->file_flags, dest);
+}
+
+bool FileFlagsToString(uint64_t flags, string dest)
+{
+	uint64_t fl_cpy = flags;
 	ClearString(dest);
 	for (int i = 0; i < 19 && fl_cpy; ++i)
 	{
-		if (rec->file_flags & flag_desc[i].flag)
+		if (flags & flag_desc[i].flag)
 		{
 			if (StringLen(dest) > 0)
 				StringPrint(dest, StringLen(dest), L" | %ls", flag_desc[i].description);
@@ -366,19 +986,10 @@ bool FileFlagsFromIndexRec(const index_entry rec, string dest)
 
 int CompareName(const void* name, const void* entry, void* context)
 {
-	if ((*(index_entry*)entry)->index_flags & INDEX_ENTRY_END)
+	index_entry ent = *(index_entry*)entry;
+	if (ent->index_flags & INDEX_ENTRY_END)
 		return -1;
 
-	for (wchar_t *ind_name = (wchar_t *)(*(index_entry*)entry)->filename;
-		  ind_name < (wchar_t *)(*(index_entry*)entry)->filename + (rsize_t)(*(index_entry*)entry)->filename_len;)
-	{
-		if (!*((wchar_t*)name))
-			//End of given name, but not index name:
-			return -1;
-		int dif = ((execution_context)context)->upper_case[*((wchar_t*)name)++] - ((execution_context)context)->upper_case[*ind_name++];
-		if (dif != 0)
-			return dif;
-	}
-	//End of index name:
-	return !*((wchar_t*)name) ? 0 : 1;
+	return CompareFoldedName((execution_context)context, ((search_name*)name)->folded, ((search_name*)name)->len,
+								(wchar_t*)ent->filename, (rsize_t)ent->filename_len);
 }
@@ -76,6 +76,11 @@ typedef struct _index_iter *index_iter;
 
 index_iter StartIndexIterator(execution_context context, const index_entry root);
 
+//Starts an iterator at the first entry that doesn't sort before 'folded', a name upper cased with
+//FoldName. All names starting with it come first from there, so a range of names can be listed
+//without going through the rest of the directory.
+index_iter SeekIndexIterator(execution_context context, const index_entry root, const wchar_t* folded, rsize_t len);
+
 void CloseIndexIterator(index_iter iter);
 
 index_entry CurrentIterEntry(const index_iter iter);
@@ -84,9 +89,29 @@ index_entry NextIterEntry(execution_context context, index_iter iter);
 
 uint64_t SubNodeEntry(const index_entry rec);
 
+//True for junctions and symbolic links. Other reparse points (like WOF compressed files) are just files.
+bool IsLinkEntry(const index_entry rec);
+
 bool FileFlagsFromIndexRec(const index_entry rec, string dest);
 
+//The file attributes (FILE_ATTR_xxx) as text, joined with " | "
+bool FileFlagsToString(uint64_t flags, string dest);
+
 bytes FindIndexEntry(execution_context context, uint64_t parent_mft, const wchar_t* name);
 
+//Called by SweepIndex for every entry of the directory
+typedef void (*sweep_callback)(const index_entry entry, void* state);
+
+//Calls 'callback' for every entry of directory 'folder', in the order they're stored on disk instead
+//of sorted. The index blocks in use are read front to back in big reads, rather than one by one
+//following the B-tree, so it's the fastest way to get all entries when their order doesn't matter.
+bool SweepIndex(execution_context context, uint64_t folder, sweep_callback callback, void* state);
+
+//Cache of the index nodes of directories, shared by FindIndexEntry and the index iterators,
+//so the upper levels of a directory's B-tree are read and fixed up only once per run
+index_cache CreateIndexCache();
+
+void DeleteIndexCache(index_cache cache);
+
 
 #endif INDEX_H
\ No newline at end of file
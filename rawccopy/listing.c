@@ -0,0 +1,693 @@
+#include <windows.h>
+#include <stdio.h>
+
+#include "listing.h"
+#include "attribs.h"
+#include "mft.h"
+
+//Size of the buffer in characters
+#define LIST_BUFFER_SZ 0x10000
+
+//NTFS dates are in 100ns units since 1 January 1601 (UTC)
+#define TICKS_PER_SECOND 10000000ULL
+#define TICKS_PER_DAY (86400 * TICKS_PER_SECOND)
+
+//1 January 1970, in those units
+#define UNIX_EPOCH 116444736000000000ULL
+
+//The local time offset is looked up once per quarter of an hour, since that's the finest
+//granularity of time zones and their daylight saving time switches
+#define OFFSET_PERIOD (900 * TICKS_PER_SECOND)
+#define OFFSET_CACHE_SZ 1024
+
+typedef struct {
+	uint64_t period;					// Period + 1, so a zeroed entry is empty
+	int64_t offset;						// Local minus UTC time, in 100ns units
+} utc_offset;
+
+typedef struct {
+	unsigned int year;
+	unsigned int month;
+	unsigned int day;
+	unsigned int hour;
+	unsigned int minute;
+	unsigned int second;
+	unsigned int ticks;
+} calendar_time;
+
+//What /RecordInfo:1 takes from the MFT record of an entry
+typedef struct {
+	uint64_t ref;
+	bool found;							// The record is still in use by the file of the entry
+	uint64_t creation_tm;
+	uint64_t last_modif_tm;
+	uint64_t file_last_modif_tm;
+	uint64_t last_access_tm;
+	uint64_t allocated_sz;
+	uint64_t real_sz;
+	uint32_t file_flags;
+	int streams;						// Number of alternate data streams
+} record_info;
+
+static const UT_icd record_info_icd = { sizeof(record_info), NULL, NULL, NULL };
+
+struct _listing {
+	execution_context context;
+	HANDLE out;
+	bool console;
+	bool own_file;						// 'out' is a file opened for the listing
+	string folder;						// Folder being listed, repeated on every CSV/JSON line
+	string flags;
+	UT_array* pending;					// Copies of the entries waiting for their MFT record to be read
+	int streams;						// Alternate data streams of the entry being listed, -1 if unknown
+	utc_offset offsets[OFFSET_CACHE_SZ];
+	bool failed;						// A write of the buffer failed, what's written is incomplete
+	rsize_t len;
+	wchar_t buffer[LIST_BUFFER_SZ];
+	char utf8[LIST_BUFFER_SZ * 3];		// Worst case size of the UTF-8 encoding of 'buffer'
+};
+
+static const wchar_t* const month_names[] = { L"Jan", L"Feb", L"Mar", L"Apr", L"May", L"Jun",
+												L"Jul", L"Aug", L"Sep", L"Oct", L"Nov", L"Dec" };
+
+bool ListPending(listing lst);
+
+void ReadRecordInfo(execution_context context, uint64_t ref, mft_file file, void* state);
+
+int CompareRecordInfo(const void* first, const void* second);
+
+void FormatEntry(listing lst, const index_entry rec);
+
+void ListText(listing lst, const index_entry rec);
+
+void ListCSV(listing lst, const index_entry rec);
+
+void ListJSON(listing lst, const index_entry rec);
+
+void PutLocalDate(listing lst, uint64_t date);
+
+void SplitDate(uint64_t date, calendar_time* tm);
+
+int64_t LocalOffset(listing lst, uint64_t date);
+
+bool WriteListing(listing lst);
+
+#define Put(lst, c) do { if ((lst)->len == LIST_BUFFER_SZ) WriteListing(lst); (lst)->buffer[(lst)->len++] = (c); } while (0)
+
+
+listing OpenListing(execution_context context)
+{
+	listing result = OpenListingFile(context, context->parameters->list_format == LIST_TEXT || context->parameters->tcp_send ? NULL :
+										context->parameters->list_format == LIST_CSV ? L"Listing.csv" : L"Listing.jsonl");
+	if (result && context->parameters->list_format == LIST_CSV)
+		PutText(result, context->parameters->record_info ?
+						L"Directory,FileName,MftRef,MftSeqNo,ParentMftRef,ParentMftSeqNo,Flags,Created,Modified,"
+						L"MftModified,Accessed,AllocatedSize,RealSize,NameSpace,AltStreams\n" :
+						L"Directory,FileName,MftRef,MftSeqNo,ParentMftRef,ParentMftSeqNo,Flags,Created,Modified,"
+						L"MftModified,Accessed,AllocatedSize,RealSize,NameSpace\n");
+	return result;
+}
+
+listing OpenListingFile(execution_context context, const wchar_t* file_name)
+{
+	SafeCreate(result, listing);
+	memset(result, 0, sizeof(struct _listing));
+	result->context = context;
+	result->out = GetStdHandle(STD_OUTPUT_HANDLE);
+	if (file_name)
+	{
+		string path = StringPrint(NULL, 0, L"%ls\\%ls", BaseString(context->parameters->output_folder), file_name);
+		result->out = path ? CreateFileW(BaseString(path), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL) :
+								INVALID_HANDLE_VALUE;
+		if (result->out == INVALID_HANDLE_VALUE)
+		{
+			DWORD error = GetLastError();
+			if (path)
+				DeleteString(path);
+			return ErrorCleanUp(free, result, "Error: Creating the listing file failed: %d\n", error);
+		}
+		result->own_file = true;
+		wprintf(L"Writing: %ls\n", BaseString(path));
+		DeleteString(path);
+	}
+
+	DWORD mode;
+	result->console = GetConsoleMode(result->out, &mode);
+	result->folder = NewString();
+	result->flags = NewString();
+	result->pending = ListOfBuffers();
+	result->streams = -1;
+	if (!result->folder || !result->flags || !result->pending)
+		return ErrorCleanUp(CloseListing, result, "");
+
+	return result;
+}
+
+bool CloseListing(listing lst)
+{
+	bool result = FlushListing(lst);
+	if (lst->own_file)
+		CloseHandle(lst->out);
+	if (lst->folder)
+		DeleteString(lst->folder);
+	if (lst->flags)
+		DeleteString(lst->flags);
+	if (lst->pending)
+		utarray_free(lst->pending);
+	free(lst);
+	return result;
+}
+
+void ListFolder(listing lst, const wchar_t* path, rsize_t path_len)
+{
+	//The entries of the previous folder go first:
+	ListPending(lst);
+
+	StringPrint(lst->folder, 0, L"%.*ls", (int)path_len, path);
+	if (lst->context->parameters->list_format != LIST_TEXT)
+		return;
+
+	PutText(lst, L"Directory listing for: ");
+	PutChars(lst, path, path_len);
+	PutText(lst, L"\n\n");
+	if (lst->context->parameters->detail_mode != 1)
+		PutText(lst, L"  File Modified Time |  Type |                        | FileName\n");
+}
+
+void ListEntry(listing lst, const index_entry rec)
+{
+	if (lst->context->parameters->record_info)
+	{
+		//Listed once the MFT records of all of them are read:
+		bytes copy = FromBuffer(rec, rec->entry_size);
+		if (copy)
+			utarray_push_back(lst->pending, &copy);
+		return;
+	}
+
+	FormatEntry(lst, rec);
+}
+
+void ListRow(listing lst, const file_table table, uint64_t row)
+{
+	ListRowName(lst, table, row, table->parent[row], FileRowName(table, row), table->name_len[row], table->name_space[row]);
+}
+
+void ListRowName(listing lst, const file_table table, uint64_t row, uint64_t parent,
+					const wchar_t* name, uint8_t name_len, uint8_t name_space)
+{
+	uint8_t buffer[sizeof(struct _index_entry) + 0xFF * sizeof(wchar_t)];
+	index_entry rec = (index_entry)buffer;
+	memset(rec, 0, sizeof(struct _index_entry));
+	rec->mft_reference = row | ((uint64_t)table->seq[row] << 48);
+	rec->parent_mft_ref = parent;
+	memcpy(&rec->creation_tm, table->si_times + row * FILE_TIMES, FILE_TIMES * sizeof(uint64_t));
+	rec->allocated_sz = table->alloc_sz[row];
+	rec->real_sz = table->data_sz[row];
+	rec->file_flags = table->attributes[row] | (table->flags[row] & FILE_ROW_DIRECTORY ? FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT : 0);
+	rec->filename_len = name_len;
+	rec->namespace = name_space;
+	memcpy(rec->filename, name, name_len * sizeof(wchar_t));
+
+	lst->streams = table->streams[row];
+	FormatEntry(lst, rec);
+	lst->streams = -1;
+}
+
+bool ListPending(listing lst)
+{
+	if (!lst->pending || !utarray_len(lst->pending))
+		return true;
+
+	UT_array* infos;
+	utarray_new(infos, &record_info_icd);
+	for (bytes* ent = (bytes*)utarray_front(lst->pending); ent; ent = (bytes*)utarray_next(lst->pending, ent))
+	{
+		record_info info = { IndexEntryPtr((*ent))->mft_reference, false };
+		utarray_push_back(infos, &info);
+	}
+
+	//The records are read in the order they're in the MFT, and hard links and DOS names
+	//make some of them show up more than once:
+	utarray_sort(infos, CompareRecordInfo);
+	rsize_t cnt = 0;
+	for (rsize_t i = 0; i < utarray_len(infos); ++i)
+	{
+		record_info* info = (record_info*)utarray_eltptr(infos, i);
+		if (cnt && info->ref == ((record_info*)utarray_eltptr(infos, cnt - 1))->ref)
+			continue;
+		*(record_info*)utarray_eltptr(infos, cnt) = *info;
+		++cnt;
+	}
+	utarray_resize(infos, cnt);
+
+	uint64_t* refs;
+	SafeAlloc(refs, cnt);
+	for (rsize_t i = 0; i < cnt; ++i)
+		refs[i] = ((record_info*)utarray_eltptr(infos, i))->ref;
+	bool result = FetchMFTRecords(lst->context, refs, cnt, ReadRecordInfo, infos);
+	free(refs);
+
+	//Entries of which the record wasn't found keep what the index says:
+	for (bytes* ent = (bytes*)utarray_front(lst->pending); ent; ent = (bytes*)utarray_next(lst->pending, ent))
+	{
+		index_entry rec = IndexEntryPtr((*ent));
+		record_info* info = utarray_find(infos, &rec->mft_reference, CompareRecordInfo);
+		if (info && info->found)
+		{
+			rec->creation_tm = info->creation_tm;
+			rec->last_modif_tm = info->last_modif_tm;
+			rec->file_last_modif_tm = info->file_last_modif_tm;
+			rec->last_access_tm = info->last_access_tm;
+			rec->allocated_sz = info->allocated_sz;
+			rec->real_sz = info->real_sz;
+			rec->file_flags = info->file_flags | (rec->file_flags & (FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT | FILE_ATTR_DUP_VIEW_INDEX_PRESENT));
+		}
+		lst->streams = info && info->found ? info->streams : -1;
+		FormatEntry(lst, rec);
+	}
+	lst->streams = -1;
+
+	utarray_clear(lst->pending);
+	utarray_free(infos);
+	return result;
+}
+
+void ReadRecordInfo(execution_context context, uint64_t ref, mft_file file, void* state)
+{
+	record_info* info = utarray_find((UT_array*)state, &ref, CompareRecordInfo);
+	if (!info)
+		return;
+
+	attribute std_info = FirstAttribute(context, file, AttrTypeFlag(ATTR_STANDARD_INFORMATION));
+	if (!std_info || std_info->non_resident || std_info->value_len < STANDARD_INFORMATION_V1_SZ)
+		return;
+
+	standard_information si = (standard_information)((uint8_t*)std_info + std_info->value_offs);
+	info->creation_tm = si->creation_time;
+	info->last_modif_tm = si->last_data_change_time;
+	info->file_last_modif_tm = si->last_mft_change_time;
+	info->last_access_tm = si->last_access_time;
+	info->file_flags = si->file_attributes;
+	info->allocated_sz = info->real_sz = 0;
+	info->streams = 0;
+
+	for (attribute at = FirstAttribute(context, file, AttrTypeFlag(ATTR_DATA)); at;
+		at = NextAttribute(context, file, at, AttrTypeFlag(ATTR_DATA)))
+	{
+		//Only the first extent of an attribute has its sizes:
+		if (at->non_resident && at->start_vcn)
+			continue;
+
+		if (at->name_len)
+			++info->streams;
+		else if (at->non_resident)
+		{
+			info->allocated_sz = at->alloc_sz;
+			info->real_sz = at->real_sz;
+		}
+		else
+		{
+			//Like in $FILE_NAME, resident data is counted in multiples of 8 bytes:
+			info->allocated_sz = (at->value_len + 7) & ~7ULL;
+			info->real_sz = at->value_len;
+		}
+	}
+	info->found = true;
+}
+
+//Orders by record number, and then by sequence number
+int CompareRecordInfo(const void* first, const void* second)
+{
+	uint64_t ref1 = *(uint64_t*)first, ref2 = *(uint64_t*)second;
+	if ((ref1 & 0x0000FFFFFFFFFFFF) != (ref2 & 0x0000FFFFFFFFFFFF))
+		return (ref1 & 0x0000FFFFFFFFFFFF) < (ref2 & 0x0000FFFFFFFFFFFF) ? -1 : 1;
+	return ref1 < ref2 ? -1 : (ref1 > ref2);
+}
+
+void FormatEntry(listing lst, const index_entry rec)
+{
+	switch (lst->context->parameters->list_format)
+	{
+	case LIST_CSV:
+		ListCSV(lst, rec);
+		break;
+	case LIST_JSONL:
+		ListJSON(lst, rec);
+		break;
+	default:
+		ListText(lst, rec);
+	}
+}
+
+void ListText(listing lst, const index_entry rec)
+{
+	if (lst->context->parameters->detail_mode != 1)
+	{
+		PutLocalDate(lst, rec->file_last_modif_tm);
+		PutText(lst, rec->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT ? L" | <DIR> | " : L" |       | ");
+		//A size of zero is left blank:
+		if (rec->real_sz)
+			PutNumber(lst, rec->real_sz, 22, L' ');
+		else
+			PutText(lst, L"                      ");
+		PutText(lst, L" | ");
+		PutChars(lst, (wchar_t*)rec->filename, rec->filename_len);
+		Put(lst, L'\n');
+		return;
+	}
+
+	PutText(lst, L"FileName: ");
+	PutChars(lst, (wchar_t*)rec->filename, rec->filename_len);
+	PutText(lst, L"\nMFT Ref: ");
+	PutNumber(lst, rec->mft_reference & 0x000000FFFFFFFFFF, 0, 0);
+	PutText(lst, L"\nMFT Ref SeqNo: ");
+	PutNumber(lst, rec->mft_reference >> 40, 0, 0);
+	PutText(lst, L"\nParent MFT Ref: ");
+	PutNumber(lst, rec->parent_mft_ref & 0x000000FFFFFFFFFF, 0, 0);
+	PutText(lst, L"\nParent MFT Ref SeqNo: ");
+	PutNumber(lst, rec->parent_mft_ref >> 40, 0, 0);
+	FileFlagsFromIndexRec(rec, lst->flags);
+	PutText(lst, L"\nFlags: ");
+	PutChars(lst, BaseString(lst->flags), StringLen(lst->flags));
+	PutText(lst, L"\nFile Create Time: ");
+	PutLocalDate(lst, rec->creation_tm);
+	PutText(lst, L"\nFile Modified Time: ");
+	PutLocalDate(lst, rec->file_last_modif_tm);
+	PutText(lst, L"\nMFT Entry modified Time: ");
+	PutLocalDate(lst, rec->last_modif_tm);
+	PutText(lst, L"\nFile Last Access Time: ");
+	PutLocalDate(lst, rec->last_access_tm);
+	PutText(lst, L"\nAllocated Size: ");
+	PutNumber(lst, rec->allocated_sz, 0, 0);
+	PutText(lst, L"\nReal Size: ");
+	PutNumber(lst, rec->real_sz, 0, 0);
+	if (lst->context->parameters->record_info)
+	{
+		PutText(lst, L"\nAlternate Data Streams: ");
+		if (lst->streams >= 0)
+			PutNumber(lst, lst->streams, 0, 0);
+	}
+	PutText(lst, L"\nNameSpace: ");
+	PutText(lst, rec->namespace < 4 ? NameSpaceLabel(rec->namespace) : L"");
+	if (rec->index_flags == 1)
+	{
+		PutText(lst, L"\nFlags: Index Entry node\nSubNodeVCN: ");
+		PutNumber(lst, SubNodeEntry(rec), 0, 0);
+		PutText(lst, L"\n\n");
+	}
+	else
+		PutText(lst, L"\nFlags:\nSubNodeVCN:\n\n");
+}
+
+//The dates in the index entry are those of its $FILE_NAME attribute: created, modified,
+//MFT record modified and accessed, in that order
+void ListCSV(listing lst, const index_entry rec)
+{
+	PutCSVField(lst, BaseString(lst->folder), StringLen(lst->folder));
+	Put(lst, L',');
+	PutCSVField(lst, (wchar_t*)rec->filename, rec->filename_len);
+	Put(lst, L',');
+	PutNumber(lst, rec->mft_reference & 0x0000FFFFFFFFFFFF, 0, 0);
+	Put(lst, L',');
+	PutNumber(lst, rec->mft_reference >> 48, 0, 0);
+	Put(lst, L',');
+	PutNumber(lst, rec->parent_mft_ref & 0x0000FFFFFFFFFFFF, 0, 0);
+	Put(lst, L',');
+	PutNumber(lst, rec->parent_mft_ref >> 48, 0, 0);
+	Put(lst, L',');
+	FileFlagsFromIndexRec(rec, lst->flags);
+	PutCSVField(lst, BaseString(lst->flags), StringLen(lst->flags));
+	Put(lst, L',');
+	PutISODate(lst, rec->creation_tm);
+	Put(lst, L',');
+	PutISODate(lst, rec->last_modif_tm);
+	Put(lst, L',');
+	PutISODate(lst, rec->file_last_modif_tm);
+	Put(lst, L',');
+	PutISODate(lst, rec->last_access_tm);
+	Put(lst, L',');
+	PutNumber(lst, rec->allocated_sz, 0, 0);
+	Put(lst, L',');
+	PutNumber(lst, rec->real_sz, 0, 0);
+	Put(lst, L',');
+	PutText(lst, rec->namespace < 4 ? NameSpaceLabel(rec->namespace) : L"");
+	if (lst->context->parameters->record_info)
+	{
+		Put(lst, L',');
+		if (lst->streams >= 0)
+			PutNumber(lst, lst->streams, 0, 0);
+	}
+	Put(lst, L'\n');
+}
+
+void ListJSON(listing lst, const index_entry rec)
+{
+	PutText(lst, L"{\"directory\":");
+	PutJSONString(lst, BaseString(lst->folder), StringLen(lst->folder));
+	PutText(lst, L",\"name\":");
+	PutJSONString(lst, (wchar_t*)rec->filename, rec->filename_len);
+	PutText(lst, L",\"mft_ref\":");
+	PutNumber(lst, rec->mft_reference & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",\"mft_seq_no\":");
+	PutNumber(lst, rec->mft_reference >> 48, 0, 0);
+	PutText(lst, L",\"parent_mft_ref\":");
+	PutNumber(lst, rec->parent_mft_ref & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",\"parent_mft_seq_no\":");
+	PutNumber(lst, rec->parent_mft_ref >> 48, 0, 0);
+	FileFlagsFromIndexRec(rec, lst->flags);
+	PutText(lst, L",\"flags\":");
+	PutJSONString(lst, BaseString(lst->flags), StringLen(lst->flags));
+	PutText(lst, L",\"created\":\"");
+	PutISODate(lst, rec->creation_tm);
+	PutText(lst, L"\",\"modified\":\"");
+	PutISODate(lst, rec->last_modif_tm);
+	PutText(lst, L"\",\"mft_modified\":\"");
+	PutISODate(lst, rec->file_last_modif_tm);
+	PutText(lst, L"\",\"accessed\":\"");
+	PutISODate(lst, rec->last_access_tm);
+	PutText(lst, L"\",\"allocated_size\":");
+	PutNumber(lst, rec->allocated_sz, 0, 0);
+	PutText(lst, L",\"real_size\":");
+	PutNumber(lst, rec->real_sz, 0, 0);
+	PutText(lst, L",\"namespace\":\"");
+	PutText(lst, rec->namespace < 4 ? NameSpaceLabel(rec->namespace) : L"");
+	Put(lst, L'"');
+	if (lst->context->parameters->record_info)
+	{
+		PutText(lst, L",\"alt_streams\":");
+		if (lst->streams >= 0)
+			PutNumber(lst, lst->streams, 0, 0);
+		else
+			PutText(lst, L"null");
+	}
+	PutText(lst, L"}\n");
+}
+
+bool FlushListing(listing lst)
+{
+	bool result = ListPending(lst);
+	return WriteListing(lst) && !lst->failed && result;
+}
+
+bool WriteListing(listing lst)
+{
+	//Whatever was printed before goes first:
+	fflush(stdout);
+
+	//A surrogate pair isn't split over two writes:
+	rsize_t len = lst->len;
+	if (len > 1 && IS_HIGH_SURROGATE(lst->buffer[len - 1]))
+		--len;
+	if (!len)
+		return true;
+
+	DWORD written;
+	bool result;
+	if (lst->console)
+		result = WriteConsoleW(lst->out, lst->buffer, (DWORD)len, &written, NULL);
+	else
+	{
+		int utf8_len = WideCharToMultiByte(CP_UTF8, 0, lst->buffer, (int)len, lst->utf8, sizeof(lst->utf8), NULL, NULL);
+		result = utf8_len > 0 && WriteFile(lst->out, lst->utf8, (DWORD)utf8_len, &written, NULL);
+	}
+
+	memmove(lst->buffer, lst->buffer + len, (lst->len - len) * sizeof(wchar_t));
+	lst->len -= len;
+	//Put and PutChars don't check, the listing fails when it's flushed:
+	if (!result && !lst->failed)
+	{
+		printf("Error: Writing the listing failed: %d\n", GetLastError());
+		lst->failed = true;
+	}
+	return result;
+}
+
+void PutChars(listing lst, const wchar_t* text, rsize_t len)
+{
+	while (len > 0)
+	{
+		if (lst->len == LIST_BUFFER_SZ)
+			WriteListing(lst);
+
+		rsize_t cnt = min(len, LIST_BUFFER_SZ - lst->len);
+		memcpy(lst->buffer + lst->len, text, cnt * sizeof(wchar_t));
+		lst->len += cnt;
+		text += cnt;
+		len -= cnt;
+	}
+}
+
+void PutNumber(listing lst, uint64_t value, unsigned int width, wchar_t pad)
+{
+	wchar_t digits[20];
+	unsigned int cnt = 0;
+	do
+	{
+		digits[cnt++] = L'0' + (wchar_t)(value % 10);
+		value /= 10;
+	} while (value);
+
+	for (; width > cnt; --width)
+		Put(lst, pad);
+	while (cnt > 0)
+		Put(lst, digits[--cnt]);
+}
+
+//Same format as before: dd-MMM-yyyy HH:mm:ss, in local time
+void PutLocalDate(listing lst, uint64_t date)
+{
+	int64_t offset = LocalOffset(lst, date);
+	calendar_time tm;
+	SplitDate(offset < 0 && date < (uint64_t)-offset ? 0 : date + offset, &tm);
+
+	PutNumber(lst, tm.day, 2, L'0');
+	Put(lst, L'-');
+	PutText(lst, month_names[tm.month - 1]);
+	Put(lst, L'-');
+	PutNumber(lst, tm.year, 4, L'0');
+	Put(lst, L' ');
+	PutNumber(lst, tm.hour, 2, L'0');
+	Put(lst, L':');
+	PutNumber(lst, tm.minute, 2, L'0');
+	Put(lst, L':');
+	PutNumber(lst, tm.second, 2, L'0');
+}
+
+//ISO 8601 in UTC, with the full 100ns precision
+void PutISODate(listing lst, uint64_t date)
+{
+	calendar_time tm;
+	SplitDate(date, &tm);
+
+	PutNumber(lst, tm.year, 4, L'0');
+	Put(lst, L'-');
+	PutNumber(lst, tm.month, 2, L'0');
+	Put(lst, L'-');
+	PutNumber(lst, tm.day, 2, L'0');
+	Put(lst, L'T');
+	PutNumber(lst, tm.hour, 2, L'0');
+	Put(lst, L':');
+	PutNumber(lst, tm.minute, 2, L'0');
+	Put(lst, L':');
+	PutNumber(lst, tm.second, 2, L'0');
+	Put(lst, L'.');
+	PutNumber(lst, tm.ticks, 7, L'0');
+	Put(lst, L'Z');
+}
+
+void PutUnixTime(listing lst, uint64_t date)
+{
+	PutNumber(lst, date > UNIX_EPOCH ? (date - UNIX_EPOCH) / TICKS_PER_SECOND : 0, 0, 0);
+}
+
+void PutCSVField(listing lst, const wchar_t* text, rsize_t len)
+{
+	//Only fields with a separator, quote or line break in them need quotes:
+	bool quote = false;
+	for (rsize_t i = 0; i < len && !quote; ++i)
+		quote = text[i] == L',' || text[i] == L'"' || text[i] == L'\n' || text[i] == L'\r';
+	if (!quote)
+	{
+		PutChars(lst, text, len);
+		return;
+	}
+
+	Put(lst, L'"');
+	for (rsize_t i = 0; i < len; ++i)
+	{
+		if (text[i] == L'"')
+			Put(lst, L'"');
+		Put(lst, text[i]);
+	}
+	Put(lst, L'"');
+}
+
+void PutJSONString(listing lst, const wchar_t* text, rsize_t len)
+{
+	static const wchar_t hex_digits[] = L"0123456789abcdef";
+
+	Put(lst, L'"');
+	for (rsize_t i = 0; i < len; ++i)
+	{
+		if (text[i] == L'"' || text[i] == L'\\')
+		{
+			Put(lst, L'\\');
+			Put(lst, text[i]);
+		}
+		//Control characters, and halves of surrogate pairs that don't belong to one (NTFS
+		//doesn't check names), wouldn't give valid JSON as is:
+		else if (text[i] < 0x20 || (IS_LOW_SURROGATE(text[i]) && !(i > 0 && IS_HIGH_SURROGATE(text[i - 1]))) ||
+					(IS_HIGH_SURROGATE(text[i]) && !(i + 1 < len && IS_LOW_SURROGATE(text[i + 1]))))
+		{
+			PutText(lst, L"\\u");
+			for (int shift = 12; shift >= 0; shift -= 4)
+				Put(lst, hex_digits[(text[i] >> shift) & 0xF]);
+		}
+		else
+			Put(lst, text[i]);
+	}
+	Put(lst, L'"');
+}
+
+void SplitDate(uint64_t date, calendar_time* tm)
+{
+	uint64_t days = date / TICKS_PER_DAY;
+	uint64_t rest = date % TICKS_PER_DAY;
+	tm->ticks = (unsigned int)(rest % TICKS_PER_SECOND);
+	rest /= TICKS_PER_SECOND;
+	tm->second = (unsigned int)(rest % 60);
+	tm->minute = (unsigned int)(rest / 60 % 60);
+	tm->hour = (unsigned int)(rest / 3600);
+
+	//Days since 1 March of year 0, in the proleptic Gregorian calendar: years start in March,
+	//so the leap day is the last day of the year, and the calendar repeats every 400 years
+	//(146097 days)
+	uint64_t z = days + 584694;
+	uint64_t era = z / 146097;
+	uint64_t day_of_era = z - era * 146097;
+	uint64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	uint64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	uint64_t month = (5 * day_of_year + 2) / 153;
+	tm->day = (unsigned int)(day_of_year - (153 * month + 2) / 5 + 1);
+	tm->month = (unsigned int)(month < 10 ? month + 3 : month - 9);
+	tm->year = (unsigned int)(year_of_era + era * 400 + (tm->month <= 2));
+}
+
+int64_t LocalOffset(listing lst, uint64_t date)
+{
+	uint64_t period = date / OFFSET_PERIOD;
+	utc_offset* cached = &lst->offsets[period % OFFSET_CACHE_SZ];
+	if (cached->period == period + 1)
+		return cached->offset;
+
+	uint64_t start = period * OFFSET_PERIOD;
+	SYSTEMTIME system_tm, loc_system_tm;
+	uint64_t local;
+	cached->period = period + 1;
+	cached->offset = 0;
+	if (FileTimeToSystemTime((FILETIME*)&start, &system_tm) && SystemTimeToTzSpecificLocalTime(NULL, &system_tm, &loc_system_tm) &&
+			SystemTimeToFileTime(&loc_system_tm, (FILETIME*)&local))
+		cached->offset = (int64_t)(local - start);
+	return cached->offset;
+}
@@ -0,0 +1,62 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include "context.h"
+#include "index.h"
+#include "file-table.h"
+
+//Formats of the directory listing (/ListFormat:)
+#define LIST_TEXT 0
+#define LIST_CSV 1
+#define LIST_JSONL 2
+
+//The directory listing is built up in a big buffer, that's written out in large chunks: to the
+//console as is, and otherwise as UTF-8. Text goes to the standard output, CSV and JSON lines to
+//a Listing.csv or Listing.jsonl file in the output folder. Dates are converted with integer
+//arithmetic instead of the (locale dependent) Win32 date functions.
+typedef struct _listing* listing;
+
+listing OpenListing(execution_context context);
+
+//A listing that's written to a file of that name in the output folder, or to the standard
+//output when NULL. Other exports use it, through the Put... functions, for its buffering.
+listing OpenListingFile(execution_context context, const wchar_t* file_name);
+
+//Starts the listing of a folder, 'path' is how it's shown
+void ListFolder(listing lst, const wchar_t* path, rsize_t path_len);
+
+void ListEntry(listing lst, const index_entry rec);
+
+//Lists a file of a file table, which has the metadata of its MFT record like with /RecordInfo:1
+void ListRow(listing lst, const file_table table, uint64_t row);
+
+//Same as ListRow, under another name of the file than the one in the table, like a hard link
+void ListRowName(listing lst, const file_table table, uint64_t row, uint64_t parent,
+					const wchar_t* name, uint8_t name_len, uint8_t name_space);
+
+//Writes out what's in the buffer. With /RecordInfo:1, the entries are only listed here, after
+//their MFT records are read in one go
+bool FlushListing(listing lst);
+
+bool CloseListing(listing lst);
+
+void PutChars(listing lst, const wchar_t* text, rsize_t len);
+
+//Right aligned in 'width' characters at least
+void PutNumber(listing lst, uint64_t value, unsigned int width, wchar_t pad);
+
+//As 2001-02-03T04:05:06.1234567Z
+void PutISODate(listing lst, uint64_t date);
+
+//In whole seconds since 1 January 1970 (UTC), like in a bodyfile, 0 for dates before that
+void PutUnixTime(listing lst, uint64_t date);
+
+//Quoted only when needed
+void PutCSVField(listing lst, const wchar_t* text, rsize_t len);
+
+//With the quotes
+void PutJSONString(listing lst, const wchar_t* text, rsize_t len);
+
+#define PutText(lst, text) PutChars((lst), (text), wcslen(text))
+
+#endif //LISTING_H
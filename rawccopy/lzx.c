@@ -0,0 +1,266 @@
+#include <stdlib.h>
+
+#include "lzx.h"
+#include "huffman.h"
+
+#define LZX_NUM_CHARS 256
+#define LZX_NUM_OFFSET_SLOTS 30					// for a 32K window
+#define LZX_NUM_LEN_HEADERS 8
+#define LZX_MAIN_SYMS (LZX_NUM_CHARS + LZX_NUM_LEN_HEADERS * LZX_NUM_OFFSET_SLOTS)
+#define LZX_LEN_SYMS 249
+#define LZX_PRE_SYMS 20
+#define LZX_ALIGNED_SYMS 8
+#define LZX_MAX_LEN 16
+#define LZX_MAX_PRE_LEN 15
+#define LZX_MAX_ALIGNED_LEN 7
+
+#define LZX_MAIN_TABLE_BITS 11
+#define LZX_LEN_TABLE_BITS 10
+#define LZX_PRE_TABLE_BITS 8
+#define LZX_ALIGNED_TABLE_BITS 7
+
+#define LZX_MIN_MATCH 2
+#define LZX_NUM_RECENT_OFFSETS 3
+#define LZX_OFFSET_ADJUSTMENT (LZX_NUM_RECENT_OFFSETS - 1)
+
+#define LZX_BLOCK_VERBATIM 1
+#define LZX_BLOCK_ALIGNED 2
+#define LZX_BLOCK_UNCOMPRESSED 3
+#define LZX_DEFAULT_BLOCK_SZ 0x8000
+
+#define LZX_E8_FILE_SZ 12000000					// fixed "file size" for the E8 translation in WIM and WOF
+
+static const uint32_t offset_slot_base[LZX_NUM_OFFSET_SLOTS] = {
+	0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192,
+	256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576 };
+
+static const uint8_t offset_extra_bits[LZX_NUM_OFFSET_SLOTS] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+typedef struct {
+	uint8_t main_lens[LZX_MAIN_SYMS];			// code lengths, the next block's are sent as a delta
+	uint8_t len_lens[LZX_LEN_SYMS];
+	uint8_t aligned_lens[LZX_ALIGNED_SYMS];
+	uint32_t main_table[HUFF_TABLE_SZ(LZX_MAIN_TABLE_BITS, LZX_MAIN_SYMS, LZX_MAX_LEN)];
+	uint32_t len_table[HUFF_TABLE_SZ(LZX_LEN_TABLE_BITS, LZX_LEN_SYMS, LZX_MAX_LEN)];
+	uint32_t pre_table[HUFF_TABLE_SZ(LZX_PRE_TABLE_BITS, LZX_PRE_SYMS, LZX_MAX_PRE_LEN)];
+	uint32_t aligned_table[HUFF_TABLE_SZ(LZX_ALIGNED_TABLE_BITS, LZX_ALIGNED_SYMS, LZX_MAX_ALIGNED_LEN)];
+	uint32_t recent[LZX_NUM_RECENT_OFFSETS];	// most recently used match offsets
+} lzx_decoder;
+
+#define TableSize(table) (sizeof(table) / sizeof((table)[0]))
+
+bool ReadCodeLengths(lzx_decoder* d, bit_reader* br, uint8_t* lens, uint32_t cnt);
+
+bool DecodeBlock(lzx_decoder* d, bit_reader* br, int block_type, uint8_t* dst, uint8_t* out, uint8_t* block_end);
+
+void UndoE8Translation(uint8_t* buf, size_t len);
+
+bool LzxDecompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+	if (dst_len > LZX_WINDOW_SZ)
+		return false;
+
+	//Every chunk starts from scratch: all code lengths 0, all recent offsets 1
+	lzx_decoder* d = calloc(1, sizeof(lzx_decoder));
+	if (!d)
+		return false;
+	for (int i = 0; i < LZX_NUM_RECENT_OFFSETS; ++i)
+		d->recent[i] = 1;
+
+	bit_reader br;
+	InitBitReader(&br, src, src + src_len);
+
+	bool result = true;
+	for (uint8_t* out = dst; result && out < dst + dst_len; )
+	{
+		int block_type = ReadBits(&br, 3);
+		size_t block_sz = ReadBits(&br, 1) ? LZX_DEFAULT_BLOCK_SZ : ReadBits(&br, 16);
+		if (!block_sz || block_sz > (size_t)(dst + dst_len - out))
+		{
+			result = false;
+			break;
+		}
+
+		switch (block_type)
+		{
+		case LZX_BLOCK_ALIGNED:
+			for (int i = 0; i < LZX_ALIGNED_SYMS; ++i)
+				d->aligned_lens[i] = (uint8_t)ReadBits(&br, 3);
+			if (!BuildDecodeTable(d->aligned_table, TableSize(d->aligned_table), LZX_ALIGNED_TABLE_BITS, d->aligned_lens,
+						LZX_ALIGNED_SYMS, LZX_MAX_ALIGNED_LEN))
+			{
+				result = false;
+				break;
+			}
+			//The rest of the header is the same as for a verbatim block:
+		case LZX_BLOCK_VERBATIM:
+			//The code lengths of the main code come in two parts, literals first:
+			result = ReadCodeLengths(d, &br, d->main_lens, LZX_NUM_CHARS) &&
+				ReadCodeLengths(d, &br, d->main_lens + LZX_NUM_CHARS, LZX_MAIN_SYMS - LZX_NUM_CHARS) &&
+				ReadCodeLengths(d, &br, d->len_lens, LZX_LEN_SYMS) &&
+				BuildDecodeTable(d->main_table, TableSize(d->main_table), LZX_MAIN_TABLE_BITS, d->main_lens, LZX_MAIN_SYMS, LZX_MAX_LEN) &&
+				BuildDecodeTable(d->len_table, TableSize(d->len_table), LZX_LEN_TABLE_BITS, d->len_lens, LZX_LEN_SYMS, LZX_MAX_LEN) &&
+				DecodeBlock(d, &br, block_type, dst, out, out + block_sz);
+			break;
+		case LZX_BLOCK_UNCOMPRESSED:
+			//The header is followed by 16 bit alignment (a full word, if the bits happen to
+			//be aligned already), the recent offsets and the bytes as they are:
+			EnsureBits(&br, 1);
+			AlignBitReader(&br);
+			if ((size_t)(br.end - br.next) < 4 * LZX_NUM_RECENT_OFFSETS + block_sz)
+			{
+				result = false;
+				break;
+			}
+			for (int i = 0; i < LZX_NUM_RECENT_OFFSETS; ++i, br.next += 4)
+				if (!(d->recent[i] = ReadLE32(br.next)))
+					result = false;
+			memcpy(out, br.next, block_sz);
+			br.next += block_sz;
+			if ((block_sz & 1) && br.next < br.end)
+				br.next++;
+			break;
+		default:
+			result = false;
+		}
+		out += block_sz;
+	}
+
+	free(d);
+	if (result)
+		UndoE8Translation(dst, dst_len);
+
+	return result;
+}
+
+bool ReadCodeLengths(lzx_decoder* d, bit_reader* br, uint8_t* lens, uint32_t cnt)
+{
+	//The lengths are coded with a small Huffman code of their own, the pre-code:
+	uint8_t pre_lens[LZX_PRE_SYMS];
+	for (int i = 0; i < LZX_PRE_SYMS; ++i)
+		pre_lens[i] = (uint8_t)ReadBits(br, 4);
+	if (!BuildDecodeTable(d->pre_table, TableSize(d->pre_table), LZX_PRE_TABLE_BITS, pre_lens, LZX_PRE_SYMS, LZX_MAX_PRE_LEN))
+		return false;
+
+	for (uint32_t i = 0; i < cnt; )
+	{
+		uint32_t pre_sym = DecodeSymbol(br, d->pre_table, LZX_PRE_TABLE_BITS);
+		uint32_t run = 1;
+		uint8_t len = 0;
+		if (pre_sym < 17)
+			//Difference with the length in the previous block
+			len = (uint8_t)((lens[i] + 17 - pre_sym) % 17);
+		else if (pre_sym == 17)
+			run = 4 + ReadBits(br, 4);
+		else if (pre_sym == 18)
+			run = 20 + ReadBits(br, 5);
+		else
+		{
+			//Run of the same difference:
+			run = 4 + ReadBits(br, 1);
+			if ((pre_sym = DecodeSymbol(br, d->pre_table, LZX_PRE_TABLE_BITS)) > 16)
+				return false;
+			len = (uint8_t)((lens[i] + 17 - pre_sym) % 17);
+		}
+
+		run = min(run, cnt - i);
+		memset(lens + i, len, run);
+		i += run;
+	}
+	return true;
+}
+
+bool DecodeBlock(lzx_decoder* d, bit_reader* br, int block_type, uint8_t* dst, uint8_t* out, uint8_t* block_end)
+{
+	while (out < block_end)
+	{
+		uint32_t sym = DecodeSymbol(br, d->main_table, LZX_MAIN_TABLE_BITS);
+		if (sym < LZX_NUM_CHARS)
+		{
+			*out++ = (uint8_t)sym;
+			continue;
+		}
+
+		//Match: the symbol combines the offset slot with the length header
+		sym -= LZX_NUM_CHARS;
+		uint32_t len = sym % LZX_NUM_LEN_HEADERS;
+		uint32_t slot = sym / LZX_NUM_LEN_HEADERS;
+		if (len == LZX_NUM_LEN_HEADERS - 1)
+			len += DecodeSymbol(br, d->len_table, LZX_LEN_TABLE_BITS);
+		len += LZX_MIN_MATCH;
+
+		uint32_t offset;
+		if (slot < LZX_NUM_RECENT_OFFSETS)
+		{
+			//Repeat of a recent offset, which then moves to the front:
+			offset = d->recent[slot];
+			d->recent[slot] = d->recent[0];
+			d->recent[0] = offset;
+		}
+		else
+		{
+			uint32_t extra = offset_extra_bits[slot];
+			offset = offset_slot_base[slot] - LZX_OFFSET_ADJUSTMENT;
+			if (block_type == LZX_BLOCK_ALIGNED && extra >= 3)
+			{
+				//The lowest 3 bits come from the aligned offset code:
+				offset += ReadBits(br, extra - 3) << 3;
+				offset += DecodeSymbol(br, d->aligned_table, LZX_ALIGNED_TABLE_BITS);
+			}
+			else
+				offset += ReadBits(br, extra);
+
+			d->recent[2] = d->recent[1];
+			d->recent[1] = d->recent[0];
+			d->recent[0] = offset;
+		}
+
+		if (offset > (size_t)(out - dst) || len > (size_t)(block_end - out))
+			return false;
+		CopyMatch(out, offset, len);
+		out += len;
+	}
+	return true;
+}
+
+void UndoE8Translation(uint8_t* buf, size_t len)
+{
+	//The compressor turned the relative targets of x86 CALL instructions (E8 xx xx xx xx)
+	//into absolute ones, here they're turned back:
+	if (len <= 10)
+		return;
+
+	for (size_t pos = 0; pos < len - 10; )
+	{
+		if (buf[pos] != 0xE8)
+		{
+			++pos;
+			continue;
+		}
+
+		int32_t abs_offs = (int32_t)ReadLE32(buf + pos + 1);
+		int32_t rel_offs;
+		bool translate = false;
+		if (abs_offs >= 0 && abs_offs < LZX_E8_FILE_SZ)
+		{
+			rel_offs = abs_offs - (int32_t)pos;
+			translate = true;
+		}
+		else if (abs_offs < 0 && abs_offs >= -(int32_t)pos)
+		{
+			rel_offs = abs_offs + LZX_E8_FILE_SZ;
+			translate = true;
+		}
+
+		if (translate)
+		{
+			buf[pos + 1] = (uint8_t)rel_offs;
+			buf[pos + 2] = (uint8_t)(rel_offs >> 8);
+			buf[pos + 3] = (uint8_t)(rel_offs >> 16);
+			buf[pos + 4] = (uint8_t)(rel_offs >> 24);
+		}
+		pos += 5;
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef LZX_H
+#define LZX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Window size of the LZX variant used by WIM and WOF, also the largest chunk it can decompress
+#define LZX_WINDOW_SZ 0x8000
+
+//Decompresses a chunk in the LZX format as used by WIM and WOF files: a 32K window, no state
+//carried over from other chunks and E8 call translation with a fixed file size.
+//Returns false if the data is corrupt.
+bool LzxDecompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len);
+
+#endif //LZX_H
@@ -0,0 +1,568 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mft-export.h"
+#include "index.h"
+#include "file-table.h"
+#include "data-writer.h"
+#include "filter.h"
+#include "helpers.h"
+#include "thread-pool.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+//The rows are formatted in slices of this many, a few slices per thread at a time
+#define SLICE_ROWS 2048
+#define SLICES_PER_THREAD 4
+
+//Room a row takes in the text without its names: 20 numbers of up to 20 digits, and the JSON keys
+#define ROW_TEXT_SZ 1024
+
+//Most bytes a UTF-16 code unit can take: a \u escape in JSON
+#define MAX_UNIT_SZ 6
+
+//The binary export is written in pieces of this size
+#define EXPORT_BUFFER_SZ 0x100000
+
+#define ESCAPE_NONE 0
+#define ESCAPE_CSV 1					// Quotes are doubled
+#define ESCAPE_JSON 2
+
+typedef struct {
+	execution_context context;
+	file_table table;
+	folder_paths paths;
+	filter flt;
+	row_names names;					// For the filter
+	data_writer wr;
+	bytes buffer;						// Of the binary format, of which 'used' bytes are filled
+	rsize_t used;
+	bool result;
+} mft_exporter;
+
+typedef struct {
+	uint64_t first;
+	uint64_t cnt;
+	bytes text;							// UTF-8, of which 'used' bytes are filled
+	rsize_t used;
+} export_job;
+
+void DeleteExportJob(void* job);
+
+static const UT_icd export_job_icd = { sizeof(export_job), NULL, NULL, DeleteExportJob };
+
+static const UT_icd row_icd = { sizeof(uint64_t), NULL, NULL, NULL };
+
+static const struct {
+	uint32_t id;
+	uint32_t width;
+} columns[] = {
+	{ MFT_COLUMN_REF, sizeof(uint64_t) },
+	{ MFT_COLUMN_PARENT_REF, sizeof(uint64_t) },
+	{ MFT_COLUMN_FLAGS, sizeof(uint16_t) },
+	{ MFT_COLUMN_ATTRIBUTES, sizeof(uint32_t) },
+	{ MFT_COLUMN_REAL_SZ, sizeof(uint64_t) },
+	{ MFT_COLUMN_ALLOCATED_SZ, sizeof(uint64_t) },
+	{ MFT_COLUMN_STREAMS, sizeof(uint16_t) },
+	{ MFT_COLUMN_NAME_SPACE, sizeof(uint8_t) },
+	{ MFT_COLUMN_SI_TIMES, FILE_TIMES * sizeof(uint64_t) },
+	{ MFT_COLUMN_FN_TIMES, FILE_TIMES * sizeof(uint64_t) },
+	{ MFT_COLUMN_NAME_OFFS, sizeof(uint64_t) },
+	{ MFT_COLUMN_NAMES, 0 }
+};
+
+#define COLUMN_CNT (sizeof(columns) / sizeof(columns[0]))
+
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+bool ExportText(mft_exporter* exp);
+
+void ExportSlice(void* item, void* shared);
+
+uint8_t* FormatCSV(const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, uint8_t* dest);
+
+uint8_t* FormatJSON(const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, uint8_t* dest);
+
+bool ExportColumns(mft_exporter* exp);
+
+void PutColumnValue(mft_exporter* exp, const void* value, rsize_t size);
+
+bool WriteColumns(mft_exporter* exp);
+
+bool IsExported(const mft_exporter* exp, uint64_t row);
+
+uint8_t* PutUTF8(uint8_t* dest, const wchar_t* text, rsize_t len, int escape);
+
+rsize_t UTF8Length(const wchar_t* text, rsize_t len);
+
+uint8_t* PutCSVText(uint8_t* dest, const wchar_t* text, rsize_t len);
+
+uint8_t* PutDecimal(uint8_t* dest, uint64_t value);
+
+#define PutLiteral(dest, text) (memcpy((dest), (text), sizeof(text) - 1), (dest) + sizeof(text) - 1)
+
+
+bool ExportMFT(execution_context context)
+{
+	mft_exporter exp;
+	memset(&exp, 0, sizeof(mft_exporter));
+	exp.context = context;
+	exp.result = true;
+	if (context->parameters->filter_expr && !(exp.flt = CompileFilter(context, BaseString(context->parameters->filter_expr))))
+		return false;
+
+	if ((exp.table = BuildFileTable(context, SCAN_DELETED, NULL, NULL)) && (!exp.flt || (exp.names = CreateRowNames(exp.table, 0))))
+	{
+		//All folders get their path first, after that the threads can look them up:
+		const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+		exp.paths = CreateFolderPaths(exp.table, source[0] && source[1] == L':' ? source : L"x:", 2);
+		if (exp.paths)
+			ResolveFolderPaths(exp.paths);
+	}
+
+	unsigned int mode = context->parameters->export_mode;
+	string file_name = exp.paths ? StringPrint(NULL, 0, L"%ls\\%ls", BaseString(context->parameters->output_folder),
+									mode == MFT_EXPORT_CSV ? L"MftExport.csv" : mode == MFT_EXPORT_JSONL ? L"MftExport.jsonl" : L"MftExport.bin") : NULL;
+	if (file_name)
+	{
+		exp.wr = context->parameters->tcp_send ? TCPWriter(context->parameters->ip_address, context->parameters->tcp_port, false) :
+					FileWriter(file_name, false);
+		if (exp.wr)
+			wprintf(context->parameters->tcp_send ? L"Tcpsending: %ls\n" : L"Writing: %ls\n", BaseString(file_name));
+		DeleteString(file_name);
+	}
+
+	bool result = exp.wr && (mode == MFT_EXPORT_BINARY ? ExportColumns(&exp) : ExportText(&exp));
+
+	if (exp.wr)
+		CloseDataWriter(exp.wr);
+	if (exp.buffer)
+		DeleteBytes(exp.buffer);
+	if (exp.paths)
+		DeleteFolderPaths(exp.paths);
+	if (exp.names)
+		DeleteRowNames(exp.names);
+	if (exp.table)
+		DeleteFileTable(exp.table);
+	if (exp.flt)
+		DeleteFilter(exp.flt);
+	return result;
+}
+
+//A few slices per thread are formatted at a time, each in a buffer of its own, which are then
+//written out one after the other
+bool ExportText(mft_exporter* exp)
+{
+	struct _bytes header = { 0 };
+	if (exp->context->parameters->export_mode == MFT_EXPORT_CSV)
+	{
+		header.buffer = (uint8_t*)"Directory,FileName,MftRef,MftSeqNo,ParentMftRef,ParentMftSeqNo,FileAttributes,Deleted,AllocatedSize,RealSize,"
+								"AltStreams,NameSpace,SICreated,SIModified,SIMftModified,SIAccessed,FNCreated,FNModified,FNMftModified,FNAccessed\n";
+		header.buffer_len = strlen((char*)header.buffer);
+		if (!WriteData(exp->wr, &header))
+			return false;
+	}
+
+	UT_array* jobs;
+	utarray_new(jobs, &export_job_icd);
+	rsize_t job_cnt = PoolSize(exp->context->workers) * SLICES_PER_THREAD;
+	for (rsize_t i = 0; i < job_cnt; ++i)
+	{
+		export_job job = { 0, 0, CreateEmpty(), 0 };
+		utarray_push_back(jobs, &job);
+	}
+
+	bool result = true;
+	uint64_t row_cnt = exp->table->row_cnt;
+	for (uint64_t first = 0; result && first < row_cnt; first += job_cnt * SLICE_ROWS)
+	{
+		rsize_t slice_cnt = (rsize_t)min(job_cnt, (row_cnt - first + SLICE_ROWS - 1) / SLICE_ROWS);
+		for (rsize_t i = 0; i < slice_cnt; ++i)
+		{
+			export_job* job = (export_job*)utarray_eltptr(jobs, i);
+			job->first = first + i * SLICE_ROWS;
+			job->cnt = min(SLICE_ROWS, row_cnt - job->first);
+			job->used = 0;
+		}
+
+		RunParallel(exp->context->workers, ExportSlice, utarray_front(jobs), sizeof(export_job), slice_cnt, exp);
+
+		for (rsize_t i = 0; result && i < slice_cnt; ++i)
+		{
+			export_job* job = (export_job*)utarray_eltptr(jobs, i);
+			struct _bytes text = { job->text->buffer, job->used };
+			result = !text.buffer_len || WriteData(exp->wr, &text);
+		}
+	}
+	utarray_free(jobs);
+	return result;
+}
+
+void ExportSlice(void* item, void* shared)
+{
+	export_job* job = (export_job*)item;
+	const mft_exporter* exp = (const mft_exporter*)shared;
+	bool json = exp->context->parameters->export_mode == MFT_EXPORT_JSONL;
+	for (uint64_t row = job->first; row < job->first + job->cnt; ++row)
+	{
+		if (!IsExported(exp, row))
+			continue;
+
+		rsize_t path_len = 0;
+		const wchar_t* path = FolderPath(exp->paths, exp->table->parent[row], &path_len);
+		rsize_t needed = job->used + ROW_TEXT_SZ + (exp->table->name_len[row] + path_len) * MAX_UNIT_SZ;
+		if (needed > job->text->buffer_len)
+			Reserve(job->text, max(needed, 2 * job->text->buffer_len));
+
+		uint8_t* dest = job->text->buffer + job->used;
+		dest = json ? FormatJSON(exp->table, row, path, path_len, dest) : FormatCSV(exp->table, row, path, path_len, dest);
+		job->used = dest - job->text->buffer;
+	}
+}
+
+//Files whose folder has no path have an empty Directory
+uint8_t* FormatCSV(const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, uint8_t* dest)
+{
+	if (path)
+		dest = PutCSVText(dest, path, path_len);
+	*dest++ = ',';
+	dest = PutCSVText(dest, FileRowName(table, row), table->name_len[row]);
+	*dest++ = ',';
+	dest = PutDecimal(dest, row);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->seq[row]);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->parent[row] & 0x0000FFFFFFFFFFFF);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->parent[row] >> 48);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->attributes[row] | (table->flags[row] & FILE_ROW_DIRECTORY ? FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT : 0));
+	dest = table->flags[row] & FILE_ROW_DELETED ? PutLiteral(dest, ",1,") : PutLiteral(dest, ",0,");
+	dest = PutDecimal(dest, table->alloc_sz[row]);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->data_sz[row]);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->streams[row]);
+	*dest++ = ',';
+	dest = PutDecimal(dest, table->name_space[row]);
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		*dest++ = ',';
+		dest = PutDecimal(dest, table->si_times[row * FILE_TIMES + i]);
+	}
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		*dest++ = ',';
+		dest = PutDecimal(dest, table->fn_times[row * FILE_TIMES + i]);
+	}
+	*dest++ = '\n';
+	return dest;
+}
+
+//The keys are those of the USN journal export, where they're the same. Files whose folder has no
+//path have a null directory.
+uint8_t* FormatJSON(const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, uint8_t* dest)
+{
+	static const char* const time_keys[2][FILE_TIMES] = {
+		{ ",\"si_created\":", ",\"si_modified\":", ",\"si_mft_modified\":", ",\"si_accessed\":" },
+		{ ",\"fn_created\":", ",\"fn_modified\":", ",\"fn_mft_modified\":", ",\"fn_accessed\":" } };
+
+	dest = PutLiteral(dest, "{\"directory\":");
+	if (path)
+	{
+		*dest++ = '"';
+		dest = PutUTF8(dest, path, path_len, ESCAPE_JSON);
+		*dest++ = '"';
+	}
+	else
+		dest = PutLiteral(dest, "null");
+	dest = PutLiteral(dest, ",\"name\":\"");
+	dest = PutUTF8(dest, FileRowName(table, row), table->name_len[row], ESCAPE_JSON);
+	dest = PutLiteral(dest, "\",\"mft_ref\":");
+	dest = PutDecimal(dest, row);
+	dest = PutLiteral(dest, ",\"mft_seq_no\":");
+	dest = PutDecimal(dest, table->seq[row]);
+	dest = PutLiteral(dest, ",\"parent_mft_ref\":");
+	dest = PutDecimal(dest, table->parent[row] & 0x0000FFFFFFFFFFFF);
+	dest = PutLiteral(dest, ",\"parent_mft_seq_no\":");
+	dest = PutDecimal(dest, table->parent[row] >> 48);
+	dest = PutLiteral(dest, ",\"file_attributes\":");
+	dest = PutDecimal(dest, table->attributes[row] | (table->flags[row] & FILE_ROW_DIRECTORY ? FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT : 0));
+	dest = table->flags[row] & FILE_ROW_DELETED ? PutLiteral(dest, ",\"deleted\":true") : PutLiteral(dest, ",\"deleted\":false");
+	dest = PutLiteral(dest, ",\"allocated_size\":");
+	dest = PutDecimal(dest, table->alloc_sz[row]);
+	dest = PutLiteral(dest, ",\"real_size\":");
+	dest = PutDecimal(dest, table->data_sz[row]);
+	dest = PutLiteral(dest, ",\"alt_streams\":");
+	dest = PutDecimal(dest, table->streams[row]);
+	dest = PutLiteral(dest, ",\"name_space\":");
+	dest = PutDecimal(dest, table->name_space[row]);
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		rsize_t key_len = strlen(time_keys[0][i]);
+		memcpy(dest, time_keys[0][i], key_len);
+		dest = PutDecimal(dest + key_len, table->si_times[row * FILE_TIMES + i]);
+	}
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		rsize_t key_len = strlen(time_keys[1][i]);
+		memcpy(dest, time_keys[1][i], key_len);
+		dest = PutDecimal(dest + key_len, table->fn_times[row * FILE_TIMES + i]);
+	}
+	return PutLiteral(dest, "}\n");
+}
+
+//Column by column, each one in a single pass over the rows. Since the header says where every
+//column starts, the rows and the size of the names are counted first.
+bool ExportColumns(mft_exporter* exp)
+{
+	file_table table = exp->table;
+	UT_array* rows;
+	utarray_new(rows, &row_icd);
+	uint64_t names_sz = 0;
+	for (uint64_t row = 0; row < table->row_cnt; ++row)
+	{
+		if (IsExported(exp, row))
+		{
+			utarray_push_back(rows, &row);
+			names_sz += UTF8Length(FileRowName(table, row), table->name_len[row]);
+		}
+	}
+
+	if (!(exp->buffer = CreateBytes(EXPORT_BUFFER_SZ)))
+	{
+		utarray_free(rows);
+		return false;
+	}
+	uint64_t row_cnt = utarray_len(rows);
+	struct _mft_export_header hdr = { "RCCMFT", MFT_EXPORT_VERSION, (uint32_t)COLUMN_CNT, row_cnt };
+	PutColumnValue(exp, &hdr, sizeof(struct _mft_export_header));
+	uint64_t offs = sizeof(struct _mft_export_header) + COLUMN_CNT * sizeof(struct _mft_export_column);
+	for (rsize_t i = 0; i < COLUMN_CNT; ++i)
+	{
+		struct _mft_export_column col = { columns[i].id, columns[i].width, offs,
+											columns[i].id == MFT_COLUMN_NAMES ? names_sz :
+											columns[i].id == MFT_COLUMN_NAME_OFFS ? (row_cnt + 1) * sizeof(uint64_t) : row_cnt * columns[i].width };
+		PutColumnValue(exp, &col, sizeof(struct _mft_export_column));
+		offs += col.size;
+	}
+
+	for (rsize_t i = 0; i < COLUMN_CNT; ++i)
+	{
+		uint64_t name_offs = 0;
+		for (uint64_t* row = (uint64_t*)utarray_front(rows); row; row = (uint64_t*)utarray_next(rows, row))
+		{
+			uint64_t value;
+			switch (columns[i].id)
+			{
+			case MFT_COLUMN_REF:
+				value = *row | ((uint64_t)table->seq[*row] << 48);
+				PutColumnValue(exp, &value, sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_PARENT_REF:
+				PutColumnValue(exp, table->parent + *row, sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_FLAGS:
+				PutColumnValue(exp, table->flags + *row, sizeof(uint16_t));
+				break;
+			case MFT_COLUMN_ATTRIBUTES:
+				PutColumnValue(exp, table->attributes + *row, sizeof(uint32_t));
+				break;
+			case MFT_COLUMN_REAL_SZ:
+				PutColumnValue(exp, table->data_sz + *row, sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_ALLOCATED_SZ:
+				PutColumnValue(exp, table->alloc_sz + *row, sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_STREAMS:
+				PutColumnValue(exp, table->streams + *row, sizeof(uint16_t));
+				break;
+			case MFT_COLUMN_NAME_SPACE:
+				PutColumnValue(exp, table->name_space + *row, sizeof(uint8_t));
+				break;
+			case MFT_COLUMN_SI_TIMES:
+				PutColumnValue(exp, table->si_times + *row * FILE_TIMES, FILE_TIMES * sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_FN_TIMES:
+				PutColumnValue(exp, table->fn_times + *row * FILE_TIMES, FILE_TIMES * sizeof(uint64_t));
+				break;
+			case MFT_COLUMN_NAME_OFFS:
+				PutColumnValue(exp, &name_offs, sizeof(uint64_t));
+				name_offs += UTF8Length(FileRowName(table, *row), table->name_len[*row]);
+				break;
+			case MFT_COLUMN_NAMES:
+				if (exp->used + UINT8_MAX * MAX_UNIT_SZ > exp->buffer->buffer_len)
+					exp->result = WriteColumns(exp) && exp->result;
+				exp->used = PutUTF8(exp->buffer->buffer + exp->used, FileRowName(table, *row), table->name_len[*row], ESCAPE_NONE) -
+								exp->buffer->buffer;
+				break;
+			}
+		}
+		if (columns[i].id == MFT_COLUMN_NAME_OFFS)
+			PutColumnValue(exp, &name_offs, sizeof(uint64_t));
+	}
+	utarray_free(rows);
+	return WriteColumns(exp) && exp->result;
+}
+
+void PutColumnValue(mft_exporter* exp, const void* value, rsize_t size)
+{
+	if (exp->used + size > exp->buffer->buffer_len)
+		exp->result = WriteColumns(exp) && exp->result;
+	memcpy(exp->buffer->buffer + exp->used, value, size);
+	exp->used += size;
+}
+
+bool WriteColumns(mft_exporter* exp)
+{
+	struct _bytes data = { exp->buffer->buffer, exp->used };
+	exp->used = 0;
+	return !data.buffer_len || WriteData(exp->wr, &data);
+}
+
+//Base records with a name, of files that are there or deleted
+bool IsExported(const mft_exporter* exp, uint64_t row)
+{
+	uint16_t flags = exp->table->flags[row];
+	return (flags & (FILE_ROW_IN_USE | FILE_ROW_DELETED)) && !(flags & FILE_ROW_EXTENSION) && exp->table->name_len[row] &&
+			(!exp->flt || MatchFilter(exp->flt, exp->table, exp->names, row));
+}
+
+//Halves of surrogate pairs without the other half (NTFS doesn't check names) become U+FFFD, or
+//a \u escape in JSON like in the listing. 'dest' needs room for MAX_UNIT_SZ bytes per code unit.
+uint8_t* PutUTF8(uint8_t* dest, const wchar_t* text, rsize_t len, int escape)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+
+	rsize_t i = 0;
+	while (i < len)
+	{
+#ifdef HAS_SSE2
+		//8 code units of printable ASCII that needs no escaping, which is what most names are,
+		//are narrowed to bytes in one go. Signed, the ones from 0x8000 up are below 0x20 too.
+		if (i + 8 <= len)
+		{
+			__m128i units = _mm_loadu_si128((const __m128i*)(text + i));
+			__m128i special = _mm_or_si128(_mm_cmplt_epi16(units, _mm_set1_epi16(0x20)), _mm_cmpgt_epi16(units, _mm_set1_epi16(0x7E)));
+			if (escape != ESCAPE_NONE)
+				special = _mm_or_si128(special, _mm_cmpeq_epi16(units, _mm_set1_epi16('"')));
+			if (escape == ESCAPE_JSON)
+				special = _mm_or_si128(special, _mm_cmpeq_epi16(units, _mm_set1_epi16('\\')));
+			if (!_mm_movemask_epi8(special))
+			{
+				_mm_storel_epi64((__m128i*)dest, _mm_packus_epi16(units, units));
+				dest += 8;
+				i += 8;
+				continue;
+			}
+		}
+#endif
+		wchar_t unit = text[i++];
+		bool lone_surrogate = (IS_HIGH_SURROGATE(unit) && !(i < len && IS_LOW_SURROGATE(text[i]))) || IS_LOW_SURROGATE(unit);
+		if ((unit == L'"' && escape != ESCAPE_NONE) || (unit == L'\\' && escape == ESCAPE_JSON))
+		{
+			*dest++ = escape == ESCAPE_JSON ? '\\' : '"';
+			*dest++ = (uint8_t)unit;
+		}
+		else if (escape == ESCAPE_JSON && (unit < 0x20 || lone_surrogate))
+		{
+			dest = PutLiteral(dest, "\\u");
+			for (int shift = 12; shift >= 0; shift -= 4)
+				*dest++ = hex_digits[(unit >> shift) & 0xF];
+		}
+		else if (unit < 0x80)
+			*dest++ = (uint8_t)unit;
+		else if (unit < 0x800)
+		{
+			*dest++ = (uint8_t)(0xC0 | (unit >> 6));
+			*dest++ = (uint8_t)(0x80 | (unit & 0x3F));
+		}
+		else if (IS_HIGH_SURROGATE(unit) && !lone_surrogate)
+		{
+			uint32_t code_point = 0x10000 + (((uint32_t)unit - 0xD800) << 10) + ((uint32_t)text[i++] - 0xDC00);
+			*dest++ = (uint8_t)(0xF0 | (code_point >> 18));
+			*dest++ = (uint8_t)(0x80 | ((code_point >> 12) & 0x3F));
+			*dest++ = (uint8_t)(0x80 | ((code_point >> 6) & 0x3F));
+			*dest++ = (uint8_t)(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			if (lone_surrogate)
+				unit = 0xFFFD;
+			*dest++ = (uint8_t)(0xE0 | (unit >> 12));
+			*dest++ = (uint8_t)(0x80 | ((unit >> 6) & 0x3F));
+			*dest++ = (uint8_t)(0x80 | (unit & 0x3F));
+		}
+	}
+	return dest;
+}
+
+//Same as what PutUTF8 gives without escaping
+rsize_t UTF8Length(const wchar_t* text, rsize_t len)
+{
+	rsize_t result = 0;
+	for (rsize_t i = 0; i < len; ++i)
+	{
+		if (text[i] < 0x80)
+			result += 1;
+		else if (text[i] < 0x800)
+			result += 2;
+		else if (IS_HIGH_SURROGATE(text[i]) && i + 1 < len && IS_LOW_SURROGATE(text[i + 1]))
+		{
+			result += 4;
+			++i;
+		}
+		else
+			result += 3;
+	}
+	return result;
+}
+
+//Quoted only when needed, like in the listing
+uint8_t* PutCSVText(uint8_t* dest, const wchar_t* text, rsize_t len)
+{
+	bool quote = false;
+	for (rsize_t i = 0; i < len && !quote; ++i)
+		quote = text[i] == L',' || text[i] == L'"' || text[i] == L'\n' || text[i] == L'\r';
+	if (!quote)
+		return PutUTF8(dest, text, len, ESCAPE_NONE);
+
+	*dest++ = '"';
+	dest = PutUTF8(dest, text, len, ESCAPE_CSV);
+	*dest++ = '"';
+	return dest;
+}
+
+//Two digits at a time, from the back
+uint8_t* PutDecimal(uint8_t* dest, uint64_t value)
+{
+	char digits[20];
+	rsize_t pos = sizeof(digits);
+	while (value >= 100)
+	{
+		pos -= 2;
+		memcpy(digits + pos, digit_pairs + (value % 100) * 2, 2);
+		value /= 100;
+	}
+	if (value >= 10)
+	{
+		pos -= 2;
+		memcpy(digits + pos, digit_pairs + value * 2, 2);
+	}
+	else
+		digits[--pos] = (char)('0' + value);
+
+	memcpy(dest, digits + pos, sizeof(digits) - pos);
+	return dest + sizeof(digits) - pos;
+}
+
+void DeleteExportJob(void* job)
+{
+	if (((export_job*)job)->text)
+		DeleteBytes(((export_job*)job)->text);
+}
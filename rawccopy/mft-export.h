@@ -0,0 +1,52 @@
+#ifndef MFT_EXPORT_H
+#define MFT_EXPORT_H
+
+#include "context.h"
+
+//Formats of /MftExport:
+#define MFT_EXPORT_CSV 1
+#define MFT_EXPORT_JSONL 2
+#define MFT_EXPORT_BINARY 3
+
+#define MFT_EXPORT_VERSION 1
+
+//Columns of the binary export, with what a row has in them
+#define MFT_COLUMN_REF 1				// uint64_t: MFT reference of the file (sequence number in the top 16 bits)
+#define MFT_COLUMN_PARENT_REF 2			// uint64_t: MFT reference of the folder it's in
+#define MFT_COLUMN_FLAGS 3				// uint16_t: 0x01 in use, 0x02 directory, 0x08 resident data, 0x10 attribute list, 0x20 deleted
+#define MFT_COLUMN_ATTRIBUTES 4			// uint32_t: file attributes from $STANDARD_INFORMATION
+#define MFT_COLUMN_REAL_SZ 5			// uint64_t: size of the unnamed $DATA
+#define MFT_COLUMN_ALLOCATED_SZ 6		// uint64_t
+#define MFT_COLUMN_STREAMS 7			// uint16_t: number of alternate data streams
+#define MFT_COLUMN_NAME_SPACE 8			// uint8_t: FILE_NAME_xxx
+#define MFT_COLUMN_SI_TIMES 9			// 4 uint64_t: created, modified, MFT record modified and accessed, as FILETIME
+#define MFT_COLUMN_FN_TIMES 10			// The same from $FILE_NAME
+#define MFT_COLUMN_NAME_OFFS 11			// uint64_t: where the name starts in MFT_COLUMN_NAMES, with one more at the end for the last one
+#define MFT_COLUMN_NAMES 12				// The names of all rows in UTF-8, back to back
+
+//The binary export starts with this header, followed by an mft_export_column for every column,
+//followed by the columns themselves. All numbers are little endian.
+#pragma pack (push, 1)
+typedef struct _mft_export_header {
+	/*  0*/	char magic[8];					// "RCCMFT" and two zeros
+	/*  8*/	uint32_t version;				// MFT_EXPORT_VERSION
+	/* 12*/	uint32_t column_cnt;
+	/* 16*/	uint64_t row_cnt;
+} *mft_export_header;
+
+typedef struct _mft_export_column {
+	/*  0*/	uint32_t id;					// MFT_COLUMN_xxx
+	/*  4*/	uint32_t width;					// Bytes per row, 0 for MFT_COLUMN_NAMES
+	/*  8*/	uint64_t offs;					// From the start of the file
+	/* 16*/	uint64_t size;					// In bytes
+} *mft_export_column;
+#pragma pack(pop)
+
+//Writes out the metadata of all files of the volume, deleted ones included, from one sequential
+//read of the MFT: as UTF-8 CSV to MftExport.csv, as JSON lines to MftExport.jsonl, or in the
+//binary format above to MftExport.bin, in the output folder. Times are FILETIME numbers, not
+//dates. The text is formatted on all threads, in slices of rows that are written out in record
+//order. With /Filter:, only the files that pass it are in there.
+bool ExportMFT(execution_context context);
+
+#endif //MFT_EXPORT_H
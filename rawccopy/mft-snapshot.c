@@ -0,0 +1,618 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mft-snapshot.h"
+#include "mft.h"
+#include "names.h"
+#include "helpers.h"
+
+#define SNAPSHOT_MAGIC "RCCSNAP"
+#define SNAPSHOT_VERSION 3
+
+//Number of sections (arrays) in a snapshot file, see SnapshotSections
+#define SECTION_CNT 18
+
+//WriteFile takes a 32 bit count, so sections are written in pieces of at most this size
+#define WRITE_CHUNK_SZ 0x1000000
+
+//What InternName gives when a name doesn't fit in the heap anymore: its offsets are 32 bits
+#define NAME_HEAP_FULL UINT32_MAX
+
+//The metafiles (records 0 up to here, and the files in $Extend) don't show up in the USN
+//journal, so their records are always read again
+#define FIRST_USER_RECORD 24
+#define EXTEND_RECORD 11
+
+#pragma pack (push, 1)
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t section_cnt;
+	uint64_t serial;
+	uint64_t mft_lsn;
+	uint64_t journal_id;
+	uint64_t next_usn;
+	uint64_t row_cnt;
+	uint64_t name_chars;			// Size of the name heap in characters
+	uint64_t child_cnt;
+	uint64_t offsets[SECTION_CNT];	// File offset of every section, all of them 8 byte aligned
+} snapshot_header;
+#pragma pack(pop)
+
+//Where a section goes in memory, and its size
+typedef struct {
+	void** column;
+	uint64_t len;
+} section;
+
+//A slot of the hash table of InternNames
+typedef struct {
+	uint32_t offs;					// Of the name in the new heap plus one, 0 when the slot is empty
+	uint32_t len;
+} name_slot;
+
+struct _snapshot_map {
+	HANDLE file;
+	HANDLE mapping;
+	uint8_t* view;
+	struct _bytes names;			// Name heap of the table, in the view
+};
+
+static const UT_icd row_icd = { sizeof(uint64_t), NULL, NULL, NULL };
+
+file_table RefreshTable(execution_context context, const mft_snapshot snap, mft_file journal, uint64_t row_cnt);
+
+bool CollectRow(execution_context context, const usn_entry* entry, void* state);
+
+void AddExtraNames(const mft_snapshot snap, file_table table);
+
+void SnapshotSections(mft_snapshot snap, uint64_t name_chars, uint64_t child_cnt, section* sections);
+
+bool CheckSnapshot(const mft_snapshot snap, uint64_t name_chars, uint64_t child_cnt);
+
+bool InternNames(const file_table table, file_table interned, uint32_t** extra_offs);
+
+uint32_t InternName(name_slot* slots, uint64_t slot_cnt, bytes heap, rsize_t* heap_cap, const wchar_t* name, uint8_t len);
+
+bool LinkChildren(execution_context context, const file_table table, const uint32_t* extra_offs, mft_snapshot snap);
+
+int64_t EntryFolder(const file_table table, uint64_t entry);
+
+int64_t FolderRow(const file_table table, uint64_t row, uint64_t parent);
+
+const wchar_t* EntryName(const file_table table, uint64_t entry, uint8_t* len);
+
+void SortByName(execution_context context, const file_table table, uint32_t* entries, uint32_t* tmp, rsize_t cnt);
+
+bool WriteSections(execution_context context, mft_snapshot snap, HANDLE out);
+
+bool WriteAll(HANDLE out, const void* data, uint64_t len);
+
+
+mft_snapshot LoadSnapshot(execution_context context)
+{
+	const wchar_t* path = BaseString(context->parameters->snapshot_file);
+	attribute mft_data = FirstAttribute(context, context->mft_table, AttrTypeFlag(ATTR_DATA));
+	uint64_t row_cnt = mft_data ? AttributeSize(mft_data) / context->mft_record_sz : 0;
+
+	//A file that isn't a snapshot isn't overwritten:
+	mft_snapshot result = NULL;
+	bool stale = false;
+	if (PathFileExistsW(path) && !(result = MapSnapshot(path, &stale)) && !stale)
+		return NULL;
+
+	//The state of the journal is taken before the MFT is read, so what changes while it's
+	//being read is read again the next time:
+	usn_journal_info jrnl = { 0, 0, 0 };
+	mft_file journal = LoadUsnJournal(context);
+	if (journal && !UsnJournalInfo(context, journal, &jrnl))
+	{
+		DeleteMFTFile(journal);
+		journal = NULL;
+	}
+
+	//Without a journal, only the $MFT record tells whether the volume changed, and it doesn't
+	//change with every change of a file:
+	bool same_volume = result && result->serial == context->boot->volume_serial_nbr;
+	if (same_volume && result->table.row_cnt == row_cnt && (journal ?
+			result->journal_id == jrnl.journal_id && result->next_usn == jrnl.next_usn : result->mft_lsn == RecordLSN(context->mft_table)))
+	{
+		if (journal)
+			DeleteMFTFile(journal);
+		wprintf(L"Using snapshot: %ls\n", path);
+		return result;
+	}
+
+	//Records are never removed from the MFT, so a snapshot with more rows is of another volume:
+	file_table table = NULL;
+	if (same_volume && journal && result->journal_id == jrnl.journal_id && result->next_usn >= jrnl.lowest_usn &&
+			result->next_usn <= jrnl.next_usn && result->table.row_cnt <= row_cnt)
+		table = RefreshTable(context, result, journal, row_cnt);
+	if (result)
+		CloseSnapshot(result);
+	if (journal)
+		DeleteMFTFile(journal);
+
+	if (!table && !(table = BuildFileTable(context, 0, NULL, NULL)))
+		return NULL;
+
+	wprintf(L"Writing snapshot: %ls\n", path);
+	bool ok = WriteSnapshot(context, table, &jrnl, path);
+	DeleteFileTable(table);
+	return ok ? MapSnapshot(path, &stale) : NULL;
+}
+
+bool WriteSnapshot(execution_context context, const file_table table, const usn_journal_info* journal, const wchar_t* path)
+{
+	if (table->row_cnt > UINT32_MAX)
+		return CleanUpAndFail(NULL, NULL, "Error: Too many MFT records for a snapshot.\n");
+
+	//Everything goes in as it is in the table, except for the names:
+	struct _mft_snapshot snap;
+	memset(&snap, 0, sizeof(struct _mft_snapshot));
+	snap.table = *table;
+	snap.table.name_offs = NULL;
+	snap.table.names = NULL;
+	snap.serial = context->boot->volume_serial_nbr;
+	snap.mft_lsn = RecordLSN(context->mft_table);
+	snap.journal_id = journal->journal_id;
+	snap.next_usn = journal->next_usn;
+
+	uint32_t* extra_offs = NULL;
+	bool result = InternNames(table, &snap.table, &extra_offs) && LinkChildren(context, table, extra_offs, &snap);
+	if (result)
+	{
+		HANDLE out = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (out == INVALID_HANDLE_VALUE)
+			result = CleanUpAndFail(NULL, NULL, "Error: Creating the snapshot file failed: %d\n", GetLastError());
+		else
+		{
+			result = WriteSections(context, &snap, out);
+			CloseHandle(out);
+			if (!result)
+				DeleteFileW(path);
+		}
+	}
+
+	free(snap.table.name_offs);
+	if (snap.table.names)
+		DeleteBytes(snap.table.names);
+	free(extra_offs);
+	free(snap.child_start);
+	free(snap.children);
+	free(snap.child_name_offs);
+	free(snap.child_name_len);
+	free(snap.child_name_space);
+	return result;
+}
+
+mft_snapshot MapSnapshot(const wchar_t* path, bool* stale)
+{
+	*stale = false;
+	SafeCreate(result, mft_snapshot);
+	memset(result, 0, sizeof(struct _mft_snapshot));
+	if (!(result->map = calloc(1, sizeof(struct _snapshot_map))))
+		return ErrorCleanUp(free, result, "Memory allocation problem.\n");
+
+	LARGE_INTEGER size;
+	result->map->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (result->map->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(result->map->file, &size))
+		return ErrorCleanUp(CloseSnapshot, result, "Error: Opening the snapshot file failed: %d\n", GetLastError());
+
+	if (size.QuadPart < sizeof(snapshot_header))
+		return ErrorCleanUp(CloseSnapshot, result, "Error: %ls isn't a snapshot file.\n", path);
+
+	if (!(result->map->mapping = CreateFileMappingW(result->map->file, NULL, PAGE_READONLY, 0, 0, NULL)) ||
+		!(result->map->view = MapViewOfFile(result->map->mapping, FILE_MAP_READ, 0, 0, 0)))
+		return ErrorCleanUp(CloseSnapshot, result, "Error: Mapping the snapshot file failed: %d\n", GetLastError());
+
+	snapshot_header* hdr = (snapshot_header*)result->map->view;
+	if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)))
+		return ErrorCleanUp(CloseSnapshot, result, "Error: %ls isn't a snapshot file.\n", path);
+
+	//Like a snapshot of another volume, one of another version or a damaged one is made again:
+	*stale = true;
+	if (hdr->version != SNAPSHOT_VERSION || hdr->section_cnt != SECTION_CNT)
+		return ErrorCleanUp(CloseSnapshot, result, "The snapshot file is of another version, it's made again.\n");
+
+	//The sizes are checked against the file before anything is multiplied with them:
+	uint64_t file_sz = (uint64_t)size.QuadPart;
+	if (hdr->row_cnt > UINT32_MAX || hdr->name_chars > file_sz || hdr->child_cnt > file_sz)
+		return ErrorCleanUp(CloseSnapshot, result, "The snapshot file is damaged, it's made again.\n");
+
+	result->table.row_cnt = hdr->row_cnt;
+	result->serial = hdr->serial;
+	result->mft_lsn = hdr->mft_lsn;
+	result->journal_id = hdr->journal_id;
+	result->next_usn = hdr->next_usn;
+	result->map->names.buffer_len = hdr->name_chars * sizeof(wchar_t);
+	result->table.names = &result->map->names;
+
+	section sections[SECTION_CNT];
+	SnapshotSections(result, hdr->name_chars, hdr->child_cnt, sections);
+	for (int i = 0; i < SECTION_CNT; ++i)
+	{
+		if (hdr->offsets[i] % 8 || hdr->offsets[i] > file_sz || sections[i].len > file_sz - hdr->offsets[i])
+			return ErrorCleanUp(CloseSnapshot, result, "The snapshot file is damaged, it's made again.\n");
+		*sections[i].column = result->map->view + hdr->offsets[i];
+	}
+	if (!CheckSnapshot(result, hdr->name_chars, hdr->child_cnt))
+		return ErrorCleanUp(CloseSnapshot, result, "The snapshot file is damaged, it's made again.\n");
+
+	*stale = false;
+	return result;
+}
+
+void CloseSnapshot(mft_snapshot snap)
+{
+	if (snap->map)
+	{
+		if (snap->map->view)
+			UnmapViewOfFile(snap->map->view);
+		if (snap->map->mapping)
+			CloseHandle(snap->map->mapping);
+		if (snap->map->file && snap->map->file != INVALID_HANDLE_VALUE)
+			CloseHandle(snap->map->file);
+		free(snap->map);
+	}
+	free(snap);
+}
+
+//The table of the snapshot, with the records that changed since it was taken read again. The
+//names of those rows go at the end of the name heap, WriteSnapshot leaves out what's left over.
+file_table RefreshTable(execution_context context, const mft_snapshot snap, mft_file journal, uint64_t row_cnt)
+{
+	UT_array* rows;
+	utarray_new(rows, &row_icd);
+	for (uint64_t row = 0; row < FIRST_USER_RECORD && row < row_cnt; ++row)
+		utarray_push_back(rows, &row);
+	if (snap->table.row_cnt > EXTEND_RECORD)
+	{
+		for (uint32_t i = snap->child_start[EXTEND_RECORD]; i < snap->child_start[EXTEND_RECORD + 1]; ++i)
+		{
+			uint64_t row = snap->children[i];
+			utarray_push_back(rows, &row);
+		}
+	}
+
+	file_table result = NULL;
+	rsize_t system_cnt = utarray_len(rows);
+	if (ReadUsnJournal(context, journal, snap->next_usn, CollectRow, rows) && (result = CopyFileTable(&snap->table, row_cnt)))
+	{
+		AddExtraNames(snap, result);
+		wprintf(L"Refreshing snapshot: %llu changes in the USN journal\n", (unsigned long long)(utarray_len(rows) - system_cnt));
+		if (!UpdateFileRows(context, result, utarray_front(rows), utarray_len(rows)))
+		{
+			DeleteFileTable(result);
+			result = NULL;
+		}
+	}
+	utarray_free(rows);
+	return result;
+}
+
+bool CollectRow(execution_context context, const usn_entry* entry, void* state)
+{
+	uint64_t row = entry->file_ref & 0x0000FFFFFFFFFFFF;
+	utarray_push_back((UT_array*)state, &row);
+	return true;
+}
+
+//The names in the lists of children that aren't those of the rows are the extra names of the table
+void AddExtraNames(const mft_snapshot snap, file_table table)
+{
+	for (uint64_t folder = 0; folder < snap->table.row_cnt; ++folder)
+	{
+		for (uint32_t i = snap->child_start[folder]; i < snap->child_start[folder + 1]; ++i)
+		{
+			uint32_t row = snap->children[i];
+			if (snap->child_name_offs[i] == snap->table.name_offs[row] && snap->child_name_len[i] == snap->table.name_len[row] &&
+					snap->child_name_space[i] == snap->table.name_space[row] && (snap->table.parent[row] & 0x0000FFFFFFFFFFFF) == folder)
+				continue;
+
+			extra_name name = { row, folder | ((uint64_t)snap->table.seq[folder] << 48), snap->child_name_offs[i],
+								snap->child_name_len[i], snap->child_name_space[i] };
+			utarray_push_back(table->extra_names, &name);
+		}
+	}
+}
+
+//The sections of a snapshot, in the order they're in the file
+void SnapshotSections(mft_snapshot snap, uint64_t name_chars, uint64_t child_cnt, section* sections)
+{
+	file_table table = &snap->table;
+	uint64_t rows = table->row_cnt;
+	section list[SECTION_CNT] = {
+		{ (void**)&table->seq, rows * sizeof(uint16_t) },
+		{ (void**)&table->flags, rows * sizeof(uint16_t) },
+		{ (void**)&table->parent, rows * sizeof(uint64_t) },
+		{ (void**)&table->name_offs, rows * sizeof(uint32_t) },
+		{ (void**)&table->name_len, rows * sizeof(uint8_t) },
+		{ (void**)&table->name_space, rows * sizeof(uint8_t) },
+		{ (void**)&table->attributes, rows * sizeof(uint32_t) },
+		{ (void**)&table->si_times, rows * FILE_TIMES * sizeof(uint64_t) },
+		{ (void**)&table->fn_times, rows * FILE_TIMES * sizeof(uint64_t) },
+		{ (void**)&table->data_sz, rows * sizeof(uint64_t) },
+		{ (void**)&table->alloc_sz, rows * sizeof(uint64_t) },
+		{ (void**)&table->streams, rows * sizeof(uint16_t) },
+		{ (void**)&table->names->buffer, name_chars * sizeof(wchar_t) },
+		{ (void**)&snap->child_start, (rows + 1) * sizeof(uint32_t) },
+		{ (void**)&snap->children, child_cnt * sizeof(uint32_t) },
+		{ (void**)&snap->child_name_offs, child_cnt * sizeof(uint32_t) },
+		{ (void**)&snap->child_name_len, child_cnt * sizeof(uint8_t) },
+		{ (void**)&snap->child_name_space, child_cnt * sizeof(uint8_t) } };
+	memcpy(sections, list, sizeof(list));
+}
+
+//The sections fit in the file, but what's in them is used without any more checks: the names
+//have to be within the name heap, and the lists of children within 'children'
+bool CheckSnapshot(const mft_snapshot snap, uint64_t name_chars, uint64_t child_cnt)
+{
+	const file_table table = &snap->table;
+	for (uint64_t row = 0; row < table->row_cnt; ++row)
+	{
+		if ((uint64_t)table->name_offs[row] + table->name_len[row] > name_chars ||
+				snap->child_start[row] > snap->child_start[row + 1])
+			return false;
+	}
+	if (snap->child_start[0] || snap->child_start[table->row_cnt] > child_cnt)
+		return false;
+
+	for (uint64_t i = 0; i < child_cnt; ++i)
+	{
+		if (snap->children[i] >= table->row_cnt || (uint64_t)snap->child_name_offs[i] + snap->child_name_len[i] > name_chars)
+			return false;
+	}
+	return true;
+}
+
+//Gives every distinct name a single place in a new name heap, the names seen before are
+//found with a hash table. The extra names get theirs in 'extra_offs'.
+bool InternNames(const file_table table, file_table interned, uint32_t** extra_offs)
+{
+	rsize_t extra_cnt = utarray_len(table->extra_names);
+	uint64_t slot_cnt = 16;
+	while (slot_cnt < 2 * (table->row_cnt + extra_cnt))
+		slot_cnt <<= 1;
+
+	name_slot* slots = calloc((rsize_t)slot_cnt, sizeof(name_slot));
+	interned->name_offs = calloc((rsize_t)table->row_cnt, sizeof(uint32_t));
+	interned->names = CreateEmpty();
+	*extra_offs = malloc(extra_cnt * sizeof(uint32_t) + 1);
+	if (!slots || !interned->name_offs || !*extra_offs)
+	{
+		free(slots);
+		return CleanUpAndFail(NULL, NULL, "Memory allocation problem.\n");
+	}
+
+	rsize_t heap_cap = 0;
+	bool result = true;
+	for (uint64_t row = 0; result && row < table->row_cnt; ++row)
+	{
+		if (table->name_len[row])
+			result = (interned->name_offs[row] = InternName(slots, slot_cnt, interned->names, &heap_cap, FileRowName(table, row),
+																table->name_len[row])) != NAME_HEAP_FULL;
+	}
+	for (rsize_t i = 0; result && i < extra_cnt; ++i)
+	{
+		extra_name* name = (extra_name*)utarray_eltptr(table->extra_names, i);
+		result = ((*extra_offs)[i] = InternName(slots, slot_cnt, interned->names, &heap_cap,
+										(wchar_t*)table->names->buffer + name->name_offs, name->name_len)) != NAME_HEAP_FULL;
+	}
+	free(slots);
+	if (!result)
+		return CleanUpAndFail(NULL, NULL, "Error: The file names don't fit in a snapshot.\n");
+	return true;
+}
+
+//Offset of 'name' in 'heap', where it's added when it isn't in there yet, or NAME_HEAP_FULL
+uint32_t InternName(name_slot* slots, uint64_t slot_cnt, bytes heap, rsize_t* heap_cap, const wchar_t* name, uint8_t len)
+{
+	uint32_t hash = 2166136261;
+	for (uint8_t i = 0; i < len; ++i)
+		hash = (hash ^ name[i]) * 16777619;
+
+	uint64_t slot = hash & (slot_cnt - 1);
+	for (; slots[slot].offs; slot = (slot + 1) & (slot_cnt - 1))
+	{
+		if (slots[slot].len == len && !memcmp((wchar_t*)heap->buffer + slots[slot].offs - 1, name, len * sizeof(wchar_t)))
+			return slots[slot].offs - 1;
+	}
+
+	//The name has to end before NAME_HEAP_FULL, so it can't be mistaken for it:
+	uint64_t start = heap->buffer_len / sizeof(wchar_t);
+	if (start + len >= NAME_HEAP_FULL)
+		return NAME_HEAP_FULL;
+
+	struct _bytes copy = { (uint8_t*)name, len * sizeof(wchar_t) };
+	slots[slot].offs = (uint32_t)start + 1;
+	slots[slot].len = len;
+	AppendGrowing(heap, heap_cap, &copy, 0, copy.buffer_len);
+	return slots[slot].offs - 1;
+}
+
+//Lists the children of every folder, every name in it separately, sorted by name. The names are
+//numbered as entries: those of the rows first, the extra names after them.
+bool LinkChildren(execution_context context, const file_table table, const uint32_t* extra_offs, mft_snapshot snap)
+{
+	rsize_t rows = (rsize_t)table->row_cnt;
+	uint64_t entry_cnt = table->row_cnt + utarray_len(table->extra_names);
+	if (entry_cnt > UINT32_MAX)
+		return CleanUpAndFail(NULL, NULL, "Error: Too many file names for a snapshot.\n");
+
+	//Counted first, so every folder knows where its children start:
+	uint32_t* start = calloc(rows + 1, sizeof(uint32_t));
+	uint32_t* next = malloc(rows * sizeof(uint32_t));
+	if (!start || !next)
+	{
+		free(start);
+		free(next);
+		return CleanUpAndFail(NULL, NULL, "Memory allocation problem.\n");
+	}
+	for (uint64_t entry = 0; entry < entry_cnt; ++entry)
+	{
+		int64_t folder = EntryFolder(table, entry);
+		if (folder >= 0)
+			++start[folder + 1];
+	}
+	for (rsize_t i = 0; i < rows; ++i)
+		start[i + 1] += start[i];
+
+	rsize_t child_cnt = start[rows];
+	uint32_t* list = malloc(child_cnt * sizeof(uint32_t) + 1);
+	uint32_t* tmp = malloc(child_cnt * sizeof(uint32_t) + 1);
+	snap->child_start = start;
+	snap->children = malloc(child_cnt * sizeof(uint32_t) + 1);
+	snap->child_name_offs = malloc(child_cnt * sizeof(uint32_t) + 1);
+	snap->child_name_len = malloc(child_cnt + 1);
+	snap->child_name_space = malloc(child_cnt + 1);
+	if (!list || !tmp || !snap->children || !snap->child_name_offs || !snap->child_name_len || !snap->child_name_space)
+	{
+		free(next);
+		free(list);
+		free(tmp);
+		return CleanUpAndFail(NULL, NULL, "Memory allocation problem.\n");
+	}
+
+	memcpy(next, start, rows * sizeof(uint32_t));
+	for (uint64_t entry = 0; entry < entry_cnt; ++entry)
+	{
+		int64_t folder = EntryFolder(table, entry);
+		if (folder >= 0)
+			list[next[folder]++] = (uint32_t)entry;
+	}
+
+	for (rsize_t i = 0; i < rows; ++i)
+		SortByName(context, table, list + start[i], tmp, start[i + 1] - start[i]);
+
+	for (rsize_t i = 0; i < child_cnt; ++i)
+	{
+		uint32_t entry = list[i];
+		extra_name* extra = entry < rows ? NULL : (extra_name*)utarray_eltptr(table->extra_names, entry - rows);
+		snap->children[i] = extra ? (uint32_t)extra->row : entry;
+		snap->child_name_offs[i] = extra ? extra_offs[entry - rows] : snap->table.name_offs[entry];
+		snap->child_name_len[i] = extra ? extra->name_len : table->name_len[entry];
+		snap->child_name_space[i] = extra ? extra->name_space : table->name_space[entry];
+	}
+
+	free(next);
+	free(list);
+	free(tmp);
+	return true;
+}
+
+//Row of the folder a name is in, or -1 when it isn't in one (anymore)
+int64_t EntryFolder(const file_table table, uint64_t entry)
+{
+	if (entry < table->row_cnt)
+		return table->name_len[entry] ? FolderRow(table, entry, table->parent[entry]) : -1;
+
+	extra_name* name = (extra_name*)utarray_eltptr(table->extra_names, entry - table->row_cnt);
+	return table->flags[name->row] & FILE_ROW_IN_USE ? FolderRow(table, name->row, name->parent) : -1;
+}
+
+//Row of the folder that 'parent' refers to, for a name of the file of 'row'
+int64_t FolderRow(const file_table table, uint64_t row, uint64_t parent)
+{
+	uint64_t folder = parent & 0x0000FFFFFFFFFFFF;
+	if ((table->flags[row] & FILE_ROW_EXTENSION) || folder >= table->row_cnt || folder == row ||
+		!(table->flags[folder] & FILE_ROW_DIRECTORY) || table->seq[folder] != parent >> 48)
+		return -1;
+	return (int64_t)folder;
+}
+
+const wchar_t* EntryName(const file_table table, uint64_t entry, uint8_t* len)
+{
+	if (entry < table->row_cnt)
+	{
+		*len = table->name_len[entry];
+		return FileRowName(table, entry);
+	}
+
+	extra_name* name = (extra_name*)utarray_eltptr(table->extra_names, entry - table->row_cnt);
+	*len = name->name_len;
+	return (wchar_t*)table->names->buffer + name->name_offs;
+}
+
+//Merge sort, with 'tmp' at least as big as 'entries'
+void SortByName(execution_context context, const file_table table, uint32_t* entries, uint32_t* tmp, rsize_t cnt)
+{
+	if (cnt < 2)
+		return;
+
+	rsize_t half = cnt / 2;
+	SortByName(context, table, entries, tmp, half);
+	SortByName(context, table, entries + half, tmp, cnt - half);
+
+	//What's left of the second half is in place already:
+	rsize_t i = 0, j = half, k = 0;
+	while (i < half && j < cnt)
+	{
+		uint8_t first_len, second_len;
+		const wchar_t* first = EntryName(table, entries[i], &first_len);
+		const wchar_t* second = EntryName(table, entries[j], &second_len);
+		if (CompareNames(context, second, second_len, first, first_len) < 0)
+			tmp[k++] = entries[j++];
+		else
+			tmp[k++] = entries[i++];
+	}
+	while (i < half)
+		tmp[k++] = entries[i++];
+	memcpy(entries, tmp, k * sizeof(uint32_t));
+}
+
+//The header goes in last, so a file that's cut short is never taken for a snapshot
+bool WriteSections(execution_context context, mft_snapshot snap, HANDLE out)
+{
+	uint64_t child_cnt = snap->child_start[snap->table.row_cnt];
+	snapshot_header hdr;
+	memset(&hdr, 0, sizeof(snapshot_header));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.section_cnt = SECTION_CNT;
+	hdr.serial = snap->serial;
+	hdr.mft_lsn = snap->mft_lsn;
+	hdr.journal_id = snap->journal_id;
+	hdr.next_usn = snap->next_usn;
+	hdr.row_cnt = snap->table.row_cnt;
+	hdr.name_chars = snap->table.names->buffer_len / sizeof(wchar_t);
+	hdr.child_cnt = child_cnt;
+
+	section sections[SECTION_CNT];
+	SnapshotSections(snap, hdr.name_chars, child_cnt, sections);
+	uint64_t pos = (sizeof(snapshot_header) + 7) & ~7ULL;
+	for (int i = 0; i < SECTION_CNT; ++i)
+	{
+		hdr.offsets[i] = pos;
+		pos += (sections[i].len + 7) & ~7ULL;
+	}
+
+	const uint8_t padding[8] = { 0 };
+	if (!WriteAll(out, &hdr, sizeof(snapshot_header)) || !WriteAll(out, padding, hdr.offsets[0] - sizeof(snapshot_header)))
+		return CleanUpAndFail(NULL, NULL, "Error: Writing the snapshot file failed: %d\n", GetLastError());
+
+	for (int i = 0; i < SECTION_CNT; ++i)
+	{
+		if (!WriteAll(out, *sections[i].column, sections[i].len) || !WriteAll(out, padding, ((sections[i].len + 7) & ~7ULL) - sections[i].len))
+			return CleanUpAndFail(NULL, NULL, "Error: Writing the snapshot file failed: %d\n", GetLastError());
+	}
+
+	LARGE_INTEGER start = { 0 };
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	if (!SetFilePointerEx(out, start, NULL, FILE_BEGIN) || !WriteAll(out, &hdr, sizeof(snapshot_header)))
+		return CleanUpAndFail(NULL, NULL, "Error: Writing the snapshot file failed: %d\n", GetLastError());
+	return true;
+}
+
+bool WriteAll(HANDLE out, const void* data, uint64_t len)
+{
+	for (uint64_t done = 0; done < len;)
+	{
+		DWORD written;
+		DWORD cnt = (DWORD)min(len - done, WRITE_CHUNK_SZ);
+		if (!WriteFile(out, (const uint8_t*)data + done, cnt, &written, NULL) || written != cnt)
+			return false;
+		done += cnt;
+	}
+	return true;
+}
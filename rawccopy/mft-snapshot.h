@@ -0,0 +1,40 @@
+#ifndef MFT_SNAPSHOT_H
+#define MFT_SNAPSHOT_H
+
+#include "context.h"
+#include "file-table.h"
+#include "usn.h"
+
+//A snapshot file keeps the file table of a volume, so it only has to be parsed once. Equal names
+//share their place in the name heap, and every folder has the list of its children, sorted by
+//name like in its index: a file is in there under every name it has in the folder, so with its
+//DOS name as well, and a hard link in every folder it's in. The extra names of the table are
+//only in these lists. The file is mapped read-only and used as is: all pointers go into it.
+typedef struct _mft_snapshot {
+	struct _file_table table;
+	uint32_t* child_start;		// The children of row r are children[child_start[r]] up to children[child_start[r + 1]]
+	uint32_t* children;			// Rows, once for every name of the file in the folder
+	uint32_t* child_name_offs;	// Name of every entry of 'children', offset in the name heap in characters
+	uint8_t* child_name_len;
+	uint8_t* child_name_space;	// FILE_NAME_xxx
+	uint64_t serial;			// Volume serial number
+	uint64_t mft_lsn;			// LSN of the $MFT record when the snapshot was taken
+	uint64_t journal_id;		// Of the USN journal, 0 when the volume didn't have one
+	uint64_t next_usn;			// The changes from this USN on aren't in the snapshot
+	struct _snapshot_map* map;
+} *mft_snapshot;
+
+//Maps the snapshot file of /Snapshot:, after bringing it up to date when it's of another state
+//of the volume. When the USN journal still has all changes since the snapshot was taken, only
+//the records that changed are read again, otherwise the whole MFT is.
+mft_snapshot LoadSnapshot(execution_context context);
+
+bool WriteSnapshot(execution_context context, const file_table table, const usn_journal_info* journal, const wchar_t* path);
+
+//NULL with 'stale' set for a snapshot file of another version, or one that doesn't pass the
+//checks, which is to be made again. Without it, the file couldn't be mapped or isn't a snapshot.
+mft_snapshot MapSnapshot(const wchar_t* path, bool* stale);
+
+void CloseSnapshot(mft_snapshot snap);
+
+#endif //MFT_SNAPSHOT_H
@@ -6,35 +6,20 @@ const unsigned char RecordSignature[] = { 0x46, 0x49, 0x4C, 0x45 }; //FILE signa
 const unsigned char RecordSignatureBad[] = { 0x44, 0x41, 0x41, 0x42 }; // BAAD signature
 
 
-#define MFT_RECORD_IN_USE 0x0001
-#define MFT_RECORD_IS_DIRECTORY 0x0002
-
-#pragma pack (push, 1)
-typedef struct _ntfs_record {
-	/*  0*/ uint8_t magic[4];			// A four-byte magic identifying the record, contains strings like "FILE" or "INDX"
-	/*  4*/ uint16_t usa_offs;			// Offset to the Update Sequence Array from the start of the ntfs record.
-	/*  6*/ uint16_t usa_cnt;			// Number of le16 sized entries in the usa
-}*ntfs_record;
-#pragma pack(pop)
-
-#pragma pack (push, 1)
-typedef struct _raw_mft_record{
-	/*  0*/ struct _ntfs_record;
-
-	/*  8*/	uint64_t lsn;					// $LogFile sequence number for this record. Changed every time the record is modified.
-	/* 16*/	uint16_t seq_nmbr;				// Number of times this mft record has been reused.
-	/* 18*/	uint16_t link_cnt;				// Number of hard links, i.e. the number of directory entries referencing this record.
-	/* 20*/	uint16_t attrs_offs;			// Byte offset to the first attribute in this mft record from the start of the mft record.
-	/* 22*/	uint16_t flags;					// Bit array of fLAGS. When a file is deleted, the MFT_RECORD_IN_USE flag is set to zero.
-	/* 24*/	uint32_t bytes_used;			// Number of bytes used in this mft record.
-	/* 28*/	uint32_t bytes_alloc;			// Number of bytes allocated for this mft record. This should be equal to the mft record size.
-	/* 32*/	uint64_t base_mft_rec;			// This is zero for base mft records. When it is not zero it is a mft reference
-											// pointing to the base mft record to which this record belongs.
-	/* 40*/	uint16_t next_attr_inst;		// The instance number that will be assigned to the next attribute added to this mft record.
-	/* 42*/ uint16_t reserved;				// Reserved/alignment.
-	/* 44*/ uint32_t mft_rec_number;		// Number of this mft record.
-}* raw_mft_record;
-#pragma pack(pop)
+//FetchMFTRecords reads up to this much of the MFT at once, and reads gaps of up to
+//FETCH_GAP_SZ between wanted records along, rather than doing a separate read:
+#define FETCH_READ_SZ 0x100000
+#define FETCH_GAP_SZ 0x10000
+
+//ScanMFT reads up to SCAN_READ_SZ at once. Unused records are skipped when there are
+//at least SCAN_GAP_SZ worth of them, fewer are read along.
+#define SCAN_READ_SZ 0x400000
+#define SCAN_GAP_SZ 0x10000
+
+//Smallest possible attribute header
+#define MIN_ATTRIBUTE_SZ 0x18
+
+#define RecordInUse(bitmap, index) ((bitmap)->buffer[(index) / 8] & (1 << ((index) % 8)))
 
 struct _mft_file {
 	UT_array* mft_recs;			// array holding actual mft records, sorted by record number
@@ -49,7 +34,11 @@ struct _attribute_reader {
 	at_list_entry entry;		// attribute list entry that points to extent, only used for caching purposes when parent uses an Attribute List
 	attribute extent;			// current attribute extent on which the reader is positioned; is equal to attrib, when parent doesn't use Attribute List
 	run_list_iterator iter;		// iterates through the run list in extent if it is non-resident
-	bytes compr_buf;			// buffer to be used in case of a compressed attribute, contains decompressed bytes
+	UT_array* units;			// compression units of a compressed attribute, built on the first read
+	UT_array* fragments;		// on-disk cluster runs of the compression units, split at unit boundaries
+	struct _cached_unit* unit_cache;	// recently decompressed units, UNIT_CACHE_SZ of them
+	uint64_t tick;				// counts the reads, to find the least recently used cached unit
+	bytes staging;				// compressed data of the units waiting to be decompressed
 };
 
 void SetFirstExtent(execution_context context, attribute_reader rdr);
@@ -62,9 +51,67 @@ bool AppendNormalBytesFromAttribRdr(execution_context context, attribute_reader
 
 bool AppendCompressedBytesFromAttribRdr(execution_context context, attribute_reader rdr, int64_t offset, uint64_t cnt, bytes dest, rsize_t pos);
 
-//Simple forward iterator through all the attributes in an MFT file record:
-attribute FirstAttr(bytes mft_rec);
-attribute NextAttr(bytes mft_rec, const attribute cur);
+attribute CheckAttr(bytes mft_rec, attribute attr);
+
+//Compression units, as found in the run list of a compressed attribute:
+#define UNIT_SPARSE 0			// no clusters on disk, all zeros
+#define UNIT_RAW 1				// all clusters on disk, stored as they are
+#define UNIT_COMPRESSED 2		// clusters on disk followed by sparse ones, LZNT1 compressed
+
+typedef struct {
+	uint64_t first_frag;		// index of the unit's first fragment in the fragment list
+	uint32_t frag_cnt;			// number of fragments, ie on-disk runs, in the unit
+	uint32_t kind;				// UNIT_SPARSE, UNIT_RAW or UNIT_COMPRESSED
+	uint64_t data_cl;			// number of clusters on disk
+	uint64_t sparse_cl;			// number of sparse clusters
+} compression_unit;
+
+typedef struct {
+	uint64_t lcn;				// first cluster of the fragment on the volume
+	uint64_t cnt;				// number of clusters
+} unit_fragment;
+
+static const UT_icd unit_icd = { sizeof(compression_unit), NULL, NULL, NULL };
+static const UT_icd fragment_icd = { sizeof(unit_fragment), NULL, NULL, NULL };
+
+#define UNIT_CACHE_SZ 16
+
+typedef struct _cached_unit {
+	uint64_t unit;				// number of the unit in data, UINT64_MAX if the entry is unused
+	uint64_t last_use;			// tick of the last read that used the unit
+	bytes data;					// decompressed unit
+} cached_unit;
+
+//A compression unit waiting to be decompressed, offsets are used until the buffers are final
+typedef struct {
+	rsize_t src_offs;			// start of the compressed data in the staging buffer
+	rsize_t src_len;			// size of the compressed data
+	rsize_t dst_offs;			// where the unit, or the part of it that was asked for, goes in the destination buffer
+	rsize_t unit_sz;			// size of the decompressed unit
+	cached_unit* cache;			// cache entry that receives the unit, NULL to decompress straight into the destination
+	rsize_t skip;				// start of the part that was asked for, if the unit goes through the cache
+	rsize_t len;				// size of that part
+	const uint8_t* src;
+	uint8_t* dst;
+	bool ok;
+} unit_job;
+
+static const UT_icd unit_job_icd = { sizeof(unit_job), NULL, NULL, NULL };
+
+//Maps the run list of a compressed attribute on its compression units
+bool BuildUnitIndex(execution_context context, attribute_reader rdr);
+
+//Appends 'cnt' bytes from the on-disk clusters of a unit, starting 'skip' bytes into them
+bool AppendUnitClusters(execution_context context, attribute_reader rdr, const compression_unit* unit, uint64_t skip, uint64_t cnt, bytes dest);
+
+cached_unit* FindCachedUnit(attribute_reader rdr, uint64_t unit_nr);
+
+//Hands out the least recently used cache entry for a unit that's about to be decompressed
+cached_unit* ClaimCachedUnit(attribute_reader rdr, uint64_t unit_nr, rsize_t unit_sz);
+
+bool DecompressUnits(execution_context context, UT_array* jobs, bytes staging, bytes dest);
+
+void DecompressUnit(void* item, void* shared);
 
 //Some housekeeping functions for the record list in mft_rec:
 
@@ -79,10 +126,18 @@ attribute NextAttr(bytes mft_rec, const attribute cur);
 //buffer. If it hasn't been cached, retrieves it from disk first.
 bytes RetrieveSubMFT(execution_context context, mft_file parent, uint64_t index);
 
+//Fixes up a record that was read as part of a bigger read, and checks it's record 'index' and in use
+bool ValidRecord(execution_context context, bytes raw, uint64_t index, bool in_use);
+
 //Compares an mft number to the one in an mft record.
 //Used for sorting/inserting mft records
 int MFTIDCompare(const void* id, const void* mft, void* context);
 
+//Adds a range to a sorted list of ranges, merging it with the ones it touches
+void AddRange(UT_array* ranges, uint64_t start, uint64_t end);
+
+static const UT_icd range_icd = { sizeof(byte_range), NULL, NULL, NULL };
+
 #define AppendBytesFromVolRdr(context, offset, cnt, dest, pos)	\
 	AppendBytesFromDiskRdr(((execution_context)(context))->dr,			\
 						((offset) < 0 ? (offset) : (offset) + ((execution_context)(context))->parameters->image_offs), (cnt), (dest), (pos))
@@ -96,6 +151,11 @@ bool DoFixUp(bytes record, uint16_t sector_sz)
 {
 	ntfs_record hdr = (ntfs_record)(record->buffer);
 
+	//A damaged header makes a damaged record, the array and the sectors it patches have to fit:
+	if (record->buffer_len < sizeof(struct _ntfs_record) || hdr->usa_offs % 2 || !hdr->usa_cnt ||
+			hdr->usa_offs + 2ULL * hdr->usa_cnt > record->buffer_len || (hdr->usa_cnt - 1ULL) * sector_sz > record->buffer_len)
+		return false;
+
 	for (uint32_t i = 1; i < hdr->usa_cnt; ++i)
 		if (!Equals(record, hdr->usa_offs, record, (uint64_t)sector_sz * i - 2, 2))
 			return false;
@@ -154,6 +214,11 @@ mft_file LoadMFTFile(execution_context context, uint64_t index)
 	if (!rec)
 		return NULL;
 
+	return MFTFileFromRecord(context, rec);
+}
+
+mft_file MFTFileFromRecord(execution_context context, bytes rec)
+{
 	SafeCreate(result, mft_file);
 	
 	result->mft_recs = ListOfBuffers();
@@ -190,6 +255,154 @@ mft_file LoadMFTFile(execution_context context, uint64_t index)
 	return result;
 }
 
+bool FetchMFTRecords(execution_context context, const uint64_t* refs, rsize_t cnt, record_callback callback, void* state)
+{
+	attribute mft_data = FirstAttribute(context, context->mft_table, AttrTypeFlag(ATTR_DATA));
+	attribute_reader rdr = mft_data ? OpenAttributeReader(context, context->mft_table, mft_data) : NULL;
+	if (!rdr)
+		return CleanUpAndFail(NULL, NULL, "Error: Unable to read the MFT.\n");
+
+	bytes buffer = CreateEmpty();
+	uint64_t max_gap = max(FETCH_GAP_SZ / context->mft_record_sz, 1);
+	uint64_t recs_per_read = max(FETCH_READ_SZ / context->mft_record_sz, 1);
+	bool result = buffer != NULL;
+	for (rsize_t i = 0; result && i < cnt; )
+	{
+		//Records that are close to each other are read together, the ones in between included:
+		uint64_t first = refs[i] & 0x0000FFFFFFFFFFFF;
+		rsize_t last = i;
+		while (last + 1 < cnt && (refs[last + 1] & 0x0000FFFFFFFFFFFF) - (refs[last] & 0x0000FFFFFFFFFFFF) <= max_gap &&
+				(refs[last + 1] & 0x0000FFFFFFFFFFFF) - first < recs_per_read)
+			++last;
+
+		uint64_t rec_cnt = (refs[last] & 0x0000FFFFFFFFFFFF) - first + 1;
+		if (!(result = AppendBytesFromAttribRdr(context, rdr, first * context->mft_record_sz, rec_cnt * context->mft_record_sz, buffer, 0)))
+			break;
+
+		for (; i <= last; ++i)
+		{
+			uint64_t index = refs[i] & 0x0000FFFFFFFFFFFF;
+			if ((index - first + 1) * context->mft_record_sz > buffer->buffer_len)
+				continue;
+
+			struct _bytes raw = { buffer->buffer + (index - first) * context->mft_record_sz, context->mft_record_sz };
+
+			//Deleted and reused records are skipped, they don't belong to the reference any more:
+			if (!ValidRecord(context, &raw, index, true) || ((refs[i] >> 48) && ((raw_mft_record)raw.buffer)->seq_nmbr != (refs[i] >> 48)))
+				continue;
+
+			bytes copy = FromBuffer(raw.buffer, raw.buffer_len);
+			mft_file file = copy ? MFTFileFromRecord(context, copy) : NULL;
+			if (!file)
+			{
+				result = false;
+				break;
+			}
+			callback(context, refs[i], file, state);
+			DeleteMFTFile(file);
+		}
+	}
+
+	if (buffer)
+		DeleteBytes(buffer);
+	CloseAttributeReader(rdr);
+	return result;
+}
+
+bool ScanMFT(execution_context context, uint32_t scan_flags, scan_callback callback, void* state)
+{
+	//$MFT has a bitmap with a bit for every record, telling whether it's in use:
+	attribute mft_data = FirstAttribute(context, context->mft_table, AttrTypeFlag(ATTR_DATA));
+	attribute bitmap_attr = FirstAttribute(context, context->mft_table, AttrTypeFlag(ATTR_BITMAP));
+	bytes bitmap = mft_data && bitmap_attr ? GetBytesFromAttrib(context, context->mft_table, bitmap_attr, 0, AttributeSize(bitmap_attr)) : NULL;
+	if (!bitmap)
+		return CleanUpAndFail(NULL, NULL, "Error: Unable to read the MFT bitmap.\n");
+
+	uint64_t recs_per_read = max(SCAN_READ_SZ / context->mft_record_sz, 1);
+	uint64_t max_gap = max(SCAN_GAP_SZ / context->mft_record_sz, 1);
+	uint64_t rec_cnt = min(AttributeSize(mft_data) / context->mft_record_sz, (uint64_t)bitmap->buffer_len * 8);
+	record_batch batch = { 0, 0, NULL };
+	SafeAlloc(batch.records, recs_per_read);
+
+	attribute_reader rdr = OpenAttributeReader(context, context->mft_table, mft_data);
+	bytes buffer = CreateEmpty();
+	bool result = rdr && buffer;
+	//What's left of deleted files is in the records that aren't in use, so then all are read:
+	bool deleted = scan_flags & SCAN_DELETED;
+	for (uint64_t first = 0; result && first < rec_cnt; )
+	{
+		if (!deleted && !(first % 8) && !bitmap->buffer[first / 8])
+		{
+			first += 8;
+			continue;
+		}
+		if (!deleted && !RecordInUse(bitmap, first))
+		{
+			++first;
+			continue;
+		}
+
+		//The read ends before the first gap that's worth skipping:
+		uint64_t end = first + 1, gap = 0;
+		for (; end < rec_cnt && end - first < recs_per_read && gap < max_gap; ++end)
+			gap = deleted || RecordInUse(bitmap, end) ? 0 : gap + 1;
+		end -= gap;
+
+		if (!(result = AppendBytesFromAttribRdr(context, rdr, first * context->mft_record_sz,
+												(end - first) * context->mft_record_sz, buffer, 0)))
+			break;
+
+		batch.first = first;
+		batch.cnt = (rsize_t)(end - first);
+		for (rsize_t i = 0; i < batch.cnt; ++i)
+		{
+			batch.records[i].buffer = buffer->buffer + i * context->mft_record_sz;
+			batch.records[i].buffer_len = context->mft_record_sz;
+			if ((!deleted && !RecordInUse(bitmap, first + i)) || !ValidRecord(context, batch.records + i, first + i, !deleted))
+				batch.records[i].buffer = NULL;
+		}
+		if (!callback(context, &batch, state))
+			break;
+		first = end;
+	}
+
+	if (!result)
+		printf("Error: Reading the MFT failed.\n");
+	if (buffer)
+		DeleteBytes(buffer);
+	if (rdr)
+		CloseAttributeReader(rdr);
+	free(batch.records);
+	DeleteBytes(bitmap);
+	return result;
+}
+
+rsize_t RunSlices(execution_context context, const record_batch* batch, UT_array* slices, item_job job, void* shared)
+{
+	rsize_t slice_cnt = (batch->cnt + SLICE_RECORDS - 1) / SLICE_RECORDS;
+	while (utarray_len(slices) < slice_cnt)
+		utarray_extend_back(slices);
+
+	for (rsize_t i = 0; i < slice_cnt; ++i)
+	{
+		batch_slice* slice = (batch_slice*)utarray_eltptr(slices, i);
+		slice->batch = batch;
+		slice->first = i * SLICE_RECORDS;
+		slice->cnt = min(SLICE_RECORDS, batch->cnt - slice->first);
+	}
+
+	RunParallel(context->workers, job, utarray_front(slices), slices->icd.sz, slice_cnt, shared);
+	return slice_cnt;
+}
+
+//With 'in_use' cleared, records that aren't in use pass too when they're intact
+bool ValidRecord(execution_context context, bytes raw, uint64_t index, bool in_use)
+{
+	raw_mft_record rec = (raw_mft_record)raw->buffer;
+	return !strncmp(rec->magic, (unsigned char*)RecordSignature, 4) && DoFixUp(raw, context->boot->bytes_per_sector) &&
+			(!in_use || (rec->flags & MFT_RECORD_IN_USE)) && rec->mft_rec_number == index;
+}
+
 attribute FirstAttribute(execution_context context, mft_file mft_rec, uint32_t attribute_mask)
 {
 	bytes at_rec = NULL;
@@ -270,6 +483,28 @@ void DeleteMFTFile(mft_file file)
 	free(file);
 }
 
+uint64_t RecordLSN(const mft_file file)
+{
+	bytes* rec = utarray_front(file->mft_recs);
+	return rec ? ((raw_mft_record)(*rec)->buffer)->lsn : 0;
+}
+
+bytes FileRecord(const mft_file file, uint64_t index)
+{
+	int32_t rec_ind = FindInArray(file->mft_recs, &index, NULL, MFTIDCompare);
+	bytes* rec = rec_ind < 0 ? NULL : (bytes*)utarray_eltptr(file->mft_recs, (size_t)rec_ind);
+	return rec ? *rec : NULL;
+}
+
+void AppendExtensionRefs(const mft_file file, uint64_t index, UT_array* refs)
+{
+	for (at_list_entry ent = FirstAttributeListEntry(file); ent && ent->length; ent = NextAttributeListEntry(file, ent))
+	{
+		if ((ent->mft_ref & 0x0000FFFFFFFFFFFF) != index)
+			utarray_push_back(refs, &ent->mft_ref);
+	}
+}
+
 attribute_reader OpenAttributeReader(execution_context context, mft_file mft_rec, const attribute attrib)
 {
 	SafeCreate(result, attribute_reader);
@@ -279,14 +514,12 @@ attribute_reader OpenAttributeReader(execution_context context, mft_file mft_rec
 	result->position = 0;
 	result->iter = NULL;
 
-	SetFirstExtent(context, result);
+	result->units = result->fragments = NULL;
+	result->unit_cache = NULL;
+	result->tick = 0;
+	result->staging = NULL;
 
-	if (attrib->flags & ATTR_IS_COMPRESSED)
-	{
-		result->compr_buf = CreateEmpty();
-	}
-	else
-		result->compr_buf = NULL;
+	SetFirstExtent(context, result);
 
 	return result;
 }
@@ -296,8 +529,22 @@ void CloseAttributeReader(attribute_reader rdr)
 	if (rdr->iter)
 		CloseRunListIterator(rdr->iter);
 
-	if (rdr->compr_buf)
-		DeleteBytes(rdr->compr_buf);
+	if (rdr->units)
+		utarray_free(rdr->units);
+
+	if (rdr->fragments)
+		utarray_free(rdr->fragments);
+
+	if (rdr->unit_cache)
+	{
+		for (int i = 0; i < UNIT_CACHE_SZ; ++i)
+			if (rdr->unit_cache[i].data)
+				DeleteBytes(rdr->unit_cache[i].data);
+		free(rdr->unit_cache);
+	}
+
+	if (rdr->staging)
+		DeleteBytes(rdr->staging);
 
 	free(rdr);
 }
@@ -358,7 +605,7 @@ bool AppendBytesFromAttribRdr(execution_context context, attribute_reader rdr, i
 	uint64_t read_cnt = cnt = min(cnt, AttributeSize(rdr->attrib) - start_pos);
 	
 	if (rdr->attrib->non_resident && rdr->attrib->init_sz != rdr->attrib->real_sz)
-		read_cnt = max(0, (int64_t)rdr->attrib->init_sz - start_pos);
+		read_cnt = rdr->attrib->init_sz > start_pos ? min(cnt, rdr->attrib->init_sz - start_pos) : 0;
 
 	bool result = true;
 	if (read_cnt > 0)
@@ -372,7 +619,11 @@ bool AppendBytesFromAttribRdr(execution_context context, attribute_reader rdr, i
 	}
 	result = result && (dest->buffer_len == pos + read_cnt);
 	if (result && read_cnt < cnt)
+	{
+		//Beyond the initialized size, there are only zeros:
 		SetBytes(dest, 0, dest->buffer_len, (rsize_t)(cnt - read_cnt));
+		rdr->position = start_pos + cnt;
+	}
 
 	return result;
 }
@@ -434,164 +685,205 @@ bool AppendNormalBytesFromAttribRdr(execution_context context, attribute_reader
 
 bool AppendCompressedBytesFromAttribRdr(execution_context context, attribute_reader rdr, int64_t offset, uint64_t cnt, bytes dest, rsize_t pos)
 {
-	uint64_t block_sz = (1ULL << rdr->attrib->compr_unit);
-	uint64_t block_sz_bt = block_sz *context->cluster_sz;
-
-	if (offset == 0)
-		SetFirstExtent(context, rdr);
-	else if (offset > 0)
-	{
-		uint64_t start_cl = (offset / block_sz_bt) * block_sz;
-
-		//First find the extent that contains the start of the buffer in which offset is
-		for (SetFirstExtent(context, rdr); rdr->extent && rdr->extent->end_vcn < start_cl; SetNextExtent(context, rdr));
-		if (!rdr->extent)
-			return false;
+	if (!rdr->units && !BuildUnitIndex(context, rdr))
+		return false;
 
-		//Next, move the iterator forward until we reach the mapping pair that contains offset
-		for (; !rdr->iter->end_of_runs && rdr->iter->next_vcn <= start_cl; NextRun(rdr->iter));
-		if (rdr->iter->end_of_runs)
-			return false;
+	uint64_t unit_sz = (1ULL << rdr->attrib->compr_unit) * context->cluster_sz;
+	if (offset < 0)
+		offset = rdr->position;
+	++rdr->tick;
 
-		//At this point, offset is contained in the current mapping pair of rdr->iter
-		//We now need to update the state of the reader to ensure consistency between
-		//rdr->position and offset AND make sure that rdr->position is block-aligned
+	//Every unit is handled on its own, so a read can start anywhere. Sparse and raw units
+	//are simply copied, compressed ones are served from the cache or collected in jobs,
+	//that are decompressed together in the end:
+	RightTrim(rdr->staging, rdr->staging->buffer_len);
+	UT_array* jobs;
+	utarray_new(jobs, &unit_job_icd);
 
-		if (offset % block_sz_bt)
+	bool result = true;
+	for (uint64_t cur = offset; result && cur < offset + cnt; )
+	{
+		uint64_t unit_nr = cur / unit_sz;
+		uint64_t skip = cur % unit_sz;
+		uint64_t delta = min(unit_sz - skip, offset + cnt - cur);
+		compression_unit* unit = unit_nr < utarray_len(rdr->units) ? utarray_eltptr(rdr->units, (unsigned int)unit_nr) : NULL;
+		cached_unit* hit;
+
+		if (!unit || unit->kind == UNIT_SPARSE)
+			SetBytes(dest, 0, dest->buffer_len, (rsize_t)delta);
+		else if (unit->kind == UNIT_RAW)
+			result = AppendUnitClusters(context, rdr, unit, skip, delta, dest);
+		else if ((hit = FindCachedUnit(rdr, unit_nr)))
+			Append(dest, hit->data, (rsize_t)skip, (rsize_t)delta);
+		else
 		{
-			//It's not block-aligned
-			//Set position to start of block before offset...
-			rdr->position = context->cluster_sz * start_cl;
-			RightTrim(rdr->compr_buf, rdr->compr_buf->buffer_len);
+			//A unit that is only partly needed goes through the cache, so that the next read
+			//(which most likely continues in the same unit) doesn't need to decompress it again:
+			unit_job job = { rdr->staging->buffer_len, (rsize_t)(unit->data_cl * context->cluster_sz), dest->buffer_len, (rsize_t)unit_sz,
+				delta < unit_sz ? ClaimCachedUnit(rdr, unit_nr, (rsize_t)unit_sz) : NULL, (rsize_t)skip, (rsize_t)delta };
+			result = AppendUnitClusters(context, rdr, unit, 0, job.src_len, rdr->staging);
+			Reserve(dest, dest->buffer_len + (rsize_t)delta);
+			utarray_push_back(jobs, &job);
+		}
+		cur += delta;
+	}
 
-			//and get that block from a recursive call:
-			AppendCompressedBytesFromAttribRdr(context, rdr, -1, block_sz_bt, rdr->compr_buf, 0);
-			uint64_t delta = min(rdr->position - offset, cnt);
-			uint64_t buf_end = min(block_sz_bt, cnt);
+	if (result && !(result = DecompressUnits(context, jobs, rdr->staging, dest)))
+		printf("Decompression error.\n");
+	utarray_free(jobs);
 
-			Append(dest, rdr->compr_buf, (rsize_t)(offset % block_sz_bt), (rsize_t)delta);
+	rdr->position = offset + cnt;
+	return result;
+}
 
-			if (offset + cnt <= rdr->position)
-			{
-				//cnt was small enough to stay in the same block, we're done here:
-				rdr->position = offset + cnt;
-				return true;
-			}
-		}
-		else
-			rdr->position = offset;
-	}
-	else //offset < 0, the continuation case
+bool BuildUnitIndex(execution_context context, attribute_reader rdr)
+{
+	uint64_t unit_cl = 1ULL << rdr->attrib->compr_unit;
+	utarray_new(rdr->units, &unit_icd);
+	utarray_new(rdr->fragments, &fragment_icd);
+	rdr->staging = CreateEmpty();
+	SafeAlloc(rdr->unit_cache, UNIT_CACHE_SZ);
+	for (int i = 0; i < UNIT_CACHE_SZ; ++i)
 	{
-		offset = rdr->position;
-		//The "normal" continuation case would be to have an empty buffer, with 'position' set at the start
-		//of a new block, which would indicate we've handled a complete one last time.
-		//In that case, no action would be needed, and we could go straight into the main loop
-		if ((rdr->compr_buf->buffer_len != 0 || offset % block_sz_bt != 0))
-		{
-			uint64_t skip = offset % block_sz_bt;
-			uint64_t delta = min(block_sz_bt - skip, cnt);
-			if (rdr->compr_buf->buffer_len == 0 && skip != 0)
-				//We're not in that case however, this means we have an incomplete sparse (because buffer is empty)
-				//block to handle
-				SetBytes(dest, 0, dest->buffer_len, (rsize_t)delta);
-			else if (rdr->compr_buf->buffer_len == block_sz_bt)
-				//State of reader is OK from last time, just need to handle what was in the buffer
-				AppendAt(dest, pos, rdr->compr_buf, (rsize_t)skip, (rsize_t)delta);
-			else if (rdr->compr_buf->buffer_len != 0)
-				return CleanUpAndFail(NULL, NULL, "Inconsistent state of attribute reader.\n");
-
-			if (skip + delta > 0 && skip + delta < block_sz_bt)
-			{
-				//cnt was small enough to stay in the same block, we're done here:
-				rdr->position = offset + cnt;
-				return true;
-			}
-			rdr->position = offset + delta;
-		}
+		rdr->unit_cache[i].unit = UINT64_MAX;
+		rdr->unit_cache[i].last_use = 0;
+		rdr->unit_cache[i].data = NULL;
 	}
 
-	uint64_t block_st = dest->buffer_len;
-	uint64_t empty_cnt = 0;
-	//uint64_t end_pos = ((offset + cnt + block_sz_bt - 1) / block_sz_bt) * block_sz_bt;
-	uint64_t end_cl = ((offset + cnt + block_sz_bt - 1) / block_sz_bt) * block_sz;
-	bytes compr_bf = CreateEmpty();
-
-	for (; rdr->extent; SetNextExtent(context, rdr))
+	for (SetFirstExtent(context, rdr); rdr->extent; SetNextExtent(context, rdr))
 	{
+		if (!rdr->iter)
+			return CleanUpAndFail(NULL, NULL, "Compressed attribute is resident.\n");
+
 		for (; !rdr->iter->end_of_runs; NextRun(rdr->iter))
 		{
-			if (rdr->iter->cur_lcn != 0)
-			{
-				//Real clusters, can either be part of a compressed or non-compressed block;
-				//Simply append them to dest:
-				uint64_t clust_cnt = min(end_cl, rdr->iter->next_vcn) - rdr->iter->cur_vcn;
-				uint64_t skip_cl = max(rdr->position / context->cluster_sz, rdr->iter->cur_vcn) - rdr->iter->cur_vcn;
-
-				AppendBytesFromVolRdr(context, context->cluster_sz*(rdr->iter->cur_lcn + skip_cl),
-							context->cluster_sz * (clust_cnt - skip_cl), dest, dest->buffer_len);
-
-				//All full-sized blocks between block_st and end of dest are normal, we can simply
-				//commit these, by advancing block_st
-
-				block_st = dest->buffer_len - (dest->buffer_len - block_st) % block_sz_bt;
-				rdr->position += context->cluster_sz * (clust_cnt - skip_cl);
-
-				//If we have sparse buffers pending, that would result in an inconsistency,
-				//therefore we should flush them, maybe add error handling later on:
-				empty_cnt = 0;
-			}
-			else
+			//Split the run at the unit boundaries:
+			for (uint64_t vcn = rdr->iter->cur_vcn; vcn < rdr->iter->next_vcn; )
 			{
-				uint64_t extra_clust = min(end_cl, rdr->iter->next_vcn) - max(rdr->iter->cur_vcn, rdr->position / context->cluster_sz);
-				empty_cnt += extra_clust;
-				rdr->position += context->cluster_sz * extra_clust;
+				uint64_t unit_nr = vcn / unit_cl;
+				uint64_t clust_cnt = min(rdr->iter->next_vcn, (unit_nr + 1) * unit_cl) - vcn;
 
-				uint64_t cl_len = (dest->buffer_len - block_st) / context->cluster_sz;
-				if (cl_len > 0ULL)
+				//Units not covered by the run list (which shouldn't happen) are sparse:
+				while (utarray_len(rdr->units) <= unit_nr)
 				{
-					//Compressed block:
-					if (cl_len + empty_cnt >= block_sz)
-					{
-						Reserve(compr_bf, (rsize_t)block_sz_bt);
-						//Decompress the block starting at block_sz into the buffer:
-						if (!LZNT1Decompress(dest, (rsize_t)block_st, compr_bf, 0))
-							return CleanUpAndFail(DeleteBytes, compr_bf, "Decompression error.\n");
-
-						//Copy the result back into dest:
-						AppendAt(dest, (rsize_t)block_st, compr_bf, 0, (rsize_t)block_sz_bt);
-						block_st += block_sz_bt;
-						empty_cnt -= (block_sz - cl_len);
-					}
+					compression_unit empty = { utarray_len(rdr->fragments), 0, UNIT_SPARSE, 0, 0 };
+					utarray_push_back(rdr->units, &empty);
 				}
-				if (empty_cnt >= block_sz)
+
+				compression_unit* unit = utarray_back(rdr->units);
+				if (rdr->iter->cur_lcn)
 				{
-					uint64_t delta = context->cluster_sz * empty_cnt;
-					SetBytes(dest, 0, dest->buffer_len, (rsize_t)delta);
-					block_st += delta;
-					empty_cnt -= empty_cnt;
+					unit_fragment frag = { rdr->iter->cur_lcn + vcn - rdr->iter->cur_vcn, clust_cnt };
+					utarray_push_back(rdr->fragments, &frag);
+					unit->frag_cnt++;
+					unit->data_cl += clust_cnt;
 				}
+				else
+					unit->sparse_cl += clust_cnt;
+				vcn += clust_cnt;
 			}
+		}
+	}
 
-			if (rdr->position >= end_cl * context->cluster_sz)
-				break;
+	//A unit with all of its clusters on disk isn't compressed; note that this also goes for a
+	//last unit that is cut short by the end of the run list:
+	for (compression_unit* unit = utarray_front(rdr->units); unit; unit = utarray_next(rdr->units, unit))
+		unit->kind = !unit->data_cl ? UNIT_SPARSE : (unit->sparse_cl ? UNIT_COMPRESSED : UNIT_RAW);
+
+	//The walk through the run list has moved the reader to the end, put it back:
+	SetFirstExtent(context, rdr);
+	return true;
+}
+
+bool AppendUnitClusters(execution_context context, attribute_reader rdr, const compression_unit* unit, uint64_t skip, uint64_t cnt, bytes dest)
+{
+	unit_fragment* frag = utarray_eltptr(rdr->fragments, (unsigned int)unit->first_frag);
+	for (uint32_t i = 0; cnt && i < unit->frag_cnt; ++i, ++frag)
+	{
+		uint64_t frag_sz = frag->cnt * context->cluster_sz;
+		if (skip >= frag_sz)
+		{
+			skip -= frag_sz;
+			continue;
 		}
 
-		if (rdr->position >= end_cl * context->cluster_sz)
-			break;
+		uint64_t delta = min(frag_sz - skip, cnt);
+		if (!AppendBytesFromVolRdr(context, frag->lcn * context->cluster_sz + skip, delta, dest, dest->buffer_len))
+			return false;
+		cnt -= delta;
+		skip = 0;
 	}
 
-	if ((offset + cnt) % block_sz_bt != 0)
+	return !cnt;
+}
+
+cached_unit* FindCachedUnit(attribute_reader rdr, uint64_t unit_nr)
+{
+	for (int i = 0; i < UNIT_CACHE_SZ; ++i)
 	{
-		RightTrim(rdr->compr_buf, rdr->compr_buf->buffer_len);
-		//Keep the last block for a  potential next read:
-		AppendAt(rdr->compr_buf, 0, dest, dest->buffer_len - (rsize_t)block_sz_bt, (rsize_t)block_sz_bt);
-		RightTrim(dest, (rsize_t)(block_sz_bt - (offset + cnt) % block_sz_bt));
-		rdr->position = offset + cnt;
+		if (rdr->unit_cache[i].unit == unit_nr)
+		{
+			rdr->unit_cache[i].last_use = rdr->tick;
+			return rdr->unit_cache + i;
+		}
 	}
-	DeleteBytes(compr_bf);
+	return NULL;
+}
 
-	return true;
+cached_unit* ClaimCachedUnit(attribute_reader rdr, uint64_t unit_nr, rsize_t unit_sz)
+{
+	//Entries claimed during the current read have the current tick, so they're never
+	//handed out twice in the same read:
+	cached_unit* result = rdr->unit_cache;
+	for (int i = 1; i < UNIT_CACHE_SZ; ++i)
+		if (rdr->unit_cache[i].last_use < result->last_use)
+			result = rdr->unit_cache + i;
+
+	if (!result->data)
+		result->data = CreateEmpty();
+	Reserve(result->data, unit_sz);
+
+	result->unit = unit_nr;
+	result->last_use = rdr->tick;
+	return result;
+}
+
+bool DecompressUnits(execution_context context, UT_array* jobs, bytes staging, bytes dest)
+{
+	//All buffers have reached their final size, so the offsets can be turned into pointers now:
+	for (unit_job* job = utarray_front(jobs); job; job = utarray_next(jobs, job))
+	{
+		job->src = staging->buffer + job->src_offs;
+		job->dst = job->cache ? job->cache->data->buffer : dest->buffer + job->dst_offs;
+	}
+
+	RunParallel(context->workers, DecompressUnit, utarray_front(jobs), sizeof(unit_job), utarray_len(jobs), NULL);
+
+	bool result = true;
+	for (unit_job* job = utarray_front(jobs); job; job = utarray_next(jobs, job))
+	{
+		if (!job->ok)
+		{
+			//Don't leave garbage behind in the cache:
+			if (job->cache)
+				job->cache->unit = UINT64_MAX;
+			result = false;
+		}
+		else if (job->cache)
+			memcpy(dest->buffer + job->dst_offs, job->cache->data->buffer + job->skip, job->len);
+	}
+
+	return result;
+}
+
+void DecompressUnit(void* item, void* shared)
+{
+	unit_job* job = item;
+	long len = LZNT1DecompressBuffer(job->src, job->src_len, job->dst, job->unit_sz);
+
+	//A unit that decompresses to less than its full size is padded with zeros:
+	if ((job->ok = (len >= 0)) && (rsize_t)len < job->unit_sz)
+		memset(job->dst + len, 0, job->unit_sz - len);
 }
 
 bool AppendBytesFromRuns(execution_context context, const attribute attr, uint64_t cnt, bytes dest, uint64_t pos)
@@ -614,6 +906,63 @@ bool AppendBytesFromRuns(execution_context context, const attribute attr, uint64
 	return true;
 }
 
+UT_array* ZeroRanges(execution_context context, mft_file mft_rec, const attribute attrib)
+{
+	UT_array* result;
+	utarray_new(result, &range_icd);
+	if (!attrib->non_resident)
+		return result;
+
+	//Within a compressed attribute, sparse clusters at the end of a compression unit
+	//are part of the compressed data, so only complete units count:
+	uint64_t unit_sz = (attrib->flags & ATTR_IS_COMPRESSED) ? (1ULL << attrib->compr_unit) * context->cluster_sz : context->cluster_sz;
+	uint64_t size = AttributeSize(attrib);
+
+	attribute_reader rdr = OpenAttributeReader(context, mft_rec, attrib);
+	for (; rdr->extent; SetNextExtent(context, rdr))
+	{
+		if (!rdr->extent->non_resident)
+			continue;
+
+		for (; !rdr->iter->end_of_runs; NextRun(rdr->iter))
+		{
+			if (rdr->iter->cur_lcn)
+				continue;
+
+			uint64_t start = ((rdr->iter->cur_vcn * context->cluster_sz + unit_sz - 1) / unit_sz) * unit_sz;
+			uint64_t end = min(size, ((rdr->iter->next_vcn * context->cluster_sz) / unit_sz) * unit_sz);
+			if (start < end)
+				AddRange(result, start, end);
+		}
+	}
+	CloseAttributeReader(rdr);
+
+	if (attrib->init_sz < size)
+		AddRange(result, attrib->init_sz, size);
+
+	return result;
+}
+
+void AddRange(UT_array* ranges, uint64_t start, uint64_t end)
+{
+	//Swallow the ranges that start inside the new one...
+	for (byte_range* last = utarray_back(ranges); last && last->offset >= start; last = utarray_back(ranges))
+	{
+		end = max(end, last->offset + last->length);
+		utarray_pop_back(ranges);
+	}
+
+	//...and extend the one that touches it:
+	byte_range* last = utarray_back(ranges);
+	if (last && last->offset + last->length >= start)
+		last->length = max(end, last->offset + last->length) - last->offset;
+	else
+	{
+		byte_range new_range = { start, end - start };
+		utarray_push_back(ranges, &new_range);
+	}
+}
+
 void SetFirstExtent(execution_context context, attribute_reader rdr)
 {
 	rdr->extent = NULL;
@@ -714,6 +1063,41 @@ attribute NextAttr(bytes mft_rec, const attribute cur)
 		return result;
 }
 
+//Every attribute (and the type of the next one) has to be within the used part of the record
+attribute CheckAttr(bytes mft_rec, attribute attr)
+{
+	if (!attr)
+		return NULL;
+
+	rsize_t end = min(((raw_mft_record)(mft_rec->buffer))->bytes_used, mft_rec->buffer_len);
+	rsize_t offs = (uint8_t*)attr - mft_rec->buffer;
+	if (offs + MIN_ATTRIBUTE_SZ > end || attr->length < MIN_ATTRIBUTE_SZ || offs + attr->length + sizeof(uint32_t) > end)
+		return NULL;
+	return attr;
+}
+
+attribute FirstCheckedAttr(bytes mft_rec)
+{
+	raw_mft_record hdr = (raw_mft_record)(mft_rec->buffer);
+	if ((rsize_t)hdr->attrs_offs + sizeof(uint32_t) > min(hdr->bytes_used, mft_rec->buffer_len))
+		return NULL;
+	return CheckAttr(mft_rec, FirstAttr(mft_rec));
+}
+
+attribute NextCheckedAttr(bytes mft_rec, const attribute cur)
+{
+	return CheckAttr(mft_rec, NextAttr(mft_rec, cur));
+}
+
+//Compared without adding value_offs and value_len, so a value_len near 4GB can't wrap around
+void* ResidentValue(const attribute attr, rsize_t min_len)
+{
+	if (attr->non_resident || attr->value_len < min_len || attr->value_len > attr->length ||
+			attr->value_offs > attr->length - attr->value_len)
+		return NULL;
+	return (uint8_t*)attr + attr->value_offs;
+}
+
 
 bytes RetrieveSubMFT(execution_context context, mft_file parent, uint64_t index)
 {
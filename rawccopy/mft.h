@@ -21,14 +21,69 @@
 #define UPCASE_TABLE_NUMBER              (0xa)   //  $UpCase
 
 
+#define MFT_RECORD_IN_USE 0x0001
+#define MFT_RECORD_IS_DIRECTORY 0x0002
+
+#pragma pack (push, 1)
+typedef struct _ntfs_record {
+	/*  0*/ uint8_t magic[4];			// A four-byte magic identifying the record, contains strings like "FILE" or "INDX"
+	/*  4*/ uint16_t usa_offs;			// Offset to the Update Sequence Array from the start of the ntfs record.
+	/*  6*/ uint16_t usa_cnt;			// Number of le16 sized entries in the usa
+}*ntfs_record;
+#pragma pack(pop)
+
+#pragma pack (push, 1)
+typedef struct _raw_mft_record{
+	/*  0*/ struct _ntfs_record;
+
+	/*  8*/	uint64_t lsn;					// $LogFile sequence number for this record. Changed every time the record is modified.
+	/* 16*/	uint16_t seq_nmbr;				// Number of times this mft record has been reused.
+	/* 18*/	uint16_t link_cnt;				// Number of hard links, i.e. the number of directory entries referencing this record.
+	/* 20*/	uint16_t attrs_offs;			// Byte offset to the first attribute in this mft record from the start of the mft record.
+	/* 22*/	uint16_t flags;					// Bit array of fLAGS. When a file is deleted, the MFT_RECORD_IN_USE flag is set to zero.
+	/* 24*/	uint32_t bytes_used;			// Number of bytes used in this mft record.
+	/* 28*/	uint32_t bytes_alloc;			// Number of bytes allocated for this mft record. This should be equal to the mft record size.
+	/* 32*/	uint64_t base_mft_rec;			// This is zero for base mft records. When it is not zero it is a mft reference
+											// pointing to the base mft record to which this record belongs.
+	/* 40*/	uint16_t next_attr_inst;		// The instance number that will be assigned to the next attribute added to this mft record.
+	/* 42*/ uint16_t reserved;				// Reserved/alignment.
+	/* 44*/ uint32_t mft_rec_number;		// Number of this mft record.
+}* raw_mft_record;
+#pragma pack(pop)
+
 typedef struct _mft_file *mft_file;
 
 typedef struct _attribute_reader* attribute_reader;
 
+typedef struct {
+	uint64_t offset;
+	uint64_t length;
+} byte_range;
+
 mft_file LoadMFTFile(execution_context context, uint64_t index);
 
+//Builds an mft_file from a base record that's been read and fixed up already, takes ownership of 'rec'
+mft_file MFTFileFromRecord(execution_context context, bytes rec);
+
+typedef void (*record_callback)(execution_context context, uint64_t ref, mft_file file, void* state);
+
+//Loads the MFT records of 'refs', a list of MFT references sorted by record number, with as
+//few reads as possible. The callback gets every record that's still in use by the file the
+//reference points to, and 'file' is deleted when it returns.
+bool FetchMFTRecords(execution_context context, const uint64_t* refs, rsize_t cnt, record_callback callback, void* state);
+
 void DeleteMFTFile(mft_file file);
 
+//$LogFile sequence number of the last change of the base record
+uint64_t RecordLSN(const mft_file file);
+
+//The record with number 'index' of the file, NULL if it hasn't been loaded
+bytes FileRecord(const mft_file file, uint64_t index);
+
+//Adds the references of the records that the attribute list of file 'index' points to, other
+//than its base record, to 'refs' (uint64_t). Some can be in there more than once.
+void AppendExtensionRefs(const mft_file file, uint64_t index, UT_array* refs);
+
 attribute FirstAttribute(execution_context context, mft_file mft_rec, uint32_t attribute_mask);
 
 attribute NextAttribute(execution_context context, mft_file mft_rec, const attribute cur, uint32_t attribute_mask);
@@ -45,4 +100,57 @@ bytes GetBytesFromAttrib(execution_context context, mft_file mft_rec, const attr
 
 bool DoFixUp(bytes record, uint16_t sector_sz);
 
+//Simple forward iterator through all the attributes in an MFT file record:
+attribute FirstAttr(bytes mft_rec);
+attribute NextAttr(bytes mft_rec, const attribute cur);
+
+//The same for records that aren't trusted, like those of ScanMFT: they end at the first attribute
+//that isn't within the used part of the record, or that's too short to be one.
+attribute FirstCheckedAttr(bytes mft_rec);
+attribute NextCheckedAttr(bytes mft_rec, const attribute cur);
+
+//The value of a resident attribute, or NULL when it's non-resident, shorter than 'min_len'
+//or not within the attribute
+void* ResidentValue(const attribute attr, rsize_t min_len);
+
+//A batch of consecutive records read by ScanMFT, fixed up in place. The records that aren't
+//in use (unless scanning with SCAN_DELETED), or that failed their checks, have a NULL buffer.
+typedef struct {
+	uint64_t first;					// Record number of records[0]
+	rsize_t cnt;
+	struct _bytes* records;			// Views into the read buffer, only valid during the callback
+} record_batch;
+
+//Returns false to stop the scan
+typedef bool (*scan_callback)(execution_context context, const record_batch* batch, void* state);
+
+//Flags of ScanMFT:
+#define SCAN_DELETED 0x0001			// Also the records that aren't in use, when their signature and fix-up are fine
+
+//Reads the whole MFT front to back in big reads, skipping the ranges of records that its
+//$BITMAP says are unused (unless they're wanted too), and hands every read to the callback.
+bool ScanMFT(execution_context context, uint32_t scan_flags, scan_callback callback, void* state);
+
+//RunSlices splits a batch in slices of this many records
+#define SLICE_RECORDS 256
+
+//The records of a batch that one job of RunSlices does
+typedef struct {
+	const record_batch* batch;
+	rsize_t first;					// Index in the batch of the first record of the slice
+	rsize_t cnt;
+} batch_slice;
+
+//Calls 'job' for every slice of a batch with RunParallel, 'shared' is passed on to it. 'slices'
+//keeps the state of the slices from one batch to the next, so what they allocated is reused: its
+//elements start with a batch_slice, and are added with the init of its icd when there are too few.
+//A job clears what the previous batch left in its state. Returns the number of slices, whose
+//states are the first ones in 'slices', for the caller to merge in record order.
+rsize_t RunSlices(execution_context context, const record_batch* batch, UT_array* slices, item_job job, void* shared);
+
+//Returns a sorted list (of byte_range) with the parts of an attribute that are zero by
+//definition: sparse runs (for compressed attributes only complete compression units)
+//and the uninitialised tail beyond init_sz. None of these need to be read.
+UT_array* ZeroRanges(execution_context context, mft_file mft_rec, const attribute attrib);
+
 #endif //MFT_H
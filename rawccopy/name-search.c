@@ -0,0 +1,212 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "name-search.h"
+#include "mft.h"
+#include "attribs.h"
+#include "names.h"
+#include "file-table.h"
+#include "listing.h"
+#include "helpers.h"
+#include "thread-pool.h"
+
+//A name that matches, of the file of 'row'
+typedef struct {
+	uint64_t row;
+	uint64_t parent;
+	uint32_t name_offs;					// In characters, in the names of the search (or the slice, until merged)
+	uint8_t name_len;
+	uint8_t name_space;
+} name_hit;
+
+static const UT_icd name_hit_icd = { sizeof(name_hit), NULL, NULL, NULL };
+
+typedef struct {
+	batch_slice slice;
+	UT_array* hits;
+	bytes names;
+	rsize_t names_cap;					// Allocated size of 'names', which grows with AppendGrowing
+} search_job;
+
+void InitSearchJob(void* job);
+
+void DeleteSearchJob(void* job);
+
+static const UT_icd search_job_icd = { sizeof(search_job), InitSearchJob, NULL, DeleteSearchJob };
+
+typedef struct {
+	execution_context context;
+	name_pattern pattern;
+	UT_array* jobs;						// search_job, kept from one read to the next
+	UT_array* hits;
+	bytes names;
+	rsize_t names_cap;					// Of the names of the search
+} name_search;
+
+bool SearchBatch(execution_context context, const file_table table, const record_batch* batch, void* state);
+
+void SearchSlice(void* item, void* shared);
+
+void SearchRecord(const name_search* search, uint64_t index, const bytes rec, search_job* job);
+
+int CompareHits(const void* first, const void* second);
+
+bool ListHits(execution_context context, const file_table table, name_search* search);
+
+
+bool FindNames(execution_context context)
+{
+	name_search search;
+	memset(&search, 0, sizeof(name_search));
+	search.context = context;
+	search.pattern = CompileNamePattern(context, BaseString(context->parameters->find_name), StringLen(context->parameters->find_name));
+	search.names = CreateEmpty();
+	utarray_new(search.jobs, &search_job_icd);
+	utarray_new(search.hits, &name_hit_icd);
+
+	//The table is there for the paths of the hits and what's listed about them:
+	file_table table = search.pattern && search.names ? BuildFileTable(context, 0, SearchBatch, &search) : NULL;
+	bool result = table && ListHits(context, table, &search);
+
+	if (table)
+		DeleteFileTable(table);
+	utarray_free(search.hits);
+	utarray_free(search.jobs);
+	if (search.names)
+		DeleteBytes(search.names);
+	if (search.pattern)
+		DeleteNamePattern(search.pattern);
+	return result;
+}
+
+bool SearchBatch(execution_context context, const file_table table, const record_batch* batch, void* state)
+{
+	name_search* search = (name_search*)state;
+	rsize_t slice_cnt = RunSlices(context, batch, search->jobs, SearchSlice, search);
+
+	//Like the names of the file table, the hits are merged in record order:
+	for (rsize_t i = 0; i < slice_cnt; ++i)
+	{
+		search_job* job = (search_job*)utarray_eltptr(search->jobs, i);
+		uint32_t base = (uint32_t)(search->names->buffer_len / sizeof(wchar_t));
+		for (name_hit* hit = (name_hit*)utarray_front(job->hits); hit; hit = (name_hit*)utarray_next(job->hits, hit))
+		{
+			hit->name_offs += base;
+			utarray_push_back(search->hits, hit);
+		}
+		AppendGrowing(search->names, &search->names_cap, job->names, 0, job->names->buffer_len);
+	}
+	return true;
+}
+
+void SearchSlice(void* item, void* shared)
+{
+	search_job* job = (search_job*)item;
+	const record_batch* batch = job->slice.batch;
+	utarray_clear(job->hits);
+	RightTrim(job->names, job->names->buffer_len);
+	for (rsize_t i = job->slice.first; i < job->slice.first + job->slice.cnt; ++i)
+	{
+		if (batch->records[i].buffer)
+			SearchRecord((name_search*)shared, batch->first + i, batch->records + i, job);
+	}
+}
+
+//The names in extension records are those of the file of the base record. DOS names are
+//left out, the file has another name that says more.
+void SearchRecord(const name_search* search, uint64_t index, const bytes rec, search_job* job)
+{
+	raw_mft_record hdr = (raw_mft_record)rec->buffer;
+	for (attribute at = FirstCheckedAttr(rec); at; at = NextCheckedAttr(rec, at))
+	{
+		file_name_attribute fn = at->type == ATTR_FILE_NAME ? ResidentValue(at, sizeof(struct _file_name_attribute)) : NULL;
+		if (!fn || sizeof(struct _file_name_attribute) + fn->file_name_length * sizeof(wchar_t) > at->value_len ||
+				fn->name_space == FILE_NAME_DOS || !MatchNamePattern(search->context, search->pattern, fn->file_name, fn->file_name_length))
+			continue;
+
+		name_hit hit = { hdr->base_mft_rec ? hdr->base_mft_rec : index | ((uint64_t)hdr->seq_nmbr << 48), fn->parent_directory,
+							(uint32_t)(job->names->buffer_len / sizeof(wchar_t)), fn->file_name_length, fn->name_space };
+		struct _bytes name = { (uint8_t*)fn->file_name, fn->file_name_length * sizeof(wchar_t) };
+		AppendGrowing(job->names, &job->names_cap, &name, 0, name.buffer_len);
+		utarray_push_back(job->hits, &hit);
+	}
+}
+
+//By folder, and within a folder in record order
+int CompareHits(const void* first, const void* second)
+{
+	const name_hit* first_hit = (const name_hit*)first;
+	const name_hit* second_hit = (const name_hit*)second;
+	uint64_t first_folder = first_hit->parent & 0x0000FFFFFFFFFFFF, second_folder = second_hit->parent & 0x0000FFFFFFFFFFFF;
+	if (first_folder != second_folder)
+		return first_folder > second_folder ? 1 : -1;
+	if (first_hit->parent != second_hit->parent)
+		return first_hit->parent > second_hit->parent ? 1 : -1;
+	if (first_hit->row != second_hit->row)
+		return first_hit->row > second_hit->row ? 1 : -1;
+	return first_hit->name_offs > second_hit->name_offs ? 1 : (first_hit->name_offs < second_hit->name_offs ? -1 : 0);
+}
+
+bool ListHits(execution_context context, const file_table table, name_search* search)
+{
+	const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+	const wchar_t* root = source[0] && source[1] == L':' ? source : L"x:";
+	folder_paths paths = CreateFolderPaths(table, root, 2);
+	string orphans = paths ? StringPrint(NULL, 0, L"%.*ls%ls", 2, root, ORPHAN_FOLDER) : NULL;
+	listing lst = orphans ? OpenListing(context) : NULL;
+	bool result = lst != NULL;
+
+	if (utarray_len(search->hits) > 1)
+		utarray_sort(search->hits, CompareHits);
+	rsize_t found = 0;
+	uint64_t folder = UINT64_MAX;
+	for (name_hit* hit = result ? (name_hit*)utarray_front(search->hits) : NULL; hit; hit = (name_hit*)utarray_next(search->hits, hit))
+	{
+		//A file whose base record was reused while the scan went on, or is gone:
+		uint64_t row = hit->row & 0x0000FFFFFFFFFFFF;
+		if (row >= table->row_cnt || table->seq[row] != (uint16_t)(hit->row >> 48) ||
+				(table->flags[row] & (FILE_ROW_IN_USE | FILE_ROW_EXTENSION)) != FILE_ROW_IN_USE)
+			continue;
+
+		if (hit->parent != folder)
+		{
+			folder = hit->parent;
+			rsize_t path_len = 0;
+			const wchar_t* path = FolderPath(paths, hit->parent, &path_len);
+			if (path)
+				ListFolder(lst, path, path_len);
+			else
+				ListFolder(lst, BaseString(orphans), StringLen(orphans));
+		}
+		ListRowName(lst, table, row, hit->parent, (wchar_t*)search->names->buffer + hit->name_offs, hit->name_len, hit->name_space);
+		++found;
+	}
+
+	if (result && !found)
+		wprintf(L"Error: Nothing matches %ls\n", BaseString(context->parameters->find_name));
+	if (lst)
+		result = CloseListing(lst) && result && found > 0;
+	if (orphans)
+		DeleteString(orphans);
+	if (paths)
+		DeleteFolderPaths(paths);
+	return result;
+}
+
+void InitSearchJob(void* job)
+{
+	search_job* sj = (search_job*)job;
+	memset(sj, 0, sizeof(search_job));
+	utarray_new(sj->hits, &name_hit_icd);
+	sj->names = CreateEmpty();
+}
+
+void DeleteSearchJob(void* job)
+{
+	search_job* sj = (search_job*)job;
+	if (sj->hits)
+		utarray_free(sj->hits);
+	if (sj->names)
+		DeleteBytes(sj->names);
+}
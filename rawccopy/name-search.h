@@ -0,0 +1,13 @@
+#ifndef NAME_SEARCH_H
+#define NAME_SEARCH_H
+
+#include "context.h"
+
+//Finds the files of the whole volume with a name that matches /FindName: ('*' for any number of
+//characters, '?' for one, in any case), during one sequential read of the MFT. The $FILE_NAME
+//attributes are matched right in the records as they're read, on all threads, so hard links
+//are found too. Only for the hits a full path is worked out, and they're written like a
+//directory listing (/ListFormat:), a folder at a time.
+bool FindNames(execution_context context);
+
+#endif //NAME_SEARCH_H
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+#include "helpers.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#include <intrin.h>
+#define HAS_SSE2
+
+//Code units CompareFoldedName compares one by one before it starts on blocks
+#define SCALAR_HEAD 8
+#endif
+
+#ifdef HAS_SSE2
+//Upper cases the ASCII letters of 8 code units, and leaves everything else as it is
+static __inline __m128i FoldASCII(__m128i raw)
+{
+	__m128i lower = _mm_and_si128(_mm_cmpgt_epi16(raw, _mm_set1_epi16('a' - 1)), _mm_cmplt_epi16(raw, _mm_set1_epi16('z' + 1)));
+	return _mm_sub_epi16(raw, _mm_and_si128(lower, _mm_set1_epi16(0x20)));
+}
+#endif
+
+uint32_t NameHash(const execution_context context, const wchar_t* name, rsize_t len)
+{
+	//FNV-1a over the upper cased characters:
+	uint32_t result = 0x811C9DC5;
+	for (rsize_t i = 0; i < len; ++i)
+		result = (result ^ context->upper_case[(uint16_t)name[i]]) * 0x01000193;
+
+	return result;
+}
+
+int CompareNames(const execution_context context, const wchar_t* first, rsize_t first_len,
+					const wchar_t* second, rsize_t second_len)
+{
+	for (rsize_t i = 0; i < first_len && i < second_len; ++i)
+	{
+		int dif = context->upper_case[(uint16_t)first[i]] - context->upper_case[(uint16_t)second[i]];
+		if (dif != 0)
+			return dif;
+	}
+	return first_len < second_len ? -1 : (first_len > second_len ? 1 : 0);
+}
+
+void FoldName(const execution_context context, const wchar_t* name, rsize_t len, wchar_t* dest)
+{
+	for (rsize_t i = 0; i < len; ++i)
+		dest[i] = context->upper_case[(uint16_t)name[i]];
+}
+
+int CompareFoldedName(const execution_context context, const wchar_t* folded, rsize_t folded_len,
+						const wchar_t* name, rsize_t name_len)
+{
+	rsize_t len = folded_len < name_len ? folded_len : name_len;
+	rsize_t i = 0;
+#ifdef HAS_SSE2
+	//Most compares of a search are over within the first few characters, where setting up a
+	//block costs more than it saves, so the first block is compared one character at a time.
+	//Names shorter than 16 code units never get to the SSE2 blocks.
+	for (; i < len && i < SCALAR_HEAD; ++i)
+	{
+		int dif = folded[i] - context->upper_case[(uint16_t)name[i]];
+		if (dif != 0)
+			return dif;
+	}
+
+	//After that, blocks of 8 code units that are all ASCII get upper cased and compared in one
+	//go, as long as the volume's $UpCase table does the same for them. The first other block ends it.
+	if (context->ascii_upcase)
+	{
+		const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+		const __m128i before_a = _mm_set1_epi16('a' - 1);
+		const __m128i after_z = _mm_set1_epi16('z' + 1);
+		const __m128i case_bit = _mm_set1_epi16(0x20);
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 8 <= len; i += 8)
+		{
+			__m128i raw = _mm_loadu_si128((const __m128i*)(name + i));
+			__m128i query = _mm_loadu_si128((const __m128i*)(folded + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(raw, query), non_ascii), zero)) != 0xFFFF)
+				break;
+
+			__m128i lower = _mm_and_si128(_mm_cmpgt_epi16(raw, before_a), _mm_cmplt_epi16(raw, after_z));
+			__m128i upper = _mm_sub_epi16(raw, _mm_and_si128(lower, case_bit));
+			unsigned int dif = ~_mm_movemask_epi8(_mm_cmpeq_epi16(upper, query)) & 0xFFFF;
+			if (dif)
+			{
+				unsigned long first;
+				_BitScanForward(&first, dif);
+				rsize_t pos = i + first / 2;
+				return folded[pos] - context->upper_case[(uint16_t)name[pos]];
+			}
+		}
+	}
+#endif
+	for (; i < len; ++i)
+	{
+		int dif = folded[i] - context->upper_case[(uint16_t)name[i]];
+		if (dif != 0)
+			return dif;
+	}
+	return folded_len < name_len ? -1 : (folded_len > name_len ? 1 : 0);
+}
+
+bool MatchFoldedPattern(const execution_context context, const wchar_t* pattern, rsize_t pattern_len,
+						const wchar_t* name, rsize_t name_len)
+{
+	//Characters are matched one by one, on a mismatch the last '*' takes one more character:
+	rsize_t p = 0, n = 0, star = pattern_len, star_n = 0;
+	while (n < name_len)
+	{
+		if (p < pattern_len && pattern[p] == L'*')
+		{
+			star = p++;
+			star_n = n;
+		}
+		else if (p < pattern_len && (pattern[p] == L'?' || pattern[p] == context->upper_case[(uint16_t)name[n]]))
+		{
+			++p;
+			++n;
+		}
+		else if (star < pattern_len)
+		{
+			p = star + 1;
+			n = ++star_n;
+		}
+		else
+			return false;
+	}
+
+	while (p < pattern_len && pattern[p] == L'*')
+		++p;
+	return p == pattern_len;
+}
+
+bool ContainsFoldedName(const execution_context context, const wchar_t* folded, rsize_t folded_len,
+						const wchar_t* name, rsize_t name_len)
+{
+	if (folded_len > name_len)
+		return false;
+	if (!folded_len)
+		return true;
+
+	//The places the literal can start at are 0 up to and including 'last':
+	rsize_t last = name_len - folded_len, i = 0;
+#ifdef HAS_SSE2
+	//Blocks that are all ASCII are upper cased in one go, as long as the volume's $UpCase
+	//table does the same for them. Others are done one by one.
+	if (context->ascii_upcase)
+	{
+		const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i first = _mm_set1_epi16((short)folded[0]);
+		const __m128i final = _mm_set1_epi16((short)folded[folded_len - 1]);
+		while (i + 8 <= last + 1)
+		{
+			__m128i head = _mm_loadu_si128((const __m128i*)(name + i));
+			__m128i tail = _mm_loadu_si128((const __m128i*)(name + i + folded_len - 1));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(head, tail), non_ascii), zero)) != 0xFFFF)
+			{
+				for (rsize_t end = i + 8; i < end; ++i)
+				{
+					if (!CompareFoldedName(context, folded, folded_len, name + i, folded_len))
+						return true;
+				}
+				continue;
+			}
+
+			unsigned int hits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(FoldASCII(head), first),
+																_mm_cmpeq_epi16(FoldASCII(tail), final)));
+			while (hits)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, hits);
+				if (!CompareFoldedName(context, folded, folded_len, name + i + bit / 2, folded_len))
+					return true;
+				hits &= ~(3U << bit);
+			}
+			i += 8;
+		}
+	}
+#endif
+	for (; i <= last; ++i)
+	{
+		if (!CompareFoldedName(context, folded, folded_len, name + i, folded_len))
+			return true;
+	}
+	return false;
+}
+
+name_pattern CompileNamePattern(const execution_context context, const wchar_t* pattern, rsize_t len)
+{
+	SafeCreate(result, name_pattern);
+	memset(result, 0, sizeof(struct _name_pattern));
+	if (!(result->folded = malloc((len + 1) * sizeof(wchar_t))))
+		return ErrorCleanUp(free, result, "Memory allocation problem.\n");
+	FoldName(context, pattern, len, result->folded);
+	result->folded[len] = 0;
+	result->len = len;
+
+	for (rsize_t i = 0, run = 0; i <= len; ++i)
+	{
+		if (i < len && pattern[i] == L'*')
+			result->open_ended = true;
+		else if (i < len)
+			++result->min_len;
+
+		if (i < len && pattern[i] != L'*' && pattern[i] != L'?')
+			++run;
+		else
+		{
+			if (run > result->literal_len)
+			{
+				result->literal_offs = i - run;
+				result->literal_len = run;
+			}
+			run = 0;
+		}
+	}
+	result->substring = len == result->literal_len + 2 && result->literal_offs == 1 && pattern[0] == L'*' && pattern[len - 1] == L'*';
+	return result;
+}
+
+bool MatchNamePattern(const execution_context context, const name_pattern pattern, const wchar_t* name, rsize_t name_len)
+{
+	if (name_len < pattern->min_len || (!pattern->open_ended && name_len != pattern->min_len))
+		return false;
+	if (!ContainsFoldedName(context, pattern->folded + pattern->literal_offs, pattern->literal_len, name, name_len))
+		return false;
+	return pattern->substring || MatchFoldedPattern(context, pattern->folded, pattern->len, name, name_len);
+}
+
+void DeleteNamePattern(name_pattern pattern)
+{
+	free(pattern->folded);
+	free(pattern);
+}
@@ -0,0 +1,58 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+//File names are compared the way NTFS does it: character by character, after upper casing
+//them with the $UpCase table of the volume.
+
+uint32_t NameHash(const execution_context context, const wchar_t* name, rsize_t len);
+
+int CompareNames(const execution_context context, const wchar_t* first, rsize_t first_len,
+					const wchar_t* second, rsize_t second_len);
+
+//Upper cases 'len' characters of 'name' into 'dest'
+void FoldName(const execution_context context, const wchar_t* name, rsize_t len, wchar_t* dest);
+
+//Same as CompareNames, for a first name that is upper cased already (with FoldName)
+int CompareFoldedName(const execution_context context, const wchar_t* folded, rsize_t folded_len,
+						const wchar_t* name, rsize_t name_len);
+
+//True if 'name' matches 'pattern', in which '*' stands for any number of characters and '?' for
+//exactly one. The pattern is upper cased already (with FoldName).
+bool MatchFoldedPattern(const execution_context context, const wchar_t* pattern, rsize_t pattern_len,
+						const wchar_t* name, rsize_t name_len);
+
+//True if the upper cased 'folded' is somewhere in 'name'. Where SSE2 is there, 8 places in the
+//name are tried at once for its first and last character, and only where both are there the
+//rest is compared.
+bool ContainsFoldedName(const execution_context context, const wchar_t* folded, rsize_t folded_len,
+						const wchar_t* name, rsize_t name_len);
+
+//A pattern like for MatchFoldedPattern, upper cased, with what every name that matches it has:
+//a minimum length, and the longest run of characters without wildcards
+typedef struct _name_pattern {
+	wchar_t* folded;
+	rsize_t len;
+	rsize_t min_len;			// Number of characters that aren't '*'
+	bool open_ended;			// There's a '*' in it
+	bool substring;				// It's '*', the literal and '*', so nothing else needs checking
+	rsize_t literal_offs;
+	rsize_t literal_len;
+} *name_pattern;
+
+name_pattern CompileNamePattern(const execution_context context, const wchar_t* pattern, rsize_t len);
+
+//Same as MatchFoldedPattern, after ruling out the names that are too short or too long, or
+//don't have the literal part of the pattern in them, which is most of them
+bool MatchNamePattern(const execution_context context, const name_pattern pattern, const wchar_t* name, rsize_t name_len);
+
+void DeleteNamePattern(name_pattern pattern);
+
+#define NamesEqual(context, first, first_len, second, second_len)	\
+			((first_len) == (second_len) && !CompareNames((context), (first), (first_len), (second), (second_len)))
+
+#endif //NAMES_H
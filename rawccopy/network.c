@@ -97,7 +97,22 @@ SOCKET GetConnectedSocket(uint32_t ip, uint16_t port)
 
 bool SendData(SOCKET socket, const bytes data)
 {
-	return (send(socket, data->buffer, (int)data->buffer_len, 0));
+	return SendBuffer(socket, data->buffer, data->buffer_len);
+}
+
+bool SendBuffer(SOCKET socket, const void* buf, rsize_t len)
+{
+	//send() is allowed to transmit less than asked for, so keep going
+	//until the whole buffer is out:
+	for (const char* pt = buf; len > 0; )
+	{
+		int sent = send(socket, pt, (int)min(len, 0x40000000), 0);
+		if (sent == SOCKET_ERROR)
+			return false;
+		pt += sent;
+		len -= sent;
+	}
+	return true;
 }
 
 void CleanUpSocket(SOCKET socket)
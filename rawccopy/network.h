@@ -15,5 +15,7 @@ void CleanUpSocket(SOCKET socket);
 
 bool SendData(SOCKET socket, const bytes data);
 
+bool SendBuffer(SOCKET socket, const void* buf, rsize_t len);
+
 
 #endif //! NETWORK_H
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "mft.h"
 #include "index.h"
 #include "attribs.h"
+#include "names.h"
 
 
 const uint32_t SYMLINK_FLAG_RELATIVE = 0x00000001;  /* The substitute name is a path name relative to the
@@ -30,13 +31,53 @@ struct _reparse_point {
 #pragma pack(pop)
 typedef struct _reparse_point* reparse_point;
 
+//Steps that were resolved before, keyed by directory and name. Names that weren't found are
+//kept as well (without entry), so a batch of paths doesn't search for them again.
+#define PATH_HASH_SZ 4096
+#define PATH_CACHE_SZ 0x10000
+
+typedef struct _cached_step {
+	uint64_t parent;				// MFT reference of the directory holding the step
+	string name;
+	uint32_t hash;
+	bytes original;					// NULL if not found
+	bytes dereferenced;				// NULL for a relative symlink, which depends on the path it's reached by
+	bool relative_link;
+	struct _cached_step* next;
+} *cached_step;
+
+//Links that were followed, keyed by their MFT reference, so a link reached again (or through
+//another name, like its DOS name) doesn't need its reparse point parsed again. Junctions and
+//absolute symlinks always lead to the same entry. A relative symlink leads elsewhere depending
+//on the path it's reached by, so only its path is kept.
+#define LINK_HASH_SZ 256
+
+typedef struct _link_target {
+	uint64_t link;
+	string relative;				// Path of a relative symlink, NULL for the others
+	bytes target;					// Entry the others lead to
+	struct _link_target* next;
+} *link_target;
+
+struct _path_cache {
+	cached_step buckets[PATH_HASH_SZ];
+	rsize_t step_cnt;
+	link_target links[LINK_HASH_SZ];
+};
+
+cached_step ResolveStep(execution_context context, const resolved_path pt, uint64_t parent, const wchar_t* item);
+
+void ClearCachedSteps(path_cache cache);
+
+link_target LinkTarget(const execution_context context, const index_entry link);
+
 bytes GetLinkedEntry(const execution_context context, const resolved_path pt, const index_entry link);
 
 resolved_path CopyPath(const resolved_path pt);
 
 bool ExtendPath(const execution_context context, const wchar_t* path, resolved_path* result);
 
-resolved_path FollowLink(const execution_context context, const reparse_point link, const resolved_path pt);
+resolved_path FollowLink(const execution_context context, const reparse_point link);
 
 string GetSubstitutionPath(const reparse_point link);
 
@@ -55,6 +96,18 @@ void DeleteStep(path_step step)
 static const path_step dummy;
 static const UT_icd ut_step_icd = { sizeof(*dummy) , NULL, NULL, DeleteStep };
 
+//Gets passed a pointer to a resolved_path, so it needs to dereference it
+void DeletePathPtr(void* pt)
+{
+	DeletePath(*(resolved_path*)pt);
+}
+
+static const UT_icd path_lst_icd = { sizeof(resolved_path), NULL, NULL, DeletePathPtr };
+
+bool MatchComponents(execution_context context, resolved_path pt, const UT_array* components, rsize_t next, UT_array* matches);
+
+bool FindMatches(execution_context context, const resolved_path pt, const wchar_t* pattern, UT_array* entries);
+
 resolved_path CopyPath(const resolved_path pt)
 {
 	resolved_path result;
@@ -76,7 +129,8 @@ resolved_path EmptyPath(const execution_context context)
 	utarray_new(result, &ut_step_icd);
 	SafeCreate(step, path_step);
 	step->dereferenced = NULL;
-	step->original = FindIndexEntry(context, ROOT_FILE_NAME_INDEX_NUMBER, L".");
+	cached_step root = ResolveStep(context, result, ROOT_FILE_NAME_INDEX_NUMBER, L".");
+	step->original = root && root->original ? CopyBuffer(root->original) : NULL;
 	utarray_push_back(result, step);
 	free(step);
 	return result;
@@ -88,19 +142,25 @@ bool GoDown(execution_context context, resolved_path pt, const wchar_t* item)
 	if (!last)
 		return CleanUpAndFail(NULL, NULL, "Found path without root element.\n");
 
-	bytes next_orig = FindIndexEntry(context, IndexEntryPtr(DerefStep(last))->mft_reference, item);
-	if (!next_orig)
+	cached_step hit = ResolveStep(context, pt, IndexEntryPtr(DerefStep(last))->mft_reference, item);
+	if (!hit || !hit->original)
 		return false;
 
-	bytes next_deref = NULL;
-	if (TYPE_CAST(next_orig, index_entry)->file_flags & FILE_ATTRIBUTE_REPARSE_POINT)
+	//Resolving the link can clear the cache, 'hit' isn't used after that:
+	bytes original = CopyBuffer(hit->original);
+	if (!original)
+		return false;
+
+	bytes deref = NULL;
+	if (hit->relative_link)
 	{
-		next_deref = GetLinkedEntry(context, pt, IndexEntryPtr(next_orig));
-		if (!next_deref)
-			return CleanUpAndFail(DeleteBytes, next_orig, "");
+		if (!(deref = GetLinkedEntry(context, pt, IndexEntryPtr(original))))
+			return CleanUpAndFail(DeleteBytes, original, "");
 	}
+	else if (hit->dereferenced)
+		deref = CopyBuffer(hit->dereferenced);
 
-	path_step next = CreateStep(next_orig, next_deref);
+	path_step next = CreateStep(original, deref);
 	if (next)
 	{
 		utarray_push_back(pt, next);
@@ -152,9 +212,261 @@ bool ExtendPath(const execution_context context, const wchar_t* path, resolved_p
 	return parse_result;
 }
 
+UT_array* MatchPaths(execution_context context, const wchar_t* pattern, rsize_t* base_depth)
+{
+	const wchar_t* rel_path = wcschr(pattern, L'\\');
+	string path_cp = StringPrint(NULL, 0, L"%ls", rel_path ? rel_path + 1 : L"");
+	if (!path_cp)
+		return NULL;
+
+	UT_array* components;
+	utarray_new(components, &ut_ptr_icd);
+	wchar_t* parser_state;
+	for (wchar_t* tok = wcstok(BaseString(path_cp), L"\\", &parser_state); tok; tok = wcstok(NULL, L"\\", &parser_state))
+		utarray_push_back(components, &tok);
+
+	//Up to the first wildcard, it's an ordinary path:
+	resolved_path pt = EmptyPath(context);
+	bool result = pt != NULL;
+	rsize_t next = 0;
+	for (; result && next < utarray_len(components); ++next)
+	{
+		const wchar_t* tok = *(wchar_t**)utarray_eltptr(components, next);
+		if (HasWildcards(tok))
+			break;
+		else if (!wcscmp(L"..", tok))
+			result = GoUp(pt);
+		else if (wcscmp(L".", tok))
+			result = GoDown(context, pt, tok);
+	}
+
+	UT_array* matches = NULL;
+	if (result)
+	{
+		*base_depth = utarray_len(pt);
+		utarray_new(matches, &path_lst_icd);
+		if (!MatchComponents(context, pt, components, next, matches))
+		{
+			utarray_free(matches);
+			matches = NULL;
+		}
+	}
+	else if (pt)
+		DeletePath(pt);
+
+	utarray_free(components);
+	DeleteString(path_cp);
+	return matches;
+}
+
+//Matches the components from 'next' on, below the last step of 'pt', which it takes ownership of.
+//Components without wildcards are matched as well, a folder that doesn't have them simply
+//doesn't give any match.
+bool MatchComponents(execution_context context, resolved_path pt, const UT_array* components, rsize_t next, UT_array* matches)
+{
+	if (next == utarray_len(components))
+	{
+		utarray_push_back(matches, &pt);
+		return true;
+	}
+
+	const wchar_t* tok = *(wchar_t**)utarray_eltptr(components, next);
+	if (!wcscmp(L".", tok))
+		return MatchComponents(context, pt, components, next + 1, matches);
+	if (!wcscmp(L"..", tok))
+	{
+		if (!GoUp(pt))
+			return CleanUpAndFail(DeletePathPtr, &pt, "");
+		return MatchComponents(context, pt, components, next + 1, matches);
+	}
+
+	UT_array* entries = ListOfBuffers();
+	bool result = FindMatches(context, pt, tok, entries);
+	for (bytes* ent = utarray_front(entries); result && ent; ent = utarray_next(entries, ent))
+	{
+		resolved_path sub_path = CopyPath(pt);
+		bytes original = sub_path ? CopyBuffer(*ent) : NULL;
+		path_step step = original ? CreateStep(original, NULL) : NULL;
+		if (!step)
+		{
+			if (original)
+				DeleteBytes(original);
+			if (sub_path)
+				DeletePath(sub_path);
+			result = false;
+			break;
+		}
+		utarray_push_back(sub_path, step);
+		free(step);
+		result = MatchComponents(context, sub_path, components, next + 1, matches);
+	}
+
+	utarray_free(entries);
+	DeletePath(pt);
+	return result;
+}
+
+//Collects the entries of the last folder of 'pt' that match 'pattern'. The literal part in front
+//of the first wildcard is sought in the B-tree, and the listing stops at the first name that
+//doesn't start with it, so the rest of the folder isn't read.
+bool FindMatches(execution_context context, const resolved_path pt, const wchar_t* pattern, UT_array* entries)
+{
+	path_step last = utarray_back(pt);
+	index_entry folder = IndexEntryPtr(DerefStep(last));
+	if (!(folder->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT))
+		return true;
+
+	//No name in the index is longer than 255 characters:
+	wchar_t folded[0x100];
+	rsize_t len = wcslen(pattern);
+	if (len >= 0x100)
+		return true;
+	FoldName(context, pattern, len, folded);
+	rsize_t prefix_len = wcscspn(pattern, L"*?");
+
+	index_iter iter = SeekIndexIterator(context, folder, folded, prefix_len);
+	if (!iter)
+		return false;
 
+	bool result = true;
+	for (index_entry rec = CurrentIterEntry(iter); rec; rec = NextIterEntry(context, iter))
+	{
+		if (rec->filename_len < prefix_len || CompareFoldedName(context, folded, prefix_len, (wchar_t*)rec->filename, prefix_len))
+			break;
+
+		//Every file that has a DOS name is listed twice, and the root folder contains itself:
+		if (rec->namespace == FILE_NAME_DOS || (rec->mft_reference & 0x0000FFFFFFFFFFFF) == (folder->mft_reference & 0x0000FFFFFFFFFFFF) ||
+				!MatchFoldedPattern(context, folded, len, (wchar_t*)rec->filename, rec->filename_len))
+			continue;
+
+		//Following links could lead us in circles, or to the same files twice:
+		if (IsLinkEntry(rec))
+		{
+			wprintf(L"Skipping link: %.*ls\n", rec->filename_len, (wchar_t*)rec->filename);
+			continue;
+		}
+
+		bytes ent = FromBuffer(rec, rec->entry_size);
+		if (!(result = ent != NULL))
+			break;
+		utarray_push_back(entries, &ent);
+	}
+	CloseIndexIterator(iter);
+	return result;
+}
+
+
+cached_step ResolveStep(execution_context context, const resolved_path pt, uint64_t parent, const wchar_t* item)
+{
+	path_cache cache = context->paths;
+	rsize_t len = wcslen(item);
+	uint32_t hash = NameHash(context, item, len);
+	cached_step* bucket = &cache->buckets[hash % PATH_HASH_SZ];
+	for (cached_step cur = *bucket; cur; cur = cur->next)
+	{
+		if (cur->parent == parent && cur->hash == hash && NamesEqual(context, BaseString(cur->name), StringLen(cur->name), item, len))
+		{
+			if (!cur->original)
+				wprintf(L"Error: Unable to find the file %ls by index scanning: \n", item);
+			return cur;
+		}
+	}
+
+	bytes next_orig = FindIndexEntry(context, parent, item);
+
+	//Only links get followed, other reparse points are just files:
+	link_target link = NULL;
+	if (next_orig && IsLinkEntry(IndexEntryPtr(next_orig)) && !(link = LinkTarget(context, IndexEntryPtr(next_orig))))
+		return ErrorCleanUp(DeleteBytes, next_orig, "");
+
+	//The cache is simply emptied when it's full:
+	if (cache->step_cnt >= PATH_CACHE_SZ)
+		ClearCachedSteps(cache);
+
+	SafeCreate(result, cached_step);
+	result->parent = parent;
+	result->name = StringPrint(NULL, 0, L"%ls", item);
+	result->hash = hash;
+	result->original = next_orig;
+	result->dereferenced = link && link->target ? CopyBuffer(link->target) : NULL;
+	result->relative_link = link && link->relative;
+	result->next = *bucket;
+	*bucket = result;
+	cache->step_cnt++;
+	return result;
+}
+
+path_cache CreatePathCache()
+{
+	SafeCreate(result, path_cache);
+	memset(result, 0, sizeof(struct _path_cache));
+	return result;
+}
+
+void DeletePathCache(path_cache cache)
+{
+	ClearCachedSteps(cache);
+	for (rsize_t i = 0; i < LINK_HASH_SZ; ++i)
+	{
+		while (cache->links[i])
+		{
+			link_target cur = cache->links[i];
+			cache->links[i] = cur->next;
+			if (cur->relative)
+				DeleteString(cur->relative);
+			if (cur->target)
+				DeleteBytes(cur->target);
+			free(cur);
+		}
+	}
+	free(cache);
+}
+
+void ClearCachedSteps(path_cache cache)
+{
+	for (rsize_t i = 0; i < PATH_HASH_SZ; ++i)
+	{
+		while (cache->buckets[i])
+		{
+			cached_step cur = cache->buckets[i];
+			cache->buckets[i] = cur->next;
+			DeleteString(cur->name);
+			if (cur->original)
+				DeleteBytes(cur->original);
+			if (cur->dereferenced)
+				DeleteBytes(cur->dereferenced);
+			free(cur);
+		}
+	}
+	cache->step_cnt = 0;
+}
+
+//The entry 'link' leads to, when reached by 'pt'
 bytes GetLinkedEntry(const execution_context context, const resolved_path pt, const index_entry link)
 {
+	link_target target = LinkTarget(context, link);
+	if (!target)
+		return NULL;
+	else if (!target->relative)
+		return CopyBuffer(target->target);
+
+	resolved_path dest = CopyPath(pt);
+	bytes result = NULL;
+	path_step final;
+	if (ExtendPath(context, BaseString(target->relative), &dest) && (final = utarray_back(dest)))
+		result = CopyBuffer(DerefStep(final));
+
+	DeletePath(dest);
+	return result;
+}
+
+link_target LinkTarget(const execution_context context, const index_entry link)
+{
+	link_target* bucket = &context->paths->links[(link->mft_reference & 0x0000FFFFFFFFFFFF) % LINK_HASH_SZ];
+	for (link_target cur = *bucket; cur; cur = cur->next)
+		if (cur->link == link->mft_reference)
+			return cur;
+
 	mft_file rec = LoadMFTFile(context, link->mft_reference);
 
 	if (!rec)
@@ -165,52 +477,67 @@ bytes GetLinkedEntry(const execution_context context, const resolved_path pt, co
 		return ErrorCleanUp(DeleteMFTFile, rec, "Record is not a valid link: %lld\n", link->mft_reference);
 
 	bytes raw_link = GetBytesFromAttrib(context, rec, at, 0, AttributeSize(at));
+	reparse_point rp = (reparse_point)(raw_link->buffer);
 
-	resolved_path target = FollowLink(context, (reparse_point)(raw_link->buffer), pt);
-
-	bytes result = NULL;
-	path_step final;
-	if (target && (final = utarray_back(target)))
+	string relative = NULL;
+	bytes target = NULL;
+	if (rp->reparse_tag == IO_REPARSE_TAG_SYMLINK && (rp->flags & SYMLINK_FLAG_RELATIVE))
+		relative = GetSubstitutionPath(rp);
+	else
 	{
-		result = CopyBuffer(DerefStep(final));
-		DeletePath(target);
+		resolved_path dest = FollowLink(context, rp);
+		path_step final;
+		if (dest && (final = utarray_back(dest)))
+			target = CopyBuffer(DerefStep(final));
+		if (dest)
+			DeletePath(dest);
 	}
 
 	DeleteBytes(raw_link);
 	DeleteMFTFile(rec);
+
+	if (!relative && !target)
+		return NULL;
+
+	SafeCreate(result, link_target);
+	result->link = link->mft_reference;
+	result->relative = relative;
+	result->target = target;
+	result->next = *bucket;
+	*bucket = result;
 	return result;
 }
 
-resolved_path FollowLink(const execution_context context, const reparse_point link, const resolved_path pt)
+//Follows a junction or an absolute symlink, which lead to the same place from anywhere
+resolved_path FollowLink(const execution_context context, const reparse_point link)
 {
 	string link_path = GetSubstitutionPath(link);
 	resolved_path result = NULL;
+	bool found = false;
 	if (link->reparse_tag == IO_REPARSE_TAG_MOUNT_POINT)
 	{
 		//Check for the "\??\" prefix:
 		if (wcsncmp(L"\\??\\", BaseString(link_path), 4))
 			printf("Unresolvable link path: %ls\n", BaseString(link_path));
-		TryParsePath(context, BaseString(link_path) + 4, &result);
-	}
-	else if (link->reparse_tag == IO_REPARSE_TAG_SYMLINK && (link->flags & SYMLINK_FLAG_RELATIVE))
-	{
-		result = CopyPath(pt);
-		if (!ExtendPath(context, BaseString(link_path), &result))
-		{
-			DeletePath(result);
-			result = NULL;
-		}
+		found = TryParsePath(context, BaseString(link_path) + 4, &result);
 	}
 	else if (link->reparse_tag == IO_REPARSE_TAG_SYMLINK)
 	{
 		if (IsSymlinkCompatible(context, link_path))
-			TryParsePath(context, BaseString(link_path) + 4, &result);
+			found = TryParsePath(context, BaseString(link_path) + 4, &result);
 	}
 	else
 	{
 		printf("Invalid link tag: %lx\n", link->reparse_tag);
 	}
 
+	//A path that was only resolved part of the way doesn't lead anywhere:
+	if (!found && result)
+	{
+		DeletePath(result);
+		result = NULL;
+	}
+
 	DeleteString(link_path);
 	return result;
 }
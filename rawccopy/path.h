@@ -28,4 +28,17 @@ bool GoDown(execution_context context, resolved_path pt, const wchar_t* item);
 
 bool GoUp(resolved_path pt);
 
+#define HasWildcards(path) (wcspbrk((path), L"*?") != NULL)
+
+//Resolves a path with wildcards in its components: '*' for any number of characters and '?' for
+//exactly one. Gives a list with a resolved_path for every match, and in 'base_depth' the number
+//of steps before the first component with a wildcard.
+UT_array* MatchPaths(execution_context context, const wchar_t* pattern, rsize_t* base_depth);
+
+//Cache of the path steps resolved during a run, so paths that share a directory only need
+//their last step searched in the index
+path_cache CreatePathCache();
+
+void DeletePathCache(path_cache cache);
+
 #endif //! PATH_H
\ No newline at end of file
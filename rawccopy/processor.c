@@ -1,4 +1,5 @@
 
+#include <windows.h>
 #include <stdlib.h>
 
 #include "safe-string.h"
@@ -7,55 +8,165 @@
 #include "mft.h"
 #include "index.h"
 #include "path.h"
+#include "wof.h"
+#include "tree-walker.h"
+#include "listing.h"
+#include "mft-snapshot.h"
+#include "usn-export.h"
+#include "deleted.h"
+#include "timeline.h"
+#include "name-search.h"
+#include "filter.h"
+#include "mft-export.h"
 
 
-void WritePathInfo(execution_context context, const resolved_path res_path);
+void WritePathInfo(execution_context context, listing lst, const resolved_path res_path);
 
-bool ExtractAttributes(execution_context context, const string file_name, uint64_t mft_ref);
+bool ExtractPath(execution_context context, const resolved_path res_path, const string out_folder);
+
+string MatchFolder(execution_context context, const resolved_path res_path, rsize_t base_depth);
 
 bool WriteAttributeContent(execution_context context, mft_file file, attribute at, const string file_name);
 
-string PreferedFileName(execution_context context, mft_file file);
+bool CloseWriter(execution_context context, data_writer wr, bool result);
+
+string TreeBaseName(execution_context context, const path_step hit);
 
-bool PrintNTFSDate(uint64_t date, string str, rsize_t offset);
+string PreferedFileName(execution_context context, mft_file file);
 
 bool PerformOperation(execution_context context)
 {
+	//The path only picks the volume then:
+	if (context->parameters->usn_mode > 0)
+		return ExportUsnJournal(context);
+	if (context->parameters->deleted_mode > 0)
+		return ListDeletedFiles(context);
+	if (context->parameters->timeline_mode > 0)
+		return WriteTimeline(context);
+	if (context->parameters->export_mode > 0)
+		return ExportMFT(context);
+	if (context->parameters->find_name)
+		return FindNames(context);
+	if (context->parameters->filter_expr)
+		return SelectFiles(context);
+
+	listing lst = NULL;
+	if (context->parameters->detail_mode > 0 && !(lst = OpenListing(context)))
+		return false;
+
 	bool result;
-	if (!context->parameters->mft_ref)
+	if (context->parameters->mft_ref)
+	{
+		result = ExtractAttributes(context, context->parameters->output_folder, context->parameters->output_file, *context->parameters->mft_ref);
+	}
+	else if (HasWildcards(BaseString(context->parameters->source_path)))
+	{
+		//All matches are selected first, then extracted one after the other:
+		rsize_t base_depth;
+		UT_array* matches = MatchPaths(context, BaseString(context->parameters->source_path), &base_depth);
+		if (!(result = matches && utarray_len(matches) > 0) && matches)
+			wprintf(L"Error: Nothing matches %ls\n", BaseString(context->parameters->source_path));
+
+		for (resolved_path* cur = matches ? utarray_front(matches) : NULL; cur; cur = utarray_next(matches, cur))
+		{
+			if (lst)
+				WritePathInfo(context, lst, *cur);
+
+			string out_folder = MatchFolder(context, *cur, base_depth);
+			result = out_folder && ExtractPath(context, *cur, out_folder) && result;
+			if (out_folder)
+				DeleteString(out_folder);
+		}
+		if (matches)
+			utarray_free(matches);
+	}
+	else
 	{
 		resolved_path res_path;
 		result = TryParsePath(context, BaseString(context->parameters->source_path), &res_path);
 
-		if (context->parameters->detail_mode > 0)
-			WritePathInfo(context, res_path);
+		if (lst)
+			WritePathInfo(context, lst, res_path);
 
 		path_step hit;
-		if (result && (hit = utarray_back(res_path)))
-		{
-			if (context->parameters->output_file && StringLen(context->parameters->output_file) > 0)
-				result = ExtractAttributes(context, context->parameters->output_file, IndexEntryPtr(DerefStep(hit))->mft_reference);
-			else
-			{
-				string base_file = StringPrint(NULL, 0, L"%.*ls", IndexEntryPtr(hit->original)->filename_len, 
-									(wchar_t*)IndexEntryPtr(hit->original)->filename);
-				result = ExtractAttributes(context, base_file, IndexEntryPtr(DerefStep(hit))->mft_reference);
-				DeleteString(base_file);
-			}
-			
-		}
+		if (result && (hit = utarray_back(res_path)) && context->parameters->recursive &&
+				!(IndexEntryPtr(DerefStep(hit))->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT))
+			result = CleanUpAndFail(NULL, NULL, "Error: Recursive needs the path of a directory.\n");
+		else if (result)
+			result = ExtractPath(context, res_path, context->parameters->output_folder);
+
 		if (res_path)
 			DeletePath(res_path);
 	}
+
+	if (lst)
+		result = CloseListing(lst) && result;
+	return result;
+}
+
+bool ExtractPath(execution_context context, const resolved_path res_path, const string out_folder)
+{
+	path_step hit = utarray_back(res_path);
+	if (!hit)
+		return true;
+
+	bool result;
+	if (context->parameters->recursive && (IndexEntryPtr(DerefStep(hit))->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT))
+	{
+		string base_folder = TreeBaseName(context, hit);
+		result = base_folder && ExtractTree(context, IndexEntryPtr(DerefStep(hit)), out_folder, base_folder);
+		if (base_folder)
+			DeleteString(base_folder);
+	}
+	else if (context->parameters->output_file && StringLen(context->parameters->output_file) > 0)
+		result = ExtractAttributes(context, out_folder, context->parameters->output_file,
+						IndexEntryPtr(DerefStep(hit))->mft_reference);
 	else
 	{
-		result = ExtractAttributes(context, context->parameters->output_file, *context->parameters->mft_ref);
+		string base_file = StringPrint(NULL, 0, L"%.*ls", IndexEntryPtr(hit->original)->filename_len, 
+							(wchar_t*)IndexEntryPtr(hit->original)->filename);
+		result = ExtractAttributes(context, out_folder, base_file, IndexEntryPtr(DerefStep(hit))->mft_reference);
+		DeleteString(base_file);
+	}
+	return result;
+}
+
+//A match goes to the same subfolder of the output folder as it's in below the last folder of the
+//path without wildcards, so equally named files from different folders don't overwrite each other
+string MatchFolder(execution_context context, const resolved_path res_path, rsize_t base_depth)
+{
+	string below = StringPrint(NULL, 0, L"");
+	for (rsize_t i = base_depth; below && i + 1 < utarray_len(res_path); ++i)
+	{
+		index_entry ent = IndexEntryPtr(((path_step)utarray_eltptr(res_path, i))->original);
+		StringPrint(below, StringLen(below), L"\\%.*ls", ent->filename_len, (wchar_t*)ent->filename);
 	}
 
+	string result = below ? OutputSubfolder(context, BaseString(below), StringLen(below)) : NULL;
+	if (below)
+		DeleteString(below);
 	return result;
 }
 
-void WritePathInfo(execution_context context, const resolved_path res_path)
+string OutputSubfolder(execution_context context, const wchar_t* path, rsize_t path_len)
+{
+	string result = StringPrint(NULL, 0, L"%ls", BaseString(context->parameters->output_folder));
+	if (!result || context->parameters->tcp_send)
+		return result;
+
+	for (rsize_t start = 0, end; start < path_len; start = end)
+	{
+		end = start + 1;
+		while (end < path_len && path[end] != L'\\')
+			++end;
+		StringPrint(result, StringLen(result), L"%.*ls", (int)(end - start), path + start);
+		if (!CreateDirectoryW(BaseString(result), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+			return ErrorCleanUp(DeleteBytes, result, "Error: Creating output folder failed: %d\n", GetLastError());
+	}
+	return result;
+}
+
+void WritePathInfo(execution_context context, listing lst, const resolved_path res_path)
 {
 	path_step last_folder = utarray_back(res_path);
 	if (!last_folder)
@@ -66,75 +177,46 @@ void WritePathInfo(execution_context context, const resolved_path res_path)
 
 	rsize_t file_st = wcschr(BaseString(context->parameters->source_path), L'\\') - BaseString(context->parameters->source_path);
 
-	wprintf(L"Directory listing for: %.*ls", (int)file_st, BaseString(context->parameters->source_path));
-
+	string folder = StringPrint(NULL, 0, L"%.*ls", (int)file_st, BaseString(context->parameters->source_path));
+	if (!folder)
+		return;
 	for (path_step cur = utarray_eltptr(res_path, 1); cur; cur = utarray_next(res_path, cur))
 	{
 		index_entry ent = IndexEntryPtr(cur->original);
-		wprintf(L"\\%.*ls", (int)ent->filename_len, (wchar_t*)ent->filename);
+		StringPrint(folder, StringLen(folder), L"\\%.*ls", (int)ent->filename_len, (wchar_t*)ent->filename);
 		if (cur == last_folder)
 			break;
 	}
-	wprintf(L"\n\n");
-
-	index_iter iter = StartIndexIterator(context, IndexEntryPtr(DerefStep(last_folder)));
-	if (!iter)
-		return;
+	ListFolder(lst, BaseString(folder), StringLen(folder));
+	DeleteString(folder);
 
-	string str_buf = NewString();
-	if (context->parameters->detail_mode == 1)
+	mft_snapshot snap = context->snapshot;
+	uint64_t ref = IndexEntryPtr(DerefStep(last_folder))->mft_reference;
+	uint64_t row = ref & 0x0000FFFFFFFFFFFF;
+	if (snap && row < snap->table.row_cnt && snap->table.seq[row] == ref >> 48)
 	{
-		for (index_entry rec = CurrentIterEntry(iter); rec; rec = NextIterEntry(context, iter))
-		{
-			wprintf(L"FileName: %.*ls\n", rec->filename_len, (wchar_t*)(rec->filename));
-			wprintf(L"MFT Ref: %lld\n", rec->mft_reference & 0x000000FFFFFFFFFF);
-			wprintf(L"MFT Ref SeqNo: %lld\n", rec->mft_reference >> 40);
-			wprintf(L"Parent MFT Ref: %lld\n", rec->parent_mft_ref & 0x000000FFFFFFFFFF);
-			wprintf(L"Parent MFT Ref SeqNo: %lld\n", rec->parent_mft_ref >> 40);
-			FileFlagsFromIndexRec(rec, str_buf);
-			wprintf(L"Flags: %ls\n", BaseString(str_buf));
-
-			PrintNTFSDate(rec->creation_tm, str_buf, 0);
-			wprintf(L"File Create Time: %ls\n", BaseString(str_buf));
-			PrintNTFSDate(rec->file_last_modif_tm, str_buf, 0);
-			wprintf(L"File Modified Time: %ls\n", BaseString(str_buf));
-			PrintNTFSDate(rec->last_modif_tm, str_buf, 0);
-			wprintf(L"MFT Entry modified Time: %ls\n", BaseString(str_buf));
-			PrintNTFSDate(rec->last_access_tm, str_buf, 0);
-			wprintf(L"File Last Access Time: %ls\n", BaseString(str_buf));
-			wprintf(L"Allocated Size: %llu\n", rec->allocated_sz);
-			wprintf(L"Real Size: %llu\n", rec->real_sz);
-			wprintf(L"NameSpace: %ls\n", NameSpaceLabel(rec->namespace));
-			if (rec->index_flags == 1)
-			{
-				wprintf(L"Flags: Index Entry node\n");
-				wprintf(L"SubNodeVCN: %llu\n", SubNodeEntry(rec));
-			}
-			else
-			{
-				wprintf(L"Flags:\n");
-				wprintf(L"SubNodeVCN:\n");
-			}
-			wprintf(L"\n");
-		}
+		//The snapshot has the children of the folder, under every name they have in it, and all
+		//about them, nothing needs to be read:
+		for (uint32_t i = snap->child_start[row]; i < snap->child_start[row + 1]; ++i)
+			ListRowName(lst, &snap->table, snap->children[i], ref, (wchar_t*)snap->table.names->buffer + snap->child_name_offs[i],
+						snap->child_name_len[i], snap->child_name_space[i]);
 	}
 	else
 	{
-		wprintf(L"  File Modified Time |  Type | %22.22ls | FileName\n", L" ");
+		index_iter iter = StartIndexIterator(context, IndexEntryPtr(DerefStep(last_folder)));
+		if (!iter)
+			return;
+
 		for (index_entry rec = CurrentIterEntry(iter); rec; rec = NextIterEntry(context, iter))
-		{
-			PrintNTFSDate(rec->file_last_modif_tm, str_buf, 0);
-			wprintf(L"%ls | %5.5ls | %22.llu |", BaseString(str_buf),
-				rec->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT ? L"<DIR>" : L" ", rec->real_sz);
-			wprintf(L" %.*ls\n", rec->filename_len, (wchar_t*)(rec->filename));
-		}
+			ListEntry(lst, rec);
+		CloseIndexIterator(iter);
 	}
-	DeleteString(str_buf);
-	CloseIndexIterator(iter);
-}
 
+	//Whatever gets printed next comes after the listing:
+	FlushListing(lst);
+}
 
-bool ExtractAttributes(execution_context context, const string file_name, uint64_t mft_ref)
+bool ExtractAttributes(execution_context context, const string out_folder, const string file_name, uint64_t mft_ref)
 {
 	mft_ref &= 0x00000000FFFFFFFF;
 	wchar_t* anon_name = L"unknown";
@@ -158,7 +240,7 @@ bool ExtractAttributes(execution_context context, const string file_name, uint64
 	}
 	
 	string file_path = context->parameters->tcp_send ? NewString() :
-			StringPrint(NULL, 0, L"%ls\\", BaseString(context->parameters->output_folder));
+			StringPrint(NULL, 0, L"%ls\\", BaseString(out_folder));
 	rsize_t path_offs = StringLen(file_path);
 	bool result = true;
 	uint32_t last_type = ATTR_ATTRIBUTE_END_MARKER;
@@ -201,42 +283,104 @@ bool ExtractAttributes(execution_context context, const string file_name, uint64
 
 bool WriteAttributeContent(execution_context context, mft_file file, attribute at, const string file_name)
 {
-	const uint64_t read_block_sz = 0x20000;
-
-	//Make sure we have a data writer:
-	if (!context->writer)
+	//Compressed attributes are read in bigger windows, so the decompression of the units in it
+	//can be spread over the thread pool:
+	const uint64_t read_block_sz = (at->non_resident && (at->flags & ATTR_IS_COMPRESSED)) ?
+			(uint64_t)PoolSize(context->workers) * 0x80000 : 0x20000;
+	bool sparse = context->parameters->sparse_mode > 0;
+
+	//Every attribute gets its own output file, but when sending over TCP, all attributes go over
+	//the same connection:
+	data_writer wr = context->writer;
+	if (!wr)
 	{
-		context->writer = context->parameters->tcp_send ? TCPWriter(context->parameters->ip_address, context->parameters->tcp_port) : FileWriter(file_name);
-		if (!context->writer)
+		wr = context->parameters->tcp_send ? TCPWriter(context->parameters->ip_address, context->parameters->tcp_port, sparse) :
+								FileWriter(file_name, sparse);
+		if (!wr)
 			return false;
+		if (context->parameters->tcp_send)
+			context->writer = wr;
 	}
 
 	wprintf(context->parameters->tcp_send ? L"Tcpsending: %ls\n" : L"Writing: %ls\n", BaseString(file_name));
 
+	//The unnamed $DATA attribute of a WOF compressed file is one big sparse run, the actual
+	//content is decompressed from its "WofCompressedData" stream:
+	int wof_algorithm = (at->type == ATTR_DATA && at->name_len == 0) ? WofAlgorithm(context, file) : -1;
+	if (wof_algorithm >= 0)
+		return CloseWriter(context, wr, WriteWofContent(context, file, wof_algorithm, AttributeSize(at), wr));
+
 	attribute_reader rdr = OpenAttributeReader(context, file, at);
 	bytes read_buffer = CreateEmpty();
-	uint64_t bytes_read = 0;
 	bool result = true;
 
-	for (result = AppendBytesFromAttribRdr(context, rdr, 0, read_block_sz, read_buffer, 0); result && bytes_read < AttributeSize(at);
-		result = AppendBytesFromAttribRdr(context, rdr, -1, read_block_sz, read_buffer, 0))
+	//In sparse mode, the ranges that are zero by definition are skipped, we don't even read them:
+	UT_array* holes = sparse ? ZeroRanges(context, file, at) : NULL;
+	byte_range* next_hole = holes ? utarray_front(holes) : NULL;
+
+	uint64_t size = AttributeSize(at);
+	bool reposition = true;
+	for (uint64_t pos = 0; result && pos < size; )
 	{
-		WriteData(context->writer, read_buffer);
-		bytes_read += read_buffer->buffer_len;
+		if (next_hole && pos >= next_hole->offset)
+		{
+			result = WriteHole(wr, next_hole->offset + next_hole->length - pos);
+			pos = next_hole->offset + next_hole->length;
+			next_hole = utarray_next(holes, next_hole);
+			reposition = true;
+			continue;
+		}
+
+		//Only reposition the reader after a hole, otherwise let it continue where it was:
+		uint64_t cnt = min(read_block_sz, (next_hole ? next_hole->offset : size) - pos);
+		if (!(result = AppendBytesFromAttribRdr(context, rdr, reposition ? (int64_t)pos : -1, cnt, read_buffer, 0)))
+			break;
+		//A read that comes back empty would leave the file short without saying so:
+		if (read_buffer->buffer_len == 0)
+		{
+			printf("Error: Reading the attribute stopped at %llu of %llu bytes.\n", pos, size);
+			result = false;
+			break;
+		}
+		reposition = false;
+
+		if (context->parameters->sparse_mode > 1)
+			result = WriteSparseData(wr, read_buffer);
+		else
+			result = WriteData(wr, read_buffer);
+		pos += read_buffer->buffer_len;
 	}
+	if (holes)
+		utarray_free(holes);
 	DeleteBytes(read_buffer);
 
 	CloseAttributeReader(rdr);
 
-	if (!context->parameters->tcp_send)
-	{
-		CloseDataWriter(context->writer);
-		context->writer = NULL;
-	}
+	return CloseWriter(context, wr, result);
+}
+
+bool CloseWriter(execution_context context, data_writer wr, bool result)
+{
+	//The TCP connection stays open for the next attribute:
+	if (wr != context->writer)
+		CloseDataWriter(wr);
 
 	return result;
 }
 
+string TreeBaseName(execution_context context, const path_step hit)
+{
+	if (context->parameters->output_file && StringLen(context->parameters->output_file) > 0)
+		return StringPrint(NULL, 0, L"%ls", BaseString(context->parameters->output_file));
+
+	//The root directory is called ".":
+	index_entry ent = IndexEntryPtr(hit->original);
+	if (ent->filename_len == 1 && *(wchar_t*)ent->filename == L'.')
+		return StringPrint(NULL, 0, L"Root");
+
+	return StringPrint(NULL, 0, L"%.*ls", ent->filename_len, (wchar_t*)ent->filename);
+}
+
 string PreferedFileName(execution_context context, mft_file file)
 {
 	attribute best = FirstAttribute(context, file, AttrTypeFlag(ATTR_FILE_NAME));
@@ -255,21 +399,3 @@ string PreferedFileName(execution_context context, mft_file file)
 		(wchar_t *)((file_name_attribute)((uint8_t*)best + best->value_offs))->file_name);
 }
 
-bool PrintNTFSDate(uint64_t date, string str, rsize_t offset)
-{
-	SYSTEMTIME system_tm;
-	if (!FileTimeToSystemTime((FILETIME*)&date, &system_tm))
-		return false;
-
-	SYSTEMTIME loc_system_tm;
-	if (!SystemTimeToTzSpecificLocalTime(NULL, &system_tm, &loc_system_tm))
-		return false;
-
-	Reserve(str, offset + (offset + 21) * sizeof(wchar_t));
-	int date_ln = GetDateFormatW(LOCALE_USER_DEFAULT, 0, &loc_system_tm, L"dd'-'MMM'-'yyyy ", (wchar_t *)(str->buffer + offset*sizeof(wchar_t)), 13);
-
-	GetTimeFormatW(LOCALE_USER_DEFAULT, 0, &loc_system_tm, L"HH':'mm':'ss", (wchar_t *)(str->buffer + (offset + date_ln - 1) * sizeof(wchar_t)), 9);
-
-	return true;
-}
-
@@ -5,4 +5,12 @@
 
 bool PerformOperation(execution_context context);
 
+//Writes the attributes of MFT record 'mft_ref' to 'out_folder', named after 'file_name'
+//(or after the record's own file name, if 'file_name' is empty)
+bool ExtractAttributes(execution_context context, const string out_folder, const string file_name, uint64_t mft_ref);
+
+//The output folder with 'path' (like "\Windows\System32") below it, of which the folders are
+//made one by one as far as they're not there yet. When sending over TCP, only the output folder.
+string OutputSubfolder(execution_context context, const wchar_t* path, rsize_t path_len);
+
 #endif PROCESSOR_H
@@ -25,8 +25,8 @@ settings Parse(int argc, char* argv[])
 		return NULL;
 	}
 	   
-	char* file_name_path, *out_path, *all_attr, *image_file, *image_volume, *raw_dir_mode, *write_fs_info, *out_name, *tcp_send;
-	file_name_path = out_path = all_attr = image_file = image_volume = raw_dir_mode = write_fs_info = out_name = tcp_send = NULL;
+	char* file_name_path, *out_path, *all_attr, *image_file, *image_volume, *raw_dir_mode, *write_fs_info, *out_name, *tcp_send, *sparse_output, *threads, *recursive, *list_format, *record_info, *snapshot, *usn_journal, *deleted, *timeline, *find_name, *filter_expr, *mft_export;
+	file_name_path = out_path = all_attr = image_file = image_volume = raw_dir_mode = write_fs_info = out_name = tcp_send = sparse_output = threads = recursive = list_format = record_info = snapshot = usn_journal = deleted = timeline = find_name = filter_expr = mft_export = NULL;
 
 	for (int i = 1; i < argc; ++i)
 	{
@@ -48,6 +48,30 @@ settings Parse(int argc, char* argv[])
 			continue;
 		if (!tcp_send && match("/TcpSend:", argv[i], &tcp_send))
 			continue;
+		if (!sparse_output && match("/SparseOutput:", argv[i], &sparse_output))
+			continue;
+		if (!threads && match("/Threads:", argv[i], &threads))
+			continue;
+		if (!recursive && match("/Recursive:", argv[i], &recursive))
+			continue;
+		if (!list_format && match("/ListFormat:", argv[i], &list_format))
+			continue;
+		if (!record_info && match("/RecordInfo:", argv[i], &record_info))
+			continue;
+		if (!snapshot && match("/Snapshot:", argv[i], &snapshot))
+			continue;
+		if (!usn_journal && match("/UsnJournal:", argv[i], &usn_journal))
+			continue;
+		if (!deleted && match("/Deleted:", argv[i], &deleted))
+			continue;
+		if (!timeline && match("/Timeline:", argv[i], &timeline))
+			continue;
+		if (!find_name && match("/FindName:", argv[i], &find_name))
+			continue;
+		if (!filter_expr && match("/Filter:", argv[i], &filter_expr))
+			continue;
+		if (!mft_export && match("/MftExport:", argv[i], &mft_export))
+			continue;
 	}
 
 	SafeCreate(result, settings);
@@ -101,6 +125,158 @@ settings Parse(int argc, char* argv[])
 		result->detail_mode = *raw_dir_mode - '0';
 	}
 
+	result->list_format = 0;
+	if (list_format && *list_format)
+	{
+		if (*list_format < '0' || *list_format > '2')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: ListFormat must be an integer from 0 - 2.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->list_format = *list_format - '0';
+
+		//CSV or JSON output is a listing by itself:
+		if (result->list_format > 0 && result->detail_mode == 0)
+			result->detail_mode = 1;
+	}
+
+	result->record_info = false;
+	if (record_info && *record_info)
+	{
+		if (*record_info != '0' && *record_info != '1')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: RecordInfo must be 0 or 1.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->record_info = *record_info == '1';
+
+		//Same as for ListFormat:
+		if (result->record_info && result->detail_mode == 0)
+			result->detail_mode = 1;
+	}
+
+	if (snapshot && *snapshot)
+	{
+		result->snapshot_file = StringPrint(NULL, 0, L"%hs", snapshot);
+
+		//A listing from a snapshot has the metadata of the MFT records:
+		if (result->detail_mode > 0)
+			result->record_info = true;
+	}
+
+	result->usn_mode = 0;
+	if (usn_journal && *usn_journal)
+	{
+		if (*usn_journal < '0' || *usn_journal > '2')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: UsnJournal must be an integer from 0 - 2.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->usn_mode = *usn_journal - '0';
+	}
+
+	result->deleted_mode = 0;
+	if (deleted && *deleted)
+	{
+		if (*deleted < '0' || *deleted > '2')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: Deleted must be an integer from 0 - 2.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->deleted_mode = *deleted - '0';
+	}
+
+	result->timeline_mode = 0;
+	if (timeline && *timeline)
+	{
+		if (*timeline < '0' || *timeline > '2')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: Timeline must be an integer from 0 - 2.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->timeline_mode = *timeline - '0';
+	}
+
+	result->export_mode = 0;
+	if (mft_export && *mft_export)
+	{
+		if (*mft_export < '0' || *mft_export > '3')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: MftExport must be an integer from 0 - 3.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->export_mode = *mft_export - '0';
+	}
+
+	if (find_name && *find_name)
+	{
+		if (strpbrk(find_name, "\\/:"))
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: FindName is a file name, without a path.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->find_name = StringPrint(NULL, 0, L"%hs", find_name);
+	}
+
+	if (filter_expr && *filter_expr)
+	{
+		if (result->find_name)
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: Filter can't be combined with FindName, name = ... in the filter does the same.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->filter_expr = StringPrint(NULL, 0, L"%hs", filter_expr);
+	}
+
+	result->sparse_mode = 0;
+	if (sparse_output && *sparse_output)
+	{
+		if (*sparse_output < '0' || *sparse_output > '2')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: SparseOutput must be an integer from 0 - 2.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->sparse_mode = *sparse_output - '0';
+	}
+
+	result->thread_cnt = 0;
+	if (threads && *threads)
+	{
+		char* end;
+		unsigned long cnt = strtoul(threads, &end, 10);
+		if (*end || cnt < 1 || cnt > 256)
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: Threads must be an integer from 1 - 256.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->thread_cnt = (unsigned int)cnt;
+	}
+
+	result->recursive = false;
+	if (recursive && *recursive)
+	{
+		if (*recursive != '0' && *recursive != '1')
+		{
+			ErrorCleanUp(DeleteSettings, result, "Error: Recursive must be 0 or 1.\n");
+			PrintHelp();
+			return NULL;
+		}
+		result->recursive = *recursive == '1';
+	}
+
+	if (result->recursive && result->tcp_send)
+		return ErrorCleanUp(DeleteSettings, result, "Error: Recursive can't be combined with TcpSend.\n");
+
 	uint64_t image_vol = 0;
 	if (image_volume && *image_volume)
 	{
@@ -207,6 +383,14 @@ settings Parse(int argc, char* argv[])
 
 		result->source_path = StringPrint(NULL, 0, L"%ls%hs", file_name_path[0] == '\\' ? L"x:" : L"", file_name_path);
 	}
+	else if (file_name_path[1] == ':' && strpbrk(file_name_path, "*?"))
+	{
+		// A path with wildcards, which Windows API can't check for us, the matching
+		// is done in the indexes of the volume
+		result->source_drive = StringPrint(NULL, 0, L"%ls%.2hs", strncmp(file_name_path, "\\\\.\\", 4) ? L"\\\\.\\" : L"",
+			file_name_path);
+		result->source_path = StringPrint(NULL, 0, L"%hs", file_name_path);
+	}
 	else if (PathFileExistsA(file_name_path))
 	{
 		// This is the 'most normal' case: copy an existing file with the full path
@@ -239,13 +423,19 @@ settings Parse(int argc, char* argv[])
 		result->source_path = StringPrint(NULL, 0, L"%hs", file_name_path);
 	}
 
+	if (result->recursive && !result->source_path)
+		return ErrorCleanUp(DeleteSettings, result, "Error: Recursive needs the path of a directory, not an MFT reference.\n");
+
+	if (result->output_file && result->source_path && wcspbrk(BaseString(result->source_path), L"*?"))
+		return ErrorCleanUp(DeleteSettings, result, "Error: OutputName can't be used with wildcards, they can select several files.\n");
+
 	return result;
 }
 
 void PrintHelp()
 {
 	printf("Syntax:\n");
-	printf("RawCCopy /ImageFile:FullPath\\ImageFilename /ImageVolume:[1,2...n] /FileNamePath:FullPath\\Filename /OutputPath:FullPath /OutputName:FileName /AllAttr:[0|1] /RawDirMode:[0|1|2] /WriteFSInfo:[0|1]\n");
+	printf("RawCCopy /ImageFile:FullPath\\ImageFilename /ImageVolume:[1,2...n] /FileNamePath:FullPath\\Filename /OutputPath:FullPath /OutputName:FileName /AllAttr:[0|1] /RawDirMode:[0|1|2] /WriteFSInfo:[0|1] /SparseOutput:[0|1|2] /Threads:N /Recursive:[0|1] /ListFormat:[0|1|2] /RecordInfo:[0|1] /Snapshot:FullPath\\SnapshotFilename /UsnJournal:[0|1|2] /Deleted:[0|1|2] /Timeline:[0|1|2] /FindName:FileName /Filter:Expression /MftExport:[0|1|2|3]\n");
 	printf("Examples:\n");
 	printf("RawCCopy /FileNamePath:c:\\hiberfil.sys /OutputPath:e:\\temp /OutputName:hiberfil_c.sys\n");
 	printf("RawCCopy /FileNamePath:c:\\pagefile.sys /OutputPath:e:\\temp /AllAttr:1\n");
@@ -253,11 +443,24 @@ void PrintHelp()
 	printf("RawCCopy /ImageFile:e:\\temp\\diskimage.dd /ImageVolume:2 /FileNamePath:c:2 /OutputPath:e:\\out\n");
 	printf("RawCCopy /ImageFile:e:\\temp\\partimage.dd /ImageVolume:1 /FileNamePath:c:\\file.ext /OutputPath:e:\\out\n");
 	printf("RawCCopy /FileNamePath:c:\\$Extend /RawDirMode:1\n");
+	printf("RawCCopy /FileNamePath:c:\\Windows\\System32 /OutputPath:e:\\out /ListFormat:1\n");
+	printf("RawCCopy /FileNamePath:c:\\Users\\john\\Downloads /RawDirMode:1 /RecordInfo:1\n");
+	printf("RawCCopy /ImageFile:e:\\temp\\diskimage.dd /ImageVolume:2 /FileNamePath:c:\\Windows\\Temp /RawDirMode:1 /Snapshot:e:\\temp\\diskimage.snap\n");
+	printf("RawCCopy /FileNamePath:c:\\ /OutputPath:e:\\out /UsnJournal:1 /Snapshot:e:\\out\\c.snap\n");
+	printf("RawCCopy /ImageFile:e:\\temp\\diskimage.dd /ImageVolume:2 /FileNamePath:c:\\ /OutputPath:e:\\out /Deleted:1\n");
+	printf("RawCCopy /FileNamePath:d:\\ /OutputPath:e:\\out /Timeline:1\n");
+	printf("RawCCopy /FileNamePath:c:\\ /FindName:*.ps1 /ListFormat:1 /OutputPath:e:\\out\n");
+	printf("RawCCopy /FileNamePath:c:\\ /Filter:\"size > 100MB and modified > now-7d and not dir\" /RawDirMode:1\n");
+	printf("RawCCopy /FileNamePath:c:\\ /Filter:\"name = *.lnk and created < fn_created\" /OutputPath:e:\\out\n");
+	printf("RawCCopy /ImageFile:e:\\temp\\diskimage.dd /ImageVolume:2 /FileNamePath:c:\\ /OutputPath:e:\\out /MftExport:2\n");
 	printf("RawCCopy /ImageFile:e:\\temp\\diskimage.dd /ImageVolume:2 /FileNamePath:""c:\\system volume information"" /RawDirMode:2 /WriteFSInfo:1\n");
 	printf("RawCCopy /FileNamePath:\\\\.\\HarddiskVolumeShadowCopy1:x:\\ /RawDirMode:1\n");
 	printf("RawCCopy /FileNamePath:\\\\.\\Harddisk0Partition2:0 /OutputPath:e:\\out /OutputName:MFT_Hd0Part2\n");
 	printf("RawCCopy /FileNamePath:\\\\.\\PhysicalDrive0:0 /ImageVolume:2 /OutputPath:e:\\out\n");
 	printf("RawCCopy /FileNamePath:c:\\$LogFile /TcpSend:1 /OutputPath:10.10.10.10:6666\n");
+	printf("RawCCopy /FileNamePath:c:\\$Extend\\$UsnJrnl /OutputPath:e:\\out /SparseOutput:1\n");
+	printf("RawCCopy /FileNamePath:c:\\Users\\john /OutputPath:e:\\out /Recursive:1\n");
+	printf("RawCCopy /FileNamePath:c:\\Users\\*\\NTUSER.DAT* /OutputPath:e:\\out\n");
 }
 
 
@@ -278,6 +481,15 @@ void DeleteSettings(settings set)
 	if (set->source_path)
 		DeleteString(set->source_path);
 
+	if (set->snapshot_file)
+		DeleteString(set->snapshot_file);
+
+	if (set->find_name)
+		DeleteString(set->find_name);
+
+	if (set->filter_expr)
+		DeleteString(set->filter_expr);
+
 	free(set);
 }
 
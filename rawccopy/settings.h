@@ -17,10 +17,22 @@ typedef struct _settings {
 	unsigned int detail_mode;
 	bool write_boot_info;
 	bool all_attribs;
+	unsigned int sparse_mode;		// 0: write zeros, 1: holes for sparse runs, 2: also for zero blocks in the data
+	unsigned int thread_cnt;		// 0: one per processor
+	bool recursive;					// extract the whole directory tree under source_path
+	unsigned int list_format;		// 0: text, 1: CSV, 2: JSON lines
+	bool record_info;				// listing metadata comes from the MFT records instead of the index entries
+	unsigned int usn_mode;			// 0: no export of the USN journal, 1: JSON lines, 2: binary
+	unsigned int deleted_mode;		// 0: no list of deleted files, 1: CSV, 2: JSON lines
+	unsigned int timeline_mode;		// 0: no timeline, 1: bodyfile, 2: CSV
+	unsigned int export_mode;		// 0: no export of the MFT, 1: CSV, 2: JSON lines, 3: binary columns
 	string output_file;
 	string output_folder;
 	string source_path;
 	string source_drive;
+	string snapshot_file;			// /Snapshot:, NULL without
+	string find_name;				// /FindName:, NULL without
+	string filter_expr;				// /Filter:, NULL without
 	uint64_t image_offs;
 	uint64_t* mft_ref;
 } *settings;
@@ -0,0 +1,287 @@
+#include <windows.h>
+#include <process.h>
+
+#include "thread-pool.h"
+#include "helpers.h"
+
+struct _thread_pool
+{
+	unsigned int thread_cnt;		// threads in total, including the one calling RunParallel
+	HANDLE* workers;				// the thread_cnt - 1 worker threads
+	HANDLE start;					// semaphore, released once per worker for every run
+	HANDLE done;					// set by the last worker to finish a run
+	volatile LONG busy;				// a run is going on
+	volatile LONG active;			// workers still busy with the current run
+	volatile LONG next_item;		// index of the next item to hand out
+	volatile LONG stop;				// tells the workers to quit
+	item_job job;
+	uint8_t* items;
+	size_t item_sz;
+	size_t item_cnt;
+	void* shared;
+	task_job task;					// set during RunTasks, instead of 'job'
+	task_queue queues;				// one per thread during RunTasks
+	volatile LONG next_queue;		// index of the next queue to hand out to a thread
+	volatile LONG pending;			// tasks queued, but not done yet
+	HANDLE queued;					// semaphore, released for threads waiting for a task
+	volatile LONG waiting;			// threads waiting on 'queued'
+};
+
+//The owner of the queue adds and takes tasks at the back, other threads steal them from the front
+struct _task_queue
+{
+	thread_pool pool;				// NULL when the tasks are run on the calling thread only
+	CRITICAL_SECTION lock;
+	UT_array* tasks;
+	rsize_t first;					// tasks before this one were stolen already
+};
+
+unsigned __stdcall WorkerMain(void* arg);
+void ProcessItems(thread_pool pool);
+void ProcessTasks(thread_pool pool);
+void* FindTask(thread_pool pool, LONG own);
+void* TakeTask(task_queue queue, bool newest);
+
+thread_pool CreateThreadPool(unsigned int thread_cnt)
+{
+	if (!thread_cnt)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		thread_cnt = si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+	}
+
+	SafeCreate(result, thread_pool);
+	memset(result, 0, sizeof(struct _thread_pool));
+
+	if (thread_cnt > 1)
+	{
+		result->start = CreateSemaphore(NULL, 0, thread_cnt, NULL);
+		result->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+		result->queued = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+		if (!result->start || !result->done || !result->queued)
+			return ErrorCleanUp(CloseThreadPool, result, "Error: Creating thread pool failed: %d\n", GetLastError());
+
+		SafeAlloc(result->workers, thread_cnt - 1);
+		result->thread_cnt = 1;
+		for (unsigned int i = 0; i < thread_cnt - 1; ++i, ++result->thread_cnt)
+		{
+			if (!(result->workers[i] = (HANDLE)_beginthreadex(NULL, 0, WorkerMain, result, 0, NULL)))
+				break;
+		}
+	}
+	else
+		result->thread_cnt = 1;
+
+	return result;
+}
+
+void CloseThreadPool(thread_pool pool)
+{
+	if (pool->workers)
+	{
+		pool->stop = 1;
+		ReleaseSemaphore(pool->start, pool->thread_cnt - 1, NULL);
+		for (unsigned int i = 0; i < pool->thread_cnt - 1; ++i)
+		{
+			WaitForSingleObject(pool->workers[i], INFINITE);
+			CloseHandle(pool->workers[i]);
+		}
+		free(pool->workers);
+	}
+
+	if (pool->start)
+		CloseHandle(pool->start);
+
+	if (pool->done)
+		CloseHandle(pool->done);
+
+	if (pool->queued)
+		CloseHandle(pool->queued);
+
+	free(pool);
+}
+
+unsigned int PoolSize(const thread_pool pool)
+{
+	return pool ? pool->thread_cnt : 1;
+}
+
+void RunParallel(thread_pool pool, item_job job, void* items, size_t item_sz, size_t item_cnt, void* shared)
+{
+	if (!pool || pool->thread_cnt == 1 || item_cnt < 2 || InterlockedCompareExchange(&pool->busy, 1, 0))
+	{
+		for (size_t i = 0; i < item_cnt; ++i)
+			job((uint8_t*)items + i * item_sz, shared);
+		return;
+	}
+
+	pool->job = job;
+	pool->items = items;
+	pool->item_sz = item_sz;
+	pool->item_cnt = item_cnt;
+	pool->shared = shared;
+	pool->next_item = 0;
+	pool->active = pool->thread_cnt - 1;
+
+	ReleaseSemaphore(pool->start, pool->thread_cnt - 1, NULL);
+	ProcessItems(pool);
+	WaitForSingleObject(pool->done, INFINITE);
+
+	InterlockedExchange(&pool->busy, 0);
+}
+
+void ProcessItems(thread_pool pool)
+{
+	for (size_t i = InterlockedIncrement(&pool->next_item) - 1; i < pool->item_cnt; i = InterlockedIncrement(&pool->next_item) - 1)
+		pool->job(pool->items + i * pool->item_sz, pool->shared);
+}
+
+unsigned __stdcall WorkerMain(void* arg)
+{
+	thread_pool pool = arg;
+	while (WaitForSingleObject(pool->start, INFINITE) == WAIT_OBJECT_0 && !pool->stop)
+	{
+		if (pool->task)
+			ProcessTasks(pool);
+		else
+			ProcessItems(pool);
+		if (!InterlockedDecrement(&pool->active))
+			SetEvent(pool->done);
+	}
+	return 0;
+}
+
+void RunTasks(thread_pool pool, task_job job, void* first_task, void* shared)
+{
+	if (!pool || pool->thread_cnt == 1 || InterlockedCompareExchange(&pool->busy, 1, 0))
+	{
+		struct _task_queue queue = { NULL };
+		utarray_new(queue.tasks, &ut_ptr_icd);
+		QueueTask(&queue, first_task);
+		for (void* task = TakeTask(&queue, true); task; task = TakeTask(&queue, true))
+			job(&queue, task, shared);
+		utarray_free(queue.tasks);
+		return;
+	}
+
+	pool->queues = calloc(pool->thread_cnt, sizeof(struct _task_queue));
+	if (!pool->queues)
+		ErrorExit("Memory allocation problem.", -1);
+	for (unsigned int i = 0; i < pool->thread_cnt; ++i)
+	{
+		pool->queues[i].pool = pool;
+		InitializeCriticalSection(&pool->queues[i].lock);
+		utarray_new(pool->queues[i].tasks, &ut_ptr_icd);
+	}
+
+	pool->task = job;
+	pool->shared = shared;
+	pool->next_queue = 0;
+	pool->pending = 0;
+	pool->active = pool->thread_cnt - 1;
+	QueueTask(&pool->queues[0], first_task);
+
+	ReleaseSemaphore(pool->start, pool->thread_cnt - 1, NULL);
+	ProcessTasks(pool);
+	WaitForSingleObject(pool->done, INFINITE);
+
+	//Wake-ups that no thread waited for are dropped, so they don't carry over to the next run:
+	while (WaitForSingleObject(pool->queued, 0) == WAIT_OBJECT_0);
+
+	for (unsigned int i = 0; i < pool->thread_cnt; ++i)
+	{
+		DeleteCriticalSection(&pool->queues[i].lock);
+		utarray_free(pool->queues[i].tasks);
+	}
+	free(pool->queues);
+	pool->queues = NULL;
+	pool->task = NULL;
+
+	InterlockedExchange(&pool->busy, 0);
+}
+
+void QueueTask(task_queue queue, void* task)
+{
+	if (!queue->pool)
+	{
+		utarray_push_back(queue->tasks, &task);
+		return;
+	}
+
+	//Counted before it can be taken, so 'pending' can't drop to zero while there's work left:
+	InterlockedIncrement(&queue->pool->pending);
+	EnterCriticalSection(&queue->lock);
+	utarray_push_back(queue->tasks, &task);
+	LeaveCriticalSection(&queue->lock);
+
+	if (queue->pool->waiting)
+		ReleaseSemaphore(queue->pool->queued, 1, NULL);
+}
+
+void ProcessTasks(thread_pool pool)
+{
+	LONG own = InterlockedIncrement(&pool->next_queue) - 1;
+	while (pool->pending)
+	{
+		void* task = FindTask(pool, own);
+		if (!task)
+		{
+			//Other threads are still busy with tasks that can queue new ones. QueueTask only
+			//wakes threads that wait, so after saying so, the queues are looked at once more:
+			InterlockedIncrement(&pool->waiting);
+			if (!(task = FindTask(pool, own)) && pool->pending)
+				WaitForSingleObject(pool->queued, INFINITE);
+			InterlockedDecrement(&pool->waiting);
+			if (!task)
+				continue;
+		}
+
+		pool->task(&pool->queues[own], task, pool->shared);
+
+		//The last task wakes all threads, they're done:
+		if (!InterlockedDecrement(&pool->pending))
+			ReleaseSemaphore(pool->queued, pool->thread_cnt, NULL);
+	}
+}
+
+//The newest task of the thread's own queue, or else the oldest one of another thread
+void* FindTask(thread_pool pool, LONG own)
+{
+	void* result = TakeTask(&pool->queues[own], true);
+	for (unsigned int i = 1; !result && i < pool->thread_cnt; ++i)
+		result = TakeTask(&pool->queues[(own + i) % pool->thread_cnt], false);
+	return result;
+}
+
+void* TakeTask(task_queue queue, bool newest)
+{
+	if (queue->pool)
+		EnterCriticalSection(&queue->lock);
+
+	void* result = NULL;
+	if (utarray_len(queue->tasks) > queue->first)
+	{
+		if (newest)
+		{
+			result = *(void**)utarray_back(queue->tasks);
+			utarray_pop_back(queue->tasks);
+		}
+		else
+		{
+			//utarray_eltptr evaluates the index more than once:
+			result = *(void**)utarray_eltptr(queue->tasks, queue->first);
+			queue->first++;
+		}
+
+		if (utarray_len(queue->tasks) == queue->first)
+		{
+			utarray_clear(queue->tasks);
+			queue->first = 0;
+		}
+	}
+
+	if (queue->pool)
+		LeaveCriticalSection(&queue->lock);
+	return result;
+}
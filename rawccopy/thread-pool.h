@@ -0,0 +1,40 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct _thread_pool* thread_pool;
+
+//Work done on a single item by RunParallel, 'shared' is passed unchanged to every call
+typedef void (*item_job)(void* item, void* shared);
+
+//Creates a pool with 'thread_cnt' threads in total, the thread calling RunParallel included.
+//A count of 0 gives one thread per processor, a count of 1 does all work on the calling thread.
+thread_pool CreateThreadPool(unsigned int thread_cnt);
+
+void CloseThreadPool(thread_pool pool);
+
+unsigned int PoolSize(const thread_pool pool);
+
+//Calls 'job' once for every one of the 'item_cnt' items of 'item_sz' bytes in 'items' and
+//returns when all of them are done. Items are handed out in order, but can finish in any order.
+//A call made while the pool is already busy (e.g. from within a job) runs on the calling thread.
+void RunParallel(thread_pool pool, item_job job, void* items, size_t item_sz, size_t item_cnt, void* shared);
+
+//Queue of the tasks of one thread during RunTasks
+typedef struct _task_queue* task_queue;
+
+//Work done on a single task by RunTasks, further tasks it comes across are added with QueueTask
+typedef void (*task_job)(task_queue queue, void* task, void* shared);
+
+//Calls 'job' for 'first_task' and for every task queued by the jobs, and returns when all of them
+//are done. Every thread does the newest task of its own queue first, and when that one is empty,
+//steals the oldest task of another thread. Like RunParallel, a call made while the pool is busy
+//runs on the calling thread.
+void RunTasks(thread_pool pool, task_job job, void* first_task, void* shared);
+
+void QueueTask(task_queue queue, void* task);
+
+#endif //THREAD_POOL_H
@@ -0,0 +1,168 @@
+#include <windows.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "attribs.h"
+#include "index.h"
+#include "file-table.h"
+#include "listing.h"
+#include "filter.h"
+#include "helpers.h"
+
+//Indexes of the timestamps of a row
+#define TIME_CREATED 0
+#define TIME_MODIFIED 1
+#define TIME_MFT_MODIFIED 2
+#define TIME_ACCESSED 3
+
+void TimelineBody(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len);
+
+void TimelineBodyLine(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+						const uint64_t* times, const wchar_t* suffix);
+
+void TimelineCSV(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, const string flags);
+
+void PutFilePath(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len);
+
+
+bool WriteTimeline(execution_context context)
+{
+	filter flt = NULL;
+	if (context->parameters->filter_expr && !(flt = CompileFilter(context, BaseString(context->parameters->filter_expr))))
+		return false;
+
+	file_table table = BuildFileTable(context, SCAN_DELETED, NULL, NULL);
+	row_names names = table && flt ? CreateRowNames(table, 0) : NULL;
+	if (!table || (flt && !names))
+	{
+		if (table)
+			DeleteFileTable(table);
+		if (flt)
+			DeleteFilter(flt);
+		return false;
+	}
+
+	const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+	const wchar_t* root = source[0] && source[1] == L':' ? source : L"x:";
+	bool body = context->parameters->timeline_mode == TIMELINE_BODYFILE;
+	folder_paths paths = CreateFolderPaths(table, root, 2);
+	string flags = paths ? NewString() : NULL;
+	string orphans = flags ? StringPrint(NULL, 0, L"%.*ls%ls", 2, root, ORPHAN_FOLDER) : NULL;
+	listing lst = orphans ? OpenListingFile(context, context->parameters->tcp_send ? NULL : body ? L"Timeline.body" : L"Timeline.csv") : NULL;
+	bool result = lst != NULL;
+	if (result && !body)
+		PutText(lst, L"Directory,FileName,MftRef,MftSeqNo,ParentMftRef,ParentMftSeqNo,Flags,Deleted,AllocatedSize,RealSize,"
+						L"SICreated,SIModified,SIMftModified,SIAccessed,FNCreated,FNModified,FNMftModified,FNAccessed\n");
+
+	//The rows go out in record order, as they're in the table, through the buffer of the listing:
+	for (uint64_t row = 0; result && row < table->row_cnt; ++row)
+	{
+		//Records without a name are mostly ones that were never used:
+		if (!(table->flags[row] & (FILE_ROW_IN_USE | FILE_ROW_DELETED)) || (table->flags[row] & FILE_ROW_EXTENSION) ||
+				!table->name_len[row] || (flt && !MatchFilter(flt, table, names, row)))
+			continue;
+
+		rsize_t path_len = 0;
+		const wchar_t* path = FolderPath(paths, table->parent[row], &path_len);
+		if (!path)
+		{
+			path = BaseString(orphans);
+			path_len = StringLen(orphans);
+		}
+
+		if (body)
+			TimelineBody(lst, table, row, path, path_len);
+		else
+			TimelineCSV(lst, table, row, path, path_len, flags);
+	}
+
+	if (lst)
+		result = CloseListing(lst) && result;
+	if (orphans)
+		DeleteString(orphans);
+	if (flags)
+		DeleteString(flags);
+	if (paths)
+		DeleteFolderPaths(paths);
+	if (names)
+		DeleteRowNames(names);
+	DeleteFileTable(table);
+	if (flt)
+		DeleteFilter(flt);
+	return result;
+}
+
+//Like fls -m does for NTFS: the $FILE_NAME line has " ($FILE_NAME)" after the name, deleted
+//files have " (deleted)" after that
+void TimelineBody(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len)
+{
+	bool deleted = table->flags[row] & FILE_ROW_DELETED;
+	TimelineBodyLine(lst, table, row, path, path_len, table->si_times + row * FILE_TIMES, deleted ? L" (deleted)" : L"");
+	TimelineBodyLine(lst, table, row, path, path_len, table->fn_times + row * FILE_TIMES,
+						deleted ? L" ($FILE_NAME) (deleted)" : L" ($FILE_NAME)");
+}
+
+//MD5|name|inode|mode|UID|GID|size|atime|mtime|ctime|crtime, where ctime is when the MFT
+//record changed
+void TimelineBodyLine(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len,
+						const uint64_t* times, const wchar_t* suffix)
+{
+	PutText(lst, L"0|");
+	PutFilePath(lst, table, row, path, path_len);
+	PutText(lst, suffix);
+	PutText(lst, L"|");
+	PutNumber(lst, row, 0, 0);
+	PutText(lst, table->flags[row] & FILE_ROW_DIRECTORY ? L"|d/drwxrwxrwx|0|0|" : L"|r/rrwxrwxrwx|0|0|");
+	PutNumber(lst, table->data_sz[row], 0, 0);
+	PutText(lst, L"|");
+	PutUnixTime(lst, times[TIME_ACCESSED]);
+	PutText(lst, L"|");
+	PutUnixTime(lst, times[TIME_MODIFIED]);
+	PutText(lst, L"|");
+	PutUnixTime(lst, times[TIME_MFT_MODIFIED]);
+	PutText(lst, L"|");
+	PutUnixTime(lst, times[TIME_CREATED]);
+	PutText(lst, L"\n");
+}
+
+void TimelineCSV(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len, const string flags)
+{
+	PutCSVField(lst, path, path_len);
+	PutText(lst, L",");
+	PutCSVField(lst, FileRowName(table, row), table->name_len[row]);
+	PutText(lst, L",");
+	PutNumber(lst, row, 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->seq[row], 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->parent[row] & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->parent[row] >> 48, 0, 0);
+	PutText(lst, L",");
+	FileFlagsToString(table->attributes[row] | (table->flags[row] & FILE_ROW_DIRECTORY ? FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT : 0), flags);
+	PutCSVField(lst, BaseString(flags), StringLen(flags));
+	PutText(lst, table->flags[row] & FILE_ROW_DELETED ? L",1," : L",0,");
+	PutNumber(lst, table->alloc_sz[row], 0, 0);
+	PutText(lst, L",");
+	PutNumber(lst, table->data_sz[row], 0, 0);
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		PutText(lst, L",");
+		PutISODate(lst, table->si_times[row * FILE_TIMES + i]);
+	}
+	for (int i = 0; i < FILE_TIMES; ++i)
+	{
+		PutText(lst, L",");
+		PutISODate(lst, table->fn_times[row * FILE_TIMES + i]);
+	}
+	PutText(lst, L"\n");
+}
+
+//The root folder is its own parent, and has no name of its own in the path
+void PutFilePath(listing lst, const file_table table, uint64_t row, const wchar_t* path, rsize_t path_len)
+{
+	PutChars(lst, path, path_len);
+	PutText(lst, L"\\");
+	if ((table->parent[row] & 0x0000FFFFFFFFFFFF) != row)
+		PutChars(lst, FileRowName(table, row), table->name_len[row]);
+}
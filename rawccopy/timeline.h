@@ -0,0 +1,17 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "context.h"
+
+//Formats of /Timeline:
+#define TIMELINE_BODYFILE 1
+#define TIMELINE_CSV 2
+
+//Writes a timeline of all files of the volume, deleted ones included, from one sequential read
+//of the MFT that's parsed on all threads: in the bodyfile format of The Sleuth Kit (mactime) to
+//Timeline.body, with a line for the $STANDARD_INFORMATION and one for the $FILE_NAME times of
+//every file, or as CSV with all eight of them on one line, to Timeline.csv in the output folder.
+//With /Filter:, only the files that pass it are in there.
+bool WriteTimeline(execution_context context);
+
+#endif //TIMELINE_H
@@ -0,0 +1,185 @@
+#include <windows.h>
+
+#include "tree-walker.h"
+#include "processor.h"
+#include "attribs.h"
+#include "helpers.h"
+
+//MFT records below this one are the NTFS metadata files ($MFT, $LogFile, $BadClus, ...)
+#define FIRST_USER_FILE_NUMBER 0x10
+
+//The walk is done by the tasks of the thread pool: the task of a directory creates its output
+//folder and queues a task for every file and subdirectory in it, the task of a file extracts it.
+//Both kinds of tasks share the same threads, so extracting a big file doesn't keep the rest of
+//the tree from being walked.
+typedef struct {
+	bytes entry;					// Copy of the index entry of the file or directory
+	string out_folder;				// Output folder of the directory, or the one the file goes in
+} *tree_task;
+
+typedef struct {
+	execution_context context;
+	volatile LONG folders;
+	volatile LONG files;
+	volatile LONG links;
+	volatile LONG failures;
+} tree_walk;
+
+//State of the sweep of a single directory
+typedef struct {
+	task_queue queue;
+	tree_walk* walk;
+	tree_task folder;
+	string out_path;
+} folder_walk;
+
+void TreeJob(task_queue queue, void* task, void* shared);
+
+void WalkFolder(task_queue queue, tree_walk* walk, const tree_task folder);
+
+void QueueEntry(const index_entry rec, void* state);
+
+string ExtendedPath(const string path);
+
+tree_task CreateTreeTask(const index_entry entry, const string out_folder);
+
+void DeleteTreeTask(tree_task task);
+
+bool ExtractTree(execution_context context, const index_entry folder, const string out_folder, const string base_name)
+{
+	string relative = StringPrint(NULL, 0, L"%ls\\%ls", BaseString(out_folder), BaseString(base_name));
+	string tree_folder = ExtendedPath(relative);
+	DeleteString(relative);
+	if (!tree_folder)
+		return false;
+
+	if (!CreateDirectoryW(BaseString(tree_folder), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		return CleanUpAndFail(DeleteBytes, tree_folder, "Error: Creating output folder failed: %d\n", GetLastError());
+
+	tree_task root = CreateTreeTask(folder, tree_folder);
+	DeleteString(tree_folder);
+	if (!root)
+		return false;
+
+	tree_walk walk = { context, 0, 0, 0, 0 };
+	RunTasks(context->workers, TreeJob, root, &walk);
+
+	printf("Extracted %ld files in %ld directories, %ld links skipped, %ld failures.\n",
+		walk.files, walk.folders, walk.links, walk.failures);
+	return !walk.failures;
+}
+
+void TreeJob(task_queue queue, void* task, void* shared)
+{
+	tree_walk* walk = shared;
+	index_entry ent = IndexEntryPtr(((tree_task)task)->entry);
+
+	if (ent->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT)
+		WalkFolder(queue, walk, task);
+	else
+	{
+		string file_name = StringPrint(NULL, 0, L"%.*ls", ent->filename_len, (wchar_t*)ent->filename);
+		if (file_name && ExtractAttributes(walk->context, ((tree_task)task)->out_folder, file_name, ent->mft_reference))
+			InterlockedIncrement(&walk->files);
+		else
+			InterlockedIncrement(&walk->failures);
+		if (file_name)
+			DeleteString(file_name);
+	}
+
+	DeleteTreeTask(task);
+}
+
+void WalkFolder(task_queue queue, tree_walk* walk, const tree_task folder)
+{
+	//The order of the entries doesn't matter here, so sweeping the index is faster than iterating:
+	folder_walk state = { queue, walk, folder, NewString() };
+	if (state.out_path && SweepIndex(walk->context, IndexEntryPtr(folder->entry)->mft_reference, QueueEntry, &state))
+		InterlockedIncrement(&walk->folders);
+	else
+	{
+		wprintf(L"Error: Unable to list directory %ls\n", BaseString(folder->out_folder));
+		InterlockedIncrement(&walk->failures);
+	}
+	if (state.out_path)
+		DeleteString(state.out_path);
+}
+
+void QueueEntry(const index_entry rec, void* state)
+{
+	folder_walk* fw = state;
+
+	//Every file that has a DOS name is listed twice, unless both names are the same:
+	if (rec->namespace == FILE_NAME_DOS || (rec->mft_reference & 0x0000FFFFFFFFFFFF) < FIRST_USER_FILE_NUMBER)
+		return;
+
+	StringPrint(fw->out_path, 0, L"%ls\\%.*ls", BaseString(fw->folder->out_folder), rec->filename_len, (wchar_t*)rec->filename);
+	if (IsLinkEntry(rec))
+	{
+		//Following links could lead us in circles (like 'Application Data' in a profile):
+		wprintf(L"Skipping link: %ls\n", BaseString(fw->out_path));
+		InterlockedIncrement(&fw->walk->links);
+		return;
+	}
+
+	tree_task next;
+	if (rec->file_flags & FILE_ATTR_DUP_FILE_NAME_INDEX_PRESENT)
+	{
+		if (!CreateDirectoryW(BaseString(fw->out_path), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		{
+			wprintf(L"Error: Creating folder %ls failed: %d\n", BaseString(fw->out_path), GetLastError());
+			InterlockedIncrement(&fw->walk->failures);
+			return;
+		}
+		next = CreateTreeTask(rec, fw->out_path);
+	}
+	else
+		next = CreateTreeTask(rec, fw->folder->out_folder);
+
+	if (next)
+		QueueTask(fw->queue, next);
+	else
+		InterlockedIncrement(&fw->walk->failures);
+}
+
+//Trees can easily be deeper than MAX_PATH, so the output goes to an extended-length path
+string ExtendedPath(const string path)
+{
+	DWORD len = GetFullPathNameW(BaseString(path), 0, NULL, NULL);
+	if (!len)
+		return ErrorCleanUp(NULL, NULL, "Error: Invalid output folder: %ls\n", BaseString(path));
+
+	wchar_t* full;
+	SafeAlloc(full, len);
+	if (!GetFullPathNameW(BaseString(path), len, full, NULL))
+		return ErrorCleanUp(free, full, "Error: Invalid output folder: %ls\n", BaseString(path));
+
+	string result;
+	if (!wcsncmp(full, L"\\\\?\\", 4))
+		result = StringPrint(NULL, 0, L"%ls", full);
+	else if (!wcsncmp(full, L"\\\\", 2))
+		result = StringPrint(NULL, 0, L"\\\\?\\UNC\\%ls", full + 2);
+	else
+		result = StringPrint(NULL, 0, L"\\\\?\\%ls", full);
+	free(full);
+	return result;
+}
+
+tree_task CreateTreeTask(const index_entry entry, const string out_folder)
+{
+	SafeCreate(result, tree_task);
+	result->entry = FromBuffer(entry, entry->entry_size);
+	result->out_folder = StringPrint(NULL, 0, L"%ls", BaseString(out_folder));
+	if (!result->entry || !result->out_folder)
+		return ErrorCleanUp(DeleteTreeTask, result, "");
+	return result;
+}
+
+void DeleteTreeTask(tree_task task)
+{
+	if (task->entry)
+		DeleteBytes(task->entry);
+	if (task->out_folder)
+		DeleteString(task->out_folder);
+	free(task);
+}
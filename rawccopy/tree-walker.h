@@ -0,0 +1,13 @@
+#ifndef TREE_WALKER_H
+#define TREE_WALKER_H
+
+#include "context.h"
+#include "index.h"
+#include "safe-string.h"
+
+//Recreates directory 'folder' as 'base_name' in 'out_folder', with all files, their alternate
+//data streams and all subdirectories in it. Links aren't followed, and the NTFS metadata files
+//are skipped.
+bool ExtractTree(execution_context context, const index_entry folder, const string out_folder, const string base_name);
+
+#endif //TREE_WALKER_H
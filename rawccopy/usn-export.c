@@ -0,0 +1,231 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usn-export.h"
+#include "usn.h"
+#include "index.h"
+#include "file-table.h"
+#include "mft-snapshot.h"
+#include "listing.h"
+#include "helpers.h"
+
+//The binary export is written in pieces of this size
+#define EXPORT_BUFFER_SZ 0x100000
+
+typedef struct {
+	folder_paths paths;
+	listing lst;						// With JSON lines
+	data_writer wr;						// With the binary format
+	bytes buffer;						// Of the binary format, of which 'used' bytes are filled
+	rsize_t used;
+	string flags;
+	bool result;
+} usn_exporter;
+
+struct {
+	uint32_t reason;
+	wchar_t* description;
+} const reason_desc[] =
+{
+	{0x00000001, L"data-overwrite"},
+	{0x00000002, L"data-extend"},
+	{0x00000004, L"data-truncation"},
+	{0x00000010, L"named-data-overwrite"},
+	{0x00000020, L"named-data-extend"},
+	{0x00000040, L"named-data-truncation"},
+	{0x00000100, L"file-create"},
+	{0x00000200, L"file-delete"},
+	{0x00000400, L"ea-change"},
+	{0x00000800, L"security-change"},
+	{0x00001000, L"rename-old-name"},
+	{0x00002000, L"rename-new-name"},
+	{0x00004000, L"indexable-change"},
+	{0x00008000, L"basic-info-change"},
+	{0x00010000, L"hard-link-change"},
+	{0x00020000, L"compression-change"},
+	{0x00040000, L"encryption-change"},
+	{0x00080000, L"object-id-change"},
+	{0x00100000, L"reparse-point-change"},
+	{0x00200000, L"stream-change"},
+	{0x00400000, L"transacted-change"},
+	{0x00800000, L"integrity-change"},
+	{0x80000000, L"close"}
+};
+
+bool ExportEntry(execution_context context, const usn_entry* entry, void* state);
+
+void ExportJSON(usn_exporter* exp, const usn_entry* entry, const wchar_t* path, rsize_t path_len);
+
+void ExportBinary(usn_exporter* exp, const usn_entry* entry, const wchar_t* path, rsize_t path_len);
+
+bool WriteExport(usn_exporter* exp);
+
+file_table CurrentFileTable(execution_context context, bool* own_table);
+
+bool CloseExporter(usn_exporter* exp, bool result);
+
+
+bool ExportUsnJournal(execution_context context)
+{
+	mft_file journal = LoadUsnJournal(context);
+	if (!journal)
+		return CleanUpAndFail(NULL, NULL, "Error: The volume doesn't have a USN journal.\n");
+
+	usn_journal_info info;
+	if (!UsnJournalInfo(context, journal, &info))
+		return CleanUpAndFail(DeleteMFTFile, journal, "");
+
+	//The paths are those of the folders as they are now, whatever they were at the time of a record:
+	bool own_table;
+	file_table table = CurrentFileTable(context, &own_table);
+	if (!table)
+		return CleanUpAndFail(DeleteMFTFile, journal, "");
+
+	const wchar_t* source = context->parameters->source_path ? BaseString(context->parameters->source_path) : L"";
+	usn_exporter exp;
+	memset(&exp, 0, sizeof(usn_exporter));
+	exp.result = true;
+	exp.paths = CreateFolderPaths(table, source[0] && source[1] == L':' ? source : L"x:", 2);
+	exp.flags = NewString();
+	if (context->parameters->usn_mode == USN_EXPORT_JSONL)
+		exp.lst = OpenListingFile(context, context->parameters->tcp_send ? NULL : L"UsnJrnl.jsonl");
+	else if ((exp.buffer = CreateBytes(EXPORT_BUFFER_SZ)))
+	{
+		string file_name = StringPrint(NULL, 0, L"%ls\\UsnJrnl.bin", BaseString(context->parameters->output_folder));
+		if (file_name)
+		{
+			exp.wr = context->parameters->tcp_send ? TCPWriter(context->parameters->ip_address, context->parameters->tcp_port, false) :
+						FileWriter(file_name, false);
+			if (exp.wr)
+				wprintf(context->parameters->tcp_send ? L"Tcpsending: %ls\n" : L"Writing: %ls\n", BaseString(file_name));
+			DeleteString(file_name);
+		}
+
+		struct _usn_export_header hdr = { "RCCUSN", USN_EXPORT_VERSION, sizeof(struct _usn_export_record), info.journal_id };
+		memcpy(exp.buffer->buffer, &hdr, sizeof(struct _usn_export_header));
+		exp.used = sizeof(struct _usn_export_header);
+	}
+
+	bool result = exp.paths && exp.flags && (exp.lst || exp.wr);
+	if (result)
+	{
+		//The records before lowest_usn are gone, whatever might be left of them:
+		result = ReadUsnJournal(context, journal, info.lowest_usn, ExportEntry, &exp) && exp.result;
+	}
+
+	if (own_table)
+		DeleteFileTable(table);
+	DeleteMFTFile(journal);
+	return CloseExporter(&exp, result);
+}
+
+bool ExportEntry(execution_context context, const usn_entry* entry, void* state)
+{
+	usn_exporter* exp = (usn_exporter*)state;
+	rsize_t path_len = 0;
+	const wchar_t* path = FolderPath(exp->paths, entry->parent_ref, &path_len);
+
+	if (exp->lst)
+		ExportJSON(exp, entry, path, path_len);
+	else
+		ExportBinary(exp, entry, path, path_len);
+	return exp->result;
+}
+
+void ExportJSON(usn_exporter* exp, const usn_entry* entry, const wchar_t* path, rsize_t path_len)
+{
+	listing lst = exp->lst;
+	PutText(lst, L"{\"usn\":");
+	PutNumber(lst, entry->usn, 0, 0);
+	PutText(lst, L",\"timestamp\":\"");
+	PutISODate(lst, entry->time_stamp);
+	PutText(lst, L"\",\"mft_ref\":");
+	PutNumber(lst, entry->file_ref & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",\"mft_seq_no\":");
+	PutNumber(lst, entry->file_ref >> 48, 0, 0);
+	PutText(lst, L",\"parent_mft_ref\":");
+	PutNumber(lst, entry->parent_ref & 0x0000FFFFFFFFFFFF, 0, 0);
+	PutText(lst, L",\"parent_mft_seq_no\":");
+	PutNumber(lst, entry->parent_ref >> 48, 0, 0);
+
+	//Like the flags, the reasons are joined with " | ", and none of them need escaping:
+	PutText(lst, L",\"reason\":\"");
+	bool first = true;
+	for (int i = 0; i < sizeof(reason_desc) / sizeof(reason_desc[0]); ++i)
+	{
+		if (entry->reason & reason_desc[i].reason)
+		{
+			if (!first)
+				PutText(lst, L" | ");
+			PutText(lst, reason_desc[i].description);
+			first = false;
+		}
+	}
+
+	FileFlagsToString(entry->file_attributes, exp->flags);
+	PutText(lst, L"\",\"flags\":");
+	PutJSONString(lst, BaseString(exp->flags), StringLen(exp->flags));
+	PutText(lst, L",\"name\":");
+	PutJSONString(lst, entry->name, entry->name_len);
+	PutText(lst, L",\"directory\":");
+	if (path)
+		PutJSONString(lst, path, path_len);
+	else
+		PutText(lst, L"null");
+	PutText(lst, L"}\n");
+}
+
+void ExportBinary(usn_exporter* exp, const usn_entry* entry, const wchar_t* path, rsize_t path_len)
+{
+	rsize_t size = sizeof(struct _usn_export_record) + (entry->name_len + path_len) * sizeof(wchar_t);
+	if (exp->used + size > exp->buffer->buffer_len && !(exp->result = WriteExport(exp)))
+		return;
+
+	usn_export_record rec = (usn_export_record)(exp->buffer->buffer + exp->used);
+	rec->usn = entry->usn;
+	rec->time_stamp = entry->time_stamp;
+	rec->file_ref = entry->file_ref;
+	rec->parent_ref = entry->parent_ref;
+	rec->reason = entry->reason;
+	rec->file_attributes = entry->file_attributes;
+	rec->name_len = (uint16_t)entry->name_len;
+	rec->path_len = (uint16_t)path_len;
+	wchar_t* dest = (wchar_t*)(exp->buffer->buffer + exp->used + sizeof(struct _usn_export_record));
+	memcpy(dest, entry->name, entry->name_len * sizeof(wchar_t));
+	if (path)
+		memcpy(dest + entry->name_len, path, path_len * sizeof(wchar_t));
+	exp->used += size;
+}
+
+bool WriteExport(usn_exporter* exp)
+{
+	struct _bytes data = { exp->buffer->buffer, exp->used };
+	exp->used = 0;
+	return !data.buffer_len || WriteData(exp->wr, &data);
+}
+
+//The file table of the snapshot when there is one, otherwise the MFT is read for it
+file_table CurrentFileTable(execution_context context, bool* own_table)
+{
+	*own_table = !context->snapshot;
+	return context->snapshot ? &context->snapshot->table : BuildFileTable(context, 0, NULL, NULL);
+}
+
+bool CloseExporter(usn_exporter* exp, bool result)
+{
+	if (exp->lst)
+		result = CloseListing(exp->lst) && result;
+	if (exp->wr)
+	{
+		result = result && WriteExport(exp);
+		CloseDataWriter(exp->wr);
+	}
+	if (exp->buffer)
+		DeleteBytes(exp->buffer);
+	if (exp->flags)
+		DeleteString(exp->flags);
+	if (exp->paths)
+		DeleteFolderPaths(exp->paths);
+	return result;
+}
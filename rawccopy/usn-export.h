@@ -0,0 +1,40 @@
+#ifndef USN_EXPORT_H
+#define USN_EXPORT_H
+
+#include "context.h"
+
+//Formats of /UsnJournal:
+#define USN_EXPORT_JSONL 1
+#define USN_EXPORT_BINARY 2
+
+#define USN_EXPORT_VERSION 1
+
+//The binary export starts with this header, followed by the records. Every record is a
+//usn_export_record, followed by the name and then the path of the folder of the file, in
+//UTF-16 and without terminating zeros. All numbers are little endian.
+#pragma pack (push, 1)
+typedef struct _usn_export_header {
+	/*  0*/	char magic[8];					// "RCCUSN" and two zeros
+	/*  8*/	uint32_t version;				// USN_EXPORT_VERSION
+	/* 12*/	uint32_t record_sz;				// Size of a usn_export_record
+	/* 16*/	uint64_t journal_id;
+} *usn_export_header;
+
+typedef struct _usn_export_record {
+	/*  0*/	uint64_t usn;
+	/*  8*/	uint64_t time_stamp;
+	/* 16*/	uint64_t file_ref;
+	/* 24*/	uint64_t parent_ref;
+	/* 32*/	uint32_t reason;
+	/* 36*/	uint32_t file_attributes;
+	/* 40*/	uint16_t name_len;				// In characters
+	/* 42*/	uint16_t path_len;				// In characters, 0 when the folder isn't known
+} *usn_export_record;
+#pragma pack(pop)
+
+//Writes out all records of the USN change journal of the volume, with the path of the folder
+//of every file as the MFT has it now (that of the snapshot, with /Snapshot:): as JSON lines to
+//UsnJrnl.jsonl, or in the binary format above to UsnJrnl.bin, in the output folder.
+bool ExportUsnJournal(execution_context context);
+
+#endif //USN_EXPORT_H
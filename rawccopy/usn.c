@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "usn.h"
+#include "index.h"
+#include "attribs.h"
+#include "helpers.h"
+
+//$J is read in pieces of this size
+#define USN_READ_SZ 0x100000
+
+//Records don't cross the boundaries of these pages, the rest of a page that a record
+//doesn't fit in anymore is zeroed
+#define USN_PAGE_SZ 0x1000
+
+//MFT record of $Extend, the folder $UsnJrnl is in
+#define EXTEND_RECORD 11
+
+void FindJournalEntry(const index_entry entry, void* state);
+
+attribute JournalStream(execution_context context, mft_file journal, const wchar_t* name);
+
+bool ParseUsnRecord(const uint8_t* raw, uint32_t len, usn_entry* entry);
+
+
+mft_file LoadUsnJournal(execution_context context)
+{
+	//$Extend only has a handful of files, and a lookup by name would complain when it's not there:
+	uint64_t ref = 0;
+	if (!SweepIndex(context, EXTEND_RECORD, FindJournalEntry, &ref) || !ref)
+		return NULL;
+	return LoadMFTFile(context, ref & 0x0000FFFFFFFFFFFF);
+}
+
+bool UsnJournalInfo(execution_context context, mft_file journal, usn_journal_info* info)
+{
+	attribute max_attr = JournalStream(context, journal, L"$Max");
+	attribute data = JournalStream(context, journal, L"$J");
+	bytes max = max_attr && data && AttributeSize(max_attr) >= sizeof(struct _usn_max) ?
+					GetBytesFromAttrib(context, journal, max_attr, 0, sizeof(struct _usn_max)) : NULL;
+	if (!max)
+		return CleanUpAndFail(NULL, NULL, "Error: Unable to read the USN journal.\n");
+
+	info->journal_id = ((usn_max)max->buffer)->journal_id;
+	info->lowest_usn = ((usn_max)max->buffer)->lowest_usn;
+	info->next_usn = AttributeSize(data);
+	DeleteBytes(max);
+	return true;
+}
+
+bool ReadUsnJournal(execution_context context, mft_file journal, uint64_t from_usn, usn_callback callback, void* state)
+{
+	attribute data = JournalStream(context, journal, L"$J");
+	attribute_reader rdr = data ? OpenAttributeReader(context, journal, data) : NULL;
+	if (!rdr)
+		return CleanUpAndFail(NULL, NULL, "Error: Unable to read the USN journal.\n");
+
+	//The journal is cut off at the front by deallocating it, so most of $J is a sparse run
+	//before the live records. The run list tells where those are, and they're skipped unread:
+	UT_array* holes = ZeroRanges(context, journal, data);
+	byte_range* next_hole = utarray_front(holes);
+	bytes buffer = CreateEmpty();
+
+	//'buffer' holds $J from 'start' on, of which the records up to 'offs' are done:
+	uint64_t end = AttributeSize(data), start = from_usn & ~7ULL;
+	rsize_t offs = 0;
+	bool result = buffer != NULL, go_on = true, reposition = true;
+	while (result && go_on)
+	{
+		uint64_t pos = start + buffer->buffer_len;
+		for (; next_hole && next_hole->offset + next_hole->length <= pos; next_hole = utarray_next(holes, next_hole));
+		if (next_hole && next_hole->offset <= pos)
+		{
+			//Records don't run into a hole, so what's left of the buffer is padding:
+			start = pos = next_hole->offset + next_hole->length;
+			RightTrim(buffer, buffer->buffer_len);
+			offs = 0;
+			reposition = true;
+			continue;
+		}
+		if (pos >= end)
+			break;
+
+		//What's left of the last read moves to the front, and the next read goes after it:
+		if (offs > 0)
+		{
+			memmove(buffer->buffer, buffer->buffer + offs, buffer->buffer_len - offs);
+			RightTrim(buffer, offs);
+			start += offs;
+			offs = 0;
+		}
+		uint64_t cnt = min(USN_READ_SZ, (next_hole ? next_hole->offset : end) - pos);
+		if (!(result = AppendBytesFromAttribRdr(context, rdr, reposition ? (int64_t)pos : -1, cnt, buffer, buffer->buffer_len)))
+			break;
+		reposition = false;
+
+		while (go_on && offs + sizeof(struct _usn_record_header) <= buffer->buffer_len)
+		{
+			usn_record_header hdr = (usn_record_header)(buffer->buffer + offs);
+
+			//Padding, or a damaged record, which includes one that runs into the next page (records
+			//never do): on to the next page
+			if (hdr->length < sizeof(struct _usn_record_header) || hdr->length % 8 ||
+					hdr->length > USN_PAGE_SZ - (start + offs) % USN_PAGE_SZ)
+			{
+				offs = (rsize_t)min(((start + offs + USN_PAGE_SZ) & ~(uint64_t)(USN_PAGE_SZ - 1)) - start, buffer->buffer_len);
+				continue;
+			}
+
+			//It goes on in the next read:
+			if (offs + hdr->length > buffer->buffer_len)
+				break;
+
+			//The entry points into the buffer, nothing is copied:
+			usn_entry entry;
+			if (ParseUsnRecord(buffer->buffer + offs, hdr->length, &entry))
+				go_on = callback(context, &entry, state);
+			offs += hdr->length;
+		}
+	}
+
+	if (buffer)
+		DeleteBytes(buffer);
+	utarray_free(holes);
+	CloseAttributeReader(rdr);
+	return result;
+}
+
+void FindJournalEntry(const index_entry entry, void* state)
+{
+	if (entry->filename_len == 8 && !wcsncmp((wchar_t*)entry->filename, L"$UsnJrnl", 8))
+		*(uint64_t*)state = entry->mft_reference;
+}
+
+attribute JournalStream(execution_context context, mft_file journal, const wchar_t* name)
+{
+	for (attribute at = FirstAttribute(context, journal, AttrTypeFlag(ATTR_DATA)); at;
+		at = NextAttribute(context, journal, at, AttrTypeFlag(ATTR_DATA)))
+	{
+		if (AttributeNameLen(at) == wcslen(name) && !wcsncmp(AttributeName(at), name, AttributeNameLen(at)))
+			return at;
+	}
+	return NULL;
+}
+
+bool ParseUsnRecord(const uint8_t* raw, uint32_t len, usn_entry* entry)
+{
+	uint16_t name_len, name_offs;
+	switch (((usn_record_header)raw)->major_version)
+	{
+	case 2:
+	{
+		usn_record_v2 rec = (usn_record_v2)raw;
+		if (len < sizeof(struct _usn_record_v2))
+			return false;
+		entry->usn = rec->usn;
+		entry->file_ref = rec->file_ref;
+		entry->parent_ref = rec->parent_ref;
+		entry->time_stamp = rec->time_stamp;
+		entry->reason = rec->reason;
+		entry->file_attributes = rec->file_attributes;
+		name_len = rec->name_len;
+		name_offs = rec->name_offs;
+		break;
+	}
+	case 3:
+	{
+		usn_record_v3 rec = (usn_record_v3)raw;
+		if (len < sizeof(struct _usn_record_v3))
+			return false;
+		entry->usn = rec->usn;
+		entry->file_ref = rec->file_ref;
+		entry->parent_ref = rec->parent_ref;
+		entry->time_stamp = rec->time_stamp;
+		entry->reason = rec->reason;
+		entry->file_attributes = rec->file_attributes;
+		name_len = rec->name_len;
+		name_offs = rec->name_offs;
+		break;
+	}
+	default:
+		return false;
+	}
+
+	if ((uint32_t)name_offs + name_len > len)
+		return false;
+	entry->name = (const wchar_t*)(raw + name_offs);
+	entry->name_len = name_len / sizeof(wchar_t);
+	return true;
+}
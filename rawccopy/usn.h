@@ -0,0 +1,86 @@
+#ifndef USN_H
+#define USN_H
+
+#include "context.h"
+#include "mft.h"
+
+#pragma pack (push, 1)
+typedef struct _usn_record_header {
+	/*  0*/	uint32_t length;				// Size of the record, a multiple of 8
+	/*  4*/	uint16_t major_version;			// 2 or 3
+	/*  6*/	uint16_t minor_version;
+} *usn_record_header;
+
+typedef struct _usn_record_v2 {
+	/*  0*/	struct _usn_record_header;
+	/*  8*/	uint64_t file_ref;
+	/* 16*/	uint64_t parent_ref;
+	/* 24*/	uint64_t usn;					// Offset of the record in $J
+	/* 32*/	uint64_t time_stamp;
+	/* 40*/	uint32_t reason;				// USN_REASON_xxx flags of the changes
+	/* 44*/	uint32_t source_info;
+	/* 48*/	uint32_t security_id;
+	/* 52*/	uint32_t file_attributes;
+	/* 56*/	uint16_t name_len;				// In bytes
+	/* 58*/	uint16_t name_offs;
+	/* 60*/	uint8_t name[0];
+} *usn_record_v2;
+
+//Same as version 2, with 128 bit file references (of which NTFS only uses the low 64 bits)
+typedef struct _usn_record_v3 {
+	/*  0*/	struct _usn_record_header;
+	/*  8*/	uint64_t file_ref;
+	/* 16*/	uint64_t file_ref_high;
+	/* 24*/	uint64_t parent_ref;
+	/* 32*/	uint64_t parent_ref_high;
+	/* 40*/	uint64_t usn;
+	/* 48*/	uint64_t time_stamp;
+	/* 56*/	uint32_t reason;
+	/* 60*/	uint32_t source_info;
+	/* 64*/	uint32_t security_id;
+	/* 68*/	uint32_t file_attributes;
+	/* 72*/	uint16_t name_len;
+	/* 74*/	uint16_t name_offs;
+	/* 76*/	uint8_t name[0];
+} *usn_record_v3;
+
+//Content of the $Max stream of $UsnJrnl
+typedef struct _usn_max {
+	/*  0*/	uint64_t max_sz;
+	/*  8*/	uint64_t alloc_delta;
+	/* 16*/	uint64_t journal_id;			// Changes when the journal is deleted and created again
+	/* 24*/	uint64_t lowest_usn;			// The records before this one are gone
+} *usn_max;
+#pragma pack(pop)
+
+//The fields of a version 2 or 3 record that are of use, the name points into the read buffer
+typedef struct {
+	uint64_t usn;
+	uint64_t file_ref;
+	uint64_t parent_ref;
+	uint64_t time_stamp;
+	uint32_t reason;
+	uint32_t file_attributes;
+	const wchar_t* name;
+	rsize_t name_len;				// In characters
+} usn_entry;
+
+typedef struct {
+	uint64_t journal_id;
+	uint64_t lowest_usn;
+	uint64_t next_usn;				// USN the next record will get, the size of $J
+} usn_journal_info;
+
+//Returns false to stop reading
+typedef bool (*usn_callback)(execution_context context, const usn_entry* entry, void* state);
+
+//Loads $Extend\$UsnJrnl, NULL if the volume doesn't have a change journal
+mft_file LoadUsnJournal(execution_context context);
+
+bool UsnJournalInfo(execution_context context, mft_file journal, usn_journal_info* info);
+
+//Hands every record in $J from 'from_usn' on to the callback, in order. The sparse and
+//uninitialised parts of $J aren't read. The entry, and its name, are only valid during the call.
+bool ReadUsnJournal(execution_context context, mft_file journal, uint64_t from_usn, usn_callback callback, void* state);
+
+#endif //USN_H
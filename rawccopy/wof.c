@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wof.h"
+#include "attribs.h"
+#include "helpers.h"
+#include "thread-pool.h"
+#include "xpress.h"
+#include "lzx.h"
+
+#define WOF_PROVIDER_FILE 2
+
+//Number of chunks per worker thread that are decompressed in one go
+#define CHUNKS_PER_THREAD 8
+
+#pragma pack(push, 1)
+typedef struct _wof_reparse_data {
+	/*  0*/	uint32_t reparse_tag;			// IO_REPARSE_TAG_WOF
+	/*  4*/	uint16_t data_len;
+	/*  6*/	uint16_t reserved;
+	/*  8*/	uint32_t wof_version;			// WOF_EXTERNAL_INFO
+	/*  c*/	uint32_t wof_provider;			// WOF_PROVIDER_FILE for individually compressed files
+	/* 10*/	uint32_t provider_version;		// FILE_PROVIDER_EXTERNAL_INFO_V1
+	/* 14*/	uint32_t algorithm;				// One of WOF_XPRESS4K ... WOF_XPRESS16K
+	/* 18*/
+} *wof_reparse_data;
+#pragma pack(pop)
+
+typedef struct {
+	const uint8_t* src;
+	size_t src_len;
+	uint8_t* dst;
+	size_t dst_len;
+	int algorithm;
+	bool ok;
+} chunk_job;
+
+static const wchar_t wof_stream_name[] = L"WofCompressedData";
+
+attribute FindWofStream(execution_context context, mft_file file);
+
+uint64_t ChunkOffset(const bytes table, uint64_t index, uint32_t entry_sz);
+
+void DecompressChunk(void* item, void* shared);
+
+int WofAlgorithm(execution_context context, mft_file file)
+{
+	attribute at = FirstAttribute(context, file, AttrTypeFlag(ATTR_REPARSE_POINT));
+	if (!at || AttributeSize(at) < sizeof(struct _wof_reparse_data))
+		return -1;
+
+	bytes raw = GetBytesFromAttrib(context, file, at, 0, sizeof(struct _wof_reparse_data));
+	if (!raw)
+		return -1;
+
+	wof_reparse_data wof = (wof_reparse_data)raw->buffer;
+	int result = -1;
+	if (raw->buffer_len == sizeof(struct _wof_reparse_data) && wof->reparse_tag == IO_REPARSE_TAG_WOF &&
+			wof->wof_provider == WOF_PROVIDER_FILE && wof->algorithm <= WOF_XPRESS16K)
+		result = (int)wof->algorithm;
+
+	DeleteBytes(raw);
+
+	//Without the stream holding the compressed data, there's nothing we can decompress:
+	return (result >= 0 && FindWofStream(context, file)) ? result : -1;
+}
+
+bool WriteWofContent(execution_context context, mft_file file, int algorithm, uint64_t size, data_writer wr)
+{
+	static const uint32_t chunk_sizes[] = { 0x1000, 0x8000, 0x2000, 0x4000 };
+	const uint32_t chunk_sz = chunk_sizes[algorithm];
+
+	attribute at = FindWofStream(context, file);
+	if (!at)
+		return CleanUpAndFail(NULL, NULL, "WOF compressed file without %ls stream.\n", wof_stream_name);
+
+	//The stream starts with a table of the offsets of all chunks but the first, relative to
+	//the end of the table. Chunks that didn't get smaller by compressing them are stored as is.
+	uint64_t chunk_cnt = (size + chunk_sz - 1) / chunk_sz;
+	uint32_t entry_sz = size > 0xFFFFFFFF ? 8 : 4;
+	uint64_t table_len = chunk_cnt > 0 ? (chunk_cnt - 1) * entry_sz : 0;
+	uint64_t stream_sz = AttributeSize(at);
+	if (table_len > stream_sz)
+		return CleanUpAndFail(NULL, NULL, "Invalid WOF chunk table.\n");
+
+	attribute_reader rdr = OpenAttributeReader(context, file, at);
+	if (!rdr)
+		return false;
+
+	bytes table = GetBytesFromAttribRdr(context, rdr, 0, table_len);
+	if (!table)
+		return CleanUpAndFail(CloseAttributeReader, rdr, "");
+
+	//Decompress the chunks in windows that keep all worker threads busy:
+	const uint64_t window = (uint64_t)PoolSize(context->workers) * CHUNKS_PER_THREAD;
+	chunk_job* jobs;
+	SafeAlloc(jobs, window);
+	bytes comp = CreateEmpty();
+	bytes decomp = CreateEmpty();
+	bool result = comp && decomp;
+
+	for (uint64_t first = 0; result && first < chunk_cnt; first += window)
+	{
+		uint64_t cnt = min(window, chunk_cnt - first);
+		uint64_t comp_start = ChunkOffset(table, first, entry_sz);
+		uint64_t comp_end = first + cnt < chunk_cnt ? ChunkOffset(table, first + cnt, entry_sz) : stream_sz - table_len;
+		uint64_t decomp_len = min(cnt * chunk_sz, size - first * chunk_sz);
+		if (comp_end < comp_start || comp_end > stream_sz - table_len)
+		{
+			result = CleanUpAndFail(NULL, NULL, "Invalid WOF chunk table.\n");
+			break;
+		}
+
+		if (!(result = AppendBytesFromAttribRdr(context, rdr, table_len + comp_start, comp_end - comp_start, comp, 0)) ||
+				!(result = Reserve(decomp, (rsize_t)decomp_len)))
+			break;
+		if (comp->buffer_len != comp_end - comp_start)
+		{
+			result = CleanUpAndFail(NULL, NULL, "Unexpected end of WOF compressed data.\n");
+			break;
+		}
+		RightTrim(decomp, decomp->buffer_len - (rsize_t)decomp_len);
+
+		for (uint64_t i = 0; result && i < cnt; i++)
+		{
+			uint64_t src_start = ChunkOffset(table, first + i, entry_sz) - comp_start;
+			uint64_t src_end = i + 1 < cnt ? ChunkOffset(table, first + i + 1, entry_sz) - comp_start : comp->buffer_len;
+			if (src_end < src_start || src_end > comp->buffer_len)
+				result = CleanUpAndFail(NULL, NULL, "Invalid WOF chunk table.\n");
+			jobs[i].src = comp->buffer + src_start;
+			jobs[i].src_len = (size_t)(src_end - src_start);
+			jobs[i].dst = decomp->buffer + i * chunk_sz;
+			jobs[i].dst_len = (size_t)min(chunk_sz, decomp_len - i * chunk_sz);
+			jobs[i].algorithm = algorithm;
+			jobs[i].ok = false;
+		}
+		if (!result)
+			break;
+		RunParallel(context->workers, DecompressChunk, jobs, sizeof(chunk_job), (size_t)cnt, NULL);
+
+		for (uint64_t i = 0; result && i < cnt; i++)
+			if (!jobs[i].ok)
+				result = CleanUpAndFail(NULL, NULL, "Corrupt WOF compressed chunk: %lld\n", first + i);
+
+		if (result)
+			result = context->parameters->sparse_mode > 1 ? WriteSparseData(wr, decomp) : WriteData(wr, decomp);
+	}
+
+	free(jobs);
+	DeleteBytes(decomp);
+	DeleteBytes(comp);
+	DeleteBytes(table);
+	CloseAttributeReader(rdr);
+	return result;
+}
+
+attribute FindWofStream(execution_context context, mft_file file)
+{
+	const rsize_t name_len = sizeof(wof_stream_name) / sizeof(wchar_t) - 1;
+	for (attribute at = FirstAttribute(context, file, AttrTypeFlag(ATTR_DATA)); at; at = NextAttribute(context, file, at, AttrTypeFlag(ATTR_DATA)))
+	{
+		if (AttributeNameLen(at) == name_len && !wcsncmp(AttributeName(at), wof_stream_name, name_len))
+			return at;
+	}
+	return NULL;
+}
+
+uint64_t ChunkOffset(const bytes table, uint64_t index, uint32_t entry_sz)
+{
+	//The first chunk starts right after the table, so it has no entry:
+	if (index == 0)
+		return 0;
+
+	const uint8_t* entry = table->buffer + (index - 1) * entry_sz;
+	return entry_sz == 8 ? *(uint64_t*)entry : *(uint32_t*)entry;
+}
+
+void DecompressChunk(void* item, void* shared)
+{
+	chunk_job* job = item;
+	if (job->src_len == job->dst_len)
+	{
+		memcpy(job->dst, job->src, job->dst_len);
+		job->ok = true;
+	}
+	else if (job->src_len > job->dst_len)
+		job->ok = false;
+	else if (job->algorithm == WOF_LZX)
+		job->ok = LzxDecompress(job->src, job->src_len, job->dst, job->dst_len);
+	else
+		job->ok = XpressDecompress(job->src, job->src_len, job->dst, job->dst_len);
+}
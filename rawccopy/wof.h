@@ -0,0 +1,24 @@
+#ifndef WOF_H
+#define WOF_H
+
+#include "context.h"
+#include "mft.h"
+#include "data-writer.h"
+
+#define IO_REPARSE_TAG_WOF 0x80000017
+
+//Compression algorithms of the WOF file provider (as in FILE_PROVIDER_COMPRESSION_*)
+#define WOF_XPRESS4K 0
+#define WOF_LZX 1
+#define WOF_XPRESS8K 2
+#define WOF_XPRESS16K 3
+
+//Returns the compression algorithm of a file compressed by the Windows Overlay Filter
+//(CompactOS, compact /exe), or -1 if the file isn't one.
+int WofAlgorithm(execution_context context, mft_file file);
+
+//Writes the decompressed content of a WOF compressed file, which is kept in its
+//"WofCompressedData" stream, to 'wr'. 'size' is the size of the unnamed $DATA attribute.
+bool WriteWofContent(execution_context context, mft_file file, int algorithm, uint64_t size, data_writer wr);
+
+#endif //WOF_H
@@ -0,0 +1,75 @@
+#include "xpress.h"
+#include "huffman.h"
+
+#define XPRESS_NUM_SYMS 512
+#define XPRESS_NUM_CHARS 256
+#define XPRESS_MAX_LEN 15
+#define XPRESS_TABLE_BITS 11
+#define XPRESS_MIN_MATCH 3
+
+bool XpressDecompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+	uint8_t lens[XPRESS_NUM_SYMS];
+	uint32_t table[HUFF_TABLE_SZ(XPRESS_TABLE_BITS, XPRESS_NUM_SYMS, XPRESS_MAX_LEN)];
+
+	//The block starts with the lengths of the Huffman codes of all symbols, 4 bits each:
+	if (dst_len > XPRESS_MAX_BLOCK_SZ || src_len < XPRESS_NUM_SYMS / 2)
+		return false;
+
+	for (int i = 0; i < XPRESS_NUM_SYMS / 2; ++i)
+	{
+		lens[2 * i] = src[i] & 0x0F;
+		lens[2 * i + 1] = src[i] >> 4;
+	}
+	if (!BuildDecodeTable(table, sizeof(table) / sizeof(table[0]), XPRESS_TABLE_BITS, lens, XPRESS_NUM_SYMS, XPRESS_MAX_LEN))
+		return false;
+
+	bit_reader br;
+	InitBitReader(&br, src + XPRESS_NUM_SYMS / 2, src + src_len);
+
+	uint8_t* out = dst;
+	uint8_t* out_end = dst + dst_len;
+	while (out < out_end)
+	{
+		uint32_t sym = DecodeSymbol(&br, table, XPRESS_TABLE_BITS);
+		if (sym < XPRESS_NUM_CHARS)
+		{
+			*out++ = (uint8_t)sym;
+			continue;
+		}
+
+		//Match: the symbol holds the length (or part of it) and the number of bits of the offset
+		uint32_t len = sym & 0x0F;
+		uint32_t offset_bits = (sym >> 4) & 0x0F;
+
+		EnsureBits(&br, 16);
+		uint32_t offset = (1U << offset_bits) | PeekBits(&br, offset_bits);
+		RemoveBits(&br, offset_bits);
+
+		//Long matches store their length in the byte stream, in between the bits:
+		if (len == 0x0F)
+		{
+			len += ReadByte(&br);
+			if (len == 0x0F + 0xFF)
+			{
+				len = ReadByte(&br);
+				len |= ReadByte(&br) << 8;
+				if (!len)
+				{
+					for (int i = 0; i < 4; ++i)
+						len |= ReadByte(&br) << (8 * i);
+				}
+				if (len < 0x0F)
+					return false;
+			}
+		}
+		len += XPRESS_MIN_MATCH;
+
+		if (offset > (size_t)(out - dst) || len > (size_t)(out_end - out))
+			return false;
+		CopyMatch(out, offset, len);
+		out += len;
+	}
+
+	return true;
+}
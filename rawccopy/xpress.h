@@ -0,0 +1,16 @@
+#ifndef XPRESS_H
+#define XPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Largest buffer that XpressDecompress handles: a single block, with one Huffman code
+#define XPRESS_MAX_BLOCK_SZ 0x10000
+
+//Decompresses a buffer in the XPRESS Huffman format (LZ77 + Huffman, as described in MS-XCA),
+//of which the decompressed size is known up front, as in WOF and WIM chunks.
+//Returns false if the data is corrupt.
+bool XpressDecompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len);
+
+#endif //XPRESS_H
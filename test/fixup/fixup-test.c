@@ -0,0 +1,98 @@
+//Checks that the scan of records that aren't in use (/Deleted:, /Timeline:, /MftExport:) skips
+//a freed record with a damaged update sequence array, instead of leaving through the bounds
+//check of Equals or Patch, which exits. Every record goes through ValidRecord with 'in_use'
+//cleared, like ScanMFT does with SCAN_DELETED. See README.md.
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "context.h"
+#include "mft.h"
+
+#define RECORD_SZ 1024
+#define SECTOR_SZ 512
+#define RECORD_NBR 42
+
+//The fixed up value at the end of every sector
+#define USA_VALUE 0x0007
+
+//Not in mft.h, ScanMFT is its only user
+bool ValidRecord(execution_context context, bytes raw, uint64_t index, bool in_use);
+
+typedef struct {
+	const char* name;
+	uint16_t usa_offs;
+	uint16_t usa_cnt;
+	bool torn;						// The end of the second sector doesn't have the value of the array
+	bool valid;
+} fixup_case;
+
+static const fixup_case cases[] = {
+	{ "intact", 0x30, 3, false, true },
+	{ "torn sector", 0x30, 3, true, false },
+	{ "odd array offset", 0x31, 3, false, false },
+	{ "array past the end", RECORD_SZ - 2, 3, false, false },
+	{ "array offset 0xFFFE", 0xFFFE, 3, false, false },
+	{ "more sectors than fit", 0x30, 0x900, false, false },
+	{ "count 0xFFFF", 0x30, 0xFFFF, false, false },
+	{ "no array", 0x30, 0, false, false } };
+
+void FreedRecord(uint8_t* rec, const fixup_case* test);
+
+int main(int argc, char** argv)
+{
+	struct _boot_sector boot;
+	memset(&boot, 0, sizeof(boot));
+	boot.bytes_per_sector = SECTOR_SZ;
+	struct _execution_context context;
+	memset(&context, 0, sizeof(context));
+	context.boot = &boot;
+	context.mft_record_sz = RECORD_SZ;
+
+	uint8_t* rec = malloc(RECORD_SZ);
+	if (!rec)
+		return 2;
+
+	int fails = 0;
+	for (int i = 0; i < sizeof(cases) / sizeof(fixup_case); ++i)
+	{
+		FreedRecord(rec, cases + i);
+		struct _bytes raw = { rec, RECORD_SZ };
+		bool valid = ValidRecord(&context, &raw, RECORD_NBR, false);
+		printf("%-24s %s\n", cases[i].name, valid == cases[i].valid ? "ok" : "FAILED");
+		if (valid != cases[i].valid)
+			fails++;
+
+		//An intact record that isn't in use doesn't pass when only records in use do:
+		FreedRecord(rec, cases + i);
+		if (ValidRecord(&context, &raw, RECORD_NBR, true))
+		{
+			printf("%-24s passes as a record in use\n", cases[i].name);
+			fails++;
+		}
+	}
+
+	free(rec);
+	printf("%d failures\n", fails);
+	return fails ? 1 : 0;
+}
+
+//A record that was in use once: its flags are cleared, the rest is what was written last
+void FreedRecord(uint8_t* rec, const fixup_case* test)
+{
+	memset(rec, 0xA5, RECORD_SZ);
+	raw_mft_record hdr = (raw_mft_record)rec;
+	memcpy(hdr->magic, "FILE", 4);
+	hdr->usa_offs = test->usa_offs;
+	hdr->usa_cnt = test->usa_cnt;
+	hdr->flags = 0;
+	hdr->mft_rec_number = RECORD_NBR;
+
+	//The sectors end with the value of the array, and their real last bytes are in it:
+	uint16_t value = USA_VALUE;
+	if (test->usa_offs + 2 <= RECORD_SZ)
+		memcpy(rec + test->usa_offs, &value, 2);
+	for (uint32_t i = 1; i < test->usa_cnt && (uint64_t)i * SECTOR_SZ <= RECORD_SZ; ++i)
+		memcpy(rec + i * SECTOR_SZ - 2, &value, 2);
+	if (test->torn)
+		rec[2 * SECTOR_SZ - 2]++;
+}